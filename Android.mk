@@ -26,7 +26,23 @@ LOCAL_MODULE_TAGS := optional
 
 LOCAL_SHARED_LIBRARIES := libcutils liblog
 
-LOCAL_SRC_FILES := audio_hw.c
+LOCAL_SRC_FILES := \
+    audio_channels.c \
+    audio_clock.c \
+    audio_convert.c \
+    audio_datagram.c \
+    audio_drift.c \
+    audio_glitch.c \
+    audio_hw.c \
+    audio_impair.c \
+    audio_probe.c \
+    audio_resampler.c \
+    audio_stats.c \
+    audio_synth.c \
+    audio_tap.c \
+    audio_telemetry.c \
+    audio_trace.c \
+    audio_udp.c
 
 LOCAL_CFLAGS := -Wno-unused-parameter
 LOCAL_HEADER_LIBRARIES := libhardware_headers
@@ -0,0 +1,430 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "audio_hw_virtual"
+#include <errno.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "audio_channels.h"
+
+// Frames deinterleaved at once: AUDIO_CHANNEL_COUNT_MAX planes of 32 bit
+// samples take 7.5 KiB of stack.
+#define AUDIO_CHANNEL_BLOCK_FRAMES 64
+
+int audio_channel_map_init(struct audio_channel_map *map, audio_channel_mask_t in_mask,
+                           audio_channel_mask_t out_mask)
+{
+    const uint32_t in_channels = audio_channel_count_from_in_mask(in_mask);
+    const uint32_t out_channels = audio_channel_count_from_in_mask(out_mask);
+    const bool in_index =
+        audio_channel_mask_get_representation(in_mask) == AUDIO_CHANNEL_REPRESENTATION_INDEX;
+    const uint32_t in_bits = audio_channel_mask_get_bits(in_mask);
+    uint32_t out_bits = audio_channel_mask_get_bits(out_mask);
+    uint32_t c;
+
+    memset(map, 0, sizeof(*map));
+    if (in_channels == 0 || out_channels == 0 || in_channels > AUDIO_CHANNEL_COUNT_MAX ||
+        out_channels > AUDIO_CHANNEL_COUNT_MAX)
+    {
+        return -EINVAL;
+    }
+    map->in_channels = in_channels;
+    map->out_channels = out_channels;
+    if (audio_channel_mask_get_representation(out_mask) == AUDIO_CHANNEL_REPRESENTATION_INDEX)
+    {
+        // Channel n of the array is the nth channel of an index mask
+        // upstream, or of a positional one in order.
+        for (c = 0; c < out_channels; c++)
+        {
+            const uint32_t bit = __builtin_ctz(out_bits);
+            out_bits &= out_bits - 1;
+            if (in_index)
+            {
+                map->source[c] = (in_bits >> bit) & 1 ?
+                                 __builtin_popcount(in_bits & ((1u << bit) - 1)) :
+                                 AUDIO_CHANNEL_SILENT;
+            }
+            else
+            {
+                map->source[c] = bit < in_channels ? (int8_t)bit : AUDIO_CHANNEL_SILENT;
+            }
+        }
+    }
+    else if (out_channels == 1 && in_channels > 1)
+    {
+        map->downmix = true;
+    }
+    else
+    {
+        for (c = 0; c < out_channels; c++)
+        {
+            map->source[c] = in_channels == 1 ? 0 :
+                             c < in_channels ? (int8_t)c : AUDIO_CHANNEL_SILENT;
+        }
+    }
+    map->identity = !map->downmix && in_channels == out_channels;
+    for (c = 0; c < out_channels && map->identity; c++)
+    {
+        map->identity = map->source[c] == (int8_t)c;
+    }
+    return 0;
+}
+
+#if defined(__SSE2__)
+// Transpose eight rows of eight 16 bit samples in place.
+static inline void transpose_8x16(__m128i r[8])
+{
+    __m128i t[8], u[8];
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+        t[2 * i] = _mm_unpacklo_epi16(r[2 * i], r[2 * i + 1]);
+        t[2 * i + 1] = _mm_unpackhi_epi16(r[2 * i], r[2 * i + 1]);
+    }
+    for (i = 0; i < 2; i++)
+    {
+        u[4 * i] = _mm_unpacklo_epi32(t[4 * i], t[4 * i + 2]);
+        u[4 * i + 1] = _mm_unpackhi_epi32(t[4 * i], t[4 * i + 2]);
+        u[4 * i + 2] = _mm_unpacklo_epi32(t[4 * i + 1], t[4 * i + 3]);
+        u[4 * i + 3] = _mm_unpackhi_epi32(t[4 * i + 1], t[4 * i + 3]);
+    }
+    for (i = 0; i < 4; i++)
+    {
+        r[2 * i] = _mm_unpacklo_epi64(u[i], u[i + 4]);
+        r[2 * i + 1] = _mm_unpackhi_epi64(u[i], u[i + 4]);
+    }
+}
+
+// Transpose four rows of four 32 bit samples in place.
+static inline void transpose_4x32(__m128i r[4])
+{
+    __m128i t0 = _mm_unpacklo_epi32(r[0], r[1]);
+    __m128i t1 = _mm_unpackhi_epi32(r[0], r[1]);
+    __m128i t2 = _mm_unpacklo_epi32(r[2], r[3]);
+    __m128i t3 = _mm_unpackhi_epi32(r[2], r[3]);
+
+    r[0] = _mm_unpacklo_epi64(t0, t2);
+    r[1] = _mm_unpackhi_epi64(t0, t2);
+    r[2] = _mm_unpacklo_epi64(t1, t3);
+    r[3] = _mm_unpackhi_epi64(t1, t3);
+}
+#endif
+
+// Split frames of channels interleaved samples into planes.
+static void deinterleave_16(const int16_t *in, uint32_t channels,
+                            int16_t planes[][AUDIO_CHANNEL_BLOCK_FRAMES], size_t frames)
+{
+    size_t i = 0;
+    uint32_t c;
+
+#if defined(__SSE2__)
+    // Eight frames at a time.
+    for (; i + 8 <= frames; i += 8)
+    {
+        const __m128i *src = (const __m128i *)(in + i * channels);
+        __m128i r[8];
+        int k;
+
+        switch (channels)
+        {
+        case 2:
+            for (k = 0; k < 2; k++)
+            {
+                // L0 R0 L1 R1 L2 R2 L3 R3 to L0 L1 L2 L3 R0 R1 R2 R3
+                r[k] = _mm_loadu_si128(src + k);
+                r[k] = _mm_shufflelo_epi16(r[k], _MM_SHUFFLE(3, 1, 2, 0));
+                r[k] = _mm_shufflehi_epi16(r[k], _MM_SHUFFLE(3, 1, 2, 0));
+                r[k] = _mm_shuffle_epi32(r[k], _MM_SHUFFLE(3, 1, 2, 0));
+            }
+            _mm_storeu_si128((__m128i *)(planes[0] + i), _mm_unpacklo_epi64(r[0], r[1]));
+            _mm_storeu_si128((__m128i *)(planes[1] + i), _mm_unpackhi_epi64(r[0], r[1]));
+            continue;
+        case 4:
+            for (k = 0; k < 4; k++)
+            {
+                // Two frames to a0 a1 b0 b1 c0 c1 d0 d1, then a 4x4
+                // transpose of the channel pairs.
+                r[k] = _mm_loadu_si128(src + k);
+                r[k] = _mm_unpacklo_epi16(r[k], _mm_srli_si128(r[k], 8));
+            }
+            transpose_4x32(r);
+            for (k = 0; k < 4; k++)
+            {
+                _mm_storeu_si128((__m128i *)(planes[k] + i), r[k]);
+            }
+            continue;
+        case 8:
+            for (k = 0; k < 8; k++)
+            {
+                r[k] = _mm_loadu_si128(src + k);
+            }
+            transpose_8x16(r);
+            for (k = 0; k < 8; k++)
+            {
+                _mm_storeu_si128((__m128i *)(planes[k] + i), r[k]);
+            }
+            continue;
+        }
+        break;
+    }
+#endif
+    for (; i < frames; i++)
+    {
+        for (c = 0; c < channels; c++)
+        {
+            planes[c][i] = in[i * channels + c];
+        }
+    }
+}
+
+static void deinterleave_32(const int32_t *in, uint32_t channels,
+                            int32_t planes[][AUDIO_CHANNEL_BLOCK_FRAMES], size_t frames)
+{
+    size_t i = 0;
+    uint32_t c;
+
+#if defined(__SSE2__)
+    // Four frames at a time.
+    for (; i + 4 <= frames; i += 4)
+    {
+        const __m128i *src = (const __m128i *)(in + i * channels);
+        __m128i r[4];
+        int k, half;
+
+        switch (channels)
+        {
+        case 2:
+            for (k = 0; k < 2; k++)
+            {
+                r[k] = _mm_shuffle_epi32(_mm_loadu_si128(src + k), _MM_SHUFFLE(3, 1, 2, 0));
+            }
+            _mm_storeu_si128((__m128i *)(planes[0] + i), _mm_unpacklo_epi64(r[0], r[1]));
+            _mm_storeu_si128((__m128i *)(planes[1] + i), _mm_unpackhi_epi64(r[0], r[1]));
+            continue;
+        case 4:
+        case 8:
+            // Eight channels are two 4x4 transposes, of the first and of
+            // the last four channels.
+            for (half = 0; half < (int)channels / 4; half++)
+            {
+                for (k = 0; k < 4; k++)
+                {
+                    r[k] = _mm_loadu_si128(src + k * channels / 4 + half);
+                }
+                transpose_4x32(r);
+                for (k = 0; k < 4; k++)
+                {
+                    _mm_storeu_si128((__m128i *)(planes[4 * half + k] + i), r[k]);
+                }
+            }
+            continue;
+        }
+        break;
+    }
+#endif
+    for (; i < frames; i++)
+    {
+        for (c = 0; c < channels; c++)
+        {
+            planes[c][i] = in[i * channels + c];
+        }
+    }
+}
+
+// Interleave planes into frames of channels samples.
+static void interleave_16(const int16_t *const *planes, uint32_t channels, int16_t *out,
+                          size_t frames)
+{
+    size_t i = 0;
+    uint32_t c;
+
+    if (channels == 1)
+    {
+        memcpy(out, planes[0], frames * sizeof(*out));
+        return;
+    }
+#if defined(__SSE2__)
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m128i *dst = (__m128i *)(out + i * channels);
+        __m128i r[8];
+        int k;
+
+        switch (channels)
+        {
+        case 2:
+            r[0] = _mm_loadu_si128((const __m128i *)(planes[0] + i));
+            r[1] = _mm_loadu_si128((const __m128i *)(planes[1] + i));
+            _mm_storeu_si128(dst, _mm_unpacklo_epi16(r[0], r[1]));
+            _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(r[0], r[1]));
+            continue;
+        case 4:
+            for (k = 0; k < 4; k++)
+            {
+                r[k] = _mm_loadu_si128((const __m128i *)(planes[k] + i));
+            }
+            r[4] = _mm_unpacklo_epi16(r[0], r[1]); // a0 b0 a1 b1 a2 b2 a3 b3
+            r[5] = _mm_unpacklo_epi16(r[2], r[3]); // c0 d0 c1 d1 c2 d2 c3 d3
+            r[6] = _mm_unpackhi_epi16(r[0], r[1]);
+            r[7] = _mm_unpackhi_epi16(r[2], r[3]);
+            _mm_storeu_si128(dst, _mm_unpacklo_epi32(r[4], r[5]));
+            _mm_storeu_si128(dst + 1, _mm_unpackhi_epi32(r[4], r[5]));
+            _mm_storeu_si128(dst + 2, _mm_unpacklo_epi32(r[6], r[7]));
+            _mm_storeu_si128(dst + 3, _mm_unpackhi_epi32(r[6], r[7]));
+            continue;
+        case 8:
+            for (k = 0; k < 8; k++)
+            {
+                r[k] = _mm_loadu_si128((const __m128i *)(planes[k] + i));
+            }
+            transpose_8x16(r);
+            for (k = 0; k < 8; k++)
+            {
+                _mm_storeu_si128(dst + k, r[k]);
+            }
+            continue;
+        }
+        break;
+    }
+#endif
+    for (; i < frames; i++)
+    {
+        for (c = 0; c < channels; c++)
+        {
+            out[i * channels + c] = planes[c][i];
+        }
+    }
+}
+
+static void interleave_32(const int32_t *const *planes, uint32_t channels, int32_t *out,
+                          size_t frames)
+{
+    size_t i = 0;
+    uint32_t c;
+
+    if (channels == 1)
+    {
+        memcpy(out, planes[0], frames * sizeof(*out));
+        return;
+    }
+#if defined(__SSE2__)
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128i *dst = (__m128i *)(out + i * channels);
+        __m128i r[4];
+        int k, half;
+
+        switch (channels)
+        {
+        case 2:
+            r[0] = _mm_loadu_si128((const __m128i *)(planes[0] + i));
+            r[1] = _mm_loadu_si128((const __m128i *)(planes[1] + i));
+            _mm_storeu_si128(dst, _mm_unpacklo_epi32(r[0], r[1]));
+            _mm_storeu_si128(dst + 1, _mm_unpackhi_epi32(r[0], r[1]));
+            continue;
+        case 4:
+            for (k = 0; k < 4; k++)
+            {
+                r[k] = _mm_loadu_si128((const __m128i *)(planes[k] + i));
+            }
+            transpose_4x32(r);
+            for (k = 0; k < 4; k++)
+            {
+                _mm_storeu_si128(dst + k, r[k]);
+            }
+            continue;
+        case 8:
+            // The first and the last four channels of each frame, as in
+            // deinterleave_32().
+            for (half = 0; half < 2; half++)
+            {
+                for (k = 0; k < 4; k++)
+                {
+                    r[k] = _mm_loadu_si128((const __m128i *)(planes[4 * half + k] + i));
+                }
+                transpose_4x32(r);
+                for (k = 0; k < 4; k++)
+                {
+                    _mm_storeu_si128(dst + 2 * k + half, r[k]);
+                }
+            }
+            continue;
+        }
+        break;
+    }
+#endif
+    for (; i < frames; i++)
+    {
+        for (c = 0; c < channels; c++)
+        {
+            out[i * channels + c] = planes[c][i];
+        }
+    }
+}
+
+void audio_channel_select(const struct audio_channel_map *map, const void *in, void *out,
+                          size_t sample_size, size_t frames)
+{
+    union
+    {
+        int16_t s16[AUDIO_CHANNEL_COUNT_MAX][AUDIO_CHANNEL_BLOCK_FRAMES];
+        int32_t s32[AUDIO_CHANNEL_COUNT_MAX][AUDIO_CHANNEL_BLOCK_FRAMES];
+    } planes;
+    static const int32_t silence[AUDIO_CHANNEL_BLOCK_FRAMES];
+    const void *sources[AUDIO_CHANNEL_COUNT_MAX];
+    size_t done, block;
+    uint32_t c;
+
+    if (map->identity)
+    {
+        memcpy(out, in, frames * map->in_channels * sample_size);
+        return;
+    }
+    for (c = 0; c < map->out_channels; c++)
+    {
+        sources[c] = map->source[c] == AUDIO_CHANNEL_SILENT ? (const void *)silence :
+                     sample_size == 2 ? (const void *)planes.s16[map->source[c]] :
+                                        (const void *)planes.s32[map->source[c]];
+    }
+    for (done = 0; done < frames; done += block)
+    {
+        block = frames - done;
+        if (block > AUDIO_CHANNEL_BLOCK_FRAMES)
+        {
+            block = AUDIO_CHANNEL_BLOCK_FRAMES;
+        }
+        if (sample_size == 2)
+        {
+            deinterleave_16((const int16_t *)in + done * map->in_channels, map->in_channels,
+                            planes.s16, block);
+            interleave_16((const int16_t *const *)sources, map->out_channels,
+                          (int16_t *)out + done * map->out_channels, block);
+        }
+        else
+        {
+            deinterleave_32((const int32_t *)in + done * map->in_channels, map->in_channels,
+                            planes.s32, block);
+            interleave_32((const int32_t *const *)sources, map->out_channels,
+                          (int32_t *)out + done * map->out_channels, block);
+        }
+    }
+}
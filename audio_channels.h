@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef AUDIO_CHANNELS_H
+#define AUDIO_CHANNELS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <system/audio.h>
+
+// Channel selection for multi-channel capture: one interleaved upstream of
+// up to AUDIO_CHANNEL_COUNT_MAX microphones serves input streams that each
+// want a different subset of them.
+//
+// Frames are deinterleaved into planes a block at a time and the planes a
+// stream wants are interleaved again. Both steps use SSE2 for 16 and 32 bit
+// samples in 2, 4 or 8 channels where the compiler targets it, and plain C
+// otherwise.
+#define AUDIO_CHANNEL_SILENT (-1)
+
+struct audio_channel_map
+{
+    uint32_t in_channels;
+    uint32_t out_channels;
+    // Input channel of each output channel, or AUDIO_CHANNEL_SILENT
+    int8_t source[AUDIO_CHANNEL_COUNT_MAX];
+    bool downmix; // Mono output averaging every input channel
+    bool identity;
+};
+
+// Map the channels of in_mask to those of out_mask. An index mask takes its
+// channels by position in the upstream; otherwise mono is averaged from or
+// copied to every channel and the rest go channel by channel, missing ones
+// silent. Fails with -EINVAL for a mask without channels or with more than
+// AUDIO_CHANNEL_COUNT_MAX.
+int audio_channel_map_init(struct audio_channel_map *map, audio_channel_mask_t in_mask,
+                           audio_channel_mask_t out_mask);
+
+// Copy frames of sample_size (2 or 4) byte samples from in to out by map,
+// which must not downmix.
+void audio_channel_select(const struct audio_channel_map *map, const void *in, void *out,
+                          size_t sample_size, size_t frames);
+
+#endif // AUDIO_CHANNELS_H
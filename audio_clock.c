@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "audio_hw_virtual"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <log/log.h>
+
+#include <cutils/properties.h>
+
+#include "audio_clock.h"
+
+#define AUDIO_CLOCK_MAX_SLEEPERS 8
+// A virtual sleeper that has not been woken for this long of real time
+// advances the clock itself, so a stream that stops calling without
+// standby cannot hang the others.
+#define AUDIO_CLOCK_STALL_MILLISECONDS 1000
+
+struct audio_clock
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    _Atomic int mode;
+    _Atomic int64_t now_us; // Virtual time
+    int attached;
+    int sleeping;
+    int64_t deadlines[AUDIO_CLOCK_MAX_SLEEPERS]; // 0 for a free slot
+    uint64_t advances;
+    uint64_t stall_advances;
+};
+
+static struct audio_clock clk = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+static pthread_once_t clk_once = PTHREAD_ONCE_INIT;
+
+static void audio_clock_init_once(void)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&clk.cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static int64_t audio_clock_monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void audio_clock_advance_to_locked(int64_t now_us)
+{
+    if (now_us > atomic_load_explicit(&clk.now_us, memory_order_relaxed))
+    {
+        atomic_store_explicit(&clk.now_us, now_us, memory_order_relaxed);
+        clk.advances++;
+        pthread_cond_broadcast(&clk.cond);
+    }
+}
+
+// Returns the earliest deadline still in the future and the number of
+// sleepers waiting for one. Sleepers whose deadline has passed count as
+// awake even before they leave audio_clock_sleep_until_us().
+static int64_t audio_clock_earliest_deadline_locked(int *pending)
+{
+    int64_t now_us = atomic_load_explicit(&clk.now_us, memory_order_relaxed);
+    int64_t earliest = INT64_MAX;
+    int i;
+
+    *pending = 0;
+    for (i = 0; i < AUDIO_CLOCK_MAX_SLEEPERS; i++)
+    {
+        if (clk.deadlines[i] > now_us)
+        {
+            (*pending)++;
+            if (clk.deadlines[i] < earliest)
+            {
+                earliest = clk.deadlines[i];
+            }
+        }
+    }
+    return earliest;
+}
+
+int audio_clock_init(void)
+{
+    char mode[PROPERTY_VALUE_MAX] = {
+        '\0',
+    };
+
+    property_get("virtual.audio.clock", mode, "monotonic");
+    return audio_clock_set_mode(audio_clock_mode_from_string(mode));
+}
+
+void audio_clock_release(void)
+{
+    audio_clock_set_mode(AUDIO_CLOCK_MODE_MONOTONIC);
+}
+
+int audio_clock_set_mode(int mode)
+{
+    if (mode < AUDIO_CLOCK_MODE_MONOTONIC || mode > AUDIO_CLOCK_MODE_MANUAL)
+    {
+        return -EINVAL;
+    }
+    pthread_once(&clk_once, audio_clock_init_once);
+    pthread_mutex_lock(&clk.lock);
+    if (mode != AUDIO_CLOCK_MODE_MONOTONIC &&
+        atomic_load_explicit(&clk.mode, memory_order_relaxed) == AUDIO_CLOCK_MODE_MONOTONIC)
+    {
+        // Start from the real time so timestamps stay plausible and never 0,
+        // which the pacing code reads as "not started".
+        atomic_store_explicit(&clk.now_us, audio_clock_monotonic_us(), memory_order_relaxed);
+    }
+    atomic_store_explicit(&clk.mode, mode, memory_order_relaxed);
+    pthread_cond_broadcast(&clk.cond);
+    pthread_mutex_unlock(&clk.lock);
+    ALOGI("%s: pacing clock is %s.", __func__, audio_clock_mode_to_string(mode));
+    return 0;
+}
+
+int audio_clock_get_mode(void)
+{
+    return atomic_load_explicit(&clk.mode, memory_order_relaxed);
+}
+
+int audio_clock_mode_from_string(const char *str)
+{
+    if (strcmp(str, "virtual") == 0)
+    {
+        return AUDIO_CLOCK_MODE_VIRTUAL;
+    }
+    if (strcmp(str, "manual") == 0)
+    {
+        return AUDIO_CLOCK_MODE_MANUAL;
+    }
+    return AUDIO_CLOCK_MODE_MONOTONIC;
+}
+
+const char *audio_clock_mode_to_string(int mode)
+{
+    switch (mode)
+    {
+    case AUDIO_CLOCK_MODE_VIRTUAL:
+        return "virtual";
+    case AUDIO_CLOCK_MODE_MANUAL:
+        return "manual";
+    default:
+        return "monotonic";
+    }
+}
+
+int64_t audio_clock_now_us(void)
+{
+    if (atomic_load_explicit(&clk.mode, memory_order_relaxed) == AUDIO_CLOCK_MODE_MONOTONIC)
+    {
+        return audio_clock_monotonic_us();
+    }
+    return atomic_load_explicit(&clk.now_us, memory_order_relaxed);
+}
+
+void audio_clock_sleep_until_us(int64_t deadline_us)
+{
+    int slot = -1;
+    int i;
+
+    if (atomic_load_explicit(&clk.mode, memory_order_relaxed) == AUDIO_CLOCK_MODE_MONOTONIC)
+    {
+        int64_t remaining = deadline_us - audio_clock_monotonic_us();
+        if (remaining > 0)
+        {
+            usleep(remaining);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&clk.lock);
+    for (i = 0; i < AUDIO_CLOCK_MAX_SLEEPERS; i++)
+    {
+        if (clk.deadlines[i] == 0)
+        {
+            clk.deadlines[i] = deadline_us;
+            slot = i;
+            break;
+        }
+    }
+    clk.sleeping++;
+    while (atomic_load_explicit(&clk.now_us, memory_order_relaxed) < deadline_us)
+    {
+        int mode = atomic_load_explicit(&clk.mode, memory_order_relaxed);
+        struct timespec timeout;
+        int64_t wake_us;
+        int pending;
+
+        if (mode == AUDIO_CLOCK_MODE_MONOTONIC)
+        {
+            break;
+        }
+        if (mode == AUDIO_CLOCK_MODE_VIRTUAL)
+        {
+            int64_t earliest = audio_clock_earliest_deadline_locked(&pending);
+            if (slot < 0)
+            {
+                pending++;
+                earliest = earliest < deadline_us ? earliest : deadline_us;
+            }
+            if (pending >= clk.attached)
+            {
+                audio_clock_advance_to_locked(earliest);
+                continue;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &timeout);
+        wake_us = timeout.tv_sec * 1000000LL + timeout.tv_nsec / 1000 +
+                  AUDIO_CLOCK_STALL_MILLISECONDS * 1000LL;
+        timeout.tv_sec = wake_us / 1000000LL;
+        timeout.tv_nsec = (wake_us % 1000000LL) * 1000;
+        if (pthread_cond_timedwait(&clk.cond, &clk.lock, &timeout) == ETIMEDOUT &&
+            mode == AUDIO_CLOCK_MODE_VIRTUAL)
+        {
+            ALOGW("%s: attached threads did not sleep for %dms. Advance the clock.",
+                  __func__, AUDIO_CLOCK_STALL_MILLISECONDS);
+            clk.stall_advances++;
+            audio_clock_advance_to_locked(deadline_us);
+        }
+    }
+    clk.sleeping--;
+    if (slot >= 0)
+    {
+        clk.deadlines[slot] = 0;
+    }
+    pthread_mutex_unlock(&clk.lock);
+}
+
+void audio_clock_attach(void)
+{
+    pthread_mutex_lock(&clk.lock);
+    clk.attached++;
+    pthread_mutex_unlock(&clk.lock);
+}
+
+void audio_clock_detach(void)
+{
+    pthread_mutex_lock(&clk.lock);
+    if (clk.attached > 0)
+    {
+        clk.attached--;
+    }
+    // The remaining sleepers may now be all the attached threads.
+    pthread_cond_broadcast(&clk.cond);
+    pthread_mutex_unlock(&clk.lock);
+}
+
+int64_t audio_clock_advance(int64_t us)
+{
+    pthread_mutex_lock(&clk.lock);
+    if (atomic_load_explicit(&clk.mode, memory_order_relaxed) != AUDIO_CLOCK_MODE_MONOTONIC &&
+        us > 0)
+    {
+        audio_clock_advance_to_locked(atomic_load_explicit(&clk.now_us, memory_order_relaxed) + us);
+    }
+    pthread_mutex_unlock(&clk.lock);
+    return audio_clock_now_us();
+}
+
+void audio_clock_dump(int fd)
+{
+    pthread_mutex_lock(&clk.lock);
+    dprintf(fd, "  clock: %s now: %lldus attached: %d sleeping: %d advances: %llu stalls: %llu\n",
+            audio_clock_mode_to_string(atomic_load_explicit(&clk.mode, memory_order_relaxed)),
+            (long long)audio_clock_now_us(), clk.attached, clk.sleeping,
+            (unsigned long long)clk.advances, (unsigned long long)clk.stall_advances);
+    pthread_mutex_unlock(&clk.lock);
+}
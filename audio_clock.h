@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef AUDIO_CLOCK_H
+#define AUDIO_CLOCK_H
+
+#include <stdint.h>
+
+// Time source of the out_write()/in_read() pacing. By default it is
+// CLOCK_MONOTONIC with real sleeps. The virtual modes keep their own time so
+// tests can push hours of audio through the socket path in seconds, with
+// the same pacing decisions on every run.
+enum audio_clock_mode
+{
+    AUDIO_CLOCK_MODE_MONOTONIC = 0,
+    AUDIO_CLOCK_MODE_VIRTUAL, // Jumps to the next deadline once every attached thread sleeps
+    AUDIO_CLOCK_MODE_MANUAL,  // Moves only through audio_clock_advance()
+};
+
+// Read virtual.audio.clock (monotonic|virtual|manual).
+int audio_clock_init(void);
+void audio_clock_release(void);
+int audio_clock_set_mode(int mode);
+int audio_clock_get_mode(void);
+int audio_clock_mode_from_string(const char *str);
+const char *audio_clock_mode_to_string(int mode);
+
+int64_t audio_clock_now_us(void);
+void audio_clock_sleep_until_us(int64_t deadline_us);
+
+// A stream attaches while it paces on the clock (first write/read after
+// open or standby) and detaches in standby and close. In virtual mode the
+// clock only advances when all attached threads are asleep.
+void audio_clock_attach(void);
+void audio_clock_detach(void);
+
+// Test hook: moves the virtual clock forward and wakes sleepers whose
+// deadline has passed. Returns the new time; no effect in monotonic mode.
+int64_t audio_clock_advance(int64_t us);
+
+void audio_clock_dump(int fd);
+
+#endif // AUDIO_CLOCK_H
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "audio_hw_virtual"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_convert.h"
+
+bool audio_convert_supported(audio_format_t format)
+{
+    return audio_resampler_supported(format);
+}
+
+int audio_convert_reset(struct audio_convert *convert, audio_format_t in_format,
+                        audio_channel_mask_t in_mask, uint32_t in_rate, audio_format_t out_format,
+                        audio_channel_mask_t out_mask, uint32_t out_rate, size_t period_frames)
+{
+    uint32_t out_channels;
+    double step;
+
+    audio_convert_release(convert);
+    memset(convert, 0, sizeof(*convert));
+    if (!audio_convert_supported(in_format) || !audio_convert_supported(out_format) ||
+        in_rate == 0 || out_rate == 0 || audio_channel_map_init(&convert->map, in_mask, out_mask) < 0)
+    {
+        return -EINVAL;
+    }
+    out_channels = convert->map.out_channels;
+    convert->in_format = in_format;
+    convert->in_channels = convert->map.in_channels;
+    convert->in_rate = in_rate;
+    convert->out_format = out_format;
+    convert->out_channels = out_channels;
+    convert->out_rate = out_rate;
+    convert->select_only = in_format == out_format && in_rate == out_rate && !convert->map.downmix;
+    if (convert->select_only)
+    {
+        return 0;
+    }
+    step = (double)in_rate / out_rate;
+    convert->filter_frames = in_rate > out_rate ? (in_rate + out_rate - 1) / out_rate : 1;
+    if (convert->filter_frames > 1)
+    {
+        convert->filter_history = calloc(convert->filter_frames * out_channels, sizeof(float));
+        convert->filter_sum = calloc(out_channels, sizeof(double));
+        if (!convert->filter_history || !convert->filter_sum)
+        {
+            audio_convert_release(convert);
+            return -ENOMEM;
+        }
+    }
+    if (audio_resampler_reset(&convert->resampler, out_format, out_channels, step,
+                              (size_t)(period_frames * step) * 2) < 0)
+    {
+        audio_convert_release(convert);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+void audio_convert_release(struct audio_convert *convert)
+{
+    audio_resampler_release(&convert->resampler);
+    free(convert->filter_history);
+    free(convert->filter_sum);
+    convert->filter_history = NULL;
+    convert->filter_sum = NULL;
+}
+
+size_t audio_convert_input_frames(const struct audio_convert *convert, size_t out_frames)
+{
+    if (convert->select_only)
+    {
+        return out_frames;
+    }
+    return audio_resampler_input_frames(&convert->resampler, out_frames);
+}
+
+static float load_sample(audio_format_t format, const void *in, size_t index)
+{
+    switch (format)
+    {
+    case AUDIO_FORMAT_PCM_16_BIT:
+        return ((const int16_t *)in)[index] * (1.0f / 32768.0f);
+    case AUDIO_FORMAT_PCM_32_BIT:
+        return ((const int32_t *)in)[index] * (1.0f / 2147483648.0f);
+    default:
+        return ((const float *)in)[index];
+    }
+}
+
+// Convert frames to float at dst, the end of the resampler FIFO, mapped to
+// the output channels and low-passed when downsampling.
+static void load_frames(struct audio_convert *convert, const void *in, float *dst, size_t frames)
+{
+    const uint32_t in_channels = convert->in_channels;
+    const uint32_t out_channels = convert->out_channels;
+    size_t i;
+    uint32_t c;
+
+    for (i = 0; i < frames; i++, dst += out_channels)
+    {
+        const size_t base = i * in_channels;
+        if (convert->map.downmix)
+        {
+            float sum = 0.0f;
+            for (c = 0; c < in_channels; c++)
+            {
+                sum += load_sample(convert->in_format, in, base + c);
+            }
+            dst[0] = sum / in_channels;
+        }
+        else
+        {
+            for (c = 0; c < out_channels; c++)
+            {
+                const int8_t source = convert->map.source[c];
+                dst[c] = source == AUDIO_CHANNEL_SILENT ? 0.0f :
+                         load_sample(convert->in_format, in, base + source);
+            }
+        }
+        if (convert->filter_frames > 1)
+        {
+            float *old = convert->filter_history + convert->filter_index * out_channels;
+            for (c = 0; c < out_channels; c++)
+            {
+                convert->filter_sum[c] += (double)dst[c] - old[c];
+                old[c] = dst[c];
+                dst[c] = (float)(convert->filter_sum[c] / convert->filter_frames);
+            }
+            convert->filter_index = (convert->filter_index + 1) % convert->filter_frames;
+        }
+    }
+}
+
+size_t audio_convert_process(struct audio_convert *convert, const void *in, size_t in_frames,
+                             void *out, size_t max_out_frames)
+{
+    size_t produced;
+
+    if (convert->select_only)
+    {
+        // Frames in and out match one to one.
+        produced = in_frames < max_out_frames ? in_frames : max_out_frames;
+        audio_channel_select(&convert->map, in, out, audio_bytes_per_sample(convert->in_format),
+                             produced);
+        convert->frames_in += produced;
+        convert->frames_out += produced;
+        return produced;
+    }
+    if (in_frames > 0)
+    {
+        float *dst = audio_resampler_append(&convert->resampler, in_frames);
+        if (!dst)
+        {
+            return 0;
+        }
+        load_frames(convert, in, dst, in_frames);
+        convert->frames_in += in_frames;
+    }
+    produced = audio_resampler_process(&convert->resampler, out, max_out_frames);
+    convert->frames_out += produced;
+    return produced;
+}
+
+void audio_convert_dump(int fd, const struct audio_convert *convert)
+{
+    dprintf(fd, "    convert: %u Hz %u channels format 0x%x to %u Hz %u channels format 0x%x, "
+                "filter %u frames, frames in %llu out %llu\n",
+            convert->in_rate, convert->in_channels, convert->in_format, convert->out_rate,
+            convert->out_channels, convert->out_format, convert->filter_frames,
+            (unsigned long long)convert->frames_in, (unsigned long long)convert->frames_out);
+    if (convert->map.downmix)
+    {
+        dprintf(fd, "    channels: averaged to mono\n");
+    }
+    else
+    {
+        char sources[AUDIO_CHANNEL_COUNT_MAX * 4 + 1];
+        size_t used = 0;
+        uint32_t c;
+
+        sources[0] = '\0';
+        for (c = 0; c < convert->out_channels; c++)
+        {
+            if (convert->map.source[c] == AUDIO_CHANNEL_SILENT)
+            {
+                used += snprintf(sources + used, sizeof(sources) - used, " -");
+            }
+            else
+            {
+                used += snprintf(sources + used, sizeof(sources) - used, " %d",
+                                 convert->map.source[c]);
+            }
+        }
+        dprintf(fd, "    channels: from input%s%s\n", sources,
+                convert->select_only ? ", selected without conversion" : "");
+    }
+}
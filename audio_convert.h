@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef AUDIO_CONVERT_H
+#define AUDIO_CONVERT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <system/audio.h>
+
+#include "audio_channels.h"
+#include "audio_resampler.h"
+
+// Conversion of the capture an input client sends to the format, channel
+// count and rate of an input stream, so several streams with different
+// parameters can read the one capture connection.
+//
+// Frames are converted to float, mapped to the output channels (see
+// audio_channel_map_init()), and resampled by 4-point cubic interpolation.
+// Downsampling first runs a moving average over one output frame worth of
+// input, a crude anti-aliasing filter. When only the channels differ, they
+// are selected from the input samples as they are.
+struct audio_convert
+{
+    audio_format_t in_format;
+    uint32_t in_channels;
+    uint32_t in_rate;
+    audio_format_t out_format;
+    uint32_t out_channels;
+    uint32_t out_rate;
+    struct audio_channel_map map;
+    bool select_only;
+
+    // Moving average before downsampling, over filter_frames input frames
+    uint32_t filter_frames;
+    uint32_t filter_index;
+    float *filter_history; // filter_frames frames of out_channels
+    double *filter_sum;    // Running sums: in float the rounding of each update adds up
+
+    // Resampler over out_channels float frames, at in_rate / out_rate
+    struct audio_resampler resampler;
+    uint64_t frames_in;
+    uint64_t frames_out;
+};
+
+// True for the formats that can be converted.
+bool audio_convert_supported(audio_format_t format);
+
+// Start over. Fails with -EINVAL for an unsupported format or channel mask.
+int audio_convert_reset(struct audio_convert *convert, audio_format_t in_format,
+                        audio_channel_mask_t in_mask, uint32_t in_rate, audio_format_t out_format,
+                        audio_channel_mask_t out_mask, uint32_t out_rate, size_t period_frames);
+void audio_convert_release(struct audio_convert *convert);
+
+// Input frames still missing to produce out_frames.
+size_t audio_convert_input_frames(const struct audio_convert *convert, size_t out_frames);
+// Queue in_frames of input, then produce up to max_out_frames; returns how
+// many were produced. Input that is not used yet stays queued, except when
+// only the channels are selected: then frames map one to one and no more
+// than audio_convert_input_frames() should be passed.
+size_t audio_convert_process(struct audio_convert *convert, const void *in, size_t in_frames,
+                             void *out, size_t max_out_frames);
+
+void audio_convert_dump(int fd, const struct audio_convert *convert);
+
+#endif // AUDIO_CONVERT_H
@@ -0,0 +1,567 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio_datagram.h"
+
+static void xor_bytes(uint8_t *dst, const uint8_t *src, size_t bytes)
+{
+    size_t i;
+    for (i = 0; i < bytes; i++)
+    {
+        dst[i] ^= src[i];
+    }
+}
+
+void audio_datagram_sender_reset(struct audio_datagram_sender *sender, uint32_t stream,
+                                 int fec_group)
+{
+    memset(sender, 0, sizeof(*sender));
+    sender->stream = stream;
+    if (fec_group > AUDIO_DATAGRAM_MAX_FEC_GROUP)
+    {
+        fec_group = AUDIO_DATAGRAM_MAX_FEC_GROUP;
+    }
+    sender->fec_group = fec_group > 0 ? fec_group : 0;
+}
+
+// Stops after a parity datagram: its payload is the sender's parity
+// buffer, which the next group starts over.
+int audio_datagram_packetize(struct audio_datagram_sender *sender, uint32_t cmd,
+                             const void *data, size_t bytes, int64_t timestamp_ns,
+                             struct audio_datagram *datagrams, int max, size_t *consumed)
+{
+    const uint8_t *src = data;
+    size_t offset = 0;
+    int count = 0;
+
+    while (offset < bytes && count < max)
+    {
+        size_t size = bytes - offset;
+        struct audio_datagram *datagram;
+
+        if (size > AUDIO_DATAGRAM_MAX_PAYLOAD)
+        {
+            size = AUDIO_DATAGRAM_MAX_PAYLOAD;
+        }
+        if (sender->fec_group > 0 && sender->group_count == sender->fec_group)
+        {
+            memset(sender->parity, 0, sender->parity_size);
+            sender->parity_size = 0;
+            sender->size_xor = 0;
+            sender->offset_xor = 0;
+            sender->timestamp_xor = 0;
+            sender->group_count = 0;
+        }
+        if (sender->fec_group > 0 && sender->group_count + 1 == sender->fec_group &&
+            count + 2 > max)
+        {
+            break;
+        }
+        datagram = &datagrams[count++];
+        memset(&datagram->header, 0, sizeof(datagram->header));
+        datagram->header.cmd = cmd;
+        datagram->header.stream = sender->stream;
+        datagram->header.sequence = sender->sequence++;
+        datagram->header.offset = sender->offset;
+        datagram->header.fec_group = sender->fec_group;
+        datagram->header.timestamp_ns = timestamp_ns;
+        datagram->header.data_size = size;
+        datagram->payload = src + offset;
+        offset += size;
+        sender->offset += size;
+        if (sender->fec_group == 0)
+        {
+            continue;
+        }
+
+        xor_bytes(sender->parity, datagram->payload, size);
+        if (size > sender->parity_size)
+        {
+            sender->parity_size = size;
+        }
+        sender->size_xor ^= size;
+        sender->offset_xor ^= datagram->header.offset;
+        sender->timestamp_xor ^= timestamp_ns;
+        if (++sender->group_count == sender->fec_group)
+        {
+            datagram = &datagrams[count++];
+            memset(&datagram->header, 0, sizeof(datagram->header));
+            datagram->header.cmd = cmd;
+            datagram->header.stream = sender->stream;
+            datagram->header.sequence = sender->sequence - sender->fec_group;
+            datagram->header.offset = sender->offset_xor;
+            datagram->header.flags = AUDIO_DATAGRAM_FLAG_PARITY;
+            datagram->header.fec_group = sender->fec_group;
+            datagram->header.timestamp_ns = sender->timestamp_xor;
+            datagram->header.data_size = sender->parity_size;
+            datagram->header.size_xor = sender->size_xor;
+            datagram->payload = sender->parity;
+            break;
+        }
+    }
+    *consumed = offset;
+    return count;
+}
+
+int audio_datagram_send(int fd, const struct sockaddr_in *addr,
+                        const struct audio_datagram *datagrams, int count, int flags)
+{
+    struct mmsghdr msgs[AUDIO_DATAGRAM_BATCH];
+    struct iovec iov[AUDIO_DATAGRAM_BATCH][2];
+    int sent = 0;
+
+    while (sent < count)
+    {
+        int n = count - sent;
+        int i;
+        int ret;
+
+        if (n > AUDIO_DATAGRAM_BATCH)
+        {
+            n = AUDIO_DATAGRAM_BATCH;
+        }
+        memset(msgs, 0, n * sizeof(msgs[0]));
+        for (i = 0; i < n; i++)
+        {
+            const struct audio_datagram *datagram = &datagrams[sent + i];
+            iov[i][0].iov_base = (void *)&datagram->header;
+            iov[i][0].iov_len = sizeof(datagram->header);
+            iov[i][1].iov_base = (void *)datagram->payload;
+            iov[i][1].iov_len = datagram->header.data_size;
+            msgs[i].msg_hdr.msg_name = (void *)addr;
+            msgs[i].msg_hdr.msg_namelen = addr ? sizeof(*addr) : 0;
+            msgs[i].msg_hdr.msg_iov = iov[i];
+            msgs[i].msg_hdr.msg_iovlen = datagram->header.data_size > 0 ? 2 : 1;
+        }
+        ret = sendmmsg(fd, msgs, n, flags);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret < 0)
+        {
+            return sent > 0 ? sent : -1;
+        }
+        sent += ret;
+        if (ret < n)
+        {
+            break;
+        }
+    }
+    return sent;
+}
+
+int audio_datagram_receive(int fd, struct audio_datagram_batch *batch, int flags)
+{
+    int ret;
+    int i;
+
+    memset(batch->msgs, 0, sizeof(batch->msgs));
+    for (i = 0; i < AUDIO_DATAGRAM_BATCH; i++)
+    {
+        batch->iov[i].iov_base = batch->data[i];
+        batch->iov[i].iov_len = sizeof(batch->data[i]);
+        batch->msgs[i].msg_hdr.msg_name = &batch->from[i];
+        batch->msgs[i].msg_hdr.msg_namelen = sizeof(batch->from[i]);
+        batch->msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+        batch->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    do
+    {
+        ret = recvmmsg(fd, batch->msgs, AUDIO_DATAGRAM_BATCH, flags, NULL);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+const uint8_t *audio_datagram_parse(const struct audio_datagram_batch *batch, int i,
+                                    struct audio_datagram_header *header, size_t *bytes)
+{
+    size_t length = batch->msgs[i].msg_len;
+
+    if (length < sizeof(*header) || (batch->msgs[i].msg_hdr.msg_flags & MSG_TRUNC))
+    {
+        return NULL;
+    }
+    memcpy(header, batch->data[i], sizeof(*header));
+    if (header->data_size != length - sizeof(*header))
+    {
+        return NULL;
+    }
+    *bytes = header->data_size;
+    return batch->data[i] + sizeof(*header);
+}
+
+int audio_jitter_init(struct audio_jitter_buffer *jitter)
+{
+    pthread_condattr_t attr;
+
+    memset(jitter, 0, sizeof(*jitter));
+    if (pthread_mutex_init(&jitter->lock, NULL) != 0)
+    {
+        return -1;
+    }
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (pthread_cond_init(&jitter->cond, &attr) != 0)
+    {
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_destroy(&jitter->lock);
+        return -1;
+    }
+    pthread_condattr_destroy(&attr);
+    return 0;
+}
+
+void audio_jitter_destroy(struct audio_jitter_buffer *jitter)
+{
+    pthread_cond_destroy(&jitter->cond);
+    pthread_mutex_destroy(&jitter->lock);
+}
+
+void audio_jitter_reset(struct audio_jitter_buffer *jitter, size_t target_bytes)
+{
+    int i;
+
+    pthread_mutex_lock(&jitter->lock);
+    for (i = 0; i < AUDIO_JITTER_SLOTS; i++)
+    {
+        jitter->slots[i].valid = false;
+        jitter->parity[i].valid = false;
+    }
+    jitter->target_bytes = target_bytes;
+    jitter->started = false;
+    jitter->have_next = false;
+    jitter->concealing = false;
+    jitter->buffered_bytes = 0;
+    pthread_cond_broadcast(&jitter->cond);
+    pthread_mutex_unlock(&jitter->lock);
+}
+
+static bool slot_holds(const struct audio_jitter_slot *slot, uint32_t sequence)
+{
+    return slot->valid && slot->sequence == sequence;
+}
+
+// Rebuild the datagram missing from the group starting at start when it is
+// the only one and the parity is there. Called with the lock held.
+static void jitter_recover(struct audio_jitter_buffer *jitter, uint32_t start, uint16_t group)
+{
+    const struct audio_jitter_slot *parity = &jitter->parity[start % AUDIO_JITTER_SLOTS];
+    struct audio_jitter_slot *slot;
+    uint32_t missing = 0;
+    uint32_t size;
+    uint32_t offset;
+    int64_t timestamp_ns;
+    bool found = false;
+    uint16_t i;
+
+    if (!jitter->have_next || group == 0 || group > AUDIO_DATAGRAM_MAX_FEC_GROUP ||
+        !slot_holds(parity, start))
+    {
+        return;
+    }
+    for (i = 0; i < group; i++)
+    {
+        if (!slot_holds(&jitter->slots[(start + i) % AUDIO_JITTER_SLOTS], start + i))
+        {
+            if (found)
+            {
+                return;
+            }
+            missing = start + i;
+            found = true;
+        }
+    }
+    // Too late when its turn came already, or it is being concealed.
+    if (!found || (int32_t)(missing - jitter->next_sequence) < 0 ||
+        (missing == jitter->next_sequence && jitter->concealing))
+    {
+        return;
+    }
+
+    slot = &jitter->slots[missing % AUDIO_JITTER_SLOTS];
+    memcpy(slot->data, parity->data, parity->size);
+    size = parity->size_xor;
+    offset = parity->offset;
+    timestamp_ns = parity->timestamp_ns;
+    for (i = 0; i < group; i++)
+    {
+        const struct audio_jitter_slot *other = &jitter->slots[(start + i) % AUDIO_JITTER_SLOTS];
+        if (start + i != missing)
+        {
+            xor_bytes(slot->data, other->data, other->size);
+            size ^= other->size;
+            offset ^= other->offset;
+            timestamp_ns ^= other->timestamp_ns;
+        }
+    }
+    if (size > parity->size)
+    {
+        return;
+    }
+    slot->valid = true;
+    slot->sequence = missing;
+    slot->offset = offset;
+    slot->size = size;
+    slot->timestamp_ns = timestamp_ns;
+    jitter->buffered_bytes += size;
+    jitter->stats.recovered++;
+}
+
+void audio_jitter_put(struct audio_jitter_buffer *jitter,
+                      const struct audio_datagram_header *header,
+                      const void *payload, size_t bytes)
+{
+    uint32_t sequence = header->sequence;
+    struct audio_jitter_slot *slot;
+    int32_t ahead;
+
+    if (bytes > AUDIO_DATAGRAM_MAX_PAYLOAD)
+    {
+        return;
+    }
+    pthread_mutex_lock(&jitter->lock);
+    if (header->flags & AUDIO_DATAGRAM_FLAG_PARITY)
+    {
+        slot = &jitter->parity[sequence % AUDIO_JITTER_SLOTS];
+        memcpy(slot->data, payload, bytes);
+        slot->valid = true;
+        slot->sequence = sequence;
+        slot->offset = header->offset;
+        slot->size = bytes;
+        slot->size_xor = header->size_xor;
+        slot->fec_group = header->fec_group;
+        slot->timestamp_ns = header->timestamp_ns;
+        jitter_recover(jitter, sequence, header->fec_group);
+        pthread_cond_broadcast(&jitter->cond);
+        pthread_mutex_unlock(&jitter->lock);
+        return;
+    }
+
+    if (!jitter->have_next)
+    {
+        jitter->have_next = true;
+        jitter->next_sequence = sequence;
+        jitter->position = header->offset;
+    }
+    ahead = (int32_t)(sequence - jitter->next_sequence);
+    if (ahead >= AUDIO_JITTER_SLOTS || ahead < -AUDIO_JITTER_SLOTS)
+    {
+        // The sender restarted or a long gap: start over from here.
+        jitter->stats.resyncs++;
+        jitter->next_sequence = sequence;
+        jitter->position = header->offset;
+        jitter->concealing = false;
+        jitter->buffered_bytes = 0;
+        jitter->started = false;
+    }
+    else if (ahead < 0)
+    {
+        jitter->stats.late++;
+        pthread_mutex_unlock(&jitter->lock);
+        return;
+    }
+    slot = &jitter->slots[sequence % AUDIO_JITTER_SLOTS];
+    if (slot_holds(slot, sequence))
+    {
+        jitter->stats.duplicates++;
+        pthread_mutex_unlock(&jitter->lock);
+        return;
+    }
+    memcpy(slot->data, payload, bytes);
+    slot->valid = true;
+    slot->sequence = sequence;
+    slot->offset = header->offset;
+    slot->size = bytes;
+    slot->timestamp_ns = header->timestamp_ns;
+    jitter->buffered_bytes += bytes;
+    jitter->stats.received++;
+    if (header->fec_group > 0)
+    {
+        jitter_recover(jitter, sequence - sequence % header->fec_group, header->fec_group);
+    }
+    pthread_cond_broadcast(&jitter->cond);
+    pthread_mutex_unlock(&jitter->lock);
+}
+
+// The first datagram received after next_sequence, NULL if none is.
+static struct audio_jitter_slot *jitter_next_present(struct audio_jitter_buffer *jitter)
+{
+    uint32_t i;
+    for (i = 1; i < AUDIO_JITTER_SLOTS; i++)
+    {
+        uint32_t sequence = jitter->next_sequence + i;
+        struct audio_jitter_slot *slot = &jitter->slots[sequence % AUDIO_JITTER_SLOTS];
+        if (slot_holds(slot, sequence))
+        {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+static void jitter_consume(struct audio_jitter_buffer *jitter, size_t bytes)
+{
+    jitter->buffered_bytes = jitter->buffered_bytes > bytes ? jitter->buffered_bytes - bytes : 0;
+}
+
+size_t audio_jitter_get(struct audio_jitter_buffer *jitter, void *buffer, size_t bytes,
+                        int timeout_ms, int64_t *timestamp_ns)
+{
+    uint8_t *dst = buffer;
+    size_t copied = 0;
+    bool timed_out = false;
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_nsec -= 1000000000L;
+        deadline.tv_sec++;
+    }
+    if (timestamp_ns)
+    {
+        *timestamp_ns = 0;
+    }
+
+    pthread_mutex_lock(&jitter->lock);
+    while (copied < bytes)
+    {
+        struct audio_jitter_slot *slot = &jitter->slots[jitter->next_sequence % AUDIO_JITTER_SLOTS];
+        bool present = jitter->have_next && slot_holds(slot, jitter->next_sequence);
+        size_t n;
+
+        if (!jitter->started)
+        {
+            if (jitter->buffered_bytes > 0 && jitter->buffered_bytes >= jitter->target_bytes)
+            {
+                jitter->started = true;
+                continue;
+            }
+        }
+        else if (present)
+        {
+            uint32_t played = jitter->position - slot->offset;
+            if (played >= slot->size ||
+                (played == 0 && jitter->buffered_bytes > 2 * jitter->target_bytes + bytes))
+            {
+                // Behind the stream position, or the sender runs ahead of
+                // the reader: drop it to keep the latency bounded.
+                if (played < slot->size)
+                {
+                    jitter->position += slot->size;
+                    jitter->stats.overflows++;
+                }
+                jitter_consume(jitter, slot->size);
+                jitter->next_sequence++;
+                continue;
+            }
+            n = slot->size - played;
+            n = n < bytes - copied ? n : bytes - copied;
+            if (copied == 0 && timestamp_ns)
+            {
+                *timestamp_ns = slot->timestamp_ns;
+            }
+            memcpy(dst + copied, slot->data + played, n);
+            copied += n;
+            jitter->position += n;
+            jitter_consume(jitter, n);
+            if (played + n >= slot->size)
+            {
+                jitter->next_sequence++;
+            }
+            continue;
+        }
+        else if (jitter->concealing || jitter->buffered_bytes >= jitter->target_bytes ||
+                 (timed_out && jitter->buffered_bytes > 0))
+        {
+            // Later datagrams are here and this one is not: it is lost.
+            struct audio_jitter_slot *later = jitter_next_present(jitter);
+            uint32_t gap;
+
+            if (later)
+            {
+                gap = later->offset - jitter->position;
+                if (gap > (uint32_t)AUDIO_JITTER_SLOTS * AUDIO_DATAGRAM_MAX_PAYLOAD)
+                {
+                    gap = 0; // Inconsistent offsets: skip to the next one
+                }
+                n = gap < bytes - copied ? gap : bytes - copied;
+                memset(dst + copied, 0, n);
+                copied += n;
+                jitter->position += n;
+                jitter->concealing = n < gap;
+                if (!jitter->concealing)
+                {
+                    jitter->stats.concealed += later->sequence - jitter->next_sequence;
+                    jitter->position = later->offset;
+                    jitter->next_sequence = later->sequence;
+                }
+                continue;
+            }
+            jitter->concealing = false;
+        }
+        if (jitter->started && timed_out && jitter->buffered_bytes == 0)
+        {
+            jitter->stats.underruns++;
+            jitter->started = false;
+        }
+
+        if (timed_out ||
+            pthread_cond_timedwait(&jitter->cond, &jitter->lock, &deadline) == ETIMEDOUT)
+        {
+            if (timed_out)
+            {
+                break;
+            }
+            timed_out = true;
+        }
+    }
+    pthread_mutex_unlock(&jitter->lock);
+    return copied;
+}
+
+void audio_jitter_get_stats(struct audio_jitter_buffer *jitter, struct audio_jitter_stats *stats,
+                            size_t *buffered_bytes)
+{
+    pthread_mutex_lock(&jitter->lock);
+    *stats = jitter->stats;
+    *buffered_bytes = jitter->buffered_bytes;
+    pthread_mutex_unlock(&jitter->lock);
+}
+
+void audio_jitter_dump(int fd, const char *name, struct audio_jitter_buffer *jitter)
+{
+    struct audio_jitter_stats stats;
+    size_t buffered;
+
+    audio_jitter_get_stats(jitter, &stats, &buffered);
+    dprintf(fd, "    %s jitter buffer: %zu of %zu bytes, received %llu recovered %llu "
+            "concealed %llu late %llu duplicate %llu underruns %llu overflows %llu resyncs %llu\n",
+            name, buffered, jitter->target_bytes, (unsigned long long)stats.received,
+            (unsigned long long)stats.recovered, (unsigned long long)stats.concealed,
+            (unsigned long long)stats.late, (unsigned long long)stats.duplicates,
+            (unsigned long long)stats.underruns, (unsigned long long)stats.overflows,
+            (unsigned long long)stats.resyncs);
+}
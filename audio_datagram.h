@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef AUDIO_DATAGRAM_H
+#define AUDIO_DATAGRAM_H
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Datagram format of the UDP transport (see audio_udp.h) and the parts
+// both ends of it need: a packetizer that cuts periods into datagrams and
+// follows every group of them with their XOR parity, and a jitter buffer
+// that puts received datagrams back in order, rebuilds one lost datagram
+// per parity group and conceals the others with silence.
+#define AUDIO_DATAGRAM_MAX_PAYLOAD 1400 // Stays below a 1500 byte MTU with the headers
+#define AUDIO_DATAGRAM_MAX_FEC_GROUP 16
+#define AUDIO_DATAGRAM_BATCH 16 // Datagrams per sendmmsg()/recvmmsg()
+#define AUDIO_JITTER_SLOTS 256  // Datagrams the jitter buffer spans
+
+#define AUDIO_DATAGRAM_FLAG_PARITY 0x1
+#define AUDIO_DATAGRAM_FLAG_COOKIE 0x2 // Challenge of the receiver: send again with this cookie
+
+// cmd and stream take the values of the TCP protocol. Data datagrams of a
+// stream are numbered from 0 on every attach and carry the position of
+// their payload in the stream, so the receiver knows how much audio a lost
+// one held. With FEC, the datagrams numbered [k * fec_group,
+// (k + 1) * fec_group) form a group, followed by a parity datagram
+// numbered k * fec_group whose payload, offset, size and timestamp are the
+// XOR of the group's, shorter payloads padded with zeros.
+struct audio_datagram_header
+{
+    uint32_t cmd;
+    uint32_t stream;
+    uint32_t sequence;
+    uint32_t offset;      // Stream bytes before the payload, modulo 2^32
+    uint16_t flags;
+    uint16_t fec_group;   // Datagrams per parity datagram, 0 without FEC
+    uint32_t data_size;   // Payload bytes
+    int64_t timestamp_ns; // CLOCK_MONOTONIC of the sender when the period was written or captured
+    uint32_t size_xor;    // Parity: XOR of the data_size of the group
+    uint32_t cookie;      // CMD_OPEN: proves the sender receives at its address, see audio_udp.h
+};
+
+struct audio_datagram
+{
+    struct audio_datagram_header header;
+    const void *payload;
+};
+
+// Sending side of one stream.
+struct audio_datagram_sender
+{
+    uint32_t stream;
+    uint32_t sequence;
+    uint32_t offset;
+    uint16_t fec_group;
+    uint16_t group_count; // Datagrams of the current group so far
+    uint32_t parity_size;
+    uint32_t size_xor;
+    uint32_t offset_xor;
+    int64_t timestamp_xor;
+    uint8_t parity[AUDIO_DATAGRAM_MAX_PAYLOAD];
+};
+
+void audio_datagram_sender_reset(struct audio_datagram_sender *sender, uint32_t stream,
+                                 int fec_group);
+// Cut up to bytes of one period into CMD_DATA datagrams, each followed by
+// the parity datagram of the group it completes, filling at most max
+// entries. Returns the number of entries and stores the bytes taken in
+// *consumed; the payloads point into data or into the sender, so they must
+// be sent before the sender is used again.
+int audio_datagram_packetize(struct audio_datagram_sender *sender, uint32_t cmd,
+                             const void *data, size_t bytes, int64_t timestamp_ns,
+                             struct audio_datagram *datagrams, int max, size_t *consumed);
+// sendmmsg() count datagrams to addr (NULL on a connected socket). Returns
+// the number sent, or -1 with errno set when none was.
+int audio_datagram_send(int fd, const struct sockaddr_in *addr,
+                        const struct audio_datagram *datagrams, int count, int flags);
+
+struct audio_datagram_batch
+{
+    struct mmsghdr msgs[AUDIO_DATAGRAM_BATCH];
+    struct iovec iov[AUDIO_DATAGRAM_BATCH];
+    struct sockaddr_in from[AUDIO_DATAGRAM_BATCH];
+    uint8_t data[AUDIO_DATAGRAM_BATCH]
+                [sizeof(struct audio_datagram_header) + AUDIO_DATAGRAM_MAX_PAYLOAD];
+};
+
+// recvmmsg() up to AUDIO_DATAGRAM_BATCH datagrams. Returns their number, or
+// -1 with errno set; audio_datagram_parse() gives the header and payload of
+// each.
+int audio_datagram_receive(int fd, struct audio_datagram_batch *batch, int flags);
+// Returns the payload of datagram i of the batch, NULL if it is malformed.
+const uint8_t *audio_datagram_parse(const struct audio_datagram_batch *batch, int i,
+                                    struct audio_datagram_header *header, size_t *bytes);
+
+struct audio_jitter_slot
+{
+    bool valid;
+    uint32_t sequence;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t size_xor; // Parity slots only
+    uint16_t fec_group;
+    int64_t timestamp_ns;
+    uint8_t data[AUDIO_DATAGRAM_MAX_PAYLOAD];
+};
+
+struct audio_jitter_stats
+{
+    uint64_t received;
+    uint64_t recovered;  // Rebuilt from parity
+    uint64_t concealed;  // Lost, played as silence
+    uint64_t late;       // Arrived after their turn
+    uint64_t duplicates;
+    uint64_t underruns;  // Nothing to play: buffering again
+    uint64_t overflows;  // Dropped to keep the buffer near its target
+    uint64_t resyncs;    // Sequence jumped beyond the buffer
+};
+
+// Datagrams of one stream, played out in sequence once target_bytes are
+// buffered. A missing datagram is waited for while less than target_bytes
+// are buffered behind it and the reader's timeout allows, then played as
+// silence up to the offset of the next one received, so the audio after
+// it stays in place. Thread safe: one thread puts, another gets.
+struct audio_jitter_buffer
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t target_bytes;
+    bool started; // Playing; false while buffering
+    bool have_next;
+    bool concealing; // Part of the gap at next_sequence is played already
+    uint32_t next_sequence;
+    uint32_t position;     // Stream offset of the next byte to play
+    size_t buffered_bytes; // Received and not played yet
+    struct audio_jitter_stats stats;
+    struct audio_jitter_slot slots[AUDIO_JITTER_SLOTS];
+    struct audio_jitter_slot parity[AUDIO_JITTER_SLOTS];
+};
+
+int audio_jitter_init(struct audio_jitter_buffer *jitter);
+void audio_jitter_destroy(struct audio_jitter_buffer *jitter);
+// Forget everything buffered; play out once target_bytes are buffered.
+void audio_jitter_reset(struct audio_jitter_buffer *jitter, size_t target_bytes);
+void audio_jitter_put(struct audio_jitter_buffer *jitter,
+                      const struct audio_datagram_header *header,
+                      const void *payload, size_t bytes);
+// Copy up to bytes in sequence, concealing lost datagrams, waiting at most
+// timeout_ms for missing ones. Returns the bytes copied; fewer than asked
+// when the buffer ran dry. *timestamp_ns, when not NULL, gets the
+// timestamp of the datagram the first byte came from, 0 if concealed.
+size_t audio_jitter_get(struct audio_jitter_buffer *jitter, void *buffer, size_t bytes,
+                        int timeout_ms, int64_t *timestamp_ns);
+void audio_jitter_get_stats(struct audio_jitter_buffer *jitter, struct audio_jitter_stats *stats,
+                            size_t *buffered_bytes);
+void audio_jitter_dump(int fd, const char *name, struct audio_jitter_buffer *jitter);
+
+#endif // AUDIO_DATAGRAM_H
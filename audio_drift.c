@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "audio_hw_virtual"
+#include <stdio.h>
+#include <string.h>
+
+#include <log/log.h>
+
+#include <cutils/properties.h>
+
+#include "audio_drift.h"
+
+// PI gains on the queue error in seconds. The queue integrates the ratio
+// error, so this is a second order loop: about 45 s to settle, critically
+// damped, and a 100 ppm drift leaves a few ms of error while it settles.
+#define AUDIO_DRIFT_KP 0.05
+#define AUDIO_DRIFT_KI 0.0005
+#define AUDIO_DRIFT_FILTER_S 0.5 // Time constant of the queue low-pass
+#define AUDIO_DRIFT_LOCK_S 2.0    // Settling before locking onto the first queue
+
+struct audio_drift_config
+{
+    bool enabled;
+    int out_target_ms;
+    int in_target_ms; // < 0 for AUDIO_DRIFT_DEFAULT_IN_TARGET_PERIODS
+    int max_ppm;
+};
+
+static struct audio_drift_config config;
+
+int audio_drift_init(void)
+{
+    config.enabled = property_get_int32("virtual.audio.drift.enable", 0) > 0;
+    config.out_target_ms = property_get_int32("virtual.audio.drift.out_target_ms", 0);
+    config.in_target_ms = property_get_int32("virtual.audio.drift.in_target_ms", -1);
+    config.max_ppm = property_get_int32("virtual.audio.drift.max_ppm", AUDIO_DRIFT_DEFAULT_MAX_PPM);
+    if (config.max_ppm <= 0)
+    {
+        config.max_ppm = AUDIO_DRIFT_DEFAULT_MAX_PPM;
+    }
+    if (config.enabled)
+    {
+        ALOGI("%s: drift compensation on, out target %d ms, in target %d ms, max %d ppm.",
+              __func__, config.out_target_ms, config.in_target_ms, config.max_ppm);
+    }
+    return 0;
+}
+
+bool audio_drift_enabled(void)
+{
+    return config.enabled;
+}
+
+bool audio_drift_supported(audio_format_t format)
+{
+    return audio_resampler_supported(format);
+}
+
+int audio_drift_out_target_ms(void)
+{
+    return config.out_target_ms > 0 ? config.out_target_ms : -1;
+}
+
+int audio_drift_in_target_ms(int period_ms)
+{
+    return config.in_target_ms >= 0 ? config.in_target_ms :
+           AUDIO_DRIFT_DEFAULT_IN_TARGET_PERIODS * period_ms;
+}
+
+int audio_drift_reset(struct audio_drift *drift, audio_format_t format, uint32_t channels,
+                      uint32_t sample_rate, int target_ms, size_t period_frames)
+{
+    struct audio_resampler resampler = drift->resampler;
+
+    memset(drift, 0, sizeof(*drift));
+    drift->resampler = resampler;
+    drift->format = format;
+    drift->sample_rate = sample_rate;
+    drift->target_s = target_ms < 0 ? -1.0 : target_ms / 1000.0;
+    drift->step_min = 1.0;
+    drift->step_max = 1.0;
+    return audio_resampler_reset(&drift->resampler, format, channels, 1.0, period_frames * 2);
+}
+
+void audio_drift_release(struct audio_drift *drift)
+{
+    audio_resampler_release(&drift->resampler);
+}
+
+void audio_drift_update(struct audio_drift *drift, int64_t fill_frames, int64_t now_ns)
+{
+    double fill_s = (double)fill_frames / drift->sample_rate;
+    double max_dev = config.max_ppm / 1e6;
+    double dt, dev;
+
+    if (!drift->has_fill)
+    {
+        drift->has_fill = true;
+        drift->fill_s = fill_s;
+        drift->first_update_ns = now_ns;
+        drift->last_update_ns = now_ns;
+        return;
+    }
+    dt = (now_ns - drift->last_update_ns) / 1e9;
+    if (dt <= 0)
+    {
+        return;
+    }
+    drift->last_update_ns = now_ns;
+    if (dt > AUDIO_DRIFT_FILTER_S)
+    {
+        dt = AUDIO_DRIFT_FILTER_S;
+    }
+    drift->fill_s += (fill_s - drift->fill_s) * dt / AUDIO_DRIFT_FILTER_S;
+    if (drift->target_s < 0)
+    {
+        // The queue is still filling up after the start: wait for it to
+        // settle, then hold it where it is.
+        if (now_ns - drift->first_update_ns < AUDIO_DRIFT_LOCK_S * 1e9)
+        {
+            return;
+        }
+        drift->target_s = drift->fill_s;
+    }
+
+    // A queue above target is drained by consuming input faster than the
+    // output clock runs: step > 1. The integral is bounded to what the
+    // ratio limit can use, so it does not wind up during a long outage.
+    drift->integral += (drift->fill_s - drift->target_s) * dt;
+    if (drift->integral * AUDIO_DRIFT_KI > max_dev)
+    {
+        drift->integral = max_dev / AUDIO_DRIFT_KI;
+    }
+    else if (drift->integral * AUDIO_DRIFT_KI < -max_dev)
+    {
+        drift->integral = -max_dev / AUDIO_DRIFT_KI;
+    }
+    dev = AUDIO_DRIFT_KP * (drift->fill_s - drift->target_s) + AUDIO_DRIFT_KI * drift->integral;
+    dev = dev > max_dev ? max_dev : dev < -max_dev ? -max_dev : dev;
+    drift->resampler.step = 1.0 + dev;
+    drift->updates++;
+    if (drift->resampler.step < drift->step_min)
+    {
+        drift->step_min = drift->resampler.step;
+    }
+    if (drift->resampler.step > drift->step_max)
+    {
+        drift->step_max = drift->resampler.step;
+    }
+}
+
+size_t audio_drift_input_frames(const struct audio_drift *drift, size_t out_frames)
+{
+    return audio_resampler_input_frames(&drift->resampler, out_frames);
+}
+
+size_t audio_drift_resample(struct audio_drift *drift, const void *in, size_t in_frames,
+                            void *out, size_t max_out_frames)
+{
+    size_t produced;
+
+    if (in_frames > 0)
+    {
+        const size_t samples = in_frames * drift->resampler.channels;
+        float *dst = audio_resampler_append(&drift->resampler, in_frames);
+        size_t i;
+
+        if (!dst)
+        {
+            return 0;
+        }
+        switch (drift->format)
+        {
+        case AUDIO_FORMAT_PCM_16_BIT:
+            for (i = 0; i < samples; i++)
+            {
+                dst[i] = ((const int16_t *)in)[i] * (1.0f / 32768.0f);
+            }
+            break;
+        case AUDIO_FORMAT_PCM_32_BIT:
+            for (i = 0; i < samples; i++)
+            {
+                dst[i] = ((const int32_t *)in)[i] * (1.0f / 2147483648.0f);
+            }
+            break;
+        default:
+            memcpy(dst, in, samples * sizeof(float));
+            break;
+        }
+        drift->frames_in += in_frames;
+    }
+    produced = audio_resampler_process(&drift->resampler, out, max_out_frames);
+    drift->frames_out += produced;
+    return produced;
+}
+
+void audio_drift_dump(int fd, const struct audio_drift *drift)
+{
+    if (!config.enabled)
+    {
+        return;
+    }
+    dprintf(fd, "    drift: step %+.1f ppm (%+.1f..%+.1f), queue %.1f ms target %.1f ms, "
+                "%llu updates, frames in %llu out %llu\n",
+            (drift->resampler.step - 1.0) * 1e6, (drift->step_min - 1.0) * 1e6,
+            (drift->step_max - 1.0) * 1e6, drift->fill_s * 1000.0,
+            drift->target_s * 1000.0, (unsigned long long)drift->updates,
+            (unsigned long long)drift->frames_in, (unsigned long long)drift->frames_out);
+}
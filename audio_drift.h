@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef AUDIO_DRIFT_H
+#define AUDIO_DRIFT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <system/audio.h>
+
+#include "audio_resampler.h"
+
+// Compensation of the drift between the guest clock, which paces
+// out_write() and in_read(), and the clock of the host audio device. A PI
+// controller watches how much audio waits between the two clocks (the
+// client's playback queue for output, the capture queue in the HAL for
+// input) and steers a fine-ratio resampler so that the queue, and with it
+// the latency, stays at its target.
+//
+// Off unless virtual.audio.drift.enable=1. virtual.audio.drift.*:
+//   out_target_ms   client playback queue to hold, 0 keeps the one the
+//                   client settles at after the start (default)
+//   in_target_ms    capture queue to hold, default two periods
+//   max_ppm         largest ratio correction (default 500)
+#define AUDIO_DRIFT_DEFAULT_MAX_PPM 500
+#define AUDIO_DRIFT_DEFAULT_IN_TARGET_PERIODS 2
+
+struct audio_drift
+{
+    // Controller
+    uint32_t sample_rate;
+    double target_s; // < 0 until locked to the first report
+    double fill_s;   // Queue, low-pass filtered over the period sawtooth
+    double integral; // Of the error, in s * s
+    bool has_fill;
+    int64_t first_update_ns;
+    int64_t last_update_ns;
+    uint64_t updates;
+    double step_min;
+    double step_max;
+
+    // Resampler steered by the controller through its step, with the input
+    // in the stream's format
+    struct audio_resampler resampler;
+    audio_format_t format;
+    uint64_t frames_in;
+    uint64_t frames_out;
+};
+
+// Read the virtual.audio.drift.* properties.
+int audio_drift_init(void);
+bool audio_drift_enabled(void);
+// True for the formats the resampler handles.
+bool audio_drift_supported(audio_format_t format);
+
+// Start over for a stream. target_ms < 0 locks onto the queue once it has
+// settled after the first update.
+int audio_drift_reset(struct audio_drift *drift, audio_format_t format, uint32_t channels,
+                      uint32_t sample_rate, int target_ms, size_t period_frames);
+void audio_drift_release(struct audio_drift *drift);
+// The stream's target: out_target_ms or in_target_ms as configured.
+int audio_drift_out_target_ms(void);
+int audio_drift_in_target_ms(int period_ms);
+
+// Feed the controller the current queue.
+void audio_drift_update(struct audio_drift *drift, int64_t fill_frames, int64_t now_ns);
+
+// Input frames still missing to produce out_frames.
+size_t audio_drift_input_frames(const struct audio_drift *drift, size_t out_frames);
+// Queue in_frames of input, then produce up to max_out_frames; returns how
+// many were produced. Input that is not used yet stays queued.
+size_t audio_drift_resample(struct audio_drift *drift, const void *in, size_t in_frames,
+                            void *out, size_t max_out_frames);
+
+void audio_drift_dump(int fd, const struct audio_drift *drift);
+
+#endif // AUDIO_DRIFT_H
@@ -0,0 +1,425 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_virtual"
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <log/log.h>
+
+#include <cutils/properties.h>
+
+#include "audio_glitch.h"
+
+#define AUDIO_GLITCH_CLIP_LEVEL (32767.0f / 32768.0f)
+#define AUDIO_GLITCH_SILENCE_LEVEL (0.5f / 32768.0f) // Below one 16 bit step
+
+static struct
+{
+    bool enabled;
+    int gap_ms;
+} config;
+
+static const char *const audio_glitch_names[AUDIO_GLITCH_TYPE_COUNT] = {
+    [AUDIO_GLITCH_DISCONTINUITY] = "discontinuity",
+    [AUDIO_GLITCH_GAP] = "silence gap",
+    [AUDIO_GLITCH_CLIP] = "clip",
+};
+
+int audio_glitch_init(void)
+{
+    config.enabled = property_get_int32("virtual.audio.glitch.enable", 0) > 0;
+    config.gap_ms = property_get_int32("virtual.audio.glitch.gap_ms",
+                                       AUDIO_GLITCH_DEFAULT_GAP_MILLISECONDS);
+    if (config.gap_ms <= 0 || config.gap_ms >= AUDIO_GLITCH_GAP_MAX_MILLISECONDS)
+    {
+        config.gap_ms = AUDIO_GLITCH_DEFAULT_GAP_MILLISECONDS;
+    }
+    if (config.enabled)
+    {
+        ALOGI("%s: glitch detection on, gaps from %d ms.", __func__, config.gap_ms);
+    }
+    return 0;
+}
+
+bool audio_glitch_enabled(void)
+{
+    return config.enabled;
+}
+
+bool audio_glitch_supported(audio_format_t format)
+{
+    return format == AUDIO_FORMAT_PCM_16_BIT || format == AUDIO_FORMAT_PCM_32_BIT ||
+           format == AUDIO_FORMAT_PCM_FLOAT;
+}
+
+int audio_glitch_reset(struct audio_glitch *g, audio_format_t format, uint32_t channels,
+                       uint32_t sample_rate, size_t period_frames)
+{
+    audio_glitch_release(g);
+    memset(g, 0, sizeof(*g));
+    if (!audio_glitch_supported(format) || channels == 0 || channels > AUDIO_CHANNEL_COUNT_MAX ||
+        sample_rate == 0)
+    {
+        return -EINVAL;
+    }
+    g->capacity = period_frames > 0 ? period_frames : 1;
+    g->samples = (float *)calloc((g->capacity + 2) * channels, sizeof(float));
+    if (!g->samples)
+    {
+        return -ENOMEM;
+    }
+    g->format = format;
+    g->channels = channels;
+    g->sample_rate = sample_rate;
+    g->gap_min_samples = (uint64_t)config.gap_ms * sample_rate / 1000 * channels;
+    g->gap_max_samples = (uint64_t)AUDIO_GLITCH_GAP_MAX_MILLISECONDS * sample_rate / 1000 * channels;
+    g->last_jump = UINT64_MAX;
+    g->last_clip = UINT64_MAX;
+    g->enabled = true;
+    return 0;
+}
+
+void audio_glitch_release(struct audio_glitch *g)
+{
+    free(g->samples);
+    g->samples = NULL;
+    g->enabled = false;
+}
+
+void audio_glitch_clear(struct audio_glitch *g)
+{
+    int type;
+
+    for (type = 0; type < AUDIO_GLITCH_TYPE_COUNT; type++)
+    {
+        atomic_store_explicit(&g->counts[type], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&g->clipped_samples, 0, memory_order_relaxed);
+    atomic_store_explicit(&g->frames, 0, memory_order_relaxed);
+    atomic_store_explicit(&g->event_count, 0, memory_order_relaxed);
+}
+
+static void audio_glitch_record(struct audio_glitch *g, int type, uint64_t sample)
+{
+    uint64_t n = atomic_load_explicit(&g->event_count, memory_order_relaxed);
+    struct audio_glitch_event *event = &g->events[n % AUDIO_GLITCH_EVENTS];
+
+    atomic_store_explicit(&event->type, type, memory_order_relaxed);
+    atomic_store_explicit(&event->time_ns, g->period_ns, memory_order_relaxed);
+    atomic_store_explicit(&event->frame, sample / g->channels, memory_order_relaxed);
+    atomic_store_explicit(&g->event_count, n + 1, memory_order_release);
+    atomic_store_explicit(&g->counts[type],
+                          atomic_load_explicit(&g->counts[type], memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+// False when an event of the same kind was counted less than
+// AUDIO_GLITCH_MERGE_MILLISECONDS before sample.
+static bool audio_glitch_separate(const struct audio_glitch *g, uint64_t *last, uint64_t sample)
+{
+    const uint64_t merge =
+        (uint64_t)g->sample_rate * AUDIO_GLITCH_MERGE_MILLISECONDS / 1000 * g->channels;
+
+    if (*last != UINT64_MAX && sample - *last < merge)
+    {
+        return false;
+    }
+    *last = sample;
+    return true;
+}
+
+// One sample of the silence run: audio ends it, as a gap when it was short
+// and came after audio.
+static inline void audio_glitch_silence(struct audio_glitch *g, bool loud, uint64_t sample)
+{
+    if (!loud)
+    {
+        g->silent_run++;
+        return;
+    }
+    if (g->silent_run > 0)
+    {
+        if (g->had_audio && g->silent_run >= g->gap_min_samples &&
+            g->silent_run <= g->gap_max_samples)
+        {
+            audio_glitch_record(g, AUDIO_GLITCH_GAP, sample - g->silent_run);
+        }
+        g->silent_run = 0;
+    }
+    g->had_audio = true;
+}
+
+static void audio_glitch_load(const struct audio_glitch *g, const void *in, float *out, size_t n)
+{
+    size_t i = 0;
+
+    switch (g->format)
+    {
+    case AUDIO_FORMAT_PCM_16_BIT:
+    {
+        const int16_t *s = (const int16_t *)in;
+#if defined(__SSE2__)
+        const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+        for (; i + 8 <= n; i += 8)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+            // Sign extend by moving each sample to the top half of a lane.
+            __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+            __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+            _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+        }
+#endif
+        for (; i < n; i++)
+        {
+            out[i] = s[i] * (1.0f / 32768.0f);
+        }
+        break;
+    }
+    case AUDIO_FORMAT_PCM_32_BIT:
+    {
+        const int32_t *s = (const int32_t *)in;
+#if defined(__SSE2__)
+        const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+        }
+#endif
+        for (; i < n; i++)
+        {
+            out[i] = s[i] * (1.0f / 2147483648.0f);
+        }
+        break;
+    }
+    default:
+        memcpy(out, in, n * sizeof(float));
+        break;
+    }
+}
+
+// Rare path: find the jumps of a period whose largest second difference is
+// above the threshold.
+static void audio_glitch_find_jumps(struct audio_glitch *g, const float *x, size_t n,
+                                    float threshold)
+{
+    const size_t c = g->channels;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        uint64_t sample = g->samples_in + i;
+
+        if (fabsf(x[i] - 2.0f * x[i - c] + x[i - 2 * c]) > threshold &&
+            fabsf(x[i]) > AUDIO_GLITCH_SILENCE_LEVEL &&
+            fabsf(x[i - c]) > AUDIO_GLITCH_SILENCE_LEVEL &&
+            fabsf(x[i - 2 * c]) > AUDIO_GLITCH_SILENCE_LEVEL &&
+            audio_glitch_separate(g, &g->last_jump, sample))
+        {
+            audio_glitch_record(g, AUDIO_GLITCH_DISCONTINUITY, sample);
+        }
+    }
+}
+
+// Rare path: follow the runs of full scale samples of each channel.
+static void audio_glitch_find_clips(struct audio_glitch *g, const float *x, size_t n)
+{
+    const size_t c = g->channels;
+    size_t i;
+
+    g->clipping = false;
+    for (i = 0; i < n; i++)
+    {
+        uint32_t *run = &g->clip_run[i % c];
+
+        if (fabsf(x[i]) < AUDIO_GLITCH_CLIP_LEVEL)
+        {
+            *run = 0;
+        }
+        else if (++*run == AUDIO_GLITCH_CLIP_RUN)
+        {
+            uint64_t sample = g->samples_in + i - (AUDIO_GLITCH_CLIP_RUN - 1) * c;
+            if (audio_glitch_separate(g, &g->last_clip, sample))
+            {
+                audio_glitch_record(g, AUDIO_GLITCH_CLIP, sample);
+            }
+        }
+    }
+    for (i = 0; i < c && !g->clipping; i++)
+    {
+        g->clipping = g->clip_run[i] > 0;
+    }
+}
+
+static void audio_glitch_analyse_frames(struct audio_glitch *g, const void *in, size_t frames)
+{
+    const size_t c = g->channels;
+    const size_t n = frames * c;
+    float *x = g->samples + 2 * c; // After the history
+    float jump_sum = 0.0f;
+    float jump_max = 0.0f;
+    uint64_t clipped = 0;
+    float mean;
+    float threshold;
+    size_t i = 0;
+
+    audio_glitch_load(g, in, x, n);
+#if defined(__SSE2__)
+    {
+        const __m128 sign = _mm_set1_ps(-0.0f);
+        const __m128 clip = _mm_set1_ps(AUDIO_GLITCH_CLIP_LEVEL);
+        const __m128 silence = _mm_set1_ps(AUDIO_GLITCH_SILENCE_LEVEL);
+        __m128 sum = _mm_setzero_ps();
+        __m128 max = _mm_setzero_ps();
+        float lanes[4];
+
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 v = _mm_loadu_ps(x + i);
+            __m128 v1 = _mm_loadu_ps(x + i - c);
+            __m128 v2 = _mm_loadu_ps(x + i - 2 * c);
+            __m128 e = _mm_andnot_ps(sign, _mm_add_ps(_mm_sub_ps(v, _mm_add_ps(v1, v1)), v2));
+            __m128 a = _mm_andnot_ps(sign, v);
+            int loud = _mm_movemask_ps(_mm_cmpgt_ps(a, silence));
+            int l;
+
+            sum = _mm_add_ps(sum, e);
+            max = _mm_max_ps(max, e);
+            clipped += __builtin_popcount(_mm_movemask_ps(_mm_cmpge_ps(a, clip)));
+            if (loud == 0xf && g->silent_run == 0)
+            {
+                g->had_audio = true;
+            }
+            else if (loud == 0)
+            {
+                g->silent_run += 4;
+            }
+            else
+            {
+                for (l = 0; l < 4; l++)
+                {
+                    audio_glitch_silence(g, (loud >> l) & 1, g->samples_in + i + l);
+                }
+            }
+        }
+        _mm_storeu_ps(lanes, sum);
+        jump_sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        _mm_storeu_ps(lanes, max);
+        jump_max = fmaxf(fmaxf(lanes[0], lanes[1]), fmaxf(lanes[2], lanes[3]));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        float e = fabsf(x[i] - 2.0f * x[i - c] + x[i - 2 * c]);
+        float a = fabsf(x[i]);
+
+        jump_sum += e;
+        jump_max = fmaxf(jump_max, e);
+        clipped += a >= AUDIO_GLITCH_CLIP_LEVEL;
+        audio_glitch_silence(g, a > AUDIO_GLITCH_SILENCE_LEVEL, g->samples_in + i);
+    }
+
+    // A transient raises the mean of its own period as well, a splice
+    // does not.
+    mean = jump_sum / n;
+    threshold = AUDIO_GLITCH_JUMP_FACTOR * fmaxf(g->jump_mean, mean);
+    if (threshold < AUDIO_GLITCH_JUMP_FLOOR)
+    {
+        threshold = AUDIO_GLITCH_JUMP_FLOOR;
+    }
+    if (jump_max > threshold)
+    {
+        audio_glitch_find_jumps(g, x, n, threshold);
+    }
+    g->jump_mean = mean;
+    if (clipped > 0 || g->clipping)
+    {
+        audio_glitch_find_clips(g, x, n);
+        atomic_store_explicit(&g->clipped_samples,
+                              atomic_load_explicit(&g->clipped_samples, memory_order_relaxed) +
+                                  clipped,
+                              memory_order_relaxed);
+    }
+    g->samples_in += n;
+    memmove(g->samples, x + n - 2 * c, 2 * c * sizeof(float));
+}
+
+void audio_glitch_analyse(struct audio_glitch *g, const void *buffer, size_t bytes,
+                          int64_t now_ns)
+{
+    const size_t frame_size = audio_bytes_per_sample(g->format) * g->channels;
+    const uint8_t *in = (const uint8_t *)buffer;
+    size_t frames = bytes / frame_size;
+
+    if (!g->enabled)
+    {
+        return;
+    }
+    g->period_ns = now_ns;
+    atomic_store_explicit(&g->frames,
+                          atomic_load_explicit(&g->frames, memory_order_relaxed) + frames,
+                          memory_order_relaxed);
+    while (frames > 0)
+    {
+        size_t chunk = frames < g->capacity ? frames : g->capacity;
+        audio_glitch_analyse_frames(g, in, chunk);
+        in += chunk * frame_size;
+        frames -= chunk;
+    }
+}
+
+void audio_glitch_dump(int fd, const struct audio_glitch *g, int64_t now_ns)
+{
+    uint64_t count;
+    uint64_t n;
+
+    if (!g->enabled)
+    {
+        return;
+    }
+    count = atomic_load_explicit(&g->event_count, memory_order_acquire);
+    dprintf(fd, "    glitches in %llu frames: %llu discontinuities, %llu silence gaps, "
+            "%llu clips (%llu samples clipped)\n",
+            (unsigned long long)atomic_load_explicit(&g->frames, memory_order_relaxed),
+            (unsigned long long)atomic_load_explicit(&g->counts[AUDIO_GLITCH_DISCONTINUITY],
+                                                     memory_order_relaxed),
+            (unsigned long long)atomic_load_explicit(&g->counts[AUDIO_GLITCH_GAP],
+                                                     memory_order_relaxed),
+            (unsigned long long)atomic_load_explicit(&g->counts[AUDIO_GLITCH_CLIP],
+                                                     memory_order_relaxed),
+            (unsigned long long)atomic_load_explicit(&g->clipped_samples, memory_order_relaxed));
+    // Newest first
+    for (n = count; n > 0 && count - n < AUDIO_GLITCH_EVENTS; n--)
+    {
+        const struct audio_glitch_event *event = &g->events[(n - 1) % AUDIO_GLITCH_EVENTS];
+        int type = atomic_load_explicit(&event->type, memory_order_relaxed);
+
+        dprintf(fd, "      %s at frame %llu, %lld ms ago\n",
+                type >= 0 && type < AUDIO_GLITCH_TYPE_COUNT ? audio_glitch_names[type] : "?",
+                (unsigned long long)atomic_load_explicit(&event->frame, memory_order_relaxed),
+                (long long)(now_ns - atomic_load_explicit(&event->time_ns, memory_order_relaxed)) /
+                    1000000);
+    }
+}
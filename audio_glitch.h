@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef AUDIO_GLITCH_H
+#define AUDIO_GLITCH_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <system/audio.h>
+
+// Glitch detector for the PCM the output stream actually sends to the
+// client, so audible glitches can be counted across devices instead of
+// found in logs or by users. Off unless virtual.audio.glitch.enable=1.
+//
+// Each period is converted to float and scanned in one pass (SSE where the
+// compiler targets it, plain C otherwise) for:
+//   discontinuities  the second difference of a channel jumps above
+//                    AUDIO_GLITCH_JUMP_FACTOR times its mean level, as where
+//                    periods are dropped or spliced; jumps into or out of
+//                    silence are left to the gap detection
+//   silence gaps     digital silence on every channel for at least
+//                    virtual.audio.glitch.gap_ms (default 5) and at most
+//                    AUDIO_GLITCH_GAP_MAX_MILLISECONDS between audio, as an
+//                    underrun fills; longer silence is a pause
+//   clipping         AUDIO_GLITCH_CLIP_RUN samples in a row of a channel at
+//                    full scale
+// Discontinuities and clips closer than AUDIO_GLITCH_MERGE_MILLISECONDS,
+// on any channels, are one event. Events are counted, and the last few kept
+// with their stream frame and the time their period was sent.
+#define AUDIO_GLITCH_DEFAULT_GAP_MILLISECONDS 5
+#define AUDIO_GLITCH_GAP_MAX_MILLISECONDS 200
+#define AUDIO_GLITCH_JUMP_FACTOR 8.0f
+#define AUDIO_GLITCH_JUMP_FLOOR 0.05f // Smallest jump counted, of full scale
+#define AUDIO_GLITCH_CLIP_RUN 3
+#define AUDIO_GLITCH_MERGE_MILLISECONDS 10
+#define AUDIO_GLITCH_EVENTS 8 // Recent events kept for the dump
+
+enum audio_glitch_type
+{
+    AUDIO_GLITCH_DISCONTINUITY = 0,
+    AUDIO_GLITCH_GAP,
+    AUDIO_GLITCH_CLIP,
+    AUDIO_GLITCH_TYPE_COUNT
+};
+
+struct audio_glitch_event
+{
+    _Atomic int type;
+    _Atomic int64_t time_ns; // CLOCK_MONOTONIC the frame was sent at
+    _Atomic uint64_t frame;  // Of the stream since the detector was reset
+};
+
+// Written by the stream's writer thread only; the dump reads the counters
+// and events concurrently, see struct audio_stream_stats.
+struct audio_glitch
+{
+    bool enabled;
+    audio_format_t format;
+    uint32_t channels;
+    uint32_t sample_rate;
+    float *samples;       // Two history frames, then up to capacity frames
+    size_t capacity;      // In frames
+    float jump_mean;      // Mean |second difference| of the previous period
+    uint64_t samples_in;  // Samples analysed
+    uint64_t silent_run;  // Samples of the current run of silence
+    bool had_audio;       // A silence run is only a gap after audio
+    uint64_t gap_min_samples;
+    uint64_t gap_max_samples;
+    uint64_t last_jump;   // Sample index of the last discontinuity, UINT64_MAX before
+    uint64_t last_clip;   // and of the last clip
+    bool clipping;        // A clip run may continue into the next period
+    uint32_t clip_run[AUDIO_CHANNEL_COUNT_MAX];
+    int64_t period_ns;    // Send time of the period being analysed
+    _Atomic uint64_t frames;
+    _Atomic uint64_t counts[AUDIO_GLITCH_TYPE_COUNT];
+    _Atomic uint64_t clipped_samples;
+    _Atomic uint64_t event_count;
+    struct audio_glitch_event events[AUDIO_GLITCH_EVENTS];
+};
+
+// Read the properties. Called by adev_open().
+int audio_glitch_init(void);
+bool audio_glitch_enabled(void);
+bool audio_glitch_supported(audio_format_t format);
+
+int audio_glitch_reset(struct audio_glitch *glitch, audio_format_t format, uint32_t channels,
+                       uint32_t sample_rate, size_t period_frames);
+void audio_glitch_release(struct audio_glitch *glitch);
+// Clear the counters, for the stats_reset control.
+void audio_glitch_clear(struct audio_glitch *glitch);
+// Scan bytes of PCM sent at now_ns.
+void audio_glitch_analyse(struct audio_glitch *glitch, const void *buffer, size_t bytes,
+                          int64_t now_ns);
+void audio_glitch_dump(int fd, const struct audio_glitch *glitch, int64_t now_ns);
+
+#endif // AUDIO_GLITCH_H
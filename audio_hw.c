@@ -15,17 +15,25 @@
  */
 
 #define LOG_TAG "audio_hw_virtual"
-#define ATRACE_TAG ATRACE_TAG_AUDIO
 // #define LOG_NDEBUG 0
 #include <errno.h>
 #include <malloc.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sched.h>
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <linux/sockios.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 
 #include <log/log.h>
 
@@ -37,10 +45,23 @@
 #include <sys/stat.h>
 #include <cutils/properties.h>
 #include <cutils/sockets.h>
-#include <cutils/trace.h>
+#include <cutils/str_parms.h>
 #include <sys/system_properties.h>
 #include <pthread.h>
 
+#include "audio_clock.h"
+#include "audio_convert.h"
+#include "audio_drift.h"
+#include "audio_glitch.h"
+#include "audio_impair.h"
+#include "audio_probe.h"
+#include "audio_stats.h"
+#include "audio_synth.h"
+#include "audio_tap.h"
+#include "audio_telemetry.h"
+#include "audio_trace.h"
+#include "audio_udp.h"
+
 #define STUB_DEFAULT_SAMPLE_RATE 48000
 #define STUB_DEFAULT_AUDIO_FORMAT AUDIO_FORMAT_PCM_16_BIT
 
@@ -50,13 +71,52 @@
 #define STUB_OUTPUT_BUFFER_MILLISECONDS 10
 #define STUB_OUTPUT_DEFAULT_CHANNEL_MASK AUDIO_CHANNEL_OUT_STEREO
 
+#define CAPTURE_RING_MILLISECONDS 200
+#define CAPTURE_RING_MIN_PERIODS 8
+#define CAPTURE_RING_STAMPS 128 // Capture times kept for the data in the ring
+#define CAPTURE_STAMP_MAX_AGE_NS 1000000000LL // Older client stamps are not on our clock
+#define AUDIO_MAX_INPUT_STREAMS 8 // Input streams reading the capture at once
+#define DUPLEX_EXIT_POLL_MILLISECONDS 200
+#define CAPTURE_FRAME_TIMEOUT_MILLISECONDS 500 // A framed client stalled longer in a frame is dropped
+
+#define CAPTURE_PREROLL_MAX_MILLISECONDS 5000
+#define AUDIO_PARAMETER_STREAM_PREROLL_MS "preroll_ms" // Pre-roll handed to the input stream at open
+#define AUDIO_PARAMETER_STREAM_FIRST_SOUND_US "first_sound_us" // Last start to the client having it
+#define AUDIO_PARAMETER_STREAM_OPEN_FIRST_SOUND_US "open_first_sound_us"
+#define AUDIO_PARAMETER_MODULE_OPEN_US "module_open_us"
+
+// Runtime controls, see set_control_parameters()
+#define AUDIO_PARAMETER_CONTROL_OUT_PERIOD_MS "out_period_ms"     // Next output stream
+#define AUDIO_PARAMETER_CONTROL_IN_PERIOD_MS "in_period_ms"       // Next input stream, none open
+#define AUDIO_PARAMETER_CONTROL_SOCKET_PERIODS "socket_periods"   // Client socket buffer depth
+#define AUDIO_PARAMETER_CONTROL_STALL_PERIODS "stall_periods"
+#define AUDIO_PARAMETER_CONTROL_STANDBY_DELAY_MS "standby_delay_ms"
+#define AUDIO_PARAMETER_CONTROL_PACING "pacing"                   // monotonic|virtual|manual
+#define AUDIO_PARAMETER_CONTROL_STATS_RESET "stats_reset"
+#define AUDIO_PARAMETER_CONTROL_TRANSPORT "transport"             // separate|duplex|udp, read only
+#define AUDIO_PARAMETER_CONTROL_TAP "tap"                         // off|out|in|all, see audio_tap.h
+#define CONTROL_PERIOD_MAX_MILLISECONDS 1000
+#define CONTROL_SOCKET_MAX_PERIODS 64
+#define CONTROL_STALL_MAX_PERIODS 1000
+#define CONTROL_STANDBY_DELAY_MAX_MILLISECONDS 60000
+
+#define OUT_STALL_DEFAULT_PERIODS 3 // Periods without draining before output is dropped
+#define SOCKET_DEFAULT_QUEUE_PERIODS 4 // Periods the client socket buffers are sized for
+#define SOCKET_RCVBUF_OVERHEAD 4 // Receive memory per byte of advertised window, see size_client_socket()
+
+#define AUDIO_THREAD_DEFAULT_RT_PRIORITY 2
+#define AUDIO_THREAD_FALLBACK_NICE (-16) // ANDROID_PRIORITY_AUDIO
+
 enum
 {
     CMD_OPEN = 0,
     CMD_CLOSE = 1,
     CMD_DATA = 2,
     CMD_STREAM_START = 3,
-    CMD_STREAM_STOP = 4
+    CMD_STREAM_STOP = 4,
+    CMD_PING = 5, // Latency probe, to the output client (see audio_probe.h)
+    CMD_PONG = 6, // Its answer, from the output client
+    CMD_STATUS = 7 // Playback queue report, from the output client
 };
 
 enum
@@ -73,17 +133,142 @@ struct audio_socket_configuration_info
     uint32_t frame_count;
 };
 
+// CMD_PING. The send time is split in halves so the union keeps its
+// alignment and the legacy message stays 20 bytes.
+struct audio_socket_ping_info
+{
+    uint32_t id;
+    uint32_t send_ns_lo; // CLOCK_MONOTONIC of the sender
+    uint32_t send_ns_hi;
+};
+
 struct audio_socket_info
 {
     uint32_t cmd;
     union
     {
         struct audio_socket_configuration_info asci;
+        struct audio_socket_ping_info ping;
         uint32_t data_size;
         uint32_t offset;
     };
 };
 
+// Payload of CMD_PONG, the client's answer to CMD_PING on the output
+// connection. The host_* times are on the client's clock, 0 if unknown.
+struct audio_socket_pong
+{
+    uint32_t id;
+    uint32_t reserved;
+    int64_t guest_send_ns; // Echo of the ping
+    int64_t host_receive_ns;
+    int64_t host_send_ns;
+    int64_t host_render_ns; // When the last frame before the ping is heard
+};
+
+// Payload of CMD_STATUS, sent by the output client as often as it likes (up
+// to once per period): the audio it holds that is not played yet. It drives
+// the drift compensation (see audio_drift.h).
+struct audio_socket_status
+{
+    uint32_t stream;      // AUDIO_OUT
+    uint32_t fill_frames; // Received but not played yet
+    int64_t host_time_ns; // Client clock when fill_frames was sampled
+};
+
+#define CLIENT_MESSAGE_MAX_PAYLOAD 64
+
+// Frame header of the full-duplex connection. Every command and every data
+// period in either direction is prefixed by one header; the payload of
+// CMD_OPEN is an audio_socket_configuration_info, the payload of CMD_DATA is
+// PCM for the tagged stream.
+struct audio_socket_frame_header
+{
+    uint32_t cmd;
+    uint32_t stream;      // AUDIO_IN or AUDIO_OUT
+    uint32_t data_size;   // Bytes of payload following the header
+    uint32_t sequence;    // Per stream frame counter of the sender
+    int64_t timestamp_ns; // CLOCK_MONOTONIC of the sender when the frame was sent
+};
+
+// When the frame at ring position pos was captured, CLOCK_MONOTONIC.
+struct audio_capture_stamp
+{
+    uint64_t pos;
+    int64_t time_ns;
+};
+
+// Input data received from the client, waiting for in_read(). Every input
+// stream reads it through its own cursor. The writer never waits for them:
+// a cursor left more than size behind skips to the oldest data kept.
+struct audio_capture_ring
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t *data;
+    size_t size;
+    uint64_t write_pos;
+    uint32_t generation;    // Bumped whenever the buffered data is dropped
+    uint64_t overrun_bytes; // Skipped by all cursors
+    size_t frame_size;      // Overruns drop whole frames, 0 if unknown
+    bool locked;            // data is mlock()ed
+    // Capture times, see capture_ring_stamp(). The last CAPTURE_RING_STAMPS
+    // are kept, times in between follow from the sample rate.
+    struct audio_capture_stamp stamps[CAPTURE_RING_STAMPS];
+    uint32_t stamp_count;
+    // Framed clients number their frames, the ones missing are lost.
+    bool sequenced; // next_sequence is known
+    uint32_t next_sequence;
+    uint64_t lost_frames;
+};
+
+struct audio_capture_cursor
+{
+    uint64_t read_pos;
+    uint32_t generation; // Of the ring data read_pos refers to
+    uint64_t overrun_bytes;
+    uint64_t lost_frames; // Lost by the client since the cursor was attached
+    uint64_t lost_base;   // Ring lost_frames already counted in lost_frames
+};
+
+enum
+{
+    AUDIO_THREAD_SENDER = 0,  // Caller of out_write()
+    AUDIO_THREAD_READER,      // Caller of in_read()
+    AUDIO_THREAD_OUT_SERVER,  // out_socket_sever_thread
+    AUDIO_THREAD_IN_SERVER,   // in_socket_sever_thread
+    AUDIO_THREAD_DUPLEX_LOOP, // duplex_socket_server_thread
+    AUDIO_THREAD_CAPTURE_LOOP, // capture_loop_thread
+    AUDIO_THREAD_ROLE_COUNT
+};
+
+static const char *const audio_thread_role_names[AUDIO_THREAD_ROLE_COUNT] = {
+    "sender", "reader", "out_server", "in_server", "duplex_loop", "capture_loop",
+};
+
+// Scheduling requested through virtual.audio.thread.* properties.
+struct audio_thread_tuning
+{
+    int policy; // SCHED_OTHER means leave the scheduling untouched
+    int priority;
+    bool has_cpus;
+    cpu_set_t cpus;
+    bool mlock;
+};
+
+// Scheduling actually in effect for one thread role, for dump output.
+struct audio_thread_state
+{
+    bool tuned;
+    pid_t tid;
+    int policy;
+    int priority;
+    int nice;
+    cpu_set_t cpus;
+    int sched_error;    // errno of the failed priority request, 0 on success
+    int affinity_error; // errno of the failed affinity request, 0 on success
+};
+
 struct stub_audio_device
 {
     struct audio_hw_device device;
@@ -98,6 +283,31 @@ struct stub_stream_out
     audio_channel_mask_t channel_mask;
     audio_format_t format;
     size_t frame_count;
+    bool thread_tuned;
+    bool clock_attached;
+    int64_t last_write_begin_us; // For the pacing error, 0 after standby
+    int stalled_periods;         // Consecutive periods the client did not drain
+    bool dropping;               // Client stalled: periods are dropped without waiting
+    bool drift_enabled;
+    struct audio_drift drift;
+    uint32_t drift_reports;    // CMD_STATUS reports already fed to the controller
+    uint32_t drift_generation; // Client the controller is locked to
+    uint8_t *drift_buffer;     // Resampled period
+    size_t drift_buffer_size;
+    _Atomic uint32_t latency_ms;   // Returned by out_get_latency(), see out_update_latency()
+    uint32_t socket_queued_frames; // Components of the last update, for dump
+    uint32_t impair_queued_frames;
+    int64_t client_queued_frames; // -1 until the client reports its queue
+    int64_t open_ns;              // adev_open_output_stream()
+    int64_t first_sound_begin_ns; // Write that left standby, 0 once a client has it
+    int64_t first_sound_us;       // Of the last start, -1 before the first one
+    int64_t open_first_sound_us;  // From open to the first period a client got, -1 before
+    uint64_t warm_restarts;       // Writes that resumed before CMD_STREAM_STOP went out
+    uint32_t control_generation;  // Of the runtime controls last applied, see out_apply_controls()
+    uint32_t stats_resets;
+    struct audio_glitch glitch; // Of the periods sent, if virtual.audio.glitch.enable
+    struct audio_tap *tap; // NULL if the format is not tapped
+    struct audio_stream_stats stats;
 };
 
 struct stub_stream_in
@@ -109,6 +319,33 @@ struct stub_stream_in
     audio_format_t format;
     size_t frame_count;
     struct stub_audio_device *dev;
+    bool thread_tuned;
+    bool clock_attached;
+    int64_t last_read_begin_us; // For the pacing error, 0 after standby
+    bool drift_enabled;
+    struct audio_drift drift;
+    uint8_t *drift_buffer; // Client data before resampling
+    size_t drift_buffer_size;
+    uint32_t preroll_ms;          // Pre-roll found in the capture ring at open
+    size_t preroll_pending_bytes; // Of it, still to be read without pacing
+    struct audio_capture_cursor cursor;
+    size_t capture_frame_size; // Of the client capture this stream reads
+    uint32_t capture_rate;
+    bool converting; // The stream differs from the client capture
+    struct audio_convert convert;
+    uint8_t *convert_buffer; // Client capture before conversion
+    size_t convert_buffer_size;
+    uint32_t control_generation;  // Of the runtime controls last applied, see in_apply_controls()
+    uint32_t stats_resets;
+    uint64_t frames_read;       // Returned by in_read(), silence included
+    int64_t position_frames;    // get_capture_position(): frames_read when
+    int64_t position_time_ns;   // the next frame was captured at this time, 0 if unknown;
+                                // written under mutexlock_in, so the pair is read whole
+    uint64_t lost_reported;     // Capture frames in_get_input_frames_lost() returned
+    struct audio_synth synth;   // Read while no client is connected
+    bool synth_active;          // The last read came from it
+    struct audio_tap *tap;
+    struct audio_stream_stats stats;
 };
 
 struct audio_server_socket
@@ -129,10 +366,35 @@ struct audio_server_socket
     bool oss_is_sent_open_cmd;
     pthread_mutex_t mutexlock_out;
     int64_t oss_write_count;
-
-    //Audio in socket
-    struct stub_stream_in *ssi;
+    _Atomic int out_stall_periods; // Client stall watchdog threshold, 0 disables it
+    int out_standby_delay_ms; // CMD_STREAM_STOP is held back this long, 0 sends it at once
+    bool out_stop_pending;    // out_standby() happened, CMD_STREAM_STOP not sent yet
+    int64_t out_stop_deadline_ns;
+    pthread_cond_t out_standby_cond; // Wakes out_standby_thread, under mutexlock_out
+    pthread_t out_standby_thread;
+    bool out_standby_thread_started;
+    _Atomic int socket_queue_periods; // Socket buffer size in periods, 0 keeps kernel autotuning
+    int out_socket_sndbuf;    // Effective sizes of the current client, 0 if not sized
+    int out_socket_lowat;
+    int in_socket_rcvbuf;
+    // Partial message from the legacy output client
+    uint8_t client_rx[sizeof(struct audio_socket_info) + CLIENT_MESSAGE_MAX_PAYLOAD];
+    size_t client_rx_bytes;
+    size_t client_rx_skip; // Payload bytes of an oversized message still to discard
+    // Latest CMD_STATUS of the output client, for the writer thread
+    _Atomic int64_t out_client_fill_frames;
+    _Atomic uint32_t out_client_reports;
+    _Atomic uint32_t out_client_generation; // Bumped for every new client
+
+    //Audio in socket. Every open input stream reads the one client, see
+    //capture_open().
+    struct stub_stream_in *in_streams[AUDIO_MAX_INPUT_STREAMS]; // Under mutexlock_in
+    int in_stream_count;
     int in_fd;
+    // A client accepted by in_socket_sever_thread(), for capture_loop_thread()
+    // to swap in: only the thread reading in_fd closes it. Set under
+    // mutexlock_in.
+    _Atomic int in_pending_fd;
     pthread_t iss_thread; // in socket server thread
     int iss_exit;         // in socket server thread exit
     int iss_fd;           // iut socket server fd
@@ -141,8 +403,61 @@ struct audio_server_socket
     int iss_epoll_fd;
     struct epoll_event iss_epoll_event[1];
     bool iss_read_flag;
-    int input_buffer_milliseconds; // INPUT_BUFFER_MILLISECONDS
+    int input_buffer_milliseconds; // INPUT_BUFFER_MILLISECONDS, of the next input stream
     pthread_mutex_t mutexlock_in;
+
+    //Full-duplex socket. out_fd and in_fd both alias duplex_fd, which is
+    //owned by the duplex socket server thread.
+    bool duplex_mode;
+    int duplex_tcp_port;
+    int duplex_fd;
+    pthread_t dss_thread; // duplex socket server thread
+    int dss_exit;         // duplex socket server thread exit
+    int dss_fd;           // duplex socket server fd
+    int dss_epoll_fd;
+    pthread_mutex_t mutexlock_duplex_write;
+    uint32_t duplex_sequence[2]; // Indexed by AUDIO_IN/AUDIO_OUT
+    struct audio_capture_ring capture;
+    //The separate input client prefixes its capture with frame headers as
+    //on the duplex connection, see capture_receive_frame().
+    bool in_framed;
+
+    //Capture from the input client goes through the capture ring, written
+    //by capture_loop_thread (separate connections) or the duplex thread.
+    struct audio_config capture_config; // Parameters the client is opened with
+    pthread_t capture_thread;           // Reads the separate input connection
+    bool capture_thread_started;
+
+    //Always-on capture: the input client is opened as soon as it connects,
+    //and the last preroll_ms of capture wait in the capture ring for the
+    //next input stream. 0 opens the client on the first in_read().
+    int preroll_ms;
+    // Microphones the capture client sends, as an index mask; 0 to open the
+    // client with the channels of the first input stream.
+    int mic_channels;
+
+    //UDP transport (see audio_udp.h) instead of the TCP connections.
+    //out_fd and in_fd stay -1.
+    bool udp_mode;
+
+    //Runtime controls, see set_control_parameters(). Settings for the next
+    //stream or client are stored at once; the stream threads compare
+    //control_generation at the start of every period and resize their
+    //client socket or reset their statistics when it moved.
+    pthread_mutex_t mutexlock_control; // Serializes set_control_parameters()
+    _Atomic uint32_t control_generation;
+    _Atomic uint32_t stats_resets;
+    int output_buffer_milliseconds; // Of the next output stream
+
+    //Shared telemetry page for host tools
+    struct audio_telemetry_page *telemetry;
+    int64_t open_us; // Duration of adev_open()
+
+    //Thread scheduling and memory locking
+    struct audio_thread_tuning thread_tuning;
+    struct audio_thread_state thread_state[AUDIO_THREAD_ROLE_COUNT];
+    size_t locked_bytes;
+    int lock_error; // errno of the last failed mlock(), 0 if none failed
 };
 
 static struct audio_server_socket ass;
@@ -167,6 +482,7 @@ static int close_socket_fd(int *psd)
     {
         ALOGV("Close %d", *psd);
         shutdown(*psd, SHUT_RDWR);
+        audio_impair_unbind(*psd);
         close(*psd);
         *psd = -1;
         return 0;
@@ -179,1027 +495,3655 @@ static int close_socket_fd(int *psd)
     return -1;
 }
 
-static int send_open_cmd(struct audio_server_socket *pass, int audio_type)
+static const char *sched_policy_name(int policy)
 {
-    if (!pass)
+    switch (policy)
     {
-        ALOGE("pass pointer is NULL.");
-        return -1;
+    case SCHED_FIFO:
+        return "fifo";
+    case SCHED_RR:
+        return "rr";
+    case SCHED_OTHER:
+        return "other";
+    default:
+        return "unknown";
     }
+}
 
-    int ret;
-    int client_fd = -1;
-    struct audio_socket_info asi;
-    memset(&asi, 0, sizeof(struct audio_socket_info));
-    asi.cmd = CMD_OPEN;
+// Parse "0-3,6" style cpu lists and "0xf" style masks.
+static bool parse_cpu_list(const char *str, cpu_set_t *cpus)
+{
+    char *end;
 
-    switch (audio_type)
+    CPU_ZERO(cpus);
+    if (strncmp(str, "0x", 2) == 0 || strncmp(str, "0X", 2) == 0)
     {
-    case AUDIO_IN:
-        ALOGV("%s pass->in_fd = %d ", __func__, pass->in_fd);
-        client_fd = pass->in_fd;
-        if (pass->ssi)
+        unsigned long long mask = strtoull(str + 2, &end, 16);
+        int cpu;
+        if (*end != '\0' || mask == 0)
         {
-            asi.asci.sample_rate = pass->ssi->sample_rate;
-            if (ass.audio_mask == 1)
-            {
-                asi.asci.channel = pass->ssi->channel_mask;
-            }
-            else
-            {
-                asi.asci.channel = audio_channel_count_from_in_mask(pass->ssi->channel_mask);
-            }
-            asi.asci.format = pass->ssi->format;
-            asi.asci.frame_count = pass->ssi->frame_count;
-            ALOGV("%s AUDIO_IN asi.asci.sample_rate: %d asi.asci.channel: %d "
-                  "asi.asci.format: %d asi.asci.frame_count: %d\n",
-                  __func__, asi.asci.sample_rate, asi.asci.channel,
-                  asi.asci.format, asi.asci.frame_count);
+            return false;
         }
-        break;
-    case AUDIO_OUT:
-        client_fd = pass->out_fd;
-        if (pass->sso)
+        for (cpu = 0; cpu < 64 && cpu < CPU_SETSIZE; cpu++)
         {
-            asi.asci.sample_rate = pass->sso->sample_rate;
-            if (ass.audio_mask == 1)
-            {
-                asi.asci.channel = pass->sso->channel_mask;
-            }
-            else
+            if (mask & (1ULL << cpu))
             {
-                asi.asci.channel = audio_channel_count_from_out_mask(pass->sso->channel_mask);
+                CPU_SET(cpu, cpus);
             }
-            asi.asci.format = pass->sso->format;
-            asi.asci.frame_count = pass->sso->frame_count;
-            ALOGV("%s AUDIO_OUT asi.asci.sample_rate: %d asi.asci.channel: %d "
-                  "asi.asci.format: %d asi.asci.frame_count: %d\n",
-                  __func__, asi.asci.sample_rate, asi.asci.channel,
-                  asi.asci.format, asi.asci.frame_count);
         }
-        break;
-
-    default:
-        ALOGW("Unkown type: %d", audio_type);
-        return -1;
-        break;
+        return true;
     }
-    if (client_fd < 0)
+    while (*str != '\0')
     {
-        ALOGW("client_fd is %d. Do not send open command to client.", client_fd);
-        return -1;
+        long first = strtol(str, &end, 10);
+        long last = first;
+        if (end == str || first < 0)
+        {
+            return false;
+        }
+        if (*end == '-')
+        {
+            str = end + 1;
+            last = strtol(str, &end, 10);
+            if (end == str || last < first)
+            {
+                return false;
+            }
+        }
+        for (; first <= last && first < CPU_SETSIZE; first++)
+        {
+            CPU_SET(first, cpus);
+        }
+        if (*end == ',')
+        {
+            end++;
+        }
+        else if (*end != '\0')
+        {
+            return false;
+        }
+        str = end;
     }
-    do
-    {
-        ret = write(client_fd, &asi, sizeof(struct audio_socket_info));
-    } while (ret < 0 && errno == EINTR);
-    if (ret != sizeof(struct audio_socket_info))
+    return CPU_COUNT(cpus) > 0;
+}
+
+static void format_cpu_list(const cpu_set_t *cpus, char *buf, size_t size)
+{
+    size_t len = 0;
+    int cpu = 0;
+
+    buf[0] = '\0';
+    while (cpu < CPU_SETSIZE && len < size)
     {
-        ALOGE("%s: could not notify the client(%d) to open: ret=%d: %s.",
-              __FUNCTION__, client_fd, ret, strerror(errno));
-        return -1;
+        int last;
+        if (!CPU_ISSET(cpu, cpus))
+        {
+            cpu++;
+            continue;
+        }
+        for (last = cpu; last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, cpus); last++)
+            ;
+        len += snprintf(buf + len, size - len, len ? ",%d" : "%d", cpu);
+        if (last > cpu && len < size)
+        {
+            len += snprintf(buf + len, size - len, "-%d", last);
+        }
+        cpu = last + 1;
     }
-
-    ALOGV("%s Notify the audio client(%d) to open.", __func__, client_fd);
-    return 0;
 }
 
-static int send_close_cmd(int client_fd)
+static void load_thread_tuning(struct audio_thread_tuning *tuning)
 {
-    ALOGV("%s client_fd = %d", __func__, client_fd);
-    int ret;
-    struct audio_socket_info asi;
-    asi.cmd = CMD_CLOSE;
-    asi.data_size = 0;
-    if (client_fd > 0)
+    char buf[PROPERTY_VALUE_MAX] = {
+        '\0',
+    };
+
+    memset(tuning, 0, sizeof(*tuning));
+    tuning->policy = SCHED_OTHER;
+    tuning->priority = AUDIO_THREAD_DEFAULT_RT_PRIORITY;
+    if (property_get("virtual.audio.thread.policy", buf, "") > 0)
     {
-        do
+        if (strcmp(buf, "fifo") == 0)
         {
-            ret = write(client_fd, &asi, sizeof(struct audio_socket_info));
-        } while (ret < 0 && errno == EINTR);
-        if (ret != sizeof(struct audio_socket_info))
+            tuning->policy = SCHED_FIFO;
+        }
+        else if (strcmp(buf, "rr") == 0)
         {
-            ALOGE("%s: could not notify the client(%d) to "
-                  "close: ret=%d: %s.",
-                  __FUNCTION__, client_fd, ret, strerror(errno));
-            return -1;
+            tuning->policy = SCHED_RR;
         }
-        else
+        else if (strcmp(buf, "other") != 0)
         {
-            ALOGW("%s Notify the client(%d) to close.", __func__, client_fd);
-            return 0;
+            ALOGW("Unknown thread policy %s. Keep default scheduling.", buf);
         }
     }
-    else
+    if (property_get("virtual.audio.thread.priority", buf, "") > 0)
     {
-        ALOGW("Client is %d. Do not set close command to client.", client_fd);
-        return 0;
+        int min = sched_get_priority_min(SCHED_FIFO);
+        int max = sched_get_priority_max(SCHED_FIFO);
+        tuning->priority = atoi(buf);
+        if (tuning->priority < min || tuning->priority > max)
+        {
+            ALOGW("Thread priority %d is out of range [%d, %d]. Use %d.",
+                  tuning->priority, min, max, AUDIO_THREAD_DEFAULT_RT_PRIORITY);
+            tuning->priority = AUDIO_THREAD_DEFAULT_RT_PRIORITY;
+        }
+    }
+    if (property_get("virtual.audio.thread.cpus", buf, "") > 0)
+    {
+        tuning->has_cpus = parse_cpu_list(buf, &tuning->cpus);
+        if (!tuning->has_cpus)
+        {
+            ALOGW("Cannot parse thread cpus \"%s\". Keep default affinity.", buf);
+        }
+    }
+    if (property_get("virtual.audio.mlock", buf, "0") > 0)
+    {
+        tuning->mlock = atoi(buf) > 0;
     }
+    ALOGI("Thread tuning: policy %s priority %d cpus %s mlock %d",
+          sched_policy_name(tuning->policy), tuning->priority,
+          tuning->has_cpus ? "custom" : "default", tuning->mlock);
 }
 
-static uint32_t out_get_sample_rate(const struct audio_stream *stream)
+/*
+ * Apply the requested scheduling to the calling thread. Missing privileges
+ * are not fatal: a refused real-time request falls back to the audio nice
+ * level and the outcome is kept in thread_state for adev_dump().
+ */
+static void apply_thread_tuning(int role)
 {
-    const struct stub_stream_out *out = (const struct stub_stream_out *)stream;
+    const struct audio_thread_tuning *tuning = &ass.thread_tuning;
+    struct audio_thread_state *state = &ass.thread_state[role];
+    struct sched_param param;
+    int err;
+
+    memset(state, 0, sizeof(*state));
+    state->tid = gettid();
+    if (tuning->policy != SCHED_OTHER)
+    {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = tuning->priority;
+        err = pthread_setschedparam(pthread_self(), tuning->policy, &param);
+        if (err)
+        {
+            state->sched_error = err;
+            ALOGW("%s: Cannot set %s thread(%d) to %s priority %d: %s. Fall back to nice %d.",
+                  __func__, audio_thread_role_names[role], state->tid,
+                  sched_policy_name(tuning->policy), tuning->priority, strerror(err),
+                  AUDIO_THREAD_FALLBACK_NICE);
+            if (setpriority(PRIO_PROCESS, state->tid, AUDIO_THREAD_FALLBACK_NICE))
+            {
+                ALOGW("%s: Cannot set nice %d either: %s", __func__,
+                      AUDIO_THREAD_FALLBACK_NICE, strerror(errno));
+            }
+        }
+    }
+    if (tuning->has_cpus && sched_setaffinity(0, sizeof(cpu_set_t), &tuning->cpus))
+    {
+        state->affinity_error = errno;
+        ALOGW("%s: Cannot set cpu affinity of %s thread(%d): %s", __func__,
+              audio_thread_role_names[role], state->tid, strerror(errno));
+    }
 
-    ALOGV("out_get_sample_rate: %u", out->sample_rate);
-    return out->sample_rate;
+    if (pthread_getschedparam(pthread_self(), &state->policy, &param) == 0)
+    {
+        state->priority = param.sched_priority;
+    }
+    state->nice = getpriority(PRIO_PROCESS, state->tid);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &state->cpus))
+    {
+        CPU_ZERO(&state->cpus);
+    }
+    state->tuned = true;
+    ALOGI("%s thread(%d) runs with policy %s priority %d nice %d",
+          audio_thread_role_names[role], state->tid, sched_policy_name(state->policy),
+          state->priority, state->nice);
 }
 
-static int out_set_sample_rate(struct audio_stream *stream, uint32_t rate)
+// mlock() buffers touched on the I/O path when virtual.audio.mlock is set.
+static bool lock_audio_memory(const void *addr, size_t bytes)
 {
-    struct stub_stream_out *out = (struct stub_stream_out *)stream;
-
-    ALOGV("out_set_sample_rate: %d", rate);
-    out->sample_rate = rate;
-    return 0;
+    if (!ass.thread_tuning.mlock || !addr || bytes == 0)
+    {
+        return false;
+    }
+    if (mlock(addr, bytes))
+    {
+        ass.lock_error = errno;
+        ALOGW("%s: Cannot lock %zu bytes: %s", __func__, bytes, strerror(errno));
+        return false;
+    }
+    ass.locked_bytes += bytes;
+    return true;
 }
 
-static size_t out_get_buffer_size(const struct audio_stream *stream)
+static void unlock_audio_memory(const void *addr, size_t bytes)
 {
-    const struct stub_stream_out *out = (const struct stub_stream_out *)stream;
-    size_t buffer_size = out->frame_count *
-                         audio_stream_out_frame_size(&out->stream);
-
-    ALOGV("out_get_buffer_size: %zu", buffer_size);
-    return buffer_size;
+    if (munlock(addr, bytes) == 0)
+    {
+        ass.locked_bytes -= bytes;
+    }
 }
 
-static audio_channel_mask_t out_get_channels(const struct audio_stream *stream)
+static void dump_thread_tuning(int fd)
 {
-    const struct stub_stream_out *out = (const struct stub_stream_out *)stream;
-
-    ALOGV("out_get_channels: %x", out->channel_mask);
-    return out->channel_mask;
+    const struct audio_thread_tuning *tuning = &ass.thread_tuning;
+    char cpus[128];
+    int role;
+
+    format_cpu_list(&tuning->cpus, cpus, sizeof(cpus));
+    dprintf(fd, "  Thread tuning requested: policy %s priority %d cpus %s mlock %s\n",
+            sched_policy_name(tuning->policy), tuning->priority,
+            tuning->has_cpus ? cpus : "default", tuning->mlock ? "on" : "off");
+    for (role = 0; role < AUDIO_THREAD_ROLE_COUNT; role++)
+    {
+        const struct audio_thread_state *state = &ass.thread_state[role];
+        if (!state->tuned)
+        {
+            continue;
+        }
+        format_cpu_list(&state->cpus, cpus, sizeof(cpus));
+        dprintf(fd, "    %-11s tid %d policy %s priority %d nice %d cpus %s",
+                audio_thread_role_names[role], state->tid, sched_policy_name(state->policy),
+                state->priority, state->nice, cpus);
+        if (state->sched_error)
+        {
+            dprintf(fd, " (priority refused: %s)", strerror(state->sched_error));
+        }
+        if (state->affinity_error)
+        {
+            dprintf(fd, " (affinity refused: %s)", strerror(state->affinity_error));
+        }
+        dprintf(fd, "\n");
+    }
+    dprintf(fd, "  Locked memory: %zu bytes", ass.locked_bytes);
+    if (ass.lock_error)
+    {
+        dprintf(fd, " (last mlock refused: %s)", strerror(ass.lock_error));
+    }
+    dprintf(fd, "\n");
 }
 
-static audio_format_t out_get_format(const struct audio_stream *stream)
+static int64_t monotonic_time_ns(void)
 {
-    const struct stub_stream_out *out = (const struct stub_stream_out *)stream;
-
-    ALOGV("out_get_format: %d", out->format);
-    return out->format;
+    struct timespec t = {.tv_sec = 0, .tv_nsec = 0};
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
 }
 
-static int out_set_format(struct audio_stream *stream, audio_format_t format)
+// Read bytes from a client that may stall: 0 when it closed, -1 with
+// ETIMEDOUT when nothing arrives for timeout_ms.
+static ssize_t read_full_timeout(int fd, void *buffer, size_t bytes, int timeout_ms)
 {
-    struct stub_stream_out *out = (struct stub_stream_out *)stream;
-
-    ALOGV("out_set_format: %d", format);
-    out->format = format;
-    return 0;
+    size_t done = 0;
+    while (done < bytes)
+    {
+        struct pollfd pfd = {.fd = fd, .events = POLLIN, .revents = 0};
+        int ready = poll(&pfd, 1, timeout_ms);
+        ssize_t ret;
+        if (ready < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ready <= 0)
+        {
+            if (ready == 0)
+            {
+                errno = ETIMEDOUT;
+            }
+            return -1;
+        }
+        ret = audio_impair_read(fd, (uint8_t *)buffer + done, bytes - done);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return ret;
+        }
+        done += ret;
+    }
+    return done;
 }
 
-static int out_standby(struct audio_stream *stream)
+static ssize_t writev_full(int fd, struct iovec *iov, int iovcnt)
 {
-    ALOGV("out_standby");
-    int ret;
-    if (ass.out_fd > 0)
+    ssize_t total = 0;
+    while (iovcnt > 0)
     {
-        struct audio_socket_info asi;
-        memset(&asi, 0, sizeof(struct audio_socket_info));
-        asi.cmd = CMD_STREAM_STOP;
-        do
+        ssize_t ret = audio_impair_writev(fd, iov, iovcnt);
+        if (ret < 0 && errno == EINTR)
         {
-            ret = write(ass.out_fd, &asi, sizeof(struct audio_socket_info));
-        } while (ret < 0 && errno == EINTR);
-        if (ret != sizeof(struct audio_socket_info))
+            continue;
+        }
+        if (ret <= 0)
         {
-            ALOGE("%s: could not notify the client(%d) to stop streaming: ret=%d: %s.",
-                  __FUNCTION__, ass.out_fd, ret, strerror(errno));
             return -1;
         }
-        ass.out_stream_standby = true;
-    }
-    else
-    {
-
-        ALOGE("%s: Audio out client is not connected. "
-              "port(%d) ass.out_fd(%d).",
-              __FUNCTION__, ass.out_tcp_port, ass.out_fd);
-        return -1;
+        total += ret;
+        while (iovcnt > 0 && (size_t)ret >= iov->iov_len)
+        {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
     }
-    return ret;
-    // out->last_write_time_us = 0; unnecessary as a stale write time has same effect
+    return total;
 }
 
-static int out_dump(const struct audio_stream *stream, int fd)
+// Write the whole buffer, so a short write never leaves the client in the
+// middle of a message.
+static ssize_t write_full(int fd, const void *buffer, size_t bytes)
 {
-    ALOGV("out_dump");
-    return 0;
+    struct iovec iov = {
+        .iov_base = (void *)buffer,
+        .iov_len = bytes,
+    };
+    return writev_full(fd, &iov, 1);
 }
 
-static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
+/*
+ * Send one stream-tagged frame on the full-duplex connection. Header and
+ * payload leave in a single writev() under mutexlock_duplex_write, so the
+ * output and input paths never interleave inside a frame.
+ * Return the payload size on success and -1 on failure.
+ */
+static ssize_t send_duplex_frame(int fd, uint32_t cmd, uint32_t stream,
+                                 const void *payload, size_t bytes)
 {
-    ALOGV("out_set_parameters");
-    return 0;
+    struct audio_socket_frame_header hdr;
+    struct iovec iov[2];
+    int iovcnt = 1;
+    ssize_t ret;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.cmd = cmd;
+    hdr.stream = stream;
+    hdr.data_size = bytes;
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    if (payload && bytes > 0)
+    {
+        iov[1].iov_base = (void *)payload;
+        iov[1].iov_len = bytes;
+        iovcnt = 2;
+    }
+
+    pthread_mutex_lock(&ass.mutexlock_duplex_write);
+    hdr.sequence = ass.duplex_sequence[stream == AUDIO_OUT ? AUDIO_OUT : AUDIO_IN]++;
+    hdr.timestamp_ns = monotonic_time_ns();
+    ret = writev_full(fd, iov, iovcnt);
+    pthread_mutex_unlock(&ass.mutexlock_duplex_write);
+    if (ret < 0)
+    {
+        ALOGE("%s: could not send cmd %u for stream %u to duplex client(%d): %s.",
+              __func__, cmd, stream, fd, strerror(errno));
+        return -1;
+    }
+    return ret - sizeof(hdr);
 }
 
-static char *out_get_parameters(const struct audio_stream *stream, const char *keys)
+static void handle_pong(const struct audio_socket_pong *pong, int64_t receive_ns)
 {
-    ALOGV("out_get_parameters");
-    return strdup("");
+    struct audio_probe_sample sample = {
+        .id = pong->id,
+        .guest_send_ns = pong->guest_send_ns,
+        .host_receive_ns = pong->host_receive_ns,
+        .host_send_ns = pong->host_send_ns,
+        .host_render_ns = pong->host_render_ns,
+        .guest_receive_ns = receive_ns,
+    };
+    audio_probe_pong(&sample);
 }
 
-static uint32_t out_get_latency(const struct audio_stream_out *stream)
+// Follow the period just written with CMD_PING when the probe is due, so
+// the ping waits behind the same queued audio the period does.
+static void out_send_ping(void)
 {
-    ALOGV("out_get_latency");
-    return STUB_OUTPUT_BUFFER_MILLISECONDS;
+    struct audio_socket_info asi;
+    int64_t now_ns = monotonic_time_ns();
+    uint32_t id;
+    ssize_t ret;
+
+    if (!audio_probe_next(now_ns, &id))
+    {
+        return;
+    }
+    memset(&asi, 0, sizeof(asi));
+    asi.cmd = CMD_PING;
+    asi.ping.id = id;
+    asi.ping.send_ns_lo = (uint32_t)now_ns;
+    asi.ping.send_ns_hi = (uint32_t)((uint64_t)now_ns >> 32);
+    if (ass.duplex_mode)
+    {
+        ret = send_duplex_frame(ass.out_fd, CMD_PING, AUDIO_OUT, &asi.ping, sizeof(asi.ping)) < 0 ?
+              -1 : (ssize_t)sizeof(asi);
+    }
+    else
+    {
+        ret = write_full(ass.out_fd, &asi, sizeof(asi));
+    }
+    if (ret != sizeof(asi))
+    {
+        ALOGW("%s: could not ping the audio out client(%d): %s.", __func__, ass.out_fd,
+              strerror(errno));
+    }
 }
 
-static int out_set_volume(struct audio_stream_out *stream, float left,
-                          float right)
+static void handle_status(const struct audio_socket_status *status)
 {
-    ALOGV("out_set_volume: Left:%f Right:%f", left, right);
-    return 0;
+    if (status->stream == AUDIO_OUT)
+    {
+        atomic_store(&ass.out_client_fill_frames, status->fill_frames);
+        atomic_fetch_add(&ass.out_client_reports, 1);
+    }
 }
 
-static void out_update_source_metadata(struct audio_stream_out *stream,
-                                       const struct source_metadata *source_metadata)
+// Our clock for the capture time a client stamped a frame with. The stamp
+// is taken as it is when it falls within CAPTURE_STAMP_MAX_AGE_NS before
+// the frame arrived, as it does when both ends share CLOCK_MONOTONIC, and
+// the arrival time is used otherwise. The clock offset of the latency probe
+// is no help: its pings queue behind the output, which skews the offset by
+// up to the audio in flight.
+static int64_t capture_frame_time(int64_t timestamp_ns, int64_t receive_ns)
 {
-    ALOGV("update_source_metadata called. Do nothing as of now.");
+    if (timestamp_ns == 0 || timestamp_ns > receive_ns ||
+        receive_ns - timestamp_ns > CAPTURE_STAMP_MAX_AGE_NS)
+    {
+        return receive_ns;
+    }
+    return timestamp_ns;
 }
 
-static ssize_t out_write_to_client(struct audio_stream_out *stream, const void *buffer,
-                                   size_t bytes, int timeout)
+// The kernel receive timestamp of the data returned by recvmsg(), as
+// CLOCK_MONOTONIC; now_ns when the socket does not provide one.
+static int64_t receive_time_ns(struct msghdr *msg, int64_t now_ns)
 {
-    ssize_t ret = -1;
-    ssize_t result = 0;
-    int nevents = 0;
-    int ne;
-    if (ass.out_fd > 0)
+    struct cmsghdr *cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
     {
-        if (ass.out_stream_standby == true)
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
         {
-            struct audio_socket_info asi;
-            int ret;
-            asi.cmd = CMD_STREAM_START;
-            do
-            {
-                ret = write(ass.out_fd, &asi, sizeof(struct audio_socket_info));
-            } while (ret < 0 && errno == EINTR);
-            if (ret != sizeof(struct audio_socket_info))
+            struct timespec stamp, now;
+            int64_t age_ns;
+            memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+            clock_gettime(CLOCK_REALTIME, &now);
+            age_ns = (now.tv_sec - stamp.tv_sec) * 1000000000LL + now.tv_nsec - stamp.tv_nsec;
+            return age_ns > 0 ? now_ns - age_ns : now_ns;
+        }
+    }
+    return now_ns;
+}
+
+/*
+ * Collect the messages of the legacy output client: an audio_socket_info
+ * announcing data_size bytes of CMD_PONG or CMD_STATUS payload. This runs
+ * once per period without blocking, so the kernel receive timestamp stands
+ * in for the arrival time of a pong.
+ */
+static void out_receive_client_messages(void)
+{
+    const size_t header_size = sizeof(struct audio_socket_info);
+    struct audio_socket_info asi;
+
+    for (;;)
+    {
+        union
+        {
+            char buf[CMSG_SPACE(sizeof(struct timespec))];
+            struct cmsghdr align;
+        } control;
+        struct iovec iov;
+        struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control.buf,
+            .msg_controllen = sizeof(control.buf),
+        };
+        int64_t receive_ns;
+        ssize_t ret;
+
+        if (ass.client_rx_skip > 0)
+        {
+            iov.iov_base = ass.client_rx;
+            iov.iov_len = ass.client_rx_skip < sizeof(ass.client_rx) ? ass.client_rx_skip :
+                          sizeof(ass.client_rx);
+        }
+        else
+        {
+            size_t wanted = header_size;
+            if (ass.client_rx_bytes >= header_size)
             {
-                ALOGE("%s: could not notify the client(%d) to start streaming: ret=%d: %s.",
-                      __FUNCTION__, ass.out_fd, ret, strerror(errno));
+                memcpy(&asi, ass.client_rx, header_size);
+                wanted += asi.data_size;
             }
-            ass.out_stream_standby = false;
+            iov.iov_base = ass.client_rx + ass.client_rx_bytes;
+            iov.iov_len = wanted - ass.client_rx_bytes;
         }
-        nevents = epoll_wait(ass.oss_epoll_fd, ass.oss_epoll_event, 1, timeout);
-        if (nevents < 0)
+        ret = recvmsg(ass.out_fd, &msg, MSG_DONTWAIT);
+        if (ret <= 0)
         {
-            if (errno != EINTR)
-                ALOGE("epoll_wait() unexpected error: %s", strerror(errno));
-            return errno;
+            return; // Nothing yet; a hang up is seen by epoll_wait()
         }
-        else if (nevents == 0)
+        receive_ns = receive_time_ns(&msg, monotonic_time_ns());
+        if (ass.client_rx_skip > 0)
         {
-            ALOGW("out_write_to_client: Client cannot be written in given time.");
-            return -1;
+            ass.client_rx_skip -= ret;
+            continue;
         }
-        else if (nevents > 0)
+        ass.client_rx_bytes += ret;
+        if (ass.client_rx_bytes < header_size)
         {
-            for (ne = 0; ne < nevents; ne++) //In fact, only one event.
-            {
-                if (ass.oss_epoll_event[ne].data.fd == ass.out_fd)
-                {
-                    if ((ass.oss_epoll_event[ne].events & (EPOLLERR | EPOLLHUP)) != 0)
-                    {
-                        ALOGE("EPOLLERR or EPOLLHUP after epoll_wait() !?");
-                        if (epoll_ctl(ass.oss_epoll_fd, EPOLL_CTL_DEL, ass.out_fd, NULL))
-                        {
-                            ALOGE("Failed to delete audio in file descriptor to epoll");
-                        }
-                        pthread_mutex_lock(&ass.mutexlock_out);
-                        close_socket_fd(&(ass.out_fd)); // Try to clear the cache data in socket.
-                        ass.oss_is_sent_open_cmd = 0;
-                        if (ATRACE_ENABLED())
-                        {
-                            ATRACE_INT("avh_out_client_EPOLLERR_or_EPOLLHUP", ass.oss_is_sent_open_cmd);
-                        }
-                        pthread_mutex_unlock(&ass.mutexlock_out);
-                    }
-                    else if ((ass.oss_epoll_event[ne].events & EPOLLOUT) != 0)
-                    {
-                        struct audio_socket_info asi;
-                        asi.cmd = CMD_DATA;
-                        asi.data_size = bytes;
-                        ALOGV("%s asi.data_size: %d\n", __func__, asi.data_size);
-                        do
-                        {
-                            if (ATRACE_ENABLED())
-                            {
-                                ATRACE_INT("avh_CMD_DATA_count_before_write", ass.oss_write_count);
-                            }
-                            result = write(ass.out_fd, &asi, sizeof(struct audio_socket_info));
-                            if (ATRACE_ENABLED())
-                            {
-                                ATRACE_INT("avh_CMD_DATA_count_after_write", ass.oss_write_count);
-                            }
-                        } while (result < 0 && errno == EINTR);
-                        if (result != sizeof(struct audio_socket_info))
-                        {
-                            ALOGE("%s: could not notify the audio out client(%d) "
-                                  "to receive: result=%zd: %s.",
-                                  __FUNCTION__, ass.out_fd, result, strerror(errno));
-                            continue;
-                        }
-                        ALOGV("%s Notify the audio out client(%d) to receive.", __func__, ass.out_fd);
-
-                        ALOGV("out_write_to_client: write buffer to socket.");
-                        if (ATRACE_ENABLED())
-                        {
-                            ATRACE_INT("avh_data_count_before_write", ass.oss_write_count);
-                        }
-                        result = write(ass.out_fd, buffer, bytes);
-                        if (ATRACE_ENABLED())
-                        {
-                            ATRACE_INT("avh_data_count_after_write", ass.oss_write_count);
-                        }
-                        ass.oss_write_count++;
-                        if (result < 0)
-                        {
-                            ALOGE("out_write_to_client: Fail to write to audio out client(%d)"
-                                  " with error(%s)",
-                                  ass.out_fd, strerror(errno));
-                        }
-                        else if (result == 0)
-                        {
-                            ALOGW("out_write_to_client: audio out client(%d) is closed.", ass.out_fd);
-                        }
-                        else
-                        {
-                            ALOGV("out_write_to_client: Write to audio out client. "
-                                  "ass.out_fd: %d bytes: %zu",
-                                  ass.out_fd, bytes);
-                            if (bytes != (size_t)result)
-                            {
-                                ALOGW("out_write_to_client: (!^!) result(%zd) data is written. "
-                                      "But bytes(%zu) is expected.",
-                                      result, bytes);
-                            }
-                        }
-                        ret = result;
-                    }
-                    else
-                    {
-                        ALOGW("out_write_to_client: epoll unknown event. port(%d) "
-                              "ass.out_fd(%d). Return bytes(%zu) directly.",
-                              ass.out_tcp_port, ass.out_fd, bytes);
-                    }
-                }
-                else
-                {
-                    ALOGV("out_write_to_client: epoll_wait unknown source fd.");
-                }
-            }
-            return ret;
+            continue;
+        }
+        memcpy(&asi, ass.client_rx, header_size);
+        if (asi.data_size > CLIENT_MESSAGE_MAX_PAYLOAD)
+        {
+            ALOGW("%s: skip cmd %u with %u bytes from audio out client(%d).", __func__,
+                  asi.cmd, asi.data_size, ass.out_fd);
+            ass.client_rx_skip = asi.data_size;
+            ass.client_rx_bytes = 0;
+            continue;
+        }
+        if (ass.client_rx_bytes < header_size + asi.data_size)
+        {
+            continue;
+        }
+        ass.client_rx_bytes = 0;
+        if (asi.cmd == CMD_PONG && asi.data_size == sizeof(struct audio_socket_pong))
+        {
+            struct audio_socket_pong pong;
+            memcpy(&pong, ass.client_rx + header_size, sizeof(pong));
+            handle_pong(&pong, receive_ns);
+        }
+        else if (asi.cmd == CMD_STATUS && asi.data_size == sizeof(struct audio_socket_status))
+        {
+            struct audio_socket_status status;
+            memcpy(&status, ass.client_rx + header_size, sizeof(status));
+            handle_status(&status);
+        }
+        else
+        {
+            ALOGW("%s: unexpected cmd %u (%u bytes) from audio out client(%d).", __func__,
+                  asi.cmd, asi.data_size, ass.out_fd);
         }
     }
-    else
-    {
+}
 
-        ALOGV("out_write_to_client: (->v->) Audio out client is not connected. "
-              "port(%d) ass.out_fd(%d). Return bytes(%zu) directly.",
-              ass.out_tcp_port, ass.out_fd, bytes);
-        return -1;
-    }
-    return ret;
+static int capture_ring_init(struct audio_capture_ring *ring)
+{
+    pthread_condattr_t attr;
+
+    memset(ring, 0, sizeof(*ring));
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ring->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    return 0;
 }
 
-static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
-                         size_t bytes)
+static void capture_ring_destroy(struct audio_capture_ring *ring)
 {
-    if (ATRACE_ENABLED())
+    if (ring->locked)
     {
-        ATRACE_BEGIN("avh_out_write");
+        unlock_audio_memory(ring->data, ring->size);
+        ring->locked = false;
     }
-    ALOGV("out_write: %p, bytes: %zu", buffer, bytes);
-
-    struct stub_stream_out *out = (struct stub_stream_out *)stream;
-    ssize_t ret = bytes;
-    ssize_t result = -1;
+    free(ring->data);
+    ring->data = NULL;
+    ring->size = 0;
+    pthread_cond_destroy(&ring->cond);
+    pthread_mutex_destroy(&ring->lock);
+}
 
-    /* XXX: fake timing for audio output */
-    struct timespec t = {.tv_sec = 0, .tv_nsec = 0};
-    clock_gettime(CLOCK_MONOTONIC, &t);
-    const int64_t now = (t.tv_sec * 1000000000LL + t.tv_nsec) / 1000;
-    const int64_t elapsed_time_since_last_write = now - out->last_write_time_us;
-    int64_t sleep_time = bytes * 1000000LL / audio_stream_out_frame_size(stream) /
-                             out_get_sample_rate(&stream->common) -
-                         elapsed_time_since_last_write;
-    int64_t frame_time_ms = bytes * 1000LL / audio_stream_out_frame_size(stream) /
-                            out_get_sample_rate(&stream->common); // ms
-    int64_t timeout = sleep_time / 1000LL;                        // ms
-    if (timeout < 1)
-    {
-        timeout = 1;
-    }
-    if (timeout > frame_time_ms)
+// Drop buffered data. The ring is reallocated when size differs; a size or
+// frame_size of 0 keeps the current one.
+static void capture_ring_reset(struct audio_capture_ring *ring, size_t size, size_t frame_size)
+{
+    pthread_mutex_lock(&ring->lock);
+    if (frame_size > 0)
     {
-        timeout = frame_time_ms;
+        ring->frame_size = frame_size;
     }
-    if (bytes > 0)
+    if (size > 0 && size != ring->size)
     {
-        result = out_write_to_client(stream, buffer, bytes, timeout);
-        if (result < 0)
+        uint8_t *data;
+        if (ring->locked)
         {
-            ALOGV("The result of out_write_to_client is %zd", result);
+            unlock_audio_memory(ring->data, ring->size);
+            ring->locked = false;
         }
-        else if (result > 0)
+        data = (uint8_t *)realloc(ring->data, size);
+        if (data)
         {
-            ret = result;
+            ring->data = data;
+            ring->size = size;
+            ring->locked = lock_audio_memory(ring->data, ring->size);
+        }
+        else
+        {
+            ALOGE("%s: Fail to allocate %zu bytes for capture ring.", __func__, size);
         }
     }
-    clock_gettime(CLOCK_MONOTONIC, &t);
-    const int64_t new_now = (t.tv_sec * 1000000000LL + t.tv_nsec) / 1000;
-    sleep_time = sleep_time - (new_now - now);
-    int64_t frame_time_us = bytes * 1000000LL / audio_stream_out_frame_size(stream) /
-                            out_get_sample_rate(&stream->common); // us
-    if (sleep_time > 0 && sleep_time <= frame_time_us)
-    {
-        usleep(sleep_time);
-    }
-    else
+    ring->write_pos = 0;
+    ring->generation++;
+    ring->overrun_bytes = 0;
+    ring->stamp_count = 0;
+    ring->sequenced = false;
+    ring->lost_frames = 0;
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+// Append data. When a reader does not keep up the oldest data is overwritten.
+static void capture_ring_write(struct audio_capture_ring *ring, const void *data, size_t bytes)
+{
+    pthread_mutex_lock(&ring->lock);
+    if (ring->size == 0)
     {
-        // we don't sleep when we exit standby (this is typical for a real alsa buffer).
-        sleep_time = 0;
+        pthread_mutex_unlock(&ring->lock);
+        return;
     }
-    out->last_write_time_us = new_now + sleep_time;
-    // last_write_time_us is an approximation of when the (simulated) alsa
-    // buffer is believed completely full. The usleep above waits for more space
-    // in the buffer, but by the end of the sleep the buffer is considered
-    // topped-off.
-    //
-    // On the subsequent out_write(), we measure the elapsed time spent in
-    // the mixer. This is subtracted from the sleep estimate based on frames,
-    // thereby accounting for drain in the alsa buffer during mixing.
-    // This is a crude approximation; we don't handle underruns precisely.
-    if (ATRACE_ENABLED())
+    while (bytes > 0)
     {
-        ATRACE_END();
+        size_t offset = ring->write_pos % ring->size;
+        size_t chunk = ring->size - offset;
+        if (chunk > bytes)
+        {
+            chunk = bytes;
+        }
+        memcpy(ring->data + offset, data, chunk);
+        data = (const uint8_t *)data + chunk;
+        bytes -= chunk;
+        ring->write_pos += chunk;
     }
-    return ret;
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
 }
 
-static int out_get_render_position(const struct audio_stream_out *stream,
-                                   uint32_t *dsp_frames)
+static void capture_ring_stamp_locked(struct audio_capture_ring *ring, int64_t time_ns)
 {
-    *dsp_frames = 0;
-    ALOGV("out_get_render_position: dsp_frames: %p", dsp_frames);
-    return -EINVAL;
-}
+    struct audio_capture_stamp *stamp = &ring->stamps[ring->stamp_count % CAPTURE_RING_STAMPS];
 
-static int out_add_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
-{
-    ALOGV("out_add_audio_effect: %p", effect);
-    return 0;
+    stamp->pos = ring->write_pos;
+    stamp->time_ns = time_ns;
+    ring->stamp_count++;
 }
 
-static int out_remove_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
+// The frame written next was captured at time_ns.
+static void capture_ring_stamp(struct audio_capture_ring *ring, int64_t time_ns)
 {
-    ALOGV("out_remove_audio_effect: %p", effect);
-    return 0;
+    pthread_mutex_lock(&ring->lock);
+    capture_ring_stamp_locked(ring, time_ns);
+    pthread_mutex_unlock(&ring->lock);
 }
 
-static int out_get_next_write_timestamp(const struct audio_stream_out *stream,
-                                        int64_t *timestamp)
+// A frame of bytes from a framed client follows, captured at time_ns. A gap
+// in its sequence counts the frames the missing ones held as lost. They are
+// not replaced: a reader waiting for them has timed out and returned silence
+// already, and the stamp keeps what follows at its place in time.
+static void capture_ring_begin_frame(struct audio_capture_ring *ring, uint32_t sequence,
+                                     size_t bytes, int64_t time_ns)
 {
-    *timestamp = 0;
-    ALOGV("out_get_next_write_timestamp: %ld", (long int)(*timestamp));
-    return -EINVAL;
+    pthread_mutex_lock(&ring->lock);
+    if (ring->frame_size > 0 && ring->sequenced && sequence != ring->next_sequence)
+    {
+        uint32_t missing = sequence - ring->next_sequence;
+        // A sequence going back is a client that started counting again.
+        if (missing < 0x80000000u)
+        {
+            uint64_t lost = (uint64_t)missing * (bytes / ring->frame_size);
+            ALOGW("%s %u capture frames from the client are missing, %llu frames lost.",
+                  __func__, missing, (unsigned long long)lost);
+            ring->lost_frames += lost;
+        }
+    }
+    ring->sequenced = true;
+    ring->next_sequence = sequence + 1;
+    capture_ring_stamp_locked(ring, time_ns);
+    pthread_mutex_unlock(&ring->lock);
 }
 
-static void *out_socket_sever_thread(void *args)
+// Under ring->lock: move cursor to data still in the ring. After a reset it
+// starts over at the beginning; a cursor that was overrun skips whole frames
+// to the oldest data kept.
+static void capture_cursor_sync(struct audio_capture_ring *ring, struct audio_capture_cursor *cursor)
 {
-    struct audio_server_socket *pass = (struct audio_server_socket *)args;
-    int ret = 0;
-    int so_reuseaddr = 1;
-    int new_client_fd = -1;
-    struct sockaddr_in addr_in;
-
-    ALOGV("%s Constructing audio out socket server...", __func__);
-
-    pass->oss_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (pass->oss_fd < 0)
+    if (cursor->generation != ring->generation)
     {
-        ALOGE("%s:%d Fail to construct audio out socket with error: %s",
-              __func__, __LINE__, strerror(errno));
-        return NULL;
+        cursor->generation = ring->generation;
+        cursor->read_pos = 0;
+        cursor->lost_base = 0;
     }
-    if (setsockopt(pass->oss_fd, SOL_SOCKET, SO_REUSEADDR, &so_reuseaddr, sizeof(int)) < 0)
+    cursor->lost_frames += ring->lost_frames - cursor->lost_base;
+    cursor->lost_base = ring->lost_frames;
+    if (ring->write_pos - cursor->read_pos > ring->size)
     {
-        ALOGE("%s setsockopt(SO_REUSEADDR) failed. pass->oss_fd: %d\n", __func__, pass->oss_fd);
-        return NULL;
+        uint64_t read_pos = ring->write_pos - ring->size;
+        if (ring->frame_size > 0 && read_pos % ring->frame_size != 0)
+        {
+            read_pos += ring->frame_size - read_pos % ring->frame_size;
+        }
+        cursor->overrun_bytes += read_pos - cursor->read_pos;
+        ring->overrun_bytes += read_pos - cursor->read_pos;
+        cursor->read_pos = read_pos;
     }
+}
 
-    memset(&addr_in, 0, sizeof(addr_in));
-    addr_in.sin_family = AF_INET;
-    addr_in.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr_in.sin_port = htons(pass->out_tcp_port);
-    ret = bind(pass->oss_fd, (struct sockaddr *)&addr_in, sizeof(struct sockaddr_in));
-    if (ret < 0)
+// Start reading at the data written next.
+static void capture_ring_attach(struct audio_capture_ring *ring, struct audio_capture_cursor *cursor)
+{
+    pthread_mutex_lock(&ring->lock);
+    cursor->generation = ring->generation;
+    cursor->read_pos = ring->write_pos;
+    cursor->overrun_bytes = 0;
+    cursor->lost_frames = 0;
+    cursor->lost_base = ring->lost_frames;
+    pthread_mutex_unlock(&ring->lock);
+}
+
+// Bytes buffered for cursor.
+static size_t capture_ring_queued(struct audio_capture_ring *ring, struct audio_capture_cursor *cursor)
+{
+    size_t queued;
+
+    pthread_mutex_lock(&ring->lock);
+    capture_cursor_sync(ring, cursor);
+    queued = ring->write_pos - cursor->read_pos;
+    pthread_mutex_unlock(&ring->lock);
+    return queued;
+}
+
+// Wait up to timeout ms until bytes are buffered for cursor. Only whole
+// frames of frame_size bytes are consumed. Return the bytes copied.
+static size_t capture_ring_read(struct audio_capture_ring *ring, struct audio_capture_cursor *cursor,
+                                void *data, size_t bytes, size_t frame_size, int timeout)
+{
+    struct timespec deadline;
+    size_t copied = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    capture_cursor_sync(ring, cursor);
+    while (ring->write_pos - cursor->read_pos < bytes)
+    {
+        int ret = pthread_cond_timedwait(&ring->cond, &ring->lock, &deadline);
+        capture_cursor_sync(ring, cursor);
+        if (ret == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+    if (ring->write_pos - cursor->read_pos < bytes)
+    {
+        bytes = ring->write_pos - cursor->read_pos;
+        bytes -= bytes % frame_size;
+    }
+    while (copied < bytes)
+    {
+        size_t offset = cursor->read_pos % ring->size;
+        size_t chunk = ring->size - offset;
+        if (chunk > bytes - copied)
+        {
+            chunk = bytes - copied;
+        }
+        memcpy((uint8_t *)data + copied, ring->data + offset, chunk);
+        copied += chunk;
+        cursor->read_pos += chunk;
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return copied;
+}
+
+// Move cursor back to at most keep bytes before the newest data, and forget
+// its overruns so far. Return the bytes of whole frames it has to read.
+static size_t capture_ring_trim(struct audio_capture_ring *ring, struct audio_capture_cursor *cursor,
+                                size_t keep)
+{
+    size_t buffered;
+
+    pthread_mutex_lock(&ring->lock);
+    if (keep > ring->size)
+    {
+        keep = ring->size;
+    }
+    cursor->generation = ring->generation;
+    cursor->read_pos = ring->write_pos > keep ? ring->write_pos - keep : 0;
+    if (ring->frame_size > 0 && cursor->read_pos % ring->frame_size != 0)
+    {
+        cursor->read_pos += ring->frame_size - cursor->read_pos % ring->frame_size;
+    }
+    capture_cursor_sync(ring, cursor);
+    cursor->overrun_bytes = 0;
+    cursor->lost_frames = 0;
+    buffered = ring->write_pos - cursor->read_pos;
+    if (ring->frame_size > 0)
+    {
+        buffered -= buffered % ring->frame_size;
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return buffered;
+}
+
+// When the frame at cursor was captured, from the closest stamp before it
+// and the sample rate. False when nothing was stamped.
+static bool capture_ring_time(struct audio_capture_ring *ring, struct audio_capture_cursor *cursor,
+                              uint32_t rate, int64_t *time_ns)
+{
+    const struct audio_capture_stamp *stamp = NULL;
+    uint32_t kept, i;
+    bool known;
+
+    pthread_mutex_lock(&ring->lock);
+    capture_cursor_sync(ring, cursor);
+    kept = ring->stamp_count < CAPTURE_RING_STAMPS ? ring->stamp_count : CAPTURE_RING_STAMPS;
+    for (i = 1; i <= kept; i++)
+    {
+        // Newest first; the oldest is used for a cursor before all of them.
+        stamp = &ring->stamps[(ring->stamp_count - i) % CAPTURE_RING_STAMPS];
+        if (stamp->pos <= cursor->read_pos)
+        {
+            break;
+        }
+    }
+    known = stamp && ring->frame_size > 0 && rate > 0;
+    if (known)
+    {
+        int64_t frames = ((int64_t)cursor->read_pos - (int64_t)stamp->pos) /
+                         (int64_t)ring->frame_size;
+        *time_ns = stamp->time_ns + frames * 1000000000LL / rate;
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return known;
+}
+
+static size_t capture_frame_size(void)
+{
+    return audio_bytes_per_sample(ass.capture_config.format) *
+           audio_channel_count_from_in_mask(ass.capture_config.channel_mask);
+}
+
+// The capture ring holds the pre-roll, and never less than
+// CAPTURE_RING_MILLISECONDS or CAPTURE_RING_MIN_PERIODS periods.
+static size_t capture_ring_bytes(void)
+{
+    size_t period = (size_t)ass.capture_config.sample_rate * ass.input_buffer_milliseconds / 1000;
+    size_t frames = (size_t)ass.capture_config.sample_rate *
+                    (ass.preroll_ms > CAPTURE_RING_MILLISECONDS ? ass.preroll_ms :
+                     CAPTURE_RING_MILLISECONDS) / 1000;
+
+    if (frames < period * CAPTURE_RING_MIN_PERIODS)
+    {
+        frames = period * CAPTURE_RING_MIN_PERIODS;
+    }
+    return frames * capture_frame_size();
+}
+
+// Whether a newly connected input client should be opened right away.
+static bool capture_client_wanted(const struct audio_server_socket *pass)
+{
+    return pass->preroll_ms > 0 || (pass->in_stream_count > 0 && pass->iss_read_flag);
+}
+
+// The header and payload of a period go out in one writev(), there is
+// nothing to gain from Nagle's algorithm holding back the next one.
+static void set_client_nodelay(int fd)
+{
+    int on = 1;
+
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0)
+    {
+        ALOGW("%s setsockopt(TCP_NODELAY) failed. fd: %d %s", __func__, fd, strerror(errno));
+    }
+}
+
+/*
+ * Size the kernel buffers of a client socket for socket_queue_periods
+ * periods of the stream being opened, instead of the default buffers that
+ * hold seconds of audio the HAL cannot see. For output, TCP_NOTSENT_LOWAT
+ * keeps EPOLLOUT off until less than one period is left unsent, so each
+ * write queues at most one period behind what the kernel is sending.
+ * Receive memory is charged at the size of the kernel buffers holding the
+ * segments, not of the payload, and only part of it is advertised as
+ * window: a receive buffer of a few periods makes the client stall on a
+ * closed window while the reader still needs data, so the input side gets
+ * SOCKET_RCVBUF_OVERHEAD times the payload.
+ */
+static void size_client_socket(struct audio_server_socket *pass, int fd, int audio_type,
+                               size_t period_bytes)
+{
+    size_t header_bytes = pass->duplex_mode ? sizeof(struct audio_socket_frame_header) :
+                          sizeof(struct audio_socket_info);
+    int periods = atomic_load(&pass->socket_queue_periods);
+    int lowat = period_bytes + header_bytes;
+    int size = lowat * periods;
+    socklen_t len = sizeof(int);
+
+    if (periods <= 0 || period_bytes == 0)
+    {
+        return;
+    }
+    if (audio_type == AUDIO_OUT)
+    {
+        if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) < 0)
+        {
+            ALOGW("%s setsockopt(SO_SNDBUF) failed. fd: %d %s", __func__, fd, strerror(errno));
+        }
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)) < 0)
+        {
+            ALOGW("%s setsockopt(TCP_NOTSENT_LOWAT) failed. fd: %d %s", __func__, fd, strerror(errno));
+            lowat = 0;
+        }
+        // The kernel doubles the requested size for its bookkeeping.
+        if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &pass->out_socket_sndbuf, &len) < 0)
+        {
+            pass->out_socket_sndbuf = 0;
+        }
+        pass->out_socket_lowat = lowat;
+    }
+    else
+    {
+        size *= SOCKET_RCVBUF_OVERHEAD;
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0)
+        {
+            ALOGW("%s setsockopt(SO_RCVBUF) failed. fd: %d %s", __func__, fd, strerror(errno));
+        }
+        if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &pass->in_socket_rcvbuf, &len) < 0)
+        {
+            pass->in_socket_rcvbuf = 0;
+        }
+    }
+    ALOGV("%s fd %d stream %d: %d bytes for %d periods of %zu bytes", __func__, fd,
+          audio_type, size, periods, period_bytes);
+}
+
+// Payload of a period of the stream the client of audio_type is opened for,
+// 0 without one.
+static size_t client_period_bytes(const struct audio_server_socket *pass, int audio_type)
+{
+    if (audio_type == AUDIO_IN)
+    {
+        return (size_t)pass->capture_config.sample_rate * pass->input_buffer_milliseconds / 1000 *
+               capture_frame_size();
+    }
+    if (audio_type == AUDIO_OUT && pass->sso)
+    {
+        return pass->sso->frame_count * audio_stream_out_frame_size(&pass->sso->stream);
+    }
+    return 0;
+}
+
+static int send_open_cmd(struct audio_server_socket *pass, int audio_type)
+{
+    if (!pass)
+    {
+        ALOGE("pass pointer is NULL.");
+        return -1;
+    }
+
+    int ret;
+    int client_fd = -1;
+    struct audio_socket_info asi;
+    memset(&asi, 0, sizeof(struct audio_socket_info));
+    asi.cmd = CMD_OPEN;
+
+    switch (audio_type)
+    {
+    case AUDIO_IN:
+        ALOGV("%s pass->in_fd = %d ", __func__, pass->in_fd);
+        client_fd = pass->in_fd;
+        // What every input stream reads, see capture_open().
+        asi.asci.sample_rate = pass->capture_config.sample_rate;
+        if (ass.audio_mask == 1)
+        {
+            asi.asci.channel = pass->capture_config.channel_mask;
+        }
+        else
+        {
+            asi.asci.channel = audio_channel_count_from_in_mask(pass->capture_config.channel_mask);
+        }
+        asi.asci.format = pass->capture_config.format;
+        asi.asci.frame_count =
+            pass->capture_config.sample_rate * pass->input_buffer_milliseconds / 1000;
+        ALOGV("%s AUDIO_IN asi.asci.sample_rate: %d asi.asci.channel: %d "
+              "asi.asci.format: %d asi.asci.frame_count: %d\n",
+              __func__, asi.asci.sample_rate, asi.asci.channel,
+              asi.asci.format, asi.asci.frame_count);
+        break;
+    case AUDIO_OUT:
+        client_fd = pass->out_fd;
+        if (pass->sso)
+        {
+            asi.asci.sample_rate = pass->sso->sample_rate;
+            if (ass.audio_mask == 1)
+            {
+                asi.asci.channel = pass->sso->channel_mask;
+            }
+            else
+            {
+                asi.asci.channel = audio_channel_count_from_out_mask(pass->sso->channel_mask);
+            }
+            asi.asci.format = pass->sso->format;
+            asi.asci.frame_count = pass->sso->frame_count;
+            ALOGV("%s AUDIO_OUT asi.asci.sample_rate: %d asi.asci.channel: %d "
+                  "asi.asci.format: %d asi.asci.frame_count: %d\n",
+                  __func__, asi.asci.sample_rate, asi.asci.channel,
+                  asi.asci.format, asi.asci.frame_count);
+        }
+        break;
+
+    default:
+        ALOGW("Unkown type: %d", audio_type);
+        return -1;
+        break;
+    }
+    if (pass->udp_mode)
+    {
+        return audio_udp_send_command(CMD_OPEN, audio_type, &asi.asci, sizeof(asi.asci));
+    }
+    if (client_fd < 0)
+    {
+        ALOGW("client_fd is %d. Do not send open command to client.", client_fd);
+        return -1;
+    }
+    size_client_socket(pass, client_fd, audio_type, client_period_bytes(pass, audio_type));
+    if (pass->duplex_mode)
+    {
+        if (send_duplex_frame(client_fd, CMD_OPEN, audio_type, &asi.asci, sizeof(asi.asci)) < 0)
+        {
+            return -1;
+        }
+        ALOGV("%s Notify the duplex client(%d) to open stream %d.", __func__, client_fd, audio_type);
+        return 0;
+    }
+    ret = write_full(client_fd, &asi, sizeof(struct audio_socket_info));
+    if (ret != sizeof(struct audio_socket_info))
+    {
+        ALOGE("%s: could not notify the client(%d) to open: ret=%d: %s.",
+              __FUNCTION__, client_fd, ret, strerror(errno));
+        return -1;
+    }
+
+    ALOGV("%s Notify the audio client(%d) to open.", __func__, client_fd);
+    return 0;
+}
+
+static int send_close_cmd(int client_fd, int audio_type)
+{
+    ALOGV("%s client_fd = %d", __func__, client_fd);
+    int ret;
+    struct audio_socket_info asi;
+    asi.cmd = CMD_CLOSE;
+    asi.data_size = 0;
+    if (ass.udp_mode)
+    {
+        return audio_udp_send_command(CMD_CLOSE, audio_type, NULL, 0);
+    }
+    if (client_fd > 0 && ass.duplex_mode)
+    {
+        return send_duplex_frame(client_fd, CMD_CLOSE, audio_type, NULL, 0) < 0 ? -1 : 0;
+    }
+    else if (client_fd > 0)
+    {
+        ret = write_full(client_fd, &asi, sizeof(struct audio_socket_info));
+        if (ret != sizeof(struct audio_socket_info))
+        {
+            ALOGE("%s: could not notify the client(%d) to "
+                  "close: ret=%d: %s.",
+                  __FUNCTION__, client_fd, ret, strerror(errno));
+            return -1;
+        }
+        else
+        {
+            ALOGW("%s Notify the client(%d) to close.", __func__, client_fd);
+            return 0;
+        }
+    }
+    else
+    {
+        ALOGW("Client is %d. Do not set close command to client.", client_fd);
+        return 0;
+    }
+}
+
+static uint32_t out_get_sample_rate(const struct audio_stream *stream)
+{
+    const struct stub_stream_out *out = (const struct stub_stream_out *)stream;
+
+    ALOGV("out_get_sample_rate: %u", out->sample_rate);
+    return out->sample_rate;
+}
+
+static int out_set_sample_rate(struct audio_stream *stream, uint32_t rate)
+{
+    struct stub_stream_out *out = (struct stub_stream_out *)stream;
+
+    ALOGV("out_set_sample_rate: %d", rate);
+    out->sample_rate = rate;
+    return 0;
+}
+
+static size_t out_get_buffer_size(const struct audio_stream *stream)
+{
+    const struct stub_stream_out *out = (const struct stub_stream_out *)stream;
+    size_t buffer_size = out->frame_count *
+                         audio_stream_out_frame_size(&out->stream);
+
+    ALOGV("out_get_buffer_size: %zu", buffer_size);
+    return buffer_size;
+}
+
+static audio_channel_mask_t out_get_channels(const struct audio_stream *stream)
+{
+    const struct stub_stream_out *out = (const struct stub_stream_out *)stream;
+
+    ALOGV("out_get_channels: %x", out->channel_mask);
+    return out->channel_mask;
+}
+
+static audio_format_t out_get_format(const struct audio_stream *stream)
+{
+    const struct stub_stream_out *out = (const struct stub_stream_out *)stream;
+
+    ALOGV("out_get_format: %d", out->format);
+    return out->format;
+}
+
+static int out_set_format(struct audio_stream *stream, audio_format_t format)
+{
+    struct stub_stream_out *out = (struct stub_stream_out *)stream;
+
+    ALOGV("out_set_format: %d", format);
+    out->format = format;
+    return 0;
+}
+
+// Tell the client the output stopped. Return -1 when it cannot be told.
+static int send_stream_stop(void)
+{
+    int ret;
+
+    if (ass.udp_mode)
+    {
+        ass.out_stream_standby = true;
+        return audio_udp_send_command(CMD_STREAM_STOP, AUDIO_OUT, NULL, 0);
+    }
+    if (ass.out_fd > 0)
+    {
+        struct audio_socket_info asi;
+        memset(&asi, 0, sizeof(struct audio_socket_info));
+        asi.cmd = CMD_STREAM_STOP;
+        if (ass.duplex_mode)
+        {
+            ret = send_duplex_frame(ass.out_fd, CMD_STREAM_STOP, AUDIO_OUT, NULL, 0) < 0 ?
+                  -1 : (int)sizeof(struct audio_socket_info);
+        }
+        else
+        {
+            ret = write_full(ass.out_fd, &asi, sizeof(struct audio_socket_info));
+        }
+        if (ret != sizeof(struct audio_socket_info))
+        {
+            ALOGE("%s: could not notify the client(%d) to stop streaming: ret=%d: %s.",
+                  __FUNCTION__, ass.out_fd, ret, strerror(errno));
+            return -1;
+        }
+        ass.out_stream_standby = true;
+    }
+    else
+    {
+
+        ALOGE("%s: Audio out client is not connected. "
+              "port(%d) ass.out_fd(%d).",
+              __FUNCTION__, ass.out_tcp_port, ass.out_fd);
+        return -1;
+    }
+    return ret;
+}
+
+static int out_standby(struct audio_stream *stream)
+{
+    ALOGV("out_standby");
+    struct stub_stream_out *out = (struct stub_stream_out *)stream;
+    out->last_write_begin_us = 0;
+    out->first_sound_begin_ns = 0;
+    if (out->clock_attached)
+    {
+        audio_clock_detach();
+        out->clock_attached = false;
+    }
+    if (ass.out_standby_delay_ms > 0 && !ass.out_stream_standby)
+    {
+        // Keep the client streaming for a while: a write soon after goes
+        // on without CMD_STREAM_START. See out_standby_thread().
+        pthread_mutex_lock(&ass.mutexlock_out);
+        ass.out_stop_pending = true;
+        ass.out_stop_deadline_ns = monotonic_time_ns() + ass.out_standby_delay_ms * 1000000LL;
+        pthread_cond_signal(&ass.out_standby_cond);
+        pthread_mutex_unlock(&ass.mutexlock_out);
+        return 0;
+    }
+    return send_stream_stop();
+    // out->last_write_time_us = 0; unnecessary as a stale write time has same effect
+}
+
+// A write within the standby delay: the client never stopped.
+static void out_cancel_stop(struct stub_stream_out *out)
+{
+    pthread_mutex_lock(&ass.mutexlock_out);
+    if (ass.out_stop_pending)
+    {
+        ass.out_stop_pending = false;
+        out->warm_restarts++;
+    }
+    pthread_mutex_unlock(&ass.mutexlock_out);
+}
+
+// Send the CMD_STREAM_STOP that out_standby() held back once the output
+// stayed in standby for out_standby_delay_ms.
+static void *out_standby_thread(void *args)
+{
+    struct audio_server_socket *pass = (struct audio_server_socket *)args;
+
+    pthread_mutex_lock(&pass->mutexlock_out);
+    while (!pass->oss_exit)
+    {
+        int64_t now_ns = monotonic_time_ns();
+        if (!pass->out_stop_pending)
+        {
+            pthread_cond_wait(&pass->out_standby_cond, &pass->mutexlock_out);
+        }
+        else if (now_ns < pass->out_stop_deadline_ns)
+        {
+            struct timespec deadline = {
+                .tv_sec = pass->out_stop_deadline_ns / 1000000000LL,
+                .tv_nsec = pass->out_stop_deadline_ns % 1000000000LL,
+            };
+            pthread_cond_timedwait(&pass->out_standby_cond, &pass->mutexlock_out, &deadline);
+        }
+        else
+        {
+            pass->out_stop_pending = false;
+            if (send_stream_stop() < 0)
+            {
+                ALOGW("%s The held back stop did not reach the client.", __func__);
+            }
+        }
+    }
+    pthread_mutex_unlock(&pass->mutexlock_out);
+    return NULL;
+}
+
+static int out_dump(const struct audio_stream *stream, int fd)
+{
+    ALOGV("out_dump");
+    const struct stub_stream_out *out = (const struct stub_stream_out *)stream;
+
+    dprintf(fd, "  Virtual audio output stream %p: %u Hz, channels 0x%x, format 0x%x, "
+            "%zu frames per period\n",
+            out, out->sample_rate, out->channel_mask, out->format, out->frame_count);
+    dprintf(fd, "    client %s, dropped after %d stalled periods\n",
+            out->dropping ? "stalled" : "draining", ass.out_stall_periods);
+    dprintf(fd, "    latency %u ms: period %zu frames, socket %u, impair %u, client %lld\n",
+            atomic_load_explicit(&out->latency_ms, memory_order_relaxed), out->frame_count,
+            out->socket_queued_frames, out->impair_queued_frames,
+            (long long)out->client_queued_frames);
+    dprintf(fd, "    first sound %lld us after open, %lld us after the last start, "
+            "%llu warm restarts\n",
+            (long long)out->open_first_sound_us, (long long)out->first_sound_us,
+            (unsigned long long)out->warm_restarts);
+    if (out->drift_enabled)
+    {
+        audio_drift_dump(fd, &out->drift);
+    }
+    audio_stream_stats_dump(fd, &out->stats, audio_clock_now_us() * 1000LL);
+    audio_glitch_dump(fd, &out->glitch, monotonic_time_ns());
+    return 0;
+}
+
+static const char *transport_name(void)
+{
+    return ass.udp_mode ? "udp" : ass.duplex_mode ? "duplex" : "separate";
+}
+
+// Leaves *value alone without key, -EINVAL unless it is an integer in
+// [min, max].
+static int get_control_int(struct str_parms *parms, const char *key, int min, int max, int *value)
+{
+    int v;
+
+    if (!str_parms_has_key(parms, key))
+    {
+        return 0;
+    }
+    if (str_parms_get_int(parms, key, &v) < 0 || v < min || v > max)
+    {
+        ALOGW("%s: %s must be within [%d, %d].", __func__, key, min, max);
+        return -EINVAL;
+    }
+    *value = v;
+    return 0;
+}
+
+/*
+ * Runtime controls, accepted by the device and by both streams so a running
+ * module can be tuned without closing it:
+ *   out_period_ms, in_period_ms  period of the next stream opened
+ *   socket_periods               client socket buffer depth, see size_client_socket()
+ *   stall_periods                stall watchdog of out_write_to_client()
+ *   standby_delay_ms             CMD_STREAM_STOP hold back, see out_standby()
+ *   pacing                       monotonic|virtual|manual, see audio_clock.h;
+ *                                the test clocks need virtual.audio.clock.test=1
+ *   stats_reset                  clear the statistics of the open streams
+ *   tap                          off|out|in|all, see audio_tap.h; turning it on
+ *                                needs audio_tap_control_allowed()
+ * An open stream keeps its period, the framework sized its buffers from it.
+ * The input streams share the capture and its period: in_period_ms fails
+ * with -EBUSY while one is open.
+ * The stream threads pick up the socket depth and the statistics reset at
+ * the start of their next period, see out_apply_controls(). The transport
+ * is chosen in adev_open(): it can be read, asking for another one fails
+ * with -ENOSYS. Keys of the framework are ignored and leave the control
+ * generation alone; a bad value fails the call before anything is changed.
+ */
+static int set_control_parameters(const char *kvpairs)
+{
+    struct str_parms *parms = str_parms_create_str(kvpairs);
+    char value[PROPERTY_VALUE_MAX];
+    int out_period_ms = -1;
+    int in_period_ms = -1;
+    int socket_periods = -1;
+    int stall_periods = -1;
+    int standby_delay_ms = -1;
+    int clock_mode = -1;
+    int tap_mode = -1;
+    int stats_reset = 0;
+    bool applied = false;
+    int ret = 0;
+
+    if (!parms)
+    {
+        return -ENOMEM;
+    }
+    if (get_control_int(parms, AUDIO_PARAMETER_CONTROL_OUT_PERIOD_MS, 1,
+                        CONTROL_PERIOD_MAX_MILLISECONDS, &out_period_ms) < 0 ||
+        get_control_int(parms, AUDIO_PARAMETER_CONTROL_IN_PERIOD_MS, STUB_INPUT_BUFFER_MILLISECONDS,
+                        CONTROL_PERIOD_MAX_MILLISECONDS, &in_period_ms) < 0 ||
+        get_control_int(parms, AUDIO_PARAMETER_CONTROL_SOCKET_PERIODS, 0,
+                        CONTROL_SOCKET_MAX_PERIODS, &socket_periods) < 0 ||
+        get_control_int(parms, AUDIO_PARAMETER_CONTROL_STALL_PERIODS, 0,
+                        CONTROL_STALL_MAX_PERIODS, &stall_periods) < 0 ||
+        get_control_int(parms, AUDIO_PARAMETER_CONTROL_STANDBY_DELAY_MS, 0,
+                        CONTROL_STANDBY_DELAY_MAX_MILLISECONDS, &standby_delay_ms) < 0 ||
+        get_control_int(parms, AUDIO_PARAMETER_CONTROL_STATS_RESET, 0, 1, &stats_reset) < 0)
+    {
+        ret = -EINVAL;
+    }
+    if (ret == 0 && str_parms_get_str(parms, AUDIO_PARAMETER_CONTROL_PACING, value, sizeof(value)) >= 0)
+    {
+        clock_mode = audio_clock_mode_from_string(value);
+        if (strcmp(value, audio_clock_mode_to_string(clock_mode)) != 0)
+        {
+            ALOGW("%s: unknown pacing clock %s.", __func__, value);
+            ret = -EINVAL;
+        }
+        else if (clock_mode != AUDIO_CLOCK_MODE_MONOTONIC &&
+                 (property_get("virtual.audio.clock.test", value, "0") <= 0 || atoi(value) != 1))
+        {
+            // Nothing advances the manual clock outside the tests, and the
+            // virtual one runs as fast as the client drains.
+            ALOGW("%s: the %s clock needs virtual.audio.clock.test=1.", __func__,
+                  audio_clock_mode_to_string(clock_mode));
+            ret = -EPERM;
+        }
+    }
+    if (ret == 0 && str_parms_get_str(parms, AUDIO_PARAMETER_CONTROL_TAP, value, sizeof(value)) >= 0 &&
+        (tap_mode = audio_tap_mode_from_string(value)) < 0)
+    {
+        ALOGW("%s: unknown tap mode %s.", __func__, value);
+        ret = -EINVAL;
+    }
+    else if (tap_mode > AUDIO_TAP_OFF && !audio_tap_control_allowed())
+    {
+        // Any client with parameter access could record the microphone.
+        ALOGW("%s: the tap needs a debuggable build or virtual.audio.tap.control=1.", __func__);
+        ret = -EPERM;
+    }
+    if (ret == 0 && str_parms_get_str(parms, AUDIO_PARAMETER_CONTROL_TRANSPORT, value, sizeof(value)) >= 0 &&
+        strcmp(value, transport_name()) != 0)
+    {
+        ALOGW("%s: the transport is %s until the module is reopened.", __func__, transport_name());
+        ret = -ENOSYS;
+    }
+    str_parms_destroy(parms);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    pthread_mutex_lock(&ass.mutexlock_control);
+    // First, so nothing else is changed when it fails.
+    if (in_period_ms >= 0)
+    {
+        pthread_mutex_lock(&ass.mutexlock_in);
+        if (ass.in_stream_count > 0)
+        {
+            ALOGW("%s: %d input streams read the capture at %d ms periods.", __func__,
+                  ass.in_stream_count, ass.input_buffer_milliseconds);
+            pthread_mutex_unlock(&ass.mutexlock_in);
+            pthread_mutex_unlock(&ass.mutexlock_control);
+            return -EBUSY;
+        }
+        ass.input_buffer_milliseconds = in_period_ms;
+        pthread_mutex_unlock(&ass.mutexlock_in);
+        applied = true;
+    }
+    if (out_period_ms >= 0)
+    {
+        ass.output_buffer_milliseconds = out_period_ms;
+        applied = true;
+    }
+    if (socket_periods >= 0)
+    {
+        atomic_store(&ass.socket_queue_periods, socket_periods);
+        applied = true;
+    }
+    if (stall_periods >= 0)
+    {
+        atomic_store(&ass.out_stall_periods, stall_periods);
+        applied = true;
+    }
+    if (standby_delay_ms >= 0)
+    {
+        applied = true;
+        pthread_mutex_lock(&ass.mutexlock_out);
+        ass.out_standby_delay_ms = standby_delay_ms;
+        if (ass.out_stop_pending &&
+            ass.out_stop_deadline_ns > monotonic_time_ns() + standby_delay_ms * 1000000LL)
+        {
+            ass.out_stop_deadline_ns = monotonic_time_ns() + standby_delay_ms * 1000000LL;
+            pthread_cond_signal(&ass.out_standby_cond);
+        }
+        pthread_mutex_unlock(&ass.mutexlock_out);
+    }
+    if (clock_mode >= 0 && clock_mode != audio_clock_get_mode())
+    {
+        audio_clock_set_mode(clock_mode);
+        applied = true;
+    }
+    if (tap_mode >= 0)
+    {
+        audio_tap_set_mode(tap_mode);
+        applied = true;
+    }
+    if (stats_reset)
+    {
+        atomic_fetch_add(&ass.stats_resets, 1);
+        applied = true;
+    }
+    // The framework sets routing and the like on every stream change: only
+    // a control wakes the stream threads up.
+    if (applied)
+    {
+        atomic_fetch_add(&ass.control_generation, 1);
+    }
+    pthread_mutex_unlock(&ass.mutexlock_control);
+    return 0;
+}
+
+// Answer the control keys in query.
+static void get_control_parameters(struct str_parms *query, struct str_parms *reply)
+{
+    if (str_parms_has_key(query, AUDIO_PARAMETER_CONTROL_OUT_PERIOD_MS))
+    {
+        str_parms_add_int(reply, AUDIO_PARAMETER_CONTROL_OUT_PERIOD_MS, ass.output_buffer_milliseconds);
+    }
+    if (str_parms_has_key(query, AUDIO_PARAMETER_CONTROL_IN_PERIOD_MS))
+    {
+        str_parms_add_int(reply, AUDIO_PARAMETER_CONTROL_IN_PERIOD_MS, ass.input_buffer_milliseconds);
+    }
+    if (str_parms_has_key(query, AUDIO_PARAMETER_CONTROL_SOCKET_PERIODS))
+    {
+        str_parms_add_int(reply, AUDIO_PARAMETER_CONTROL_SOCKET_PERIODS,
+                          atomic_load(&ass.socket_queue_periods));
+    }
+    if (str_parms_has_key(query, AUDIO_PARAMETER_CONTROL_STALL_PERIODS))
+    {
+        str_parms_add_int(reply, AUDIO_PARAMETER_CONTROL_STALL_PERIODS,
+                          atomic_load(&ass.out_stall_periods));
+    }
+    if (str_parms_has_key(query, AUDIO_PARAMETER_CONTROL_STANDBY_DELAY_MS))
+    {
+        str_parms_add_int(reply, AUDIO_PARAMETER_CONTROL_STANDBY_DELAY_MS, ass.out_standby_delay_ms);
+    }
+    if (str_parms_has_key(query, AUDIO_PARAMETER_CONTROL_PACING))
+    {
+        str_parms_add_str(reply, AUDIO_PARAMETER_CONTROL_PACING,
+                          audio_clock_mode_to_string(audio_clock_get_mode()));
+    }
+    if (str_parms_has_key(query, AUDIO_PARAMETER_CONTROL_TRANSPORT))
+    {
+        str_parms_add_str(reply, AUDIO_PARAMETER_CONTROL_TRANSPORT, transport_name());
+    }
+    if (str_parms_has_key(query, AUDIO_PARAMETER_CONTROL_TAP))
+    {
+        str_parms_add_str(reply, AUDIO_PARAMETER_CONTROL_TAP,
+                          audio_tap_mode_to_string(atomic_load(&audio_tap_mode)));
+    }
+}
+
+// Called at the start of every period. Returns true when the controls
+// changed since the last one: the client socket is resized for the current
+// depth and the statistics are reset if that was asked for. The writer
+// thread is the only one updating out->stats, so it does the reset itself.
+static bool out_apply_controls(struct stub_stream_out *out)
+{
+    uint32_t generation = atomic_load(&ass.control_generation);
+    uint32_t stats_resets;
+
+    if (generation == out->control_generation)
+    {
+        return false;
+    }
+    out->control_generation = generation;
+    stats_resets = atomic_load(&ass.stats_resets);
+    if (stats_resets != out->stats_resets)
+    {
+        out->stats_resets = stats_resets;
+        audio_stream_stats_reset(&out->stats, audio_clock_now_us() * 1000LL);
+        audio_glitch_clear(&out->glitch);
+    }
+    pthread_mutex_lock(&ass.mutexlock_out);
+    if (ass.out_fd >= 0)
+    {
+        size_client_socket(&ass, ass.out_fd, AUDIO_OUT, client_period_bytes(&ass, AUDIO_OUT));
+    }
+    pthread_mutex_unlock(&ass.mutexlock_out);
+    return true;
+}
+
+static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
+{
+    ALOGV("out_set_parameters: %s", kvpairs);
+    return set_control_parameters(kvpairs);
+}
+
+// Answer the latency probe and control keys, and the start-up metrics of out
+// (or of the module without one); everything else is unknown here.
+static char *get_probe_parameters(const char *keys, const struct stub_stream_out *out)
+{
+    struct str_parms *query = str_parms_create_str(keys);
+    struct str_parms *reply = str_parms_create();
+    char *str;
+
+    if (!query || !reply)
+    {
+        str_parms_destroy(query);
+        str_parms_destroy(reply);
+        return strdup("");
+    }
+    audio_probe_get_parameters(query, reply);
+    get_control_parameters(query, reply);
+    if (out && str_parms_has_key(query, AUDIO_PARAMETER_STREAM_FIRST_SOUND_US))
+    {
+        str_parms_add_int(reply, AUDIO_PARAMETER_STREAM_FIRST_SOUND_US, out->first_sound_us);
+    }
+    if (out && str_parms_has_key(query, AUDIO_PARAMETER_STREAM_OPEN_FIRST_SOUND_US))
+    {
+        str_parms_add_int(reply, AUDIO_PARAMETER_STREAM_OPEN_FIRST_SOUND_US,
+                          out->open_first_sound_us);
+    }
+    if (!out && str_parms_has_key(query, AUDIO_PARAMETER_MODULE_OPEN_US))
+    {
+        str_parms_add_int(reply, AUDIO_PARAMETER_MODULE_OPEN_US, ass.open_us);
+    }
+    str = str_parms_to_str(reply);
+    str_parms_destroy(query);
+    str_parms_destroy(reply);
+    return str ? str : strdup("");
+}
+
+static char *out_get_parameters(const struct audio_stream *stream, const char *keys)
+{
+    ALOGV("out_get_parameters");
+    return get_probe_parameters(keys, (const struct stub_stream_out *)stream);
+}
+
+/*
+ * Latency from the HAL to the speaker: the period the HAL plays out, what
+ * the kernel has not delivered yet (SIOCOUTQ, less the command headers),
+ * what the impairment shim holds, and the client's unplayed queue when it
+ * reports one with CMD_STATUS. Refreshed once per period, so that
+ * out_get_latency() stays a plain load.
+ */
+static void out_update_latency(struct stub_stream_out *out, size_t frame_size)
+{
+    size_t period_bytes = out->frame_count * frame_size;
+    size_t header_bytes = ass.duplex_mode ? sizeof(struct audio_socket_frame_header) :
+                          sizeof(struct audio_socket_info);
+    uint64_t frames = out->frame_count;
+    int queued = 0;
+
+    out->socket_queued_frames = 0;
+    if (ass.out_fd > 0 && ioctl(ass.out_fd, SIOCOUTQ, &queued) == 0 && queued > 0)
+    {
+        out->socket_queued_frames =
+            (uint64_t)queued * period_bytes / (period_bytes + header_bytes) / frame_size;
+    }
+    audio_histogram_record(&out->stats.queue_us,
+                           (uint64_t)out->socket_queued_frames * 1000000 / out->sample_rate);
+    out->impair_queued_frames = audio_impair_queued(ass.out_fd) / frame_size;
+    out->client_queued_frames = atomic_load(&ass.out_client_fill_frames);
+    frames += out->socket_queued_frames + out->impair_queued_frames;
+    if (out->client_queued_frames > 0)
+    {
+        frames += out->client_queued_frames;
+    }
+    atomic_store_explicit(&out->latency_ms,
+                          (uint32_t)((frames * 1000 + out->sample_rate - 1) / out->sample_rate),
+                          memory_order_relaxed);
+}
+
+static uint32_t out_get_latency(const struct audio_stream_out *stream)
+{
+    const struct stub_stream_out *out = (const struct stub_stream_out *)stream;
+    ALOGV("out_get_latency");
+    return atomic_load_explicit(&out->latency_ms, memory_order_relaxed);
+}
+
+static int out_set_volume(struct audio_stream_out *stream, float left,
+                          float right)
+{
+    ALOGV("out_set_volume: Left:%f Right:%f", left, right);
+    return 0;
+}
+
+static void out_update_source_metadata(struct audio_stream_out *stream,
+                                       const struct source_metadata *source_metadata)
+{
+    ALOGV("update_source_metadata called. Do nothing as of now.");
+}
+
+// The first period after a start reached the client.
+static void out_record_first_sound(struct stub_stream_out *out)
+{
+    int64_t now_ns = monotonic_time_ns();
+
+    if (out->first_sound_begin_ns == 0)
+    {
+        return;
+    }
+    out->first_sound_us = (now_ns - out->first_sound_begin_ns) / 1000;
+    audio_histogram_record(&out->stats.first_sound_us, out->first_sound_us);
+    if (out->open_first_sound_us < 0)
+    {
+        out->open_first_sound_us = (now_ns - out->open_ns) / 1000;
+        ALOGI("%s First sound %lld us after the output stream opened.", __func__,
+              (long long)out->open_first_sound_us);
+    }
+    out->first_sound_begin_ns = 0;
+}
+
+// A period reached the client.
+static void out_period_sent(struct stub_stream_out *out, const void *buffer, size_t bytes)
+{
+    out_record_first_sound(out);
+    if (out->glitch.enabled)
+    {
+        audio_glitch_analyse(&out->glitch, buffer, bytes, monotonic_time_ns());
+    }
+}
+
+// There is nothing to wait for on UDP: a period that does not fit in the
+// socket buffer is dropped.
+static ssize_t out_write_to_udp_client(struct audio_stream_out *stream, const void *buffer,
+                                       size_t bytes)
+{
+    struct stub_stream_out *out = (struct stub_stream_out *)stream;
+    ssize_t result;
+    int64_t begin_ns;
+
+    if (!audio_udp_attached())
+    {
+        ALOGV("%s: (->v->) UDP client is not attached. Return bytes(%zu) directly.",
+              __func__, bytes);
+        return -1;
+    }
+    if (ass.out_stream_standby == true)
+    {
+        if (audio_udp_send_command(CMD_STREAM_START, AUDIO_OUT, NULL, 0) < 0)
+        {
+            ALOGE("%s: could not notify the udp client to start streaming: %s.",
+                  __func__, strerror(errno));
+        }
+        ass.out_stream_standby = false;
+    }
+    begin_ns = monotonic_time_ns();
+    audio_trace(AUDIO_TRACE_OUT_DATA_BEFORE_WRITE, ass.oss_write_count);
+    result = audio_udp_send_data(CMD_DATA, AUDIO_OUT, buffer, bytes);
+    audio_trace(AUDIO_TRACE_OUT_DATA_AFTER_WRITE, ass.oss_write_count);
+    audio_histogram_record(&out->stats.io_us, (monotonic_time_ns() - begin_ns) / 1000);
+    ass.oss_write_count++;
+    if (result < 0)
+    {
+        audio_stats_inc(&out->stats.errors);
+    }
+    else
+    {
+        out_period_sent(out, buffer, bytes);
+    }
+    return result;
+}
+
+static ssize_t out_write_to_client(struct audio_stream_out *stream, const void *buffer,
+                                   size_t bytes, int timeout)
+{
+    struct stub_stream_out *out = (struct stub_stream_out *)stream;
+    ssize_t ret = -1;
+    ssize_t result = 0;
+    int nevents = 0;
+    int ne;
+    int64_t begin_ns;
+    if (ass.udp_mode)
+    {
+        return out_write_to_udp_client(stream, buffer, bytes);
+    }
+    if (ass.out_fd > 0)
+    {
+        if (out->dropping)
+        {
+            // The client stopped draining: do not wait for it every period,
+            // only look whether the socket is writable (or hung up) again.
+            uint32_t events;
+
+            nevents = epoll_wait(ass.oss_epoll_fd, ass.oss_epoll_event, 1, 0);
+            events = nevents > 0 ? ass.oss_epoll_event[0].events : 0;
+            if ((events & (EPOLLERR | EPOLLHUP)) != 0)
+            {
+                // Not a recovery: the wait below sees the hang up, which
+                // stays pending, and disconnects the client.
+                ALOGW("%s: client(%d) hung up while stalled.", __func__, ass.out_fd);
+                out->dropping = false;
+                out->stalled_periods = 0;
+            }
+            else if ((events & EPOLLOUT) == 0)
+            {
+                audio_stats_add(&out->stats.stall_dropped_frames,
+                                bytes / audio_stream_out_frame_size(stream));
+                return -1;
+            }
+            else
+            {
+                ALOGW("%s: client(%d) drains again after %llu dropped frames.", __func__,
+                      ass.out_fd,
+                      (unsigned long long)atomic_load_explicit(&out->stats.stall_dropped_frames,
+                                                               memory_order_relaxed));
+                audio_stats_inc(&out->stats.recoveries);
+                out->dropping = false;
+                out->stalled_periods = 0;
+            }
+        }
+        // The legacy client gets CMD_STREAM_START in the same writev() as
+        // the first period, see below.
+        if (ass.out_stream_standby == true && ass.duplex_mode)
+        {
+            if (send_duplex_frame(ass.out_fd, CMD_STREAM_START, AUDIO_OUT, NULL, 0) < 0)
+            {
+                ALOGE("%s: could not notify the client(%d) to start streaming: %s.",
+                      __FUNCTION__, ass.out_fd, strerror(errno));
+            }
+            ass.out_stream_standby = false;
+        }
+        if (!ass.duplex_mode &&
+            (audio_drift_enabled() || (audio_probe_enabled() && audio_probe_waiting())))
+        {
+            out_receive_client_messages();
+        }
+        begin_ns = monotonic_time_ns();
+        nevents = epoll_wait(ass.oss_epoll_fd, ass.oss_epoll_event, 1, timeout);
+        audio_histogram_record(&out->stats.wait_us, (monotonic_time_ns() - begin_ns) / 1000);
+        if (nevents < 0)
+        {
+            if (errno != EINTR)
+                ALOGE("epoll_wait() unexpected error: %s", strerror(errno));
+            audio_stats_inc(&out->stats.errors);
+            return errno;
+        }
+        else if (nevents == 0)
+        {
+            ALOGW("out_write_to_client: Client cannot be written in given time.");
+            audio_stats_inc(&out->stats.timeouts);
+            if (ass.out_stall_periods > 0 && ++out->stalled_periods >= ass.out_stall_periods)
+            {
+                ALOGW("%s: client(%d) did not drain for %d periods. Drop output until it does.",
+                      __func__, ass.out_fd, out->stalled_periods);
+                audio_stats_inc(&out->stats.stalls);
+                out->dropping = true;
+            }
+            return -1;
+        }
+        else if (nevents > 0)
+        {
+            out->stalled_periods = 0;
+            for (ne = 0; ne < nevents; ne++) //In fact, only one event.
+            {
+                if (ass.oss_epoll_event[ne].data.fd == ass.out_fd)
+                {
+                    if ((ass.oss_epoll_event[ne].events & (EPOLLERR | EPOLLHUP)) != 0)
+                    {
+                        ALOGE("EPOLLERR or EPOLLHUP after epoll_wait() !?");
+                        if (epoll_ctl(ass.oss_epoll_fd, EPOLL_CTL_DEL, ass.out_fd, NULL))
+                        {
+                            ALOGE("Failed to delete audio in file descriptor to epoll");
+                        }
+                        pthread_mutex_lock(&ass.mutexlock_out);
+                        if (ass.duplex_mode)
+                        {
+                            // The duplex socket server thread owns the fd and
+                            // closes it when it sees the hang up.
+                            shutdown(ass.out_fd, SHUT_RDWR);
+                            ass.out_fd = -1;
+                        }
+                        else
+                        {
+                            close_socket_fd(&(ass.out_fd)); // Try to clear the cache data in socket.
+                        }
+                        ass.oss_is_sent_open_cmd = 0;
+                        audio_telemetry_set_connected(&ass.telemetry->out, false);
+                        audio_trace(AUDIO_TRACE_OUT_CLIENT_HUP, ass.oss_is_sent_open_cmd);
+                        pthread_mutex_unlock(&ass.mutexlock_out);
+                    }
+                    else if ((ass.oss_epoll_event[ne].events & EPOLLOUT) != 0 && ass.duplex_mode)
+                    {
+                        begin_ns = monotonic_time_ns();
+                        audio_trace(AUDIO_TRACE_OUT_DATA_BEFORE_WRITE, ass.oss_write_count);
+                        result = send_duplex_frame(ass.out_fd, CMD_DATA, AUDIO_OUT, buffer, bytes);
+                        audio_trace(AUDIO_TRACE_OUT_DATA_AFTER_WRITE, ass.oss_write_count);
+                        audio_histogram_record(&out->stats.io_us,
+                                               (monotonic_time_ns() - begin_ns) / 1000);
+                        ass.oss_write_count++;
+                        if (result < 0)
+                        {
+                            audio_stats_inc(&out->stats.errors);
+                            ALOGE("out_write_to_client: Fail to write to duplex client(%d)"
+                                  " with error(%s)",
+                                  ass.out_fd, strerror(errno));
+                        }
+                        else
+                        {
+                            out_period_sent(out, buffer, bytes);
+                            out_send_ping();
+                        }
+                        ret = result;
+                    }
+                    else if ((ass.oss_epoll_event[ne].events & EPOLLOUT) != 0)
+                    {
+                        struct audio_socket_info asi[2];
+                        struct iovec iov[3];
+                        int iovcnt = 0;
+                        bool start = ass.out_stream_standby;
+                        memset(asi, 0, sizeof(asi));
+                        if (start)
+                        {
+                            asi[0].cmd = CMD_STREAM_START;
+                            iov[iovcnt].iov_base = &asi[0];
+                            iov[iovcnt++].iov_len = sizeof(asi[0]);
+                        }
+                        asi[1].cmd = CMD_DATA;
+                        asi[1].data_size = bytes;
+                        iov[iovcnt].iov_base = &asi[1];
+                        iov[iovcnt++].iov_len = sizeof(asi[1]);
+                        iov[iovcnt].iov_base = (void *)buffer;
+                        iov[iovcnt++].iov_len = bytes;
+                        ALOGV("%s asi.data_size: %d\n", __func__, asi[1].data_size);
+                        // Header and payload leave together: a short write
+                        // would desynchronize the client, so finish it.
+                        begin_ns = monotonic_time_ns();
+                        audio_trace(AUDIO_TRACE_OUT_DATA_BEFORE_WRITE, ass.oss_write_count);
+                        result = writev_full(ass.out_fd, iov, iovcnt);
+                        audio_trace(AUDIO_TRACE_OUT_DATA_AFTER_WRITE, ass.oss_write_count);
+                        audio_histogram_record(&out->stats.io_us,
+                                               (monotonic_time_ns() - begin_ns) / 1000);
+                        ass.oss_write_count++;
+                        if (result < 0)
+                        {
+                            audio_stats_inc(&out->stats.errors);
+                            ALOGE("out_write_to_client: Fail to write to audio out client(%d)"
+                                  " with error(%s)",
+                                  ass.out_fd, strerror(errno));
+                        }
+                        else
+                        {
+                            ALOGV("out_write_to_client: Write to audio out client. "
+                                  "ass.out_fd: %d bytes: %zu",
+                                  ass.out_fd, bytes);
+                            result = bytes;
+                            if (start)
+                            {
+                                ass.out_stream_standby = false;
+                            }
+                            out_period_sent(out, buffer, bytes);
+                            out_send_ping();
+                        }
+                        ret = result;
+                    }
+                    else
+                    {
+                        ALOGW("out_write_to_client: epoll unknown event. port(%d) "
+                              "ass.out_fd(%d). Return bytes(%zu) directly.",
+                              ass.out_tcp_port, ass.out_fd, bytes);
+                    }
+                }
+                else
+                {
+                    ALOGV("out_write_to_client: epoll_wait unknown source fd.");
+                }
+            }
+            return ret;
+        }
+    }
+    else
+    {
+
+        ALOGV("out_write_to_client: (->v->) Audio out client is not connected. "
+              "port(%d) ass.out_fd(%d). Return bytes(%zu) directly.",
+              ass.out_tcp_port, ass.out_fd, bytes);
+        return -1;
+    }
+    return ret;
+}
+
+static bool reserve_drift_buffer(uint8_t **buffer, size_t *size, size_t bytes)
+{
+    uint8_t *grown;
+
+    if (bytes <= *size)
+    {
+        return true;
+    }
+    grown = realloc(*buffer, bytes);
+    if (!grown)
+    {
+        return false;
+    }
+    *buffer = grown;
+    *size = bytes;
+    return true;
+}
+
+/*
+ * Resample the period by the ratio that keeps the client's playback queue
+ * at its target, then send it. Return bytes when the result went out, so
+ * the caller accounts for what it wrote rather than for what was sent.
+ */
+static ssize_t out_write_resampled(struct audio_stream_out *stream, const void *buffer,
+                                   size_t bytes, int timeout)
+{
+    struct stub_stream_out *out = (struct stub_stream_out *)stream;
+    size_t frame_size = audio_stream_out_frame_size(stream);
+    uint32_t generation = atomic_load(&ass.out_client_generation);
+    uint32_t reports = atomic_load(&ass.out_client_reports);
+    size_t max_frames = bytes / frame_size * 2 + 4;
+    size_t frames;
+    ssize_t result;
+
+    if (generation != out->drift_generation)
+    {
+        // A new client has a queue of its own: lock onto it afresh.
+        audio_drift_reset(&out->drift, out->format,
+                          audio_channel_count_from_out_mask(out->channel_mask), out->sample_rate,
+                          audio_drift_out_target_ms(), out->frame_count);
+        out->drift_generation = generation;
+        out->drift_reports = reports;
+    }
+    else if (reports != out->drift_reports)
+    {
+        out->drift_reports = reports;
+        audio_drift_update(&out->drift, atomic_load(&ass.out_client_fill_frames),
+                           monotonic_time_ns());
+    }
+    if (!reserve_drift_buffer(&out->drift_buffer, &out->drift_buffer_size,
+                              max_frames * frame_size))
+    {
+        return out_write_to_client(stream, buffer, bytes, timeout);
+    }
+    frames = audio_drift_resample(&out->drift, buffer, bytes / frame_size, out->drift_buffer,
+                                  max_frames);
+    if (frames == 0)
+    {
+        return bytes;
+    }
+    result = out_write_to_client(stream, out->drift_buffer, frames * frame_size, timeout);
+    return result < 0 ? result : (ssize_t)bytes;
+}
+
+static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
+                         size_t bytes)
+{
+    audio_trace(AUDIO_TRACE_OUT_WRITE, 1);
+    ALOGV("out_write: %p, bytes: %zu", buffer, bytes);
+
+    struct stub_stream_out *out = (struct stub_stream_out *)stream;
+    ssize_t ret = bytes;
+    ssize_t result = -1;
+    uint64_t timeouts = atomic_load_explicit(&out->stats.timeouts, memory_order_relaxed);
+
+    if (!out->thread_tuned)
+    {
+        apply_thread_tuning(AUDIO_THREAD_SENDER);
+        out->thread_tuned = true;
+        audio_stream_stats_reset(&out->stats, audio_clock_now_us() * 1000LL);
+    }
+    if (!out->clock_attached)
+    {
+        audio_clock_attach();
+        out->clock_attached = true;
+    }
+    // The pacing clock may have been switched since the last period.
+    const bool controls_changed = out_apply_controls(out);
+
+    /* XXX: fake timing for audio output */
+    const int64_t now = audio_clock_now_us();
+    const int64_t elapsed_time_since_last_write = now - out->last_write_time_us;
+    int64_t sleep_time = bytes * 1000000LL / audio_stream_out_frame_size(stream) /
+                             out_get_sample_rate(&stream->common) -
+                         elapsed_time_since_last_write;
+    int64_t frame_time_ms = bytes * 1000LL / audio_stream_out_frame_size(stream) /
+                            out_get_sample_rate(&stream->common); // ms
+    int64_t timeout = sleep_time / 1000LL;                        // ms
+    if (out->last_write_begin_us > 0 && !controls_changed)
+    {
+        int64_t pacing_error = now - out->last_write_begin_us -
+                               (int64_t)(bytes * 1000000LL / audio_stream_out_frame_size(stream) /
+                                         out_get_sample_rate(&stream->common));
+        audio_histogram_record(&out->stats.pacing_error_us,
+                               pacing_error < 0 ? -pacing_error : pacing_error);
+    }
+    else if (out->last_write_begin_us == 0)
+    {
+        // Leaving standby: time-to-first-sound runs until a client has a
+        // period, and a stop held back by out_standby() is not needed.
+        if (out->first_sound_begin_ns == 0)
+        {
+            out->first_sound_begin_ns = monotonic_time_ns();
+        }
+        if (ass.out_standby_delay_ms > 0)
+        {
+            out_cancel_stop(out);
+        }
+    }
+    out->last_write_begin_us = now;
+    if (timeout < 1)
+    {
+        timeout = 1;
+    }
+    if (timeout > frame_time_ms)
+    {
+        timeout = frame_time_ms;
+    }
+    if (bytes > 0)
+    {
+        size_t frame_size = audio_stream_out_frame_size(stream);
+        audio_tap(out->tap, AUDIO_TAP_OUT, buffer, bytes);
+        if (out->drift_enabled)
+        {
+            result = out_write_resampled(stream, buffer, bytes, timeout);
+        }
+        else
+        {
+            result = out_write_to_client(stream, buffer, bytes, timeout);
+        }
+        if (result < 0)
+        {
+            ALOGV("The result of out_write_to_client is %zd", result);
+            audio_stats_inc(&out->stats.dropped);
+        }
+        else if (result > 0)
+        {
+            ret = result;
+            audio_stream_stats_add_bytes(&out->stats, result, now * 1000LL);
+        }
+        out_update_latency(out, frame_size);
+        audio_telemetry_update(&ass.telemetry->out, out->sample_rate,
+                               result > 0 ? result / frame_size : 0, result < 0 ? 1 : 0, result < 0 ? bytes / frame_size : 0,
+                               atomic_load_explicit(&out->stats.timeouts, memory_order_relaxed) - timeouts,
+                               out_get_latency(stream) * 1000LL, now * 1000LL);
+    }
+    const int64_t new_now = audio_clock_now_us();
+    sleep_time = sleep_time - (new_now - now);
+    int64_t frame_time_us = bytes * 1000000LL / audio_stream_out_frame_size(stream) /
+                            out_get_sample_rate(&stream->common); // us
+    if (sleep_time > 0 && sleep_time <= frame_time_us)
+    {
+        audio_clock_sleep_until_us(new_now + sleep_time);
+    }
+    else
+    {
+        // we don't sleep when we exit standby (this is typical for a real alsa buffer).
+        sleep_time = 0;
+    }
+    out->last_write_time_us = new_now + sleep_time;
+    // last_write_time_us is an approximation of when the (simulated) alsa
+    // buffer is believed completely full. The sleep above waits for more space
+    // in the buffer, but by the end of the sleep the buffer is considered
+    // topped-off.
+    //
+    // On the subsequent out_write(), we measure the elapsed time spent in
+    // the mixer. This is subtracted from the sleep estimate based on frames,
+    // thereby accounting for drain in the alsa buffer during mixing.
+    // This is a crude approximation; we don't handle underruns precisely.
+    audio_trace(AUDIO_TRACE_OUT_WRITE, 0);
+    return ret;
+}
+
+static int out_get_render_position(const struct audio_stream_out *stream,
+                                   uint32_t *dsp_frames)
+{
+    *dsp_frames = 0;
+    ALOGV("out_get_render_position: dsp_frames: %p", dsp_frames);
+    return -EINVAL;
+}
+
+static int out_add_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
+{
+    ALOGV("out_add_audio_effect: %p", effect);
+    return 0;
+}
+
+static int out_remove_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
+{
+    ALOGV("out_remove_audio_effect: %p", effect);
+    return 0;
+}
+
+static int out_get_next_write_timestamp(const struct audio_stream_out *stream,
+                                        int64_t *timestamp)
+{
+    *timestamp = 0;
+    ALOGV("out_get_next_write_timestamp: %ld", (long int)(*timestamp));
+    return -EINVAL;
+}
+
+static void *out_socket_sever_thread(void *args)
+{
+    struct audio_server_socket *pass = (struct audio_server_socket *)args;
+    int new_client_fd = -1;
+    struct sockaddr_in addr_in;
+
+    ALOGV("%s Constructing audio out socket server...", __func__);
+    apply_thread_tuning(AUDIO_THREAD_OUT_SERVER);
+
+    if (pass->oss_fd < 0) // Listening since adev_open()
+    {
+        return NULL;
+    }
+
+    while (!pass->oss_exit)
+    {
+        ALOGW("%s Wait a audio out client to connect...", __func__);
+        socklen_t alen;
+        alen = sizeof(struct sockaddr_in);
+        new_client_fd = accept(pass->oss_fd, (struct sockaddr *)&addr_in, &alen);
+        if (new_client_fd < 0)
+        {
+            ALOGE("%s The audio in socket server maybe shutdown as quit command is got. "
+                  "Or else, error happen. port: %d %s",
+                  __func__, pass->out_tcp_port, strerror(errno));
+        }
+        else
+        {
+            ALOGW("%s Currently only receive one out client. Close previous "
+                  "client(%d)",
+                  __func__, pass->out_fd);
+
+            if (pass->out_fd > 0)
+            {
+                pthread_mutex_lock(&ass.mutexlock_out);
+                audio_trace(AUDIO_TRACE_OSST_BEFORE_SEND_CLOSE, pass->oss_is_sent_open_cmd);
+                pass->oss_is_sent_open_cmd = 0;
+                if (send_close_cmd(pass->out_fd, AUDIO_OUT) < 0)
+                {
+                    ALOGE("Fail to notify audio out client(%d) to close.", pass->out_fd);
+                }
+                audio_trace(AUDIO_TRACE_OSST_AFTER_SEND_CLOSE, pass->oss_is_sent_open_cmd);
+                pthread_mutex_unlock(&ass.mutexlock_out);
+
+                if (epoll_ctl(pass->oss_epoll_fd, EPOLL_CTL_DEL, pass->out_fd, NULL))
+                {
+                    ALOGE("Failed to delete audio out file descriptor to epoll");
+                }
+                close_socket_fd(&(pass->out_fd));
+            }
+
+            ALOGW("%s A new audio out client connected to server. "
+                  "new_client_fd = %d",
+                  __func__, new_client_fd);
+            pass->out_fd = new_client_fd;
+            set_client_nodelay(new_client_fd);
+            pass->out_socket_sndbuf = 0;
+            pass->out_socket_lowat = 0;
+            audio_impair_bind(AUDIO_IMPAIR_TO_CLIENT, new_client_fd);
+            audio_probe_reset();
+            pass->client_rx_bytes = 0;
+            pass->client_rx_skip = 0;
+            atomic_store(&pass->out_client_fill_frames, -1);
+            atomic_fetch_add(&pass->out_client_generation, 1);
+            if (audio_probe_enabled())
+            {
+                int on = 1;
+                setsockopt(new_client_fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+            }
+            audio_telemetry_set_connected(&pass->telemetry->out, true);
+            pass->out_stream_standby = true; 
+            if (pass->out_fd > 0)
+            {
+                pthread_mutex_lock(&ass.mutexlock_out);
+                pass->oss_write_count = 0;
+                audio_trace(AUDIO_TRACE_OSST_BEFORE_SEND_OPEN, pass->oss_is_sent_open_cmd);
+                if (pass->sso && pass->oss_is_sent_open_cmd == 0) // Make sure parameters are ready.
+                {
+                    if (send_open_cmd(pass, AUDIO_OUT) < 0)
+                    {
+                        ALOGE("Fail to send OPEN command to audio out client(%d)", pass->out_fd);
+                    }
+                    else
+                    {
+                        pass->oss_is_sent_open_cmd = 1;
+                        ALOGE("pass->oss_is_sent_open_cmd is set to %d", pass->oss_is_sent_open_cmd);
+                    }
+                }
+                audio_trace(AUDIO_TRACE_OSST_AFTER_SEND_OPEN, pass->oss_is_sent_open_cmd);
+                pthread_mutex_unlock(&ass.mutexlock_out);
+
+                struct epoll_event event;
+                event.events = EPOLLOUT;
+                event.data.fd = pass->out_fd;
+                if (epoll_ctl(pass->oss_epoll_fd, EPOLL_CTL_ADD, pass->out_fd, &event))
+                {
+                    ALOGE("Failed to add audio out file descriptor to epoll");
+                }
+            }
+        }
+    }
+    ALOGW("%s Quit. port %d(%d)", __func__, pass->out_tcp_port, pass->out_fd);
+    pthread_mutex_lock(&ass.mutexlock_out);
+    pass->oss_is_sent_open_cmd = 0;
+    close_socket_fd(&(pass->out_fd));
+    close_socket_fd(&(pass->oss_fd));
+    pthread_mutex_unlock(&ass.mutexlock_out);
+    return NULL;
+}
+
+/** audio_stream_in implementation **/
+static uint32_t in_get_sample_rate(const struct audio_stream *stream)
+{
+    const struct stub_stream_in *in = (const struct stub_stream_in *)stream;
+
+    ALOGV("in_get_sample_rate: %u", in->sample_rate);
+    return in->sample_rate;
+}
+
+static int in_set_sample_rate(struct audio_stream *stream, uint32_t rate)
+{
+    struct stub_stream_in *in = (struct stub_stream_in *)stream;
+
+    ALOGV("in_set_sample_rate: %u", rate);
+    in->sample_rate = rate;
+    return 0;
+}
+
+static size_t in_get_buffer_size(const struct audio_stream *stream)
+{
+    const struct stub_stream_in *in = (const struct stub_stream_in *)stream;
+    size_t buffer_size = in->frame_count *
+                         audio_stream_in_frame_size(&in->stream);
+
+    ALOGV("in_get_buffer_size: %zu", buffer_size);
+    return buffer_size;
+}
+
+static audio_channel_mask_t in_get_channels(const struct audio_stream *stream)
+{
+    const struct stub_stream_in *in = (const struct stub_stream_in *)stream;
+
+    ALOGV("in_get_channels: %x", in->channel_mask);
+    return in->channel_mask;
+}
+
+static audio_format_t in_get_format(const struct audio_stream *stream)
+{
+    const struct stub_stream_in *in = (const struct stub_stream_in *)stream;
+
+    ALOGV("in_get_format: %d", in->format);
+    return in->format;
+}
+
+static int in_set_format(struct audio_stream *stream, audio_format_t format)
+{
+    struct stub_stream_in *in = (struct stub_stream_in *)stream;
+
+    ALOGV("in_set_format: %d", format);
+    in->format = format;
+    return 0;
+}
+
+static int in_standby(struct audio_stream *stream)
+{
+    struct stub_stream_in *in = (struct stub_stream_in *)stream;
+    in->last_read_time_us = 0;
+    in->last_read_begin_us = 0;
+    if (in->clock_attached)
+    {
+        audio_clock_detach();
+        in->clock_attached = false;
+    }
+    return 0;
+}
+
+static int in_dump(const struct audio_stream *stream, int fd)
+{
+    const struct stub_stream_in *in = (const struct stub_stream_in *)stream;
+
+    dprintf(fd, "  Virtual audio input stream %p: %u Hz, channels 0x%x, format 0x%x, "
+            "%zu frames per period\n",
+            in, in->sample_rate, in->channel_mask, in->format, in->frame_count);
+    if (ass.preroll_ms > 0)
+    {
+        dprintf(fd, "  Pre-roll %u ms at open, %zu bytes still to catch up\n", in->preroll_ms,
+                in->preroll_pending_bytes);
+    }
+    if (!ass.udp_mode)
+    {
+        dprintf(fd, "    capture cursor at %llu, overrun %llu bytes, lost %llu frames\n",
+                (unsigned long long)in->cursor.read_pos,
+                (unsigned long long)in->cursor.overrun_bytes,
+                (unsigned long long)in->cursor.lost_frames);
+        dprintf(fd, "    capture position %lld frames at %lld ns, read %llu frames\n",
+                (long long)in->position_frames, (long long)in->position_time_ns,
+                (unsigned long long)in->frames_read);
+    }
+    audio_synth_stream_dump(fd, &in->synth);
+    if (in->converting)
+    {
+        audio_convert_dump(fd, &in->convert);
+    }
+    if (in->drift_enabled)
+    {
+        audio_drift_dump(fd, &in->drift);
+    }
+    audio_stream_stats_dump(fd, &in->stats, audio_clock_now_us() * 1000LL);
+    return 0;
+}
+
+// See out_apply_controls().
+static bool in_apply_controls(struct stub_stream_in *in)
+{
+    uint32_t generation = atomic_load(&ass.control_generation);
+    uint32_t stats_resets;
+
+    if (generation == in->control_generation)
+    {
+        return false;
+    }
+    in->control_generation = generation;
+    stats_resets = atomic_load(&ass.stats_resets);
+    if (stats_resets != in->stats_resets)
+    {
+        in->stats_resets = stats_resets;
+        audio_stream_stats_reset(&in->stats, audio_clock_now_us() * 1000LL);
+    }
+    pthread_mutex_lock(&ass.mutexlock_in);
+    if (ass.in_fd >= 0)
+    {
+        size_client_socket(&ass, ass.in_fd, AUDIO_IN, client_period_bytes(&ass, AUDIO_IN));
+    }
+    pthread_mutex_unlock(&ass.mutexlock_in);
+    return true;
+}
+
+static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
+{
+    return set_control_parameters(kvpairs);
+}
+
+static char *in_get_parameters(const struct audio_stream *stream,
+                               const char *keys)
+{
+    const struct stub_stream_in *in = (const struct stub_stream_in *)stream;
+    struct str_parms *query = str_parms_create_str(keys);
+    struct str_parms *reply = str_parms_create();
+    char *str;
+
+    if (!query || !reply)
+    {
+        str_parms_destroy(query);
+        str_parms_destroy(reply);
+        return strdup("");
+    }
+    get_control_parameters(query, reply);
+    if (str_parms_has_key(query, AUDIO_PARAMETER_STREAM_PREROLL_MS))
+    {
+        str_parms_add_int(reply, AUDIO_PARAMETER_STREAM_PREROLL_MS, in->preroll_ms);
+    }
+    str = str_parms_to_str(reply);
+    str_parms_destroy(query);
+    str_parms_destroy(reply);
+    return str ? str : strdup("");
+}
+
+static int in_set_gain(struct audio_stream_in *stream, float gain)
+{
+    return 0;
+}
+
+// Read the client capture for a stream that differs from it: as much as the
+// conversion needs for frames of output. Return the frames produced.
+static size_t in_read_converted(struct stub_stream_in *in, void *buffer, size_t frames,
+                                int timeout)
+{
+    size_t needed = audio_convert_input_frames(&in->convert, frames);
+    size_t got = 0;
+
+    if (needed > 0)
+    {
+        if (!reserve_drift_buffer(&in->convert_buffer, &in->convert_buffer_size,
+                                  needed * in->capture_frame_size))
+        {
+            return 0;
+        }
+        got = capture_ring_read(&ass.capture, &in->cursor, in->convert_buffer,
+                                needed * in->capture_frame_size, in->capture_frame_size,
+                                timeout) / in->capture_frame_size;
+    }
+    return audio_convert_process(&in->convert, in->convert_buffer, got, buffer, frames);
+}
+
+static ssize_t in_read_from_capture_ring(struct audio_stream_in *stream, void *buffer,
+                                         size_t bytes, int timeout)
+{
+    struct stub_stream_in *in = (struct stub_stream_in *)stream;
+    size_t frame_size = audio_stream_in_frame_size(stream);
+    size_t copied = 0;
+    in->synth_active = ass.in_fd <= 0 && in->synth.mode != AUDIO_SYNTH_OFF;
+    if (ass.in_fd > 0)
+    {
+        int64_t begin_ns = monotonic_time_ns();
+        if (in->converting)
+        {
+            copied = in_read_converted(in, buffer, bytes / frame_size, timeout) * frame_size;
+        }
+        else
+        {
+            copied = capture_ring_read(&ass.capture, &in->cursor, buffer, bytes, frame_size,
+                                       timeout);
+        }
+        audio_histogram_record(&in->stats.wait_us, (monotonic_time_ns() - begin_ns) / 1000);
+        if (copied < bytes)
+        {
+            audio_stats_inc(copied > 0 ? &in->stats.short_transfers : &in->stats.timeouts);
+            ALOGW("in_read_from_capture_ring: (!^!) %zu bytes are received. But bytes(%zu) "
+                  "is expected. Memset the rest to 0.",
+                  copied, bytes);
+        }
+    }
+    else if (in->synth_active)
+    {
+        copied = audio_synth_read(&in->synth, buffer, bytes / frame_size) * frame_size;
+    }
+    else
+    {
+        ALOGV("in_read_from_capture_ring: (->v->) Audio in client is not connected."
+              " Memset data to 0. Return bytes(%zu) directly.",
+              bytes);
+    }
+    if (copied < bytes)
+    {
+        audio_stats_inc(&in->stats.zero_filled);
+        memset((uint8_t *)buffer + copied, 0, bytes - copied);
+    }
+    return bytes;
+}
+
+static ssize_t in_read_from_udp_client(struct audio_stream_in *stream, void *buffer,
+                                       size_t bytes, int timeout)
+{
+    struct stub_stream_in *in = (struct stub_stream_in *)stream;
+    size_t copied = 0;
+    in->synth_active = !audio_udp_attached() && in->synth.mode != AUDIO_SYNTH_OFF;
+    if (audio_udp_attached())
+    {
+        int64_t begin_ns = monotonic_time_ns();
+        copied = audio_udp_read_input(buffer, bytes, timeout);
+        audio_histogram_record(&in->stats.wait_us, (monotonic_time_ns() - begin_ns) / 1000);
+        if (copied < bytes)
+        {
+            audio_stats_inc(copied > 0 ? &in->stats.short_transfers : &in->stats.timeouts);
+            ALOGW("in_read_from_udp_client: (!^!) %zu bytes are received. But bytes(%zu) "
+                  "is expected. Memset the rest to 0.",
+                  copied, bytes);
+        }
+    }
+    else if (in->synth_active)
+    {
+        size_t frame_size = audio_stream_in_frame_size(stream);
+        copied = audio_synth_read(&in->synth, buffer, bytes / frame_size) * frame_size;
+    }
+    else
+    {
+        ALOGV("in_read_from_udp_client: (->v->) UDP client is not attached."
+              " Memset data to 0. Return bytes(%zu) directly.",
+              bytes);
+    }
+    if (copied < bytes)
+    {
+        audio_stats_inc(&in->stats.zero_filled);
+        memset((uint8_t *)buffer + copied, 0, bytes - copied);
+    }
+    return bytes;
+}
+
+static ssize_t in_read_from_client(struct audio_stream_in *stream, void *buffer,
+                                   size_t bytes, int timeout, uint32_t offset)
+{
+    if (ass.udp_mode)
+    {
+        return in_read_from_udp_client(stream, buffer, bytes, timeout);
+    }
+    return in_read_from_capture_ring(stream, buffer, bytes, timeout);
+}
+
+// Client data in the capture ring waiting for in_read() of this stream, in
+// frames of the stream.
+static int64_t in_capture_queued_frames(struct stub_stream_in *in)
+{
+    if (ass.udp_mode)
+    {
+        return 0;
+    }
+    return (int64_t)(capture_ring_queued(&ass.capture, &in->cursor) / in->capture_frame_size) *
+           in->sample_rate / in->capture_rate;
+}
+
+// Capture data waiting for in_read(), plus what the resampler holds.
+static int64_t in_queued_frames(struct stub_stream_in *in, size_t frame_size)
+{
+    return in_capture_queued_frames(in) +
+           (int64_t)audio_resampler_queued_frames(&in->drift.resampler);
+}
+
+// After in_read() returned frames of capture: the next frame it returns was
+// captured when the frame at the cursor was, less what the drift resampler
+// holds. What the converter holds, a few frames, is left out.
+static void in_update_capture_position(struct stub_stream_in *in, size_t frames)
+{
+    int64_t time_ns;
+
+    in->frames_read += frames;
+    if (in->synth_active)
+    {
+        // The synthetic source is captured as it is read.
+        time_ns = monotonic_time_ns();
+        pthread_mutex_lock(&ass.mutexlock_in);
+        in->position_frames = in->frames_read;
+        in->position_time_ns = time_ns;
+        pthread_mutex_unlock(&ass.mutexlock_in);
+        return;
+    }
+    if (ass.udp_mode || !capture_ring_time(&ass.capture, &in->cursor, in->capture_rate, &time_ns))
+    {
+        return;
+    }
+    if (in->drift_enabled)
+    {
+        time_ns -= (int64_t)(audio_resampler_queued_frames(&in->drift.resampler) * 1000000000.0 /
+                             in->sample_rate);
+    }
+    pthread_mutex_lock(&ass.mutexlock_in);
+    in->position_frames = in->frames_read;
+    in->position_time_ns = time_ns;
+    pthread_mutex_unlock(&ass.mutexlock_in);
+}
+
+// How long ago the first frame in_read() returned was captured, from the
+// capture position before the read: its wait in the capture ring and the
+// resampler plus its way from the client. Without a position, the queued
+// frames and one period for the transport.
+static int64_t in_telemetry_latency_us(struct stub_stream_in *in, int64_t first_time_ns,
+                                       size_t frame_size)
+{
+    if (first_time_ns > 0)
+    {
+        int64_t age_ns = monotonic_time_ns() - first_time_ns;
+        return age_ns > 0 ? age_ns / 1000 : 0;
+    }
+    return in_queued_frames(in, frame_size) * 1000000LL / in->sample_rate +
+           ass.input_buffer_milliseconds * 1000LL;
+}
+
+/*
+ * Read as much client data as the resampler needs for bytes of output at
+ * the ratio that keeps the capture queue at its target. A short read from
+ * the client gives a short result, as without resampling.
+ */
+static ssize_t in_read_resampled(struct audio_stream_in *stream, void *buffer, size_t bytes,
+                                 int timeout)
+{
+    struct stub_stream_in *in = (struct stub_stream_in *)stream;
+    size_t frame_size = audio_stream_in_frame_size(stream);
+    size_t frames;
+    ssize_t result = 0;
+
+    if (ass.in_fd > 0)
+    {
+        audio_drift_update(&in->drift, in_queued_frames(in, frame_size), monotonic_time_ns());
+    }
+    frames = audio_drift_input_frames(&in->drift, bytes / frame_size);
+    if (!reserve_drift_buffer(&in->drift_buffer, &in->drift_buffer_size, frames * frame_size))
+    {
+        return in_read_from_client(stream, buffer, bytes, timeout, -1);
+    }
+    if (frames > 0)
+    {
+        result = in_read_from_client(stream, in->drift_buffer, frames * frame_size, timeout, -1);
+        if (result <= 0)
+        {
+            return result;
+        }
+    }
+    frames = audio_drift_resample(&in->drift, in->drift_buffer, result / frame_size, buffer,
+                                  bytes / frame_size);
+    return frames * frame_size;
+}
+
+static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
+                       size_t bytes)
+{
+    audio_trace(AUDIO_TRACE_IN_READ, 1);
+    ALOGV("in_read: %p, bytes %zu", buffer, bytes);
+    if (!ass.iss_read_flag)
+    {
+        if (ass.in_fd > 0 || ass.udp_mode)
+        {
+            pthread_mutex_lock(&ass.mutexlock_in);
+            ALOGV("in_read: send_open_cmd pthread_mutex_lock");
+            if (send_open_cmd(&ass, AUDIO_IN) < 0)
+            {
+                ALOGE("%s: Fail to send OPEN command to audio in client(%d)", __func__, ass.in_fd);
+            }
+            pthread_mutex_unlock(&ass.mutexlock_in);
+        }
+        ass.iss_read_flag = true;
+    }
+
+    struct stub_stream_in *in = (struct stub_stream_in *)stream;
+    struct stub_audio_device *adev = in->dev;
+    ssize_t ret = bytes;
+    ssize_t result = -1;
+    uint64_t timeouts = atomic_load_explicit(&in->stats.timeouts, memory_order_relaxed);
+    uint64_t zero_filled = atomic_load_explicit(&in->stats.zero_filled, memory_order_relaxed);
+    uint64_t overrun_bytes = in->cursor.overrun_bytes;
+    // Capture time of the first frame this read returns, if known.
+    const int64_t first_time_ns = in->position_frames == (int64_t)in->frames_read ?
+                                  in->position_time_ns : 0;
+    // The pre-roll is older than a period: hand it out as fast as it is read.
+    const bool catching_up = in->preroll_pending_bytes > 0;
+
+    if (!in->thread_tuned)
+    {
+        apply_thread_tuning(AUDIO_THREAD_READER);
+        in->thread_tuned = true;
+        audio_stream_stats_reset(&in->stats, audio_clock_now_us() * 1000LL);
+    }
+    if (!in->clock_attached)
+    {
+        audio_clock_attach();
+        in->clock_attached = true;
+    }
+    const bool controls_changed = in_apply_controls(in);
+
+    /* XXX: fake timing for audio input */
+    const int64_t now = audio_clock_now_us();
+
+    // we do a full sleep when exiting standby.
+    const bool standby = in->last_read_time_us == 0;
+    int64_t elapsed_time_since_last_read = 0;
+    if (ass.in_fd > 0)
+    {
+        elapsed_time_since_last_read = now - in->last_read_time_us;
+    }
+    else
+    {
+        elapsed_time_since_last_read = standby ? 0 : now - in->last_read_time_us;
+    }
+    int64_t sleep_time = bytes * 1000000LL / audio_stream_in_frame_size(stream) /
+                             in_get_sample_rate(&stream->common) -
+                         elapsed_time_since_last_read; // us
+    int64_t frame_time_ms = bytes * 1000LL / audio_stream_in_frame_size(stream) /
+                            in_get_sample_rate(&stream->common); // ms
+    int64_t timeout = sleep_time / 1000LL;                       // ms
+    if (in->last_read_begin_us > 0 && !catching_up && !controls_changed)
     {
-        ALOGE("%s Failed to bind port(%d). ret: %d %s", __func__, pass->out_tcp_port, ret, strerror(errno));
-        return NULL;
+        int64_t pacing_error = now - in->last_read_begin_us -
+                               (int64_t)(bytes * 1000000LL / audio_stream_in_frame_size(stream) /
+                                         in_get_sample_rate(&stream->common));
+        audio_histogram_record(&in->stats.pacing_error_us,
+                               pacing_error < 0 ? -pacing_error : pacing_error);
+    }
+    in->last_read_begin_us = now;
+    if (timeout < 1)
+    {
+        timeout = 1;
+    }
+    if (timeout > frame_time_ms)
+    {
+        timeout = frame_time_ms;
+    }
+    //This WA is added to address the glitch issue while recording.
+    timeout+=2;
+    if (bytes > 0)
+    {
+        size_t frame_size = audio_stream_in_frame_size(stream);
+        if (in->drift_enabled)
+        {
+            result = in_read_resampled(stream, buffer, bytes, timeout);
+        }
+        else
+        {
+            result = in_read_from_client(stream, buffer, bytes, timeout, -1);
+        }
+        if (result < 0)
+        {
+            // The client hung up or failed: return silence rather than
+            // whatever the buffer held from the previous read.
+            ALOGV("The result of in_read_from_client is %zd", result);
+            audio_stats_inc(&in->stats.zero_filled);
+            memset(buffer, 0, bytes);
+        }
+        else if (result > 0)
+        {
+            ret = result;
+            in_update_capture_position(in, result / frame_size);
+            in->preroll_pending_bytes -= (size_t)result < in->preroll_pending_bytes ?
+                                         (size_t)result : in->preroll_pending_bytes;
+            audio_stream_stats_add_bytes(&in->stats, result, now * 1000LL);
+            audio_histogram_record(&in->stats.queue_us,
+                                   in_capture_queued_frames(in) * 1000000 / in->sample_rate);
+        }
+        // The telemetry page has one input block, it follows the oldest stream.
+        if (in == ass.in_streams[0])
+        {
+            audio_telemetry_update(&ass.telemetry->in, in->sample_rate,
+                                   result > 0 ? result / frame_size : 0,
+                                   atomic_load_explicit(&in->stats.zero_filled, memory_order_relaxed) - zero_filled,
+                                   in->capture_frame_size > 0 ?
+                                   (in->cursor.overrun_bytes - overrun_bytes) / in->capture_frame_size : 0,
+                                   atomic_load_explicit(&in->stats.timeouts, memory_order_relaxed) - timeouts,
+                                   in_telemetry_latency_us(in, first_time_ns, frame_size),
+                                   now * 1000LL);
+        }
+    }
+    const int64_t new_now = audio_clock_now_us();
+    sleep_time = sleep_time - (new_now - now);
+    int64_t frame_time_us = bytes * 1000000LL / audio_stream_in_frame_size(stream) /
+                            in_get_sample_rate(&stream->common); // us
+    if (sleep_time > 0 && sleep_time <= frame_time_us && !catching_up)
+    {
+        audio_clock_sleep_until_us(new_now + sleep_time);
+    }
+    else
+    {
+        sleep_time = 0;
+    }
+    in->last_read_time_us = new_now + sleep_time;
+    // last_read_time_us is an approximation of when the (simulated) alsa
+    // buffer is drained by the read, and is empty.
+    //
+    // On the subsequent in_read(), we measure the elapsed time spent in
+    // the recording thread. This is subtracted from the sleep estimate based on frames,
+    // thereby accounting for fill in the alsa buffer during the interim.
+    if (adev->mic_mute)
+        memset(buffer, 0, bytes);
+    // After the mute: the tap records what the app gets.
+    audio_tap(in->tap, AUDIO_TAP_IN, buffer, ret);
+    if (result <= 0)
+    {
+        in->frames_read += ret / audio_stream_in_frame_size(stream);
     }
+    audio_trace(AUDIO_TRACE_IN_READ, 0);
+    return ret;
+}
 
-    ret = listen(pass->oss_fd, 5);
-    if (ret < 0)
+// Frames the stream lost since the last call: skipped because it read too
+// late, or missing from a framed client, in frames of the stream.
+static uint32_t in_get_input_frames_lost(struct audio_stream_in *stream)
+{
+    struct stub_stream_in *in = (struct stub_stream_in *)stream;
+    uint64_t lost;
+
+    if (ass.udp_mode || in->capture_frame_size == 0)
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&ass.capture.lock);
+    capture_cursor_sync(&ass.capture, &in->cursor);
+    lost = in->cursor.lost_frames + in->cursor.overrun_bytes / in->capture_frame_size;
+    pthread_mutex_unlock(&ass.capture.lock);
+    if (lost <= in->lost_reported)
+    {
+        return 0;
+    }
+    lost -= in->lost_reported;
+    in->lost_reported += lost;
+    lost = lost * in->sample_rate / in->capture_rate;
+    return lost > UINT32_MAX ? UINT32_MAX : (uint32_t)lost;
+}
+
+static int in_get_capture_position(const struct audio_stream_in *stream, int64_t *frames,
+                                   int64_t *time)
+{
+    const struct stub_stream_in *in = (const struct stub_stream_in *)stream;
+    int ret = 0;
+
+    if (ass.udp_mode)
+    {
+        return -ENOSYS;
+    }
+    // in_read() moves the position on another thread.
+    pthread_mutex_lock(&ass.mutexlock_in);
+    if (in->position_time_ns == 0)
+    {
+        ret = -ENODATA;
+    }
+    else
+    {
+        *frames = in->position_frames;
+        *time = in->position_time_ns;
+    }
+    pthread_mutex_unlock(&ass.mutexlock_in);
+    return ret;
+}
+
+static int in_add_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
+{
+    return 0;
+}
+
+static int in_remove_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
+{
+    return 0;
+}
+
+static void *in_socket_sever_thread(void *args)
+{
+    struct audio_server_socket *pass = (struct audio_server_socket *)args;
+    int new_client_fd = -1;
+    struct sockaddr_in addr_in;
+
+    ALOGV("%s Constructing audio in socket server...", __func__);
+    apply_thread_tuning(AUDIO_THREAD_IN_SERVER);
+    if (pass->iss_fd < 0) // Listening since adev_open()
     {
-        ALOGE("%s Failed to listen on port %d", __func__, pass->out_tcp_port);
         return NULL;
     }
 
-    while (!pass->oss_exit)
+    while (!pass->iss_exit)
     {
-        ALOGW("%s Wait a audio out client to connect...", __func__);
-        socklen_t alen;
+        ALOGW("%s Wait a audio in client to connect...", __func__);
+        socklen_t alen = 0;
         alen = sizeof(struct sockaddr_in);
-        new_client_fd = accept(pass->oss_fd, (struct sockaddr *)&addr_in, &alen);
+        new_client_fd = accept(pass->iss_fd, (struct sockaddr *)&addr_in, &alen);
+        ALOGW("%s Inet new_client_fd %d",  __func__, new_client_fd);
+
         if (new_client_fd < 0)
         {
             ALOGE("%s The audio in socket server maybe shutdown as quit command is got. "
                   "Or else, error happen. port: %d %s",
-                  __func__, pass->out_tcp_port, strerror(errno));
+                  __func__, pass->in_tcp_port, strerror(errno));
         }
         else
         {
-            ALOGW("%s Currently only receive one out client. Close previous "
-                  "client(%d)",
-                  __func__, pass->out_fd);
+            int old_fd;
 
-            if (pass->out_fd > 0)
+            // The capture loop may be in a read of the current client: hand
+            // it the new one rather than closing that under it.
+            pthread_mutex_lock(&pass->mutexlock_in);
+            ALOGW("%s A new audio in client(%d) connected to server, it replaces client(%d).",
+                  __func__, new_client_fd, pass->in_fd);
+            old_fd = atomic_exchange(&pass->in_pending_fd, new_client_fd);
+            pthread_mutex_unlock(&pass->mutexlock_in);
+            // One that connected in between and was not taken over yet.
+            if (old_fd > 0)
             {
-                pthread_mutex_lock(&ass.mutexlock_out);
-                if (ATRACE_ENABLED())
-                {
-                    ATRACE_INT("avh_osst_before_send_close_cmd", pass->oss_is_sent_open_cmd);
-                }
-                pass->oss_is_sent_open_cmd = 0;
-                if (send_close_cmd(pass->out_fd) < 0)
-                {
-                    ALOGE("Fail to notify audio out client(%d) to close.", pass->out_fd);
-                }
-                if (ATRACE_ENABLED())
-                {
-                    ATRACE_INT("avh_osst_after_send_close_cmd", pass->oss_is_sent_open_cmd);
-                }
-                pthread_mutex_unlock(&ass.mutexlock_out);
-
-                if (epoll_ctl(pass->oss_epoll_fd, EPOLL_CTL_DEL, pass->out_fd, NULL))
-                {
-                    ALOGE("Failed to delete audio out file descriptor to epoll");
-                }
-                close_socket_fd(&(pass->out_fd));
+                close(old_fd);
             }
+        }
+    }
 
-            ALOGW("%s A new audio out client connected to server. "
-                  "new_client_fd = %d",
-                  __func__, new_client_fd);
-            pass->out_fd = new_client_fd;
-            pass->out_stream_standby = true; 
-            if (pass->out_fd > 0)
-            {
-                pthread_mutex_lock(&ass.mutexlock_out);
-                pass->oss_write_count = 0;
-                if (ATRACE_ENABLED())
-                {
-                    ATRACE_INT("avh_osst_before_send_open_cmd", pass->oss_is_sent_open_cmd);
-                }
-                if (pass->sso && pass->oss_is_sent_open_cmd == 0) // Make sure parameters are ready.
-                {
-                    if (send_open_cmd(pass, AUDIO_OUT) < 0)
-                    {
-                        ALOGE("Fail to send OPEN command to audio out client(%d)", pass->out_fd);
-                    }
-                    else
-                    {
-                        pass->oss_is_sent_open_cmd = 1;
-                        ALOGE("pass->oss_is_sent_open_cmd is set to %d", pass->oss_is_sent_open_cmd);
-                    }
-                }
-                if (ATRACE_ENABLED())
-                {
-                    ATRACE_INT("avh_osst_after_send_open_cmd", pass->oss_is_sent_open_cmd);
-                }
-                pthread_mutex_unlock(&ass.mutexlock_out);
+    ALOGW("%s Quit. (%d)", __func__,pass->in_fd);
+    pthread_mutex_lock(&pass->mutexlock_in);
+    if (atomic_load(&pass->in_pending_fd) > 0)
+    {
+        close(atomic_exchange(&pass->in_pending_fd, -1));
+    }
+    close_socket_fd(&(pass->in_fd));
+    close_socket_fd(&(pass->iss_fd));
+    pthread_mutex_unlock(&pass->mutexlock_in);
+    return NULL;
+}
 
-                struct epoll_event event;
-                event.events = EPOLLOUT;
-                event.data.fd = pass->out_fd;
-                if (epoll_ctl(pass->oss_epoll_fd, EPOLL_CTL_ADD, pass->out_fd, &event))
-                {
-                    ALOGE("Failed to add audio out file descriptor to epoll");
-                }
+// Read one frame from a framed input client into the capture ring. Return 1
+// on success, 0 when the client closed and -1 on error, a client stalled
+// in the frame or one larger than the ring.
+static int capture_receive_frame(struct audio_server_socket *pass, int fd, uint8_t *scratch,
+                                 size_t scratch_size)
+{
+    struct audio_socket_frame_header hdr;
+    ssize_t ret = read_full_timeout(fd, &hdr, sizeof(hdr), CAPTURE_FRAME_TIMEOUT_MILLISECONDS);
+    int64_t receive_ns = monotonic_time_ns();
+    size_t ring_size;
+    size_t remaining;
+
+    if (ret <= 0)
+    {
+        return ret < 0 ? -1 : 0;
+    }
+    pthread_mutex_lock(&pass->capture.lock);
+    ring_size = pass->capture.size;
+    pthread_mutex_unlock(&pass->capture.lock);
+    if (hdr.data_size > ring_size)
+    {
+        ALOGW("%s Frame of %u bytes from audio in client, the ring holds %zu.", __func__,
+              hdr.data_size, ring_size);
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (hdr.cmd == CMD_DATA && hdr.stream == AUDIO_IN)
+    {
+        audio_trace(AUDIO_TRACE_IN_DATA_READ, hdr.data_size);
+        capture_ring_begin_frame(&pass->capture, hdr.sequence, hdr.data_size,
+                                 capture_frame_time(hdr.timestamp_ns, receive_ns));
+    }
+    else
+    {
+        ALOGV("%s Ignore cmd %u for stream %u from audio in client.", __func__, hdr.cmd,
+              hdr.stream);
+    }
+    remaining = hdr.data_size;
+    while (remaining > 0)
+    {
+        size_t chunk = remaining < scratch_size ? remaining : scratch_size;
+        ret = read_full_timeout(fd, scratch, chunk, CAPTURE_FRAME_TIMEOUT_MILLISECONDS);
+        if (ret <= 0)
+        {
+            return ret < 0 ? -1 : 0;
+        }
+        if (hdr.cmd == CMD_DATA && hdr.stream == AUDIO_IN)
+        {
+            capture_ring_write(&pass->capture, scratch, chunk);
+        }
+        remaining -= chunk;
+    }
+    return 1;
+}
+
+// Take over the client in_socket_sever_thread() accepted last, on the
+// capture loop so no read of the previous client is in progress.
+static void capture_take_pending_client(struct audio_server_socket *pass)
+{
+    struct epoll_event event;
+    int new_client_fd;
+
+    pthread_mutex_lock(&pass->mutexlock_in);
+    new_client_fd = atomic_exchange(&pass->in_pending_fd, -1);
+    if (new_client_fd <= 0)
+    {
+        pthread_mutex_unlock(&pass->mutexlock_in);
+        return;
+    }
+    if (pass->in_fd > 0)
+    {
+        ALOGW("%s Currently only receive one input client. Close previous client(%d)",
+              __func__, pass->in_fd);
+        if (ass.iss_read_flag && send_close_cmd(pass->in_fd, AUDIO_IN) < 0)
+        {
+            ALOGE("Fail to notify audio in client(%d) to close.", pass->in_fd);
+        }
+        if (epoll_ctl(pass->iss_epoll_fd, EPOLL_CTL_DEL, pass->in_fd, NULL))
+        {
+            ALOGE("Failed to delete audio in file descriptor to epoll");
+        }
+        close_socket_fd(&(pass->in_fd));
+    }
+    ALOGW("%s A new audio in client connected to server. "
+          "new_client_fd = %d. Set it to pass->in_fd",
+          __func__, new_client_fd);
+    pass->in_fd = new_client_fd;
+    set_client_nodelay(new_client_fd);
+    pass->in_socket_rcvbuf = 0;
+    audio_impair_bind(AUDIO_IMPAIR_FROM_CLIENT, new_client_fd);
+    audio_telemetry_set_connected(&pass->telemetry->in, true);
+    // Nothing of the previous client may join the new stream.
+    capture_ring_reset(&pass->capture, 0, 0);
+    if (capture_client_wanted(pass)) // Make sure parameters are ready.
+    {
+        if (send_open_cmd(pass, AUDIO_IN) < 0)
+        {
+            ALOGE("Fail to send OPEN command to audio in client(%d)", pass->in_fd);
+        }
+        else
+        {
+            pass->iss_read_flag = true;
+        }
+    }
+    event.events = EPOLLIN;
+    event.data.fd = pass->in_fd;
+    if (epoll_ctl(pass->iss_epoll_fd, EPOLL_CTL_ADD, pass->in_fd, &event))
+    {
+        ALOGE("Failed to add audio in file descriptor to epoll");
+    }
+    pthread_mutex_unlock(&pass->mutexlock_in);
+    ALOGI("Success to add audio in file descriptor %d to epoll, iss_epoll_fd %d", new_client_fd,
+          pass->iss_epoll_fd);
+}
+
+// Read the separate input connection into the capture ring, where every
+// input stream reads it through its own cursor. With pre-roll the client
+// sends whether or not a stream is open, and the ring keeps the last
+// preroll_ms for the next one.
+static void *capture_loop_thread(void *args)
+{
+    struct audio_server_socket *pass = (struct audio_server_socket *)args;
+    struct epoll_event event;
+    uint8_t scratch[4096];
+    int nevents;
+    ssize_t result;
+
+    apply_thread_tuning(AUDIO_THREAD_CAPTURE_LOOP);
+    while (!pass->iss_exit)
+    {
+        if (atomic_load_explicit(&pass->in_pending_fd, memory_order_relaxed) > 0)
+        {
+            capture_take_pending_client(pass);
+        }
+        nevents = epoll_wait(pass->iss_epoll_fd, &event, 1, DUPLEX_EXIT_POLL_MILLISECONDS);
+        if (nevents < 0)
+        {
+            if (errno != EINTR)
+            {
+                ALOGE("%s epoll_wait() unexpected error: %s", __func__, strerror(errno));
+                break;
+            }
+            continue;
+        }
+        if (nevents == 0)
+        {
+            continue;
+        }
+        result = 0;
+        if ((event.events & EPOLLIN) != 0 && pass->in_framed)
+        {
+            result = capture_receive_frame(pass, event.data.fd, scratch, sizeof(scratch));
+            if (result > 0)
+            {
+                continue;
             }
         }
+        else if ((event.events & EPOLLIN) != 0)
+        {
+            result = audio_impair_read(event.data.fd, scratch, sizeof(scratch));
+            if (result > 0)
+            {
+                audio_trace(AUDIO_TRACE_IN_DATA_READ, result);
+                capture_ring_write(&pass->capture, scratch, result);
+                // Unframed data carries no capture time: its last frame
+                // was captured about when it arrived.
+                capture_ring_stamp(&pass->capture, monotonic_time_ns());
+                continue;
+            }
+            if (result < 0 && (errno == EINTR || errno == EAGAIN))
+            {
+                continue;
+            }
+        }
+        pthread_mutex_lock(&pass->mutexlock_in);
+        if (event.data.fd == pass->in_fd)
+        {
+            ALOGW("%s Audio in client(%d) is closed. ret: %zd %s", __func__, pass->in_fd, result,
+                  result < 0 ? strerror(errno) : "");
+            if (epoll_ctl(pass->iss_epoll_fd, EPOLL_CTL_DEL, pass->in_fd, NULL))
+            {
+                ALOGE("Failed to delete audio in file descriptor to epoll");
+            }
+            close_socket_fd(&(pass->in_fd));
+            audio_telemetry_set_connected(&pass->telemetry->in, false);
+        }
+        pthread_mutex_unlock(&pass->mutexlock_in);
     }
-    ALOGW("%s Quit. port %d(%d)", __func__, pass->out_tcp_port, pass->out_fd);
-    pthread_mutex_lock(&ass.mutexlock_out);
-    pass->oss_is_sent_open_cmd = 0;
-    close_socket_fd(&(pass->out_fd));
-    close_socket_fd(&(pass->oss_fd));
-    pthread_mutex_unlock(&ass.mutexlock_out);
+    ALOGW("%s Quit.", __func__);
     return NULL;
 }
 
-/** audio_stream_in implementation **/
-static uint32_t in_get_sample_rate(const struct audio_stream *stream)
-{
-    const struct stub_stream_in *in = (const struct stub_stream_in *)stream;
-
-    ALOGV("in_get_sample_rate: %u", in->sample_rate);
-    return in->sample_rate;
-}
-
-static int in_set_sample_rate(struct audio_stream *stream, uint32_t rate)
+static int open_server_socket(int port)
 {
-    struct stub_stream_in *in = (struct stub_stream_in *)stream;
-
-    ALOGV("in_set_sample_rate: %u", rate);
-    in->sample_rate = rate;
-    return 0;
-}
+    int so_reuseaddr = 1;
+    struct sockaddr_in addr_in;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
 
-static size_t in_get_buffer_size(const struct audio_stream *stream)
-{
-    const struct stub_stream_in *in = (const struct stub_stream_in *)stream;
-    size_t buffer_size = in->frame_count *
-                         audio_stream_in_frame_size(&in->stream);
+    if (fd < 0)
+    {
+        ALOGE("%s:%d Fail to construct socket with error: %s",
+              __func__, __LINE__, strerror(errno));
+        return -1;
+    }
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &so_reuseaddr, sizeof(int)) < 0)
+    {
+        ALOGE("%s setsockopt(SO_REUSEADDR) failed. fd: %d\n", __func__, fd);
+        close(fd);
+        return -1;
+    }
 
-    ALOGV("in_get_buffer_size: %zu", buffer_size);
-    return buffer_size;
+    memset(&addr_in, 0, sizeof(addr_in));
+    addr_in.sin_family = AF_INET;
+    addr_in.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr_in.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr_in, sizeof(struct sockaddr_in)) < 0)
+    {
+        ALOGE("%s Failed to bind port(%d). %s", __func__, port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, 5) < 0)
+    {
+        ALOGE("%s Failed to listen on port %d", __func__, port);
+        close(fd);
+        return -1;
+    }
+    return fd;
 }
 
-static audio_channel_mask_t in_get_channels(const struct audio_stream *stream)
+static void duplex_disconnect_client(struct audio_server_socket *pass)
 {
-    const struct stub_stream_in *in = (const struct stub_stream_in *)stream;
+    if (pass->duplex_fd < 0)
+    {
+        return;
+    }
+    ALOGW("%s Disconnect duplex client(%d).", __func__, pass->duplex_fd);
 
-    ALOGV("in_get_channels: %x", in->channel_mask);
-    return in->channel_mask;
-}
+    pthread_mutex_lock(&pass->mutexlock_out);
+    if (pass->out_fd > 0 && epoll_ctl(pass->oss_epoll_fd, EPOLL_CTL_DEL, pass->duplex_fd, NULL))
+    {
+        ALOGV("Duplex file descriptor is not in the output epoll");
+    }
+    pass->out_fd = -1;
+    pass->oss_is_sent_open_cmd = 0;
+    audio_telemetry_set_connected(&pass->telemetry->out, false);
+    pthread_mutex_unlock(&pass->mutexlock_out);
 
-static audio_format_t in_get_format(const struct audio_stream *stream)
-{
-    const struct stub_stream_in *in = (const struct stub_stream_in *)stream;
+    pthread_mutex_lock(&pass->mutexlock_in);
+    pass->in_fd = -1;
+    audio_telemetry_set_connected(&pass->telemetry->in, false);
+    pthread_mutex_unlock(&pass->mutexlock_in);
 
-    ALOGV("in_get_format: %d", in->format);
-    return in->format;
+    if (epoll_ctl(pass->dss_epoll_fd, EPOLL_CTL_DEL, pass->duplex_fd, NULL))
+    {
+        ALOGE("Failed to delete duplex file descriptor from epoll");
+    }
+    close_socket_fd(&(pass->duplex_fd));
+    capture_ring_reset(&pass->capture, 0, 0);
 }
 
-static int in_set_format(struct audio_stream *stream, audio_format_t format)
+static void duplex_accept_client(struct audio_server_socket *pass)
 {
-    struct stub_stream_in *in = (struct stub_stream_in *)stream;
+    struct sockaddr_in addr_in;
+    socklen_t alen = sizeof(struct sockaddr_in);
+    struct epoll_event event;
+    int new_client_fd = accept(pass->dss_fd, (struct sockaddr *)&addr_in, &alen);
 
-    ALOGV("in_set_format: %d", format);
-    in->format = format;
-    return 0;
-}
+    if (new_client_fd < 0)
+    {
+        ALOGE("%s The duplex socket server maybe shutdown as quit command is got. "
+              "Or else, error happen. port: %d %s",
+              __func__, pass->duplex_tcp_port, strerror(errno));
+        return;
+    }
 
-static int in_standby(struct audio_stream *stream)
-{
-    struct stub_stream_in *in = (struct stub_stream_in *)stream;
-    in->last_read_time_us = 0;
-    return 0;
-}
+    if (pass->duplex_fd > 0)
+    {
+        ALOGW("%s Currently only receive one duplex client. Close previous client(%d)",
+              __func__, pass->duplex_fd);
+        pthread_mutex_lock(&pass->mutexlock_out);
+        if (send_close_cmd(pass->duplex_fd, AUDIO_OUT) < 0)
+        {
+            ALOGE("Fail to notify duplex client(%d) to close output.", pass->duplex_fd);
+        }
+        pthread_mutex_unlock(&pass->mutexlock_out);
+        pthread_mutex_lock(&pass->mutexlock_in);
+        if (pass->iss_read_flag && send_close_cmd(pass->duplex_fd, AUDIO_IN) < 0)
+        {
+            ALOGE("Fail to notify duplex client(%d) to close input.", pass->duplex_fd);
+        }
+        pthread_mutex_unlock(&pass->mutexlock_in);
+        duplex_disconnect_client(pass);
+    }
 
-static int in_dump(const struct audio_stream *stream, int fd)
-{
-    return 0;
-}
+    ALOGW("%s A new duplex client connected to server. new_client_fd = %d",
+          __func__, new_client_fd);
+    pass->duplex_fd = new_client_fd;
+    memset(pass->duplex_sequence, 0, sizeof(pass->duplex_sequence));
+    set_client_nodelay(new_client_fd);
+    pass->out_socket_sndbuf = 0;
+    pass->out_socket_lowat = 0;
+    pass->in_socket_rcvbuf = 0;
+    audio_impair_bind(AUDIO_IMPAIR_TO_CLIENT, new_client_fd);
+    audio_impair_bind(AUDIO_IMPAIR_FROM_CLIENT, new_client_fd);
+    audio_probe_reset();
+    atomic_store(&pass->out_client_fill_frames, -1);
+    atomic_fetch_add(&pass->out_client_generation, 1);
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = new_client_fd;
+    if (epoll_ctl(pass->dss_epoll_fd, EPOLL_CTL_ADD, new_client_fd, &event))
+    {
+        ALOGE("Failed to add duplex file descriptor to epoll");
+    }
 
-static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
-{
-    return 0;
-}
+    pthread_mutex_lock(&pass->mutexlock_out);
+    pass->out_fd = new_client_fd;
+    audio_telemetry_set_connected(&pass->telemetry->out, true);
+    pass->out_stream_standby = true;
+    pass->oss_write_count = 0;
+    if (pass->sso && pass->oss_is_sent_open_cmd == 0) // Make sure parameters are ready.
+    {
+        if (send_open_cmd(pass, AUDIO_OUT) < 0)
+        {
+            ALOGE("Fail to send OPEN command to duplex client(%d)", new_client_fd);
+        }
+        else
+        {
+            pass->oss_is_sent_open_cmd = 1;
+        }
+    }
+    pthread_mutex_unlock(&pass->mutexlock_out);
+    event.events = EPOLLOUT;
+    event.data.fd = new_client_fd;
+    if (epoll_ctl(pass->oss_epoll_fd, EPOLL_CTL_ADD, new_client_fd, &event))
+    {
+        ALOGE("Failed to add duplex file descriptor to output epoll");
+    }
 
-static char *in_get_parameters(const struct audio_stream *stream,
-                               const char *keys)
-{
-    return strdup("");
+    pthread_mutex_lock(&pass->mutexlock_in);
+    pass->in_fd = new_client_fd;
+    audio_telemetry_set_connected(&pass->telemetry->in, true);
+    capture_ring_reset(&pass->capture, 0, 0);
+    if (capture_client_wanted(pass)) // Make sure parameters are ready.
+    {
+        if (send_open_cmd(pass, AUDIO_IN) < 0)
+        {
+            ALOGE("Fail to send OPEN command to duplex client(%d)", new_client_fd);
+        }
+        else
+        {
+            pass->iss_read_flag = true;
+        }
+    }
+    pthread_mutex_unlock(&pass->mutexlock_in);
 }
 
-static int in_set_gain(struct audio_stream_in *stream, float gain)
+// Read one frame from the duplex client. Return 1 on success, 0 when the
+// client closed and -1 on error, a client stalled in the frame or one
+// larger than the ring. The thread also accepts clients and watches
+// dss_exit, so it must not wait on one client for long.
+static int duplex_receive_frame(struct audio_server_socket *pass, uint8_t *scratch,
+                                size_t scratch_size)
 {
-    return 0;
-}
+    struct audio_socket_frame_header hdr;
+    ssize_t ret = read_full_timeout(pass->duplex_fd, &hdr, sizeof(hdr),
+                                    CAPTURE_FRAME_TIMEOUT_MILLISECONDS);
+    int64_t receive_ns = monotonic_time_ns();
+    size_t ring_size;
+    size_t remaining;
+
+    if (ret <= 0)
+    {
+        ALOGW("%s Duplex client(%d) is closed. ret: %zd %s", __func__, pass->duplex_fd, ret,
+              ret < 0 ? strerror(errno) : "");
+        return ret < 0 ? -1 : 0;
+    }
+    pthread_mutex_lock(&pass->capture.lock);
+    ring_size = pass->capture.size;
+    pthread_mutex_unlock(&pass->capture.lock);
+    // Control frames fit the scratch buffer, also before the ring is sized.
+    if (hdr.data_size > ring_size && hdr.data_size > scratch_size)
+    {
+        ALOGW("%s Frame of %u bytes from duplex client, the ring holds %zu.", __func__,
+              hdr.data_size, ring_size);
+        errno = EMSGSIZE;
+        return -1;
+    }
 
-static ssize_t in_read_from_client(struct audio_stream_in *stream, void *buffer,
-                                   size_t bytes, int timeout, uint32_t offset)
-{
-    ssize_t ret = -1;
-    ssize_t result = 0;
-    int nevents = 0;
-    int ne;
-    if (ass.in_fd > 0)
+    remaining = hdr.data_size;
+    while (remaining > 0)
     {
-        ALOGV("%s epoll_wait %d.", __func__, ass.iss_epoll_fd);
-        nevents = epoll_wait(ass.iss_epoll_fd, ass.iss_epoll_event, 1, timeout);
-        if (nevents < 0)
+        size_t chunk = remaining < scratch_size ? remaining : scratch_size;
+        if (pass->dss_exit)
         {
-            if (errno != EINTR)
-                ALOGE("epoll_wait() unexpected error: %s", strerror(errno));
-            return errno;
+            return -1;
         }
-        else if (nevents == 0)
+        ret = read_full_timeout(pass->duplex_fd, scratch, chunk, CAPTURE_FRAME_TIMEOUT_MILLISECONDS);
+        if (ret <= 0)
         {
-            ALOGW("in_read_from_client: Client cannot be read in given time.");
-            memset(buffer, 0, bytes);
-            return bytes;
+            ALOGW("%s Duplex client(%d) stalled or closed in a frame. ret: %zd %s", __func__,
+                  pass->duplex_fd, ret, ret < 0 ? strerror(errno) : "");
+            return ret < 0 ? -1 : 0;
         }
-        else if (nevents > 0)
+        if (hdr.cmd == CMD_DATA && hdr.stream == AUDIO_IN)
         {
-            for (ne = 0; ne < nevents; ne++) // In fact, only one event.
+            if (remaining == hdr.data_size)
             {
-                if (ass.iss_epoll_event[ne].data.fd == ass.in_fd)
-                {
-                    if ((ass.iss_epoll_event[ne].events & (EPOLLERR | EPOLLHUP)) != 0)
-                    {
-                        ALOGE("EPOLLERR or EPOLLHUP after epoll_wait() !?");
-                        if (epoll_ctl(ass.iss_epoll_fd, EPOLL_CTL_DEL, ass.in_fd, NULL))
-                        {
-                            ALOGE("Failed to delete audio in file descriptor to epoll");
-                        }
-                        close(ass.in_fd);
-                        ass.in_fd = -1;
-                    }
-                    else if ((ass.iss_epoll_event[ne].events & EPOLLIN) != 0)
-                    {
-                        result = read(ass.in_fd, buffer, bytes);
-                        if (result < 0)
-                        {
-                            ALOGE("in_read_from_client: Fail to read from audio in client(%d) "
-                                  "with error (%s)",
-                                  ass.in_fd, strerror(errno));
-                        }
-                        else if (result == 0)
-                        {
-                            ALOGE("in_read_from_client: Audio in client(%d) is closed.", ass.in_fd);
-                        }
-                        else
-                        {
-                            ALOGV("in_read_from_client: Read from port %d ass.in_fd %d bytes "
-                                  "%zu, result: %zd",
-                                  ass.in_tcp_port, ass.in_fd, bytes, result);
-                            if (bytes != (size_t)result)
-                            {
-                                ALOGW("in_read_from_client: (!^!) result(%zd) data is read. But "
-                                      "bytes(%zu) is expected.",
-                                      result, bytes);
-                            }
-                            ret = result;
-                        }
-                    }
-                    else
-                    {
-                        ALOGW("in_read_from_client: epoll unknown event. port(%d) ass.in_fd(%d)"
-                              ". Memset data to 0. Return bytes(%zu) directly.",
-                              ass.in_tcp_port, ass.in_fd, bytes);
-                    }
-                }
-                else
-                {
-                    ALOGV("in_read_from_client: epoll_wait unknown");
-                }
+                capture_ring_begin_frame(&pass->capture, hdr.sequence, hdr.data_size,
+                                         capture_frame_time(hdr.timestamp_ns, receive_ns));
             }
-            return ret;
+            capture_ring_write(&pass->capture, scratch, chunk);
         }
+        remaining -= chunk;
     }
-    else
+    if (hdr.cmd == CMD_PONG && hdr.data_size == sizeof(struct audio_socket_pong))
     {
-        ALOGV("in_read_from_client: (->v->) Audio in client is not connected. port(%d)"
-              " ass.in_fd(%d). Memset data to 0. Return bytes(%zu) directly.",
-              ass.in_tcp_port, ass.in_fd, bytes);
-        memset(buffer, 0, bytes);
-        return bytes;
+        struct audio_socket_pong pong;
+        memcpy(&pong, scratch, sizeof(pong));
+        handle_pong(&pong, receive_ns);
     }
-    return ret;
+    else if (hdr.cmd == CMD_STATUS && hdr.data_size == sizeof(struct audio_socket_status))
+    {
+        struct audio_socket_status status;
+        memcpy(&status, scratch, sizeof(status));
+        handle_status(&status);
+    }
+    else if (hdr.cmd != CMD_DATA || hdr.stream != AUDIO_IN)
+    {
+        ALOGV("%s Ignore cmd %u for stream %u from duplex client.", __func__, hdr.cmd, hdr.stream);
+    }
+    return 1;
 }
 
-static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
-                       size_t bytes)
+// Accept the duplex client and demultiplex the frames it sends. One thread
+// serves both directions; output frames are written by out_write() directly.
+static void *duplex_socket_server_thread(void *args)
 {
-    ALOGV("in_read: %p, bytes %zu", buffer, bytes);
-    if (!ass.iss_read_flag)
+    struct audio_server_socket *pass = (struct audio_server_socket *)args;
+    struct epoll_event events[2];
+    uint8_t scratch[4096];
+    int nevents;
+    int ne;
+
+    ALOGV("%s Constructing audio duplex socket server...", __func__);
+    apply_thread_tuning(AUDIO_THREAD_DUPLEX_LOOP);
+    if (pass->dss_fd < 0) // Listening since adev_open()
     {
-        if (ass.in_fd > 0)
+        return NULL;
+    }
+
+    while (!pass->dss_exit)
+    {
+        nevents = epoll_wait(pass->dss_epoll_fd, events, 2, DUPLEX_EXIT_POLL_MILLISECONDS);
+        if (nevents < 0)
         {
-            pthread_mutex_lock(&ass.mutexlock_in);
-            ALOGV("in_read: send_open_cmd pthread_mutex_lock");
-            if (send_open_cmd(&ass, AUDIO_IN) < 0)
+            if (errno != EINTR)
             {
-                ALOGE("%s: Fail to send OPEN command to audio in client(%d)", __func__, ass.in_fd);
+                ALOGE("%s epoll_wait() unexpected error: %s", __func__, strerror(errno));
+                break;
+            }
+            continue;
+        }
+        for (ne = 0; ne < nevents; ne++)
+        {
+            if (events[ne].data.fd == pass->dss_fd)
+            {
+                duplex_accept_client(pass);
+            }
+            else if (events[ne].data.fd == pass->duplex_fd)
+            {
+                if (duplex_receive_frame(pass, scratch, sizeof(scratch)) <= 0)
+                {
+                    duplex_disconnect_client(pass);
+                }
             }
-            pthread_mutex_unlock(&ass.mutexlock_in);
         }
-        ass.iss_read_flag = true;
     }
 
-    struct stub_stream_in *in = (struct stub_stream_in *)stream;
-    struct stub_audio_device *adev = in->dev;
-    ssize_t ret = bytes;
-    ssize_t result = -1;
+    ALOGW("%s Quit. port %d(%d)", __func__, pass->duplex_tcp_port, pass->duplex_fd);
+    duplex_disconnect_client(pass);
+    close_socket_fd(&(pass->dss_fd));
+    return NULL;
+}
 
-    /* XXX: fake timing for audio input */
-    struct timespec t = {.tv_sec = 0, .tv_nsec = 0};
-    clock_gettime(CLOCK_MONOTONIC, &t);
-    const int64_t now = (t.tv_sec * 1000000000LL + t.tv_nsec) / 1000;
+// A UDP client attached: announce the open streams, as on a new connection.
+static void udp_attach_client(const struct sockaddr_in *from)
+{
+    audio_udp_attach(from);
 
-    // we do a full sleep when exiting standby.
-    const bool standby = in->last_read_time_us == 0;
-    int64_t elapsed_time_since_last_read = 0;
-    if (ass.in_fd > 0)
-    {
-        elapsed_time_since_last_read = now - in->last_read_time_us;
-    }
-    else
-    {
-        elapsed_time_since_last_read = standby ? 0 : now - in->last_read_time_us;
-    }
-    int64_t sleep_time = bytes * 1000000LL / audio_stream_in_frame_size(stream) /
-                             in_get_sample_rate(&stream->common) -
-                         elapsed_time_since_last_read; // us
-    int64_t frame_time_ms = bytes * 1000LL / audio_stream_in_frame_size(stream) /
-                            in_get_sample_rate(&stream->common); // ms
-    int64_t timeout = sleep_time / 1000LL;                       // ms
-    if (timeout < 1)
+    pthread_mutex_lock(&ass.mutexlock_out);
+    audio_telemetry_set_connected(&ass.telemetry->out, true);
+    ass.out_stream_standby = true;
+    ass.oss_write_count = 0;
+    ass.oss_is_sent_open_cmd = 0;
+    if (ass.sso)
     {
-        timeout = 1;
+        if (send_open_cmd(&ass, AUDIO_OUT) < 0)
+        {
+            ALOGE("Fail to send OPEN command to the udp client");
+        }
+        else
+        {
+            ass.oss_is_sent_open_cmd = 1;
+        }
     }
-    if (timeout > frame_time_ms)
+    pthread_mutex_unlock(&ass.mutexlock_out);
+
+    pthread_mutex_lock(&ass.mutexlock_in);
+    audio_telemetry_set_connected(&ass.telemetry->in, true);
+    if (ass.in_stream_count > 0 && ass.iss_read_flag && send_open_cmd(&ass, AUDIO_IN) < 0)
     {
-        timeout = frame_time_ms;
+        ALOGE("Fail to send OPEN command to the udp client");
     }
-    //This WA is added to address the glitch issue while recording.
-    timeout+=2;
-    if (bytes > 0)
+    pthread_mutex_unlock(&ass.mutexlock_in);
+}
+
+// Datagrams from the UDP receive thread.
+static void udp_receive_datagram(const struct audio_datagram_header *header,
+                                 const void *payload, size_t bytes,
+                                 const struct sockaddr_in *from, bool from_peer)
+{
+    if (header->cmd == CMD_OPEN)
     {
-        result = in_read_from_client(stream, buffer, bytes, timeout, -1);
-        if (result < 0)
-        {
-            ALOGV("The result of in_read_from_client is %zd", result);
-        }
-        else if (result > 0)
+        // Without its cookie the sender was challenged, see audio_udp.h.
+        if (audio_udp_admit(header, from))
         {
-            ret = result;
+            udp_attach_client(from);
         }
     }
-    clock_gettime(CLOCK_MONOTONIC, &t);
-    const int64_t new_now = (t.tv_sec * 1000000000LL + t.tv_nsec) / 1000;
-    sleep_time = sleep_time - (new_now - now);
-    int64_t frame_time_us = bytes * 1000000LL / audio_stream_in_frame_size(stream) /
-                            in_get_sample_rate(&stream->common); // us
-    if (sleep_time > 0 && sleep_time <= frame_time_us)
+    else if (!from_peer)
+    {
+        ALOGV("%s Ignore cmd %u from a client that did not attach.", __func__, header->cmd);
+    }
+    else if (header->cmd == CMD_CLOSE)
+    {
+        ALOGW("%s The udp client detached.", __func__);
+        audio_udp_detach();
+        pthread_mutex_lock(&ass.mutexlock_out);
+        ass.oss_is_sent_open_cmd = 0;
+        audio_telemetry_set_connected(&ass.telemetry->out, false);
+        pthread_mutex_unlock(&ass.mutexlock_out);
+        audio_telemetry_set_connected(&ass.telemetry->in, false);
+    }
+    else if (header->cmd == CMD_DATA && header->stream == AUDIO_IN)
     {
-        usleep(sleep_time);
+        audio_udp_put_input(header, payload, bytes);
     }
     else
     {
-        sleep_time = 0;
+        ALOGV("%s Ignore cmd %u for stream %u from udp client.", __func__, header->cmd,
+              header->stream);
     }
-    in->last_read_time_us = new_now + sleep_time;
-    // last_read_time_us is an approximation of when the (simulated) alsa
-    // buffer is drained by the read, and is empty.
-    //
-    // On the subsequent in_read(), we measure the elapsed time spent in
-    // the recording thread. This is subtracted from the sleep estimate based on frames,
-    // thereby accounting for fill in the alsa buffer during the interim.
-    if (adev->mic_mute)
-        memset(buffer, 0, bytes);
-    return ret;
-}
-
-static uint32_t in_get_input_frames_lost(struct audio_stream_in *stream)
-{
-    return 0;
 }
 
-static int in_add_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
+// Whether a stream that differs from the capture can read it converted. An
+// index mask may only pick microphones of the array.
+static bool capture_convertible(const struct stub_stream_in *in)
 {
-    return 0;
-}
+    const audio_channel_mask_t capture = ass.capture_config.channel_mask;
 
-static int in_remove_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
-{
-    return 0;
+    if (!audio_convert_supported(in->format) || !audio_convert_supported(ass.capture_config.format))
+    {
+        return false;
+    }
+    return audio_channel_mask_get_representation(in->channel_mask) !=
+           AUDIO_CHANNEL_REPRESENTATION_INDEX ||
+           audio_channel_mask_get_representation(capture) != AUDIO_CHANNEL_REPRESENTATION_INDEX ||
+           (audio_channel_mask_get_bits(in->channel_mask) & ~audio_channel_mask_get_bits(capture)) == 0;
 }
 
-static void *in_socket_sever_thread(void *args)
+/*
+ * Attach a new input stream to the capture. The first stream decides what
+ * the client is opened with, all but the channels for a microphone array.
+ * With pre-roll the client is open already: it is opened again only when
+ * nothing else reads it and the stream wants other parameters, which loses
+ * the pre-roll. A stream that differs from the capture converts what it
+ * reads; for a format that cannot be converted, config is set to the
+ * capture and -EINVAL returned so the framework can retry with it.
+ */
+static int capture_open(struct stub_stream_in *in, struct audio_config *config)
 {
-    struct audio_server_socket *pass = (struct audio_server_socket *)args;
-    int ret = 0;
-    int so_reuseaddr = 1;
-    int new_client_fd = -1;
-    struct sockaddr_in addr_in;
-
-    ALOGV("%s Constructing audio in socket server...", __func__);
-    pass->iss_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct audio_config *capture = &ass.capture_config;
+    size_t frame_size = audio_stream_in_frame_size(&in->stream);
+    uint32_t capture_rate;
+    size_t bytes = 0;
+    bool same;
+    int ret;
 
-    if (pass->iss_fd < 0)
+    pthread_mutex_lock(&ass.mutexlock_in);
+    if (ass.in_stream_count == AUDIO_MAX_INPUT_STREAMS)
     {
-        ALOGE("%s:%d Fail to construct audio in socket with error: %s",
-              __func__, __LINE__, strerror(errno));
-        return NULL;
+        pthread_mutex_unlock(&ass.mutexlock_in);
+        ALOGE("%s %d input streams are open already.", __func__, AUDIO_MAX_INPUT_STREAMS);
+        return -EBUSY;
     }
-    if (setsockopt(pass->iss_fd, SOL_SOCKET, SO_REUSEADDR, &so_reuseaddr, sizeof(int)) < 0)
+    same = in->sample_rate == capture->sample_rate && in->channel_mask == capture->channel_mask &&
+           in->format == capture->format;
+    if (ass.in_stream_count == 0 && (!same || ass.preroll_ms == 0) &&
+        (ass.mic_channels == 0 || capture_convertible(in)))
     {
-        ALOGE("%s setsockopt(SO_REUSEADDR) failed. pass->iss_fd: %d\n", __func__, pass->iss_fd);
-        return NULL;
+        capture->sample_rate = in->sample_rate;
+        if (ass.mic_channels == 0)
+        {
+            capture->channel_mask = in->channel_mask;
+        }
+        capture->format = in->format;
+        ALOGI("%s Capture %u Hz, channels 0x%x, format 0x%x", __func__, capture->sample_rate,
+              capture->channel_mask, capture->format);
+        capture_ring_reset(&ass.capture, capture_ring_bytes(), capture_frame_size());
+        if (ass.preroll_ms > 0 && ass.in_fd > 0 && send_open_cmd(&ass, AUDIO_IN) < 0)
+        {
+            ALOGE("%s: Fail to send OPEN command to audio in client(%d)", __func__, ass.in_fd);
+        }
+        same = in->channel_mask == capture->channel_mask;
     }
-
-    memset(&addr_in, 0, sizeof(addr_in));
-    addr_in.sin_family = AF_INET;
-    addr_in.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr_in.sin_port = htons(pass->in_tcp_port);
-
-    ret = bind(pass->iss_fd, (struct sockaddr *)&addr_in, sizeof(struct sockaddr_in));
-    if (ret < 0)
+    else if (!same && !capture_convertible(in))
     {
-        ALOGE("%s Failed to bind port(%d). ret: %d, %s",
-              __func__, pass->in_tcp_port, ret, strerror(errno));
-        return NULL;
+        config->sample_rate = capture->sample_rate;
+        config->channel_mask = capture->channel_mask;
+        config->format = capture->format;
+        pthread_mutex_unlock(&ass.mutexlock_in);
+        ALOGW("%s Cannot convert the capture to channels 0x%x, format 0x%x.", __func__,
+              in->channel_mask, in->format);
+        return -EINVAL;
     }
-
-    ret = listen(pass->iss_fd, 5);
-    if (ret < 0)
+    if (!same)
     {
-        ALOGE("%s Failed to listen on port %d", __func__, pass->in_tcp_port);
-        return NULL;
+        ret = audio_convert_reset(&in->convert, capture->format, capture->channel_mask,
+                                  capture->sample_rate, in->format, in->channel_mask,
+                                  in->sample_rate, in->frame_count);
+        if (ret < 0)
+        {
+            pthread_mutex_unlock(&ass.mutexlock_in);
+            ALOGE("%s Cannot convert the capture to channels 0x%x: %d", __func__,
+                  in->channel_mask, ret);
+            return ret;
+        }
+    }
+    in->converting = !same;
+    in->capture_frame_size = capture_frame_size();
+    in->capture_rate = capture_rate = capture->sample_rate;
+    capture_ring_attach(&ass.capture, &in->cursor);
+    if (ass.preroll_ms > 0)
+    {
+        bytes = capture_ring_trim(&ass.capture, &in->cursor,
+                                  (size_t)capture_rate * ass.preroll_ms / 1000 *
+                                  in->capture_frame_size);
     }
+    ass.in_streams[ass.in_stream_count++] = in;
+    pthread_mutex_unlock(&ass.mutexlock_in);
 
-    while (!pass->iss_exit)
+    if (ass.preroll_ms > 0)
     {
-        ALOGW("%s Wait a audio in client to connect...", __func__);
-        socklen_t alen = 0;
-        alen = sizeof(struct sockaddr_in);
-        new_client_fd = accept(pass->iss_fd, (struct sockaddr *)&addr_in, &alen);
-        ALOGW("%s Inet new_client_fd %d",  __func__, new_client_fd);
+        size_t frames = bytes / in->capture_frame_size;
+        in->preroll_ms = frames * 1000 / capture_rate;
+        in->preroll_pending_bytes = (size_t)((uint64_t)frames * in->sample_rate / capture_rate) *
+                                    frame_size;
+        ALOGI("%s %u ms of pre-roll for the new input stream", __func__, in->preroll_ms);
+    }
+    return 0;
+}
 
-        if (new_client_fd < 0)
+// Detach a closing input stream. The client is closed with the last one,
+// unless it keeps capturing for the pre-roll.
+static void capture_close(struct stub_stream_in *in)
+{
+    int i;
+
+    pthread_mutex_lock(&ass.mutexlock_in);
+    for (i = 0; i < ass.in_stream_count; i++)
+    {
+        if (ass.in_streams[i] == in)
         {
-            ALOGE("%s The audio in socket server maybe shutdown as quit command is got. "
-                  "Or else, error happen. port: %d %s",
-                  __func__, pass->in_tcp_port, strerror(errno));
+            memmove(&ass.in_streams[i], &ass.in_streams[i + 1],
+                    (ass.in_stream_count - i - 1) * sizeof(ass.in_streams[0]));
+            ass.in_stream_count--;
+            break;
         }
-        else
+    }
+    if (ass.in_stream_count == 0 && ass.preroll_ms == 0)
+    {
+        if (ass.iss_read_flag && (ass.in_fd > 0 || ass.udp_mode))
         {
-            ALOGW("%s Currently only receive one input client. Close previous client(%d)",
-                  __func__, pass->in_fd);
-            pthread_mutex_lock(&pass->mutexlock_in);
-            if (ass.iss_read_flag && pass->in_fd > 0 && pass->in_fd != new_client_fd)
-            {
-                ALOGV("%s:%d send_close_cmd pthread_mutex_lock pass->in_fd %d", __func__, __LINE__, pass->in_fd);
-                if (send_close_cmd(pass->in_fd) < 0)
-                {
-                    ALOGE("Fail to notify audio in client(%d) to close.", pass->in_fd);
-                }
-            }
-            pthread_mutex_unlock(&pass->mutexlock_in);
-
-            if (pass->in_fd > 0)
-            {
-                if (epoll_ctl(pass->iss_epoll_fd, EPOLL_CTL_DEL, pass->in_fd, NULL))
-                {
-                    ALOGE("Failed to delete audio in file descriptor to epoll");
-                }
-                close_socket_fd(&(pass->in_fd));
-            }
-
-            ALOGW("%s A new audio in client connected to server. "
-                  "new_client_fd = %d. Set it to pass->in_fd",
-                  __func__, new_client_fd);
-            pass->in_fd = new_client_fd;
-            if (pass->in_fd > 0)
+            ALOGV("%s:%d send_close_cmd ass.in_fd %d", __func__, __LINE__, ass.in_fd);
+            if (send_close_cmd(ass.in_fd, AUDIO_IN) < 0)
             {
-                pthread_mutex_lock(&pass->mutexlock_in);
-                if (pass->ssi && ass.iss_read_flag) // Make sure parameters are ready.
-                {
-                    ALOGV("%s:%d send_close_cmd", __func__, __LINE__);
-                    if (send_open_cmd(pass, AUDIO_IN) < 0)
-                    {
-                        ALOGE("Fail to send OPEN command to audio in client(%d)", pass->in_fd);
-                    }
-                }
-                pthread_mutex_unlock(&pass->mutexlock_in);
-
-                struct epoll_event event;
-                event.events = EPOLLIN;
-                event.data.fd = pass->in_fd;
-                if (epoll_ctl(pass->iss_epoll_fd, EPOLL_CTL_ADD, pass->in_fd, &event))
-                {
-                    ALOGE("Failed to add audio in file descriptor to epoll");
-                }
-                ALOGI("Success to add audio in file descriptor %d to epoll, iss_epoll_fd %d", pass->in_fd, pass->iss_epoll_fd);
+                ALOGE("%s Fail to notify audio in client(%d) to close.", __func__, ass.in_fd);
             }
         }
+        ass.iss_read_flag = false;
+        if (!ass.udp_mode)
+        {
+            capture_ring_reset(&ass.capture, 0, 0);
+        }
     }
-
-    ALOGW("%s Quit. (%d)", __func__,pass->in_fd);
-    pthread_mutex_lock(&pass->mutexlock_in);
-    close_socket_fd(&(pass->in_fd));
-    close_socket_fd(&(pass->iss_fd));
-    pthread_mutex_unlock(&pass->mutexlock_in);
-    return NULL;
+    pthread_mutex_unlock(&ass.mutexlock_in);
 }
 
 static size_t samples_per_milliseconds(size_t milliseconds,
@@ -1252,9 +4196,30 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     if (out->format == AUDIO_FORMAT_DEFAULT)
         out->format = STUB_DEFAULT_AUDIO_FORMAT;
     out->frame_count = samples_per_milliseconds(
-        STUB_OUTPUT_BUFFER_MILLISECONDS,
+        ass.output_buffer_milliseconds,
         out->sample_rate, 1);
     out->stream.update_source_metadata = out_update_source_metadata;
+    atomic_store(&out->latency_ms, ass.output_buffer_milliseconds);
+    out->client_queued_frames = -1;
+    out->open_ns = monotonic_time_ns();
+    out->first_sound_us = -1;
+    out->open_first_sound_us = -1;
+    if (audio_drift_enabled() && audio_drift_supported(out->format))
+    {
+        out->drift_generation = atomic_load(&ass.out_client_generation);
+        out->drift_enabled = audio_drift_reset(&out->drift, out->format,
+                                               audio_channel_count_from_out_mask(out->channel_mask),
+                                               out->sample_rate, audio_drift_out_target_ms(),
+                                               out->frame_count) == 0;
+    }
+    if (audio_glitch_enabled())
+    {
+        audio_glitch_reset(&out->glitch, out->format,
+                           audio_channel_count_from_out_mask(out->channel_mask), out->sample_rate,
+                           out->frame_count);
+    }
+    out->tap = audio_tap_open(AUDIO_TAP_OUT, handle, out->format,
+                              audio_channel_count_from_out_mask(out->channel_mask), out->sample_rate);
 
     ALOGV("adev_open_output_stream: sample_rate: %u, channels: %x, format: %d,"
           " frames: %zu",
@@ -1262,12 +4227,10 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
           out->frame_count);
     *stream_out = &out->stream;
     ass.sso = out;
+    atomic_store_explicit(&ass.telemetry->out.sample_rate, out->sample_rate, memory_order_relaxed);
     pthread_mutex_lock(&ass.mutexlock_out);
 
-    if (ATRACE_ENABLED())
-    {
-        ATRACE_INT("avh_adv_open_output_stream_before_send_open_cmd", ass.oss_is_sent_open_cmd);
-    }
+    audio_trace(AUDIO_TRACE_OPEN_OUTPUT_BEFORE_SEND_OPEN, ass.oss_is_sent_open_cmd);
     if (ass.oss_is_sent_open_cmd == 0)
     {
         if (send_open_cmd(&ass, AUDIO_OUT) < 0)
@@ -1280,10 +4243,7 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
             ALOGE("ass.oss_is_sent_open_cmd is set to %d", ass.oss_is_sent_open_cmd);
         }
     }
-    if (ATRACE_ENABLED())
-    {
-        ATRACE_INT("avh_adv_open_output_stream_after_send_open_cmd", ass.oss_is_sent_open_cmd);
-    }
+    audio_trace(AUDIO_TRACE_OPEN_OUTPUT_AFTER_SEND_OPEN, ass.oss_is_sent_open_cmd);
     pthread_mutex_unlock(&ass.mutexlock_out);
     return 0;
 }
@@ -1292,28 +4252,37 @@ static void adev_close_output_stream(struct audio_hw_device *dev,
                                      struct audio_stream_out *stream)
 {
     pthread_mutex_lock(&ass.mutexlock_out);
-    if (send_close_cmd(ass.out_fd) < 0)
+    if (send_close_cmd(ass.out_fd, AUDIO_OUT) < 0)
     {
         ALOGE("Fail to notify audio out client(%d) to close.", ass.out_fd);
     }
     ass.sso = NULL;
     ass.oss_is_sent_open_cmd = 0;
+    ass.out_stop_pending = false;
     pthread_mutex_unlock(&ass.mutexlock_out);
     ALOGV("adev_close_output_stream...");
+    if (((struct stub_stream_out *)stream)->clock_attached)
+    {
+        audio_clock_detach();
+    }
+    audio_tap_close(((struct stub_stream_out *)stream)->tap);
+    audio_glitch_release(&((struct stub_stream_out *)stream)->glitch);
+    audio_drift_release(&((struct stub_stream_out *)stream)->drift);
+    free(((struct stub_stream_out *)stream)->drift_buffer);
     free(stream);
 }
 
 static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
 {
-    ALOGV("adev_set_parameters");
-    return -ENOSYS;
+    ALOGV("adev_set_parameters: %s", kvpairs);
+    return set_control_parameters(kvpairs);
 }
 
 static char *adev_get_parameters(const struct audio_hw_device *dev,
                                  const char *keys)
 {
     ALOGV("adev_get_parameters");
-    return strdup("");
+    return get_probe_parameters(keys, NULL);
 }
 
 static int adev_init_check(const struct audio_hw_device *dev)
@@ -1408,6 +4377,7 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
 {
     ALOGV("adev_open_input_stream...");
     struct stub_audio_device *adev = (struct stub_audio_device *)dev;
+    int ret;
     *stream_in = NULL;
     struct stub_stream_in *in = (struct stub_stream_in *)calloc(1, sizeof(struct stub_stream_in));
     if (!in)
@@ -1427,6 +4397,7 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
     in->stream.set_gain = in_set_gain;
     in->stream.read = in_read;
     in->stream.get_input_frames_lost = in_get_input_frames_lost;
+    in->stream.get_capture_position = in_get_capture_position;
     in->sample_rate = config->sample_rate;
     if (in->sample_rate == 0)
         in->sample_rate = STUB_DEFAULT_SAMPLE_RATE;
@@ -1439,14 +4410,56 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
     in->frame_count = samples_per_milliseconds(
         ass.input_buffer_milliseconds, in->sample_rate, 1);
     in->dev = adev;
+    if (audio_drift_enabled() && audio_drift_supported(in->format))
+    {
+        int target_ms = audio_drift_in_target_ms(ass.input_buffer_milliseconds);
+        in->drift_enabled = audio_drift_reset(&in->drift, in->format,
+                                              audio_channel_count_from_in_mask(in->channel_mask),
+                                              in->sample_rate, target_ms, in->frame_count) == 0;
+    }
 
     ALOGV("adev_open_input_stream: sample_rate: %u, channels: %x, format: %d,"
           "frames: %zu",
           in->sample_rate, in->channel_mask, in->format,
           in->frame_count);
+    if (ass.udp_mode)
+    {
+        // The UDP jitter buffer has a single reader.
+        pthread_mutex_lock(&ass.mutexlock_in);
+        ret = ass.in_stream_count > 0 ? -EBUSY : 0;
+        if (ret == 0)
+        {
+            ass.capture_config.sample_rate = in->sample_rate;
+            ass.capture_config.channel_mask = in->channel_mask;
+            ass.capture_config.format = in->format;
+            ass.in_streams[ass.in_stream_count++] = in;
+        }
+        pthread_mutex_unlock(&ass.mutexlock_in);
+        if (ret == 0)
+        {
+            audio_udp_open_input(in->sample_rate * audio_stream_in_frame_size(&in->stream) / 1000);
+        }
+    }
+    else
+    {
+        ret = capture_open(in, config);
+    }
+    if (ret < 0)
+    {
+        ALOGE("%s: cannot open the input stream: %d", __func__, ret);
+        audio_drift_release(&in->drift);
+        free(in);
+        return ret;
+    }
+    if (in == ass.in_streams[0])
+    {
+        atomic_store_explicit(&ass.telemetry->in.sample_rate, in->sample_rate,
+                              memory_order_relaxed);
+    }
+    audio_synth_open(&in->synth, in->format, in->channel_mask, in->sample_rate, in->frame_count);
+    in->tap = audio_tap_open(AUDIO_TAP_IN, handle, in->format,
+                             audio_channel_count_from_in_mask(in->channel_mask), in->sample_rate);
     *stream_in = &in->stream;
-    ass.ssi = in;
-
     return 0;
 }
 
@@ -1454,17 +4467,17 @@ static void adev_close_input_stream(struct audio_hw_device *dev,
                                     struct audio_stream_in *stream)
 {
     ALOGV("adev_close_input_stream...");
-    pthread_mutex_lock(&ass.mutexlock_in);
-    if (ass.iss_read_flag && ass.in_fd > 0)
+    capture_close((struct stub_stream_in *)stream);
+    audio_tap_close(((struct stub_stream_in *)stream)->tap);
+    audio_synth_close(&((struct stub_stream_in *)stream)->synth);
+    if (((struct stub_stream_in *)stream)->clock_attached)
     {
-        ALOGV("%s:%d send_close_cmd pthread_mutex_lock ass.in_fd %d", __func__, __LINE__, ass.in_fd);
-        if (send_close_cmd(ass.in_fd) < 0)
-        {
-            ALOGE("%s Fail to notify audio out client(%d) to close.", __func__, ass.in_fd);
-        }
+        audio_clock_detach();
     }
-    ass.iss_read_flag = false;
-    pthread_mutex_unlock(&ass.mutexlock_in);
+    audio_drift_release(&((struct stub_stream_in *)stream)->drift);
+    free(((struct stub_stream_in *)stream)->drift_buffer);
+    audio_convert_release(&((struct stub_stream_in *)stream)->convert);
+    free(((struct stub_stream_in *)stream)->convert_buffer);
 
     free(stream);
     return;
@@ -1473,13 +4486,81 @@ static void adev_close_input_stream(struct audio_hw_device *dev,
 static int adev_dump(const audio_hw_device_t *device, int fd)
 {
     ALOGV("adev_dump");
+    dprintf(fd, "Virtual audio HAL:\n");
+    dprintf(fd, "  Mode %s, out port %d client %d, in port %d client %d, duplex port %d\n",
+            ass.udp_mode ? "udp" : ass.duplex_mode ? "duplex" : "separate",
+            ass.out_tcp_port, ass.out_fd,
+            ass.in_tcp_port, ass.in_fd, ass.duplex_tcp_port);
+    dprintf(fd, "  Module opened in %lld us, standby stop delayed %d ms\n",
+            (long long)ass.open_us, ass.out_standby_delay_ms);
+    dprintf(fd, "  Controls changed %u times: next periods out %d ms in %d ms, "
+            "%u statistics resets\n",
+            atomic_load(&ass.control_generation), ass.output_buffer_milliseconds,
+            ass.input_buffer_milliseconds, atomic_load(&ass.stats_resets));
+    dprintf(fd, "  Output periods sent on this connection %lld\n",
+            (long long)ass.oss_write_count);
+    dprintf(fd, "  Socket buffers for %d periods: out sndbuf %d lowat %d, in rcvbuf %d\n",
+            ass.socket_queue_periods, ass.out_socket_sndbuf, ass.out_socket_lowat,
+            ass.in_socket_rcvbuf);
+    if (!ass.udp_mode)
+    {
+        if (ass.mic_channels > 0)
+        {
+            dprintf(fd, "  Microphone array of %d channels, %u Hz format 0x%x\n",
+                    ass.mic_channels, ass.capture_config.sample_rate,
+                    ass.capture_config.format);
+        }
+        dprintf(fd, "  Capture ring %zu bytes, overrun %llu bytes, pre-roll %d ms, "
+                "%d input streams\n",
+                ass.capture.size, (unsigned long long)ass.capture.overrun_bytes, ass.preroll_ms,
+                ass.in_stream_count);
+        dprintf(fd, "  Capture %s, %u stamps, %llu frames lost by the client\n",
+                ass.duplex_mode || ass.in_framed ? "framed" : "unframed",
+                ass.capture.stamp_count, (unsigned long long)ass.capture.lost_frames);
+    }
+    dump_thread_tuning(fd);
+    audio_clock_dump(fd);
+    audio_impair_dump(fd);
+    audio_probe_dump(fd);
+    audio_udp_dump(fd);
+    audio_synth_dump(fd);
+    audio_trace_dump(fd);
+    audio_tap_dump(fd);
+    dprintf(fd, "  Telemetry page %s\n", audio_telemetry_path());
+    if (ass.sso)
+    {
+        out_dump(&ass.sso->stream.common, fd);
+    }
+    for (int i = 0; i < ass.in_stream_count; i++)
+    {
+        in_dump(&ass.in_streams[i]->stream.common, fd);
+    }
     return 0;
 }
 
 static int adev_close(hw_device_t *device)
 {
     ALOGV("adev_close");
+    if (ass.duplex_mode)
+    {
+        ass.dss_exit = 1;
+        pthread_join(ass.dss_thread, NULL);
+        if (close(ass.dss_epoll_fd))
+        {
+            ALOGE("Failed to close duplex epoll file descriptor");
+        }
+        pthread_mutex_destroy(&ass.mutexlock_duplex_write);
+    }
     ass.oss_exit = 1;
+    if (ass.out_standby_thread_started)
+    {
+        pthread_mutex_lock(&ass.mutexlock_out);
+        pthread_cond_broadcast(&ass.out_standby_cond);
+        pthread_mutex_unlock(&ass.mutexlock_out);
+        pthread_join(ass.out_standby_thread, NULL);
+        ass.out_standby_thread_started = false;
+    }
+    pthread_cond_destroy(&ass.out_standby_cond);
     if (epoll_ctl(ass.oss_epoll_fd, EPOLL_CTL_DEL, ass.out_fd, NULL))
     {
         ALOGE("Failed to delete audio in file descriptor to epoll");
@@ -1498,6 +4579,22 @@ static int adev_close(hw_device_t *device)
 
     ass.iss_exit = 1;
     ass.iss_read_flag = false;
+    if (ass.capture_thread_started)
+    {
+        // Wake the capture thread if it is reading a frame.
+        pthread_mutex_lock(&ass.mutexlock_in);
+        if (ass.in_fd > 0)
+        {
+            shutdown(ass.in_fd, SHUT_RDWR);
+        }
+        pthread_mutex_unlock(&ass.mutexlock_in);
+        pthread_join(ass.capture_thread, NULL);
+        ass.capture_thread_started = false;
+    }
+    if (!ass.udp_mode)
+    {
+        capture_ring_destroy(&ass.capture);
+    }
     if (epoll_ctl(ass.oss_epoll_fd, EPOLL_CTL_DEL, ass.out_fd, NULL))
     {
         ALOGE("Failed to delete audio in file descriptor to epoll");
@@ -1507,13 +4604,27 @@ static int adev_close(hw_device_t *device)
         ALOGE("Failed to close output epoll file descriptor");
     }
     pthread_mutex_lock(&ass.mutexlock_in);
+    if (atomic_load(&ass.in_pending_fd) > 0)
+    {
+        close(atomic_exchange(&ass.in_pending_fd, -1));
+    }
     close_socket_fd(&(ass.in_fd));
     close_socket_fd(&(ass.iss_fd));
     pthread_mutex_unlock(&ass.mutexlock_in);
     pthread_mutex_destroy(&ass.mutexlock_in);
-
+    pthread_mutex_destroy(&ass.mutexlock_control);
+
+    audio_trace_release();
+    audio_tap_release();
+    audio_clock_release();
+    audio_impair_release();
+    audio_probe_release();
+    audio_synth_release();
+    audio_udp_release();
+    audio_telemetry_close(ass.telemetry);
+    ass.telemetry = NULL;
     free(device);
-    ass.ssi = NULL;
+    ass.in_stream_count = 0;
     return 0;
 }
 
@@ -1521,6 +4632,7 @@ static int adev_open(const hw_module_t *module, const char *name,
                      hw_device_t **device)
 {
     ALOGV("adev_open: %s", name);
+    int64_t open_begin_ns = monotonic_time_ns();
 
     //It will generate SIGPIPE when write to a closed socket, which will kill
     //the process. Ignore the signal SIGPIPE to avoid the process crash.
@@ -1566,8 +4678,54 @@ static int adev_open(const hw_module_t *module, const char *name,
 
     ALOGI("Using inet socket to process audio.");
 
+    memset(ass.thread_state, 0, sizeof(ass.thread_state));
+    ass.locked_bytes = 0;
+    ass.lock_error = 0;
+    ass.telemetry = audio_telemetry_open();
+    if (!ass.telemetry)
+    {
+        free(adev);
+        *device = NULL;
+        return -ENOMEM;
+    }
+    load_thread_tuning(&ass.thread_tuning);
+    audio_trace_init();
+    audio_tap_init();
+    audio_clock_init();
+    audio_impair_init();
+    audio_probe_init();
+    audio_drift_init();
+    audio_glitch_init();
+    audio_synth_init();
+    audio_udp_init();
+
+    // Configuration first, then the locks, epoll sets and listening
+    // sockets, and the threads last: a client may connect as soon as the
+    // first thread runs, and everything it touches must be ready by then.
+    ass.udp_mode = audio_udp_enabled();
+    ass.duplex_mode = false;
+    if (!ass.udp_mode && property_get("virtual.audio.duplex.enable", buf, "0") > 0)
+    {
+        ass.duplex_mode = atoi(buf) > 0;
+    }
+    ass.in_framed = false;
+    if (!ass.udp_mode && !ass.duplex_mode &&
+        property_get("virtual.audio.in.framed", buf, "0") > 0)
+    {
+        ass.in_framed = atoi(buf) > 0;
+    }
+    ass.duplex_tcp_port = 8769;
+    if (property_get("virtual.audio.duplex.tcp.port", buf, "") > 0)
+    {
+        ass.duplex_tcp_port = atoi(buf);
+    }
+    ass.duplex_fd = -1;
+    ass.dss_fd = -1;
+    ass.dss_exit = 0;
+
     ass.sso = NULL;
     ass.out_fd = -1;
+    atomic_store(&ass.out_client_fill_frames, -1);
     ass.oss_fd = -1;
     ass.oss_exit = 0;
 
@@ -1576,20 +4734,38 @@ static int adev_open(const hw_module_t *module, const char *name,
     {
         ass.out_tcp_port = atoi(buf);
     }
-    ALOGI("Out tcp port of INET socket %d", ass.out_tcp_port);
-
-    pthread_create(&ass.oss_thread, NULL, out_socket_sever_thread, &ass);
-    ass.oss_epoll_fd = epoll_create1(0);
-    if (ass.oss_epoll_fd == -1)
+    ass.out_stall_periods = OUT_STALL_DEFAULT_PERIODS;
+    if (property_get("virtual.audio.out.stall_periods", buf, "") > 0)
     {
-        ALOGE("Failed to create output epoll file descriptor");
+        ass.out_stall_periods = atoi(buf);
+    }
+    ass.out_standby_delay_ms = 0;
+    if (property_get("virtual.audio.out.standby_delay_ms", buf, "") > 0)
+    {
+        ass.out_standby_delay_ms = atoi(buf) > 0 ? atoi(buf) : 0;
+    }
+    ass.out_stop_pending = false;
+    ass.out_standby_thread_started = false;
+    ass.socket_queue_periods = SOCKET_DEFAULT_QUEUE_PERIODS;
+    if (property_get("virtual.audio.socket.periods", buf, "") > 0)
+    {
+        ass.socket_queue_periods = atoi(buf);
+    }
+    ass.output_buffer_milliseconds = STUB_OUTPUT_BUFFER_MILLISECONDS;
+    if (property_get("virtual.audio.out.buffer_milliseconds", buf, "") > 0 && atoi(buf) > 0)
+    {
+        ass.output_buffer_milliseconds = atoi(buf) > CONTROL_PERIOD_MAX_MILLISECONDS ?
+                                         CONTROL_PERIOD_MAX_MILLISECONDS : atoi(buf);
     }
+    atomic_store(&ass.control_generation, 0);
+    atomic_store(&ass.stats_resets, 0);
+    ALOGI("Out tcp port of INET socket %d", ass.out_tcp_port);
     ass.oss_is_sent_open_cmd = 0;
-    pthread_mutex_init(&ass.mutexlock_out, 0);
     ass.oss_write_count = 0;
 
-    ass.ssi = NULL;
+    ass.in_stream_count = 0;
     ass.in_fd = -1;
+    atomic_store(&ass.in_pending_fd, -1);
     ass.iss_fd = -1;
     ass.iss_exit = 0;
     ass.in_tcp_port = 8767;
@@ -1598,13 +4774,6 @@ static int adev_open(const hw_module_t *module, const char *name,
         ass.in_tcp_port = atoi(buf);
     }
     ALOGI("In tcp port of INET socket %d", ass.in_tcp_port);
-
-    pthread_create(&ass.iss_thread, NULL, in_socket_sever_thread, &ass);
-    ass.iss_epoll_fd = epoll_create1(0);
-    if (ass.iss_epoll_fd == -1)
-    {
-        ALOGE("Failed to create output epoll file descriptor");
-    }
     ass.iss_read_flag = false;
     if (property_get("virtual.audio.in.buffer_milliseconds", buf, "10") > 0)
     {
@@ -1624,6 +4793,43 @@ static int adev_open(const hw_module_t *module, const char *name,
         ass.input_buffer_milliseconds = STUB_INPUT_BUFFER_MILLISECONDS;
     }
     ALOGV("Input buffer milliseconds is %dms.", ass.input_buffer_milliseconds);
+    ass.preroll_ms = 0;
+    if (!ass.udp_mode && property_get("virtual.audio.in.preroll_ms", buf, "0") > 0)
+    {
+        ass.preroll_ms = atoi(buf);
+        if (ass.preroll_ms < 0)
+        {
+            ass.preroll_ms = 0;
+        }
+        else if (ass.preroll_ms > CAPTURE_PREROLL_MAX_MILLISECONDS)
+        {
+            ALOGW("Input pre-roll is greater than %dms. Set it to %dms.",
+                  CAPTURE_PREROLL_MAX_MILLISECONDS, CAPTURE_PREROLL_MAX_MILLISECONDS);
+            ass.preroll_ms = CAPTURE_PREROLL_MAX_MILLISECONDS;
+        }
+    }
+    ass.mic_channels = 0;
+    if (!ass.udp_mode && property_get("virtual.audio.in.mic_channels", buf, "0") > 0)
+    {
+        ass.mic_channels = atoi(buf);
+        if (ass.mic_channels < 0 || ass.mic_channels > AUDIO_CHANNEL_COUNT_MAX)
+        {
+            ALOGW("Input microphone array of %d channels is not supported. Ignore it.",
+                  ass.mic_channels);
+            ass.mic_channels = 0;
+        }
+    }
+    memset(&ass.capture_config, 0, sizeof(ass.capture_config));
+    ass.capture_config.sample_rate = STUB_DEFAULT_SAMPLE_RATE;
+    ass.capture_config.channel_mask = STUB_INPUT_DEFAULT_CHANNEL_MASK;
+    ass.capture_config.format = STUB_DEFAULT_AUDIO_FORMAT;
+    if (ass.mic_channels > 0)
+    {
+        ALOGI("Input microphone array of %d channels.", ass.mic_channels);
+        ass.capture_config.channel_mask =
+            audio_channel_mask_for_index_assignment_from_count(ass.mic_channels);
+    }
+    ass.capture_thread_started = false;
 
     if (property_get("acg.audio.channel.mask.enable", buf, "0") > 0)
     {
@@ -1642,8 +4848,87 @@ static int adev_open(const hw_module_t *module, const char *name,
         ass.audio_mask = 0;
     }
     ALOGV("Audio mask is %s.", ass.audio_mask ? "the mask of channel" : "the number of channel");
+
+    pthread_mutex_init(&ass.mutexlock_out, 0);
     pthread_mutex_init(&ass.mutexlock_in, 0);
+    pthread_mutex_init(&ass.mutexlock_control, 0);
+    {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&ass.out_standby_cond, &attr);
+        pthread_condattr_destroy(&attr);
+    }
+    ass.oss_epoll_fd = epoll_create1(0);
+    if (ass.oss_epoll_fd == -1)
+    {
+        ALOGE("Failed to create output epoll file descriptor");
+    }
+    ass.iss_epoll_fd = epoll_create1(0);
+    if (ass.iss_epoll_fd == -1)
+    {
+        ALOGE("Failed to create output epoll file descriptor");
+    }
+    if (!ass.udp_mode)
+    {
+        capture_ring_init(&ass.capture);
+        capture_ring_reset(&ass.capture, capture_ring_bytes(), capture_frame_size());
+    }
+    if (ass.preroll_ms > 0)
+    {
+        ALOGI("Always-on capture with %dms of pre-roll.", ass.preroll_ms);
+    }
+    if (ass.duplex_mode)
+    {
+        struct epoll_event event;
+
+        ALOGI("Full-duplex mode. Duplex tcp port of INET socket %d", ass.duplex_tcp_port);
+        pthread_mutex_init(&ass.mutexlock_duplex_write, 0);
+        ass.dss_epoll_fd = epoll_create1(0);
+        if (ass.dss_epoll_fd == -1)
+        {
+            ALOGE("Failed to create duplex epoll file descriptor");
+        }
+        ass.dss_fd = open_server_socket(ass.duplex_tcp_port);
+        event.events = EPOLLIN;
+        event.data.fd = ass.dss_fd;
+        if (ass.dss_fd >= 0 && epoll_ctl(ass.dss_epoll_fd, EPOLL_CTL_ADD, ass.dss_fd, &event))
+        {
+            ALOGE("Failed to add duplex server file descriptor to epoll");
+            close_socket_fd(&(ass.dss_fd));
+        }
+    }
+    else if (!ass.udp_mode)
+    {
+        ass.oss_fd = open_server_socket(ass.out_tcp_port);
+        ass.iss_fd = open_server_socket(ass.in_tcp_port);
+    }
+
+    if (ass.duplex_mode)
+    {
+        pthread_create(&ass.dss_thread, NULL, duplex_socket_server_thread, &ass);
+    }
+    else if (!ass.udp_mode)
+    {
+        pthread_create(&ass.oss_thread, NULL, out_socket_sever_thread, &ass);
+        pthread_create(&ass.iss_thread, NULL, in_socket_sever_thread, &ass);
+    }
+    if (!ass.duplex_mode && !ass.udp_mode)
+    {
+        ass.capture_thread_started =
+            pthread_create(&ass.capture_thread, NULL, capture_loop_thread, &ass) == 0;
+    }
+    // Started without a standby delay as well, set_control_parameters()
+    // can add one later.
+    ass.out_standby_thread_started =
+        pthread_create(&ass.out_standby_thread, NULL, out_standby_thread, &ass) == 0;
+    if (ass.udp_mode)
+    {
+        audio_udp_start(udp_receive_datagram);
+    }
 
+    ass.open_us = (monotonic_time_ns() - open_begin_ns) / 1000;
+    ALOGI("Module opened in %lld us.", (long long)ass.open_us);
     return 0;
 }
 
@@ -0,0 +1,646 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#define LOG_TAG "audio_hw_virtual"
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <log/log.h>
+
+#include <cutils/properties.h>
+
+#include "audio_impair.h"
+
+#define AUDIO_IMPAIR_RTO_MS 200 // Minimum TCP retransmission timeout
+#define AUDIO_IMPAIR_MAX_CHUNKS 1024
+#define AUDIO_IMPAIR_DEFAULT_BUFFER_KB 512
+
+struct audio_impair_config
+{
+    int delay_ms;
+    int jitter_ms;
+    int loss_percent;
+    int stall_ms;
+    int stall_interval_ms;
+    int partial_percent;
+    int bandwidth_kbps;
+    int buffer_kb;
+    uint32_t seed;
+};
+
+// One send or receive, waiting in the delay line until release_ns.
+struct audio_impair_chunk
+{
+    int64_t release_ns;
+    size_t bytes;
+};
+
+struct audio_impair_link
+{
+    int fd;                    // -1 when unbound
+    int64_t bound_ns;          // Origin of the stall schedule
+    int64_t last_release_ns;   // Releases never go backwards, as on TCP
+    int64_t bandwidth_free_ns; // When the rate limit lets the next byte through
+    int64_t last_stall;        // Index of the last stall window counted
+    uint32_t random;
+    bool delayed; // Receive side: the one way delay has been served
+    int error;    // errno of the failed send, reported to the next caller
+
+    // Delay line of the sending direction.
+    uint8_t *data;
+    size_t size;
+    uint64_t head; // Byte positions
+    uint64_t tail;
+    struct audio_impair_chunk chunks[AUDIO_IMPAIR_MAX_CHUNKS];
+    uint32_t chunk_head;
+    uint32_t chunk_tail;
+    bool busy; // The worker is writing from data[head] without the lock
+
+    uint64_t bytes;
+    uint64_t calls;
+    uint64_t partials;
+    uint64_t losses;
+    uint64_t stalls;
+    size_t queued_max;
+};
+
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // Queued data, free space, idle worker or exit
+    pthread_t thread;
+    bool thread_started;
+    bool exit;
+    struct audio_impair_config config;
+    struct audio_impair_link links[AUDIO_IMPAIR_DIRECTION_COUNT];
+} impair = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+static pthread_once_t impair_once = PTHREAD_ONCE_INIT;
+
+static const char *const audio_impair_direction_names[AUDIO_IMPAIR_DIRECTION_COUNT] = {
+    "to_client", "from_client",
+};
+
+_Atomic bool audio_impair_enabled;
+
+static void audio_impair_init_once(void)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&impair.cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static int64_t audio_impair_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void audio_impair_sleep_until_ns(int64_t deadline_ns)
+{
+    struct timespec ts = {
+        .tv_sec = deadline_ns / 1000000000LL,
+        .tv_nsec = deadline_ns % 1000000000LL,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    {
+    }
+}
+
+static int audio_impair_property(const char *name, int default_value)
+{
+    char key[64];
+    char buf[PROPERTY_VALUE_MAX] = {
+        '\0',
+    };
+
+    snprintf(key, sizeof(key), "virtual.audio.impair.%s", name);
+    if (property_get(key, buf, "") > 0)
+    {
+        return atoi(buf);
+    }
+    return default_value;
+}
+
+// xorshift32: cheap, and the same sequence for the same seed.
+static uint32_t audio_impair_random_locked(struct audio_impair_link *link)
+{
+    uint32_t x = link->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    link->random = x;
+    return x;
+}
+
+static bool audio_impair_chance_locked(struct audio_impair_link *link, int percent)
+{
+    return percent > 0 && (int)(audio_impair_random_locked(link) % 100) < percent;
+}
+
+// Delay of one send or receive beyond the fixed one way delay: jitter, and
+// a retransmission timeout when it is lost.
+static int64_t audio_impair_extra_delay_ns_locked(struct audio_impair_link *link)
+{
+    int64_t delay_ns = 0;
+
+    if (impair.config.jitter_ms > 0)
+    {
+        delay_ns += audio_impair_random_locked(link) % ((uint32_t)impair.config.jitter_ms * 1000 + 1) *
+                    1000LL;
+    }
+    if (audio_impair_chance_locked(link, impair.config.loss_percent))
+    {
+        link->losses++;
+        delay_ns += AUDIO_IMPAIR_RTO_MS * 1000000LL;
+    }
+    return delay_ns;
+}
+
+// End of the stall window now_ns falls in, or 0 when the link is not stalled.
+static int64_t audio_impair_stall_end_ns_locked(struct audio_impair_link *link, int64_t now_ns)
+{
+    int64_t interval_ns = impair.config.stall_interval_ms * 1000000LL;
+    int64_t stall_ns = impair.config.stall_ms * 1000000LL;
+    int64_t elapsed_ns = now_ns - link->bound_ns;
+    int64_t window;
+
+    if (interval_ns <= 0 || stall_ns <= 0 || elapsed_ns < interval_ns)
+    {
+        return 0;
+    }
+    window = elapsed_ns / interval_ns;
+    if (elapsed_ns - window * interval_ns >= stall_ns)
+    {
+        return 0;
+    }
+    if (window != link->last_stall)
+    {
+        link->last_stall = window;
+        link->stalls++;
+    }
+    return link->bound_ns + window * interval_ns + stall_ns;
+}
+
+static int64_t audio_impair_bandwidth_ns(size_t bytes)
+{
+    if (impair.config.bandwidth_kbps <= 0)
+    {
+        return 0;
+    }
+    return bytes * 8000000LL / impair.config.bandwidth_kbps;
+}
+
+static void audio_impair_reset_link_locked(struct audio_impair_link *link, int fd)
+{
+    link->fd = fd;
+    link->bound_ns = audio_impair_now_ns();
+    link->last_release_ns = 0;
+    link->bandwidth_free_ns = 0;
+    link->last_stall = 0;
+    link->delayed = false;
+    link->error = 0;
+    link->head = link->tail = 0;
+    link->chunk_head = link->chunk_tail = 0;
+}
+
+static ssize_t audio_impair_write_line(int fd, struct audio_impair_link *link, size_t bytes)
+{
+    size_t offset = link->head % link->size;
+    size_t done = 0;
+
+    while (done < bytes)
+    {
+        struct iovec iov[2];
+        size_t first = link->size - (offset + done) % link->size;
+        int iovcnt = 1;
+        ssize_t ret;
+
+        iov[0].iov_base = link->data + (offset + done) % link->size;
+        iov[0].iov_len = first < bytes - done ? first : bytes - done;
+        if (iov[0].iov_len < bytes - done)
+        {
+            iov[1].iov_base = link->data;
+            iov[1].iov_len = bytes - done - iov[0].iov_len;
+            iovcnt = 2;
+        }
+        ret = writev(fd, iov, iovcnt);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return -1;
+        }
+        done += ret;
+    }
+    return done;
+}
+
+// Drains the delay line of the sending direction to the socket once each
+// chunk is due, outside stall windows and within the bandwidth limit.
+static void *audio_impair_thread(void *args)
+{
+    struct audio_impair_link *link = &impair.links[AUDIO_IMPAIR_TO_CLIENT];
+
+    pthread_mutex_lock(&impair.lock);
+    while (!impair.exit)
+    {
+        struct audio_impair_chunk *chunk;
+        int64_t now_ns, due_ns, stall_end_ns;
+        size_t bytes;
+        ssize_t ret;
+        int fd;
+
+        if (link->fd < 0 || link->chunk_head == link->chunk_tail)
+        {
+            pthread_cond_wait(&impair.cond, &impair.lock);
+            continue;
+        }
+        chunk = &link->chunks[link->chunk_head % AUDIO_IMPAIR_MAX_CHUNKS];
+        now_ns = audio_impair_now_ns();
+        due_ns = chunk->release_ns;
+        stall_end_ns = audio_impair_stall_end_ns_locked(link, now_ns > due_ns ? now_ns : due_ns);
+        if (stall_end_ns > due_ns)
+        {
+            due_ns = stall_end_ns;
+        }
+        if (link->bandwidth_free_ns > due_ns)
+        {
+            due_ns = link->bandwidth_free_ns;
+        }
+        if (now_ns < due_ns)
+        {
+            struct timespec ts = {
+                .tv_sec = due_ns / 1000000000LL,
+                .tv_nsec = due_ns % 1000000000LL,
+            };
+            // Woken early by bind/unbind or exit; look at the line again.
+            pthread_cond_timedwait(&impair.cond, &impair.lock, &ts);
+            continue;
+        }
+
+        fd = link->fd;
+        bytes = chunk->bytes;
+        link->busy = true;
+        pthread_mutex_unlock(&impair.lock);
+        ret = audio_impair_write_line(fd, link, bytes);
+        pthread_mutex_lock(&impair.lock);
+        link->busy = false;
+        if (link->fd == fd)
+        {
+            if (ret < 0)
+            {
+                link->error = errno ? errno : EPIPE;
+                link->head = link->tail;
+                link->chunk_head = link->chunk_tail;
+                ALOGW("%s: dropping the delay line of client(%d): %s", __func__, fd,
+                      strerror(link->error));
+            }
+            else
+            {
+                link->head += bytes;
+                link->chunk_head++;
+                link->bandwidth_free_ns = (link->bandwidth_free_ns > now_ns ? link->bandwidth_free_ns
+                                                                            : now_ns) +
+                                          audio_impair_bandwidth_ns(bytes);
+            }
+        }
+        pthread_cond_broadcast(&impair.cond);
+    }
+    pthread_mutex_unlock(&impair.lock);
+    return NULL;
+}
+
+ssize_t audio_impair_send(int fd, const struct iovec *iov, int iovcnt)
+{
+    struct audio_impair_link *link = &impair.links[AUDIO_IMPAIR_TO_CLIENT];
+    size_t total = 0;
+    size_t bytes;
+    size_t copied = 0;
+    int64_t release_ns;
+    int i;
+
+    pthread_mutex_lock(&impair.lock);
+    if (fd < 0 || link->fd != fd || !link->data)
+    {
+        pthread_mutex_unlock(&impair.lock);
+        return writev(fd, iov, iovcnt);
+    }
+    for (i = 0; i < iovcnt; i++)
+    {
+        total += iov[i].iov_len;
+    }
+    bytes = total < link->size ? total : link->size;
+    if (bytes > 1 && audio_impair_chance_locked(link, impair.config.partial_percent))
+    {
+        bytes = 1 + audio_impair_random_locked(link) % (bytes - 1);
+    }
+    if (bytes < total)
+    {
+        link->partials++;
+    }
+    // Blocks like a full socket buffer would.
+    while (link->fd == fd && !link->error && bytes > 0 &&
+           (link->tail - link->head + bytes > link->size ||
+            link->chunk_tail - link->chunk_head == AUDIO_IMPAIR_MAX_CHUNKS))
+    {
+        pthread_cond_wait(&impair.cond, &impair.lock);
+    }
+    if (link->fd != fd || link->error)
+    {
+        errno = link->fd == fd ? link->error : EPIPE;
+        pthread_mutex_unlock(&impair.lock);
+        return -1;
+    }
+
+    for (i = 0; i < iovcnt && copied < bytes; i++)
+    {
+        size_t len = iov[i].iov_len < bytes - copied ? iov[i].iov_len : bytes - copied;
+        size_t offset = (link->tail + copied) % link->size;
+        size_t first = link->size - offset < len ? link->size - offset : len;
+
+        memcpy(link->data + offset, iov[i].iov_base, first);
+        memcpy(link->data, (const uint8_t *)iov[i].iov_base + first, len - first);
+        copied += len;
+    }
+    release_ns = audio_impair_now_ns() + impair.config.delay_ms * 1000000LL +
+                 audio_impair_extra_delay_ns_locked(link);
+    if (release_ns < link->last_release_ns)
+    {
+        release_ns = link->last_release_ns;
+    }
+    link->last_release_ns = release_ns;
+    link->chunks[link->chunk_tail % AUDIO_IMPAIR_MAX_CHUNKS].release_ns = release_ns;
+    link->chunks[link->chunk_tail % AUDIO_IMPAIR_MAX_CHUNKS].bytes = bytes;
+    link->chunk_tail++;
+    link->tail += bytes;
+    link->bytes += bytes;
+    link->calls++;
+    if (link->tail - link->head > link->queued_max)
+    {
+        link->queued_max = link->tail - link->head;
+    }
+    pthread_cond_broadcast(&impair.cond);
+    pthread_mutex_unlock(&impair.lock);
+    return bytes;
+}
+
+ssize_t audio_impair_recv(int fd, void *buffer, size_t bytes)
+{
+    struct audio_impair_link *link = &impair.links[AUDIO_IMPAIR_FROM_CLIENT];
+    int64_t now_ns, due_ns, stall_end_ns;
+    ssize_t ret;
+
+    pthread_mutex_lock(&impair.lock);
+    if (fd < 0 || link->fd != fd)
+    {
+        pthread_mutex_unlock(&impair.lock);
+        return read(fd, buffer, bytes);
+    }
+    now_ns = audio_impair_now_ns();
+    due_ns = now_ns;
+    if (!link->delayed)
+    {
+        // Data piles up in the socket during the first delay_ms, after which
+        // a reader that keeps up stays delay_ms behind the client.
+        due_ns = now_ns + impair.config.delay_ms * 1000000LL;
+        link->delayed = true;
+    }
+    stall_end_ns = audio_impair_stall_end_ns_locked(link, due_ns > now_ns ? due_ns : now_ns);
+    if (stall_end_ns > due_ns)
+    {
+        due_ns = stall_end_ns;
+    }
+    due_ns = (due_ns > now_ns ? due_ns : now_ns) + audio_impair_extra_delay_ns_locked(link);
+    if (link->bandwidth_free_ns > due_ns)
+    {
+        due_ns = link->bandwidth_free_ns;
+    }
+    if (bytes > 1 && audio_impair_chance_locked(link, impair.config.partial_percent))
+    {
+        bytes = 1 + audio_impair_random_locked(link) % (bytes - 1);
+        link->partials++;
+    }
+    pthread_mutex_unlock(&impair.lock);
+
+    audio_impair_sleep_until_ns(due_ns);
+    ret = read(fd, buffer, bytes);
+
+    pthread_mutex_lock(&impair.lock);
+    if (ret > 0 && link->fd == fd)
+    {
+        link->bytes += ret;
+        link->calls++;
+        link->bandwidth_free_ns = due_ns + audio_impair_bandwidth_ns(ret);
+    }
+    pthread_mutex_unlock(&impair.lock);
+    return ret;
+}
+
+int audio_impair_init(void)
+{
+    struct audio_impair_link *out = &impair.links[AUDIO_IMPAIR_TO_CLIENT];
+    char buf[PROPERTY_VALUE_MAX] = {
+        '\0',
+    };
+    int i;
+
+    pthread_once(&impair_once, audio_impair_init_once);
+    pthread_mutex_lock(&impair.lock);
+    for (i = 0; i < AUDIO_IMPAIR_DIRECTION_COUNT; i++)
+    {
+        impair.links[i].fd = -1;
+    }
+    pthread_mutex_unlock(&impair.lock);
+
+    property_get("virtual.audio.impair", buf, "0");
+    if (atoi(buf) <= 0)
+    {
+        return 0;
+    }
+    impair.config.delay_ms = audio_impair_property("delay_ms", 0);
+    impair.config.jitter_ms = audio_impair_property("jitter_ms", 0);
+    impair.config.loss_percent = audio_impair_property("loss_percent", 0);
+    impair.config.stall_ms = audio_impair_property("stall_ms", 0);
+    impair.config.stall_interval_ms = audio_impair_property("stall_interval_ms", 0);
+    impair.config.partial_percent = audio_impair_property("partial_percent", 0);
+    impair.config.bandwidth_kbps = audio_impair_property("bandwidth_kbps", 0);
+    impair.config.buffer_kb = audio_impair_property("buffer_kb", AUDIO_IMPAIR_DEFAULT_BUFFER_KB);
+    impair.config.seed = audio_impair_property("seed", 1);
+    if (impair.config.buffer_kb <= 0)
+    {
+        impair.config.buffer_kb = AUDIO_IMPAIR_DEFAULT_BUFFER_KB;
+    }
+
+    out->size = impair.config.buffer_kb * 1024;
+    out->data = malloc(out->size);
+    if (!out->data)
+    {
+        ALOGE("%s: cannot allocate the %d KB delay line", __func__, impair.config.buffer_kb);
+        return -ENOMEM;
+    }
+    for (i = 0; i < AUDIO_IMPAIR_DIRECTION_COUNT; i++)
+    {
+        // xorshift must not start from 0.
+        impair.links[i].random = impair.config.seed * 2654435761u + i + 1;
+    }
+    impair.exit = false;
+    if (pthread_create(&impair.thread, NULL, audio_impair_thread, NULL) != 0)
+    {
+        ALOGE("%s: cannot start the delay line thread", __func__);
+        free(out->data);
+        out->data = NULL;
+        return -EAGAIN;
+    }
+    impair.thread_started = true;
+    atomic_store_explicit(&audio_impair_enabled, true, memory_order_relaxed);
+    ALOGW("Network impairment on: delay %dms jitter %dms loss %d%% stall %d/%dms "
+          "partial %d%% bandwidth %dkbps",
+          impair.config.delay_ms, impair.config.jitter_ms, impair.config.loss_percent,
+          impair.config.stall_ms, impair.config.stall_interval_ms,
+          impair.config.partial_percent, impair.config.bandwidth_kbps);
+    return 0;
+}
+
+void audio_impair_release(void)
+{
+    struct audio_impair_link *out = &impair.links[AUDIO_IMPAIR_TO_CLIENT];
+
+    if (!impair.thread_started)
+    {
+        return;
+    }
+    atomic_store_explicit(&audio_impair_enabled, false, memory_order_relaxed);
+    pthread_mutex_lock(&impair.lock);
+    impair.exit = true;
+    pthread_cond_broadcast(&impair.cond);
+    pthread_mutex_unlock(&impair.lock);
+    pthread_join(impair.thread, NULL);
+    impair.thread_started = false;
+
+    pthread_mutex_lock(&impair.lock);
+    free(out->data);
+    memset(impair.links, 0, sizeof(impair.links));
+    pthread_mutex_unlock(&impair.lock);
+}
+
+void audio_impair_bind(int direction, int fd)
+{
+    struct audio_impair_link *link;
+
+    if (!atomic_load_explicit(&audio_impair_enabled, memory_order_relaxed) || direction < 0 ||
+        direction >= AUDIO_IMPAIR_DIRECTION_COUNT)
+    {
+        return;
+    }
+    link = &impair.links[direction];
+    pthread_mutex_lock(&impair.lock);
+    while (link->busy)
+    {
+        pthread_cond_wait(&impair.cond, &impair.lock);
+    }
+    audio_impair_reset_link_locked(link, fd);
+    pthread_cond_broadcast(&impair.cond);
+    pthread_mutex_unlock(&impair.lock);
+}
+
+void audio_impair_unbind(int fd)
+{
+    int i;
+
+    if (!atomic_load_explicit(&audio_impair_enabled, memory_order_relaxed) || fd < 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&impair.lock);
+    for (i = 0; i < AUDIO_IMPAIR_DIRECTION_COUNT; i++)
+    {
+        struct audio_impair_link *link = &impair.links[i];
+        while (link->fd == fd && link->busy)
+        {
+            pthread_cond_wait(&impair.cond, &impair.lock);
+        }
+        if (link->fd == fd)
+        {
+            audio_impair_reset_link_locked(link, -1);
+        }
+    }
+    pthread_cond_broadcast(&impair.cond);
+    pthread_mutex_unlock(&impair.lock);
+}
+
+size_t audio_impair_queued(int fd)
+{
+    const struct audio_impair_link *link = &impair.links[AUDIO_IMPAIR_TO_CLIENT];
+    size_t queued = 0;
+
+    if (!atomic_load_explicit(&audio_impair_enabled, memory_order_relaxed) || fd < 0)
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&impair.lock);
+    if (link->fd == fd)
+    {
+        queued = link->tail - link->head;
+    }
+    pthread_mutex_unlock(&impair.lock);
+    return queued;
+}
+
+void audio_impair_dump(int fd)
+{
+    int i;
+
+    if (!atomic_load_explicit(&audio_impair_enabled, memory_order_relaxed))
+    {
+        dprintf(fd, "  impair: off\n");
+        return;
+    }
+    pthread_mutex_lock(&impair.lock);
+    dprintf(fd, "  impair: delay %dms jitter %dms loss %d%% stall %d/%dms partial %d%% "
+                "bandwidth %dkbps seed %u\n",
+            impair.config.delay_ms, impair.config.jitter_ms, impair.config.loss_percent,
+            impair.config.stall_ms, impair.config.stall_interval_ms,
+            impair.config.partial_percent, impair.config.bandwidth_kbps, impair.config.seed);
+    for (i = 0; i < AUDIO_IMPAIR_DIRECTION_COUNT; i++)
+    {
+        const struct audio_impair_link *link = &impair.links[i];
+        dprintf(fd, "    %s: fd %d bytes %llu calls %llu partial %llu lost %llu stalls %llu",
+                audio_impair_direction_names[i], link->fd, (unsigned long long)link->bytes,
+                (unsigned long long)link->calls, (unsigned long long)link->partials,
+                (unsigned long long)link->losses, (unsigned long long)link->stalls);
+        if (i == AUDIO_IMPAIR_TO_CLIENT)
+        {
+            dprintf(fd, " queued %llu (max %zu) bytes",
+                    (unsigned long long)(link->tail - link->head), link->queued_max);
+        }
+        dprintf(fd, "\n");
+    }
+    pthread_mutex_unlock(&impair.lock);
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#ifndef AUDIO_IMPAIR_H
+#define AUDIO_IMPAIR_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Network impairment shim between the stream code and the client sockets,
+// for reproducing bad links on one machine. Off by default; enabled with
+// virtual.audio.impair=1 and configured through virtual.audio.impair.*:
+//
+//   delay_ms           one way latency
+//   jitter_ms          extra latency, uniform in [0, jitter_ms]
+//   loss_percent       chance a send or receive is lost; on TCP this shows
+//                      up as a retransmission stall of AUDIO_IMPAIR_RTO_MS
+//   stall_ms, stall_interval_ms
+//                      the link stops for stall_ms every stall_interval_ms
+//   partial_percent    chance a send or receive moves only part of the data
+//   bandwidth_kbps     rate limit, 0 for none
+//   buffer_kb          capacity of the sending delay line
+//   seed               random seed, so runs are reproducible
+//
+// Sends to the bound playback socket go through a delay line drained by a
+// worker thread; receives from the bound capture socket are delayed in the
+// calling thread. Traffic on any other descriptor passes through untouched.
+enum audio_impair_direction
+{
+    AUDIO_IMPAIR_TO_CLIENT = 0, // out_fd, or the duplex connection
+    AUDIO_IMPAIR_FROM_CLIENT,   // in_fd, or the duplex connection
+    AUDIO_IMPAIR_DIRECTION_COUNT
+};
+
+extern _Atomic bool audio_impair_enabled;
+
+ssize_t audio_impair_send(int fd, const struct iovec *iov, int iovcnt);
+ssize_t audio_impair_recv(int fd, void *buffer, size_t bytes);
+
+// Drop-in replacements for writev()/read() on client sockets.
+static inline ssize_t audio_impair_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    if (atomic_load_explicit(&audio_impair_enabled, memory_order_relaxed))
+    {
+        return audio_impair_send(fd, iov, iovcnt);
+    }
+    return writev(fd, iov, iovcnt);
+}
+
+static inline ssize_t audio_impair_read(int fd, void *buffer, size_t bytes)
+{
+    if (atomic_load_explicit(&audio_impair_enabled, memory_order_relaxed))
+    {
+        return audio_impair_recv(fd, buffer, bytes);
+    }
+    return read(fd, buffer, bytes);
+}
+
+// Read the properties and start the delay line worker when enabled.
+int audio_impair_init(void);
+void audio_impair_release(void);
+
+// A newly accepted client socket takes over a direction; data still queued
+// for the previous one is dropped. Call audio_impair_unbind() after
+// shutdown() and before close(), so the worker never writes to a reused fd.
+void audio_impair_bind(int direction, int fd);
+void audio_impair_unbind(int fd);
+
+// Bytes sent to fd that are still in the delay line, 0 when fd is not the
+// bound playback socket.
+size_t audio_impair_queued(int fd);
+
+void audio_impair_dump(int fd);
+
+#endif // AUDIO_IMPAIR_H
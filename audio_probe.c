@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "audio_hw_virtual"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <log/log.h>
+
+#include <cutils/properties.h>
+#include <cutils/str_parms.h>
+
+#include "audio_probe.h"
+
+#define AUDIO_PROBE_SMOOTHING 8 // Weight 1/8 for a new sample, as TCP srtt
+
+struct audio_probe
+{
+    pthread_mutex_t lock;
+    int interval_ms;
+    uint32_t next_id;
+    int64_t next_ns; // When the next ping is due
+    bool waiting;
+    uint32_t waiting_id;
+    int64_t waiting_since_ns;
+
+    int64_t window_rtt_ns[AUDIO_PROBE_WINDOW];
+    int64_t window_offset_ns[AUDIO_PROBE_WINDOW];
+    int window_count;
+    int window_pos;
+    struct audio_probe_estimate estimate;
+
+    uint64_t pings;
+    uint64_t lost;  // Unanswered within AUDIO_PROBE_TIMEOUT_MS
+    uint64_t stale; // Answers to a ping that is no longer outstanding
+};
+
+static struct audio_probe probe = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int64_t smooth(int64_t average, int64_t sample, bool first)
+{
+    return first ? sample : average + (sample - average) / AUDIO_PROBE_SMOOTHING;
+}
+
+static void reset_locked(void)
+{
+    probe.next_ns = 0;
+    probe.waiting = false;
+    probe.window_count = 0;
+    probe.window_pos = 0;
+    memset(&probe.estimate, 0, sizeof(probe.estimate));
+    probe.estimate.output_latency_ns = -1;
+}
+
+int audio_probe_init(void)
+{
+    char buf[PROPERTY_VALUE_MAX];
+
+    pthread_mutex_lock(&probe.lock);
+    probe.interval_ms = 0;
+    if (property_get("virtual.audio.probe.interval_ms", buf, "0") > 0)
+    {
+        probe.interval_ms = atoi(buf) > 0 ? atoi(buf) : 0;
+    }
+    probe.next_id = 1;
+    probe.pings = 0;
+    probe.lost = 0;
+    probe.stale = 0;
+    reset_locked();
+    pthread_mutex_unlock(&probe.lock);
+    if (probe.interval_ms > 0)
+    {
+        ALOGI("%s: ping the output client every %d ms.", __func__, probe.interval_ms);
+    }
+    return 0;
+}
+
+void audio_probe_release(void)
+{
+    pthread_mutex_lock(&probe.lock);
+    probe.interval_ms = 0;
+    reset_locked();
+    pthread_mutex_unlock(&probe.lock);
+}
+
+bool audio_probe_enabled(void)
+{
+    return probe.interval_ms > 0;
+}
+
+void audio_probe_reset(void)
+{
+    pthread_mutex_lock(&probe.lock);
+    reset_locked();
+    pthread_mutex_unlock(&probe.lock);
+}
+
+bool audio_probe_next(int64_t now_ns, uint32_t *id)
+{
+    bool due = false;
+
+    pthread_mutex_lock(&probe.lock);
+    if (probe.waiting && now_ns - probe.waiting_since_ns >= AUDIO_PROBE_TIMEOUT_MS * 1000000LL)
+    {
+        probe.waiting = false;
+        probe.lost++;
+    }
+    if (probe.interval_ms > 0 && !probe.waiting && now_ns >= probe.next_ns)
+    {
+        probe.waiting = true;
+        probe.waiting_id = probe.next_id++;
+        probe.waiting_since_ns = now_ns;
+        probe.next_ns = now_ns + probe.interval_ms * 1000000LL;
+        probe.pings++;
+        *id = probe.waiting_id;
+        due = true;
+    }
+    pthread_mutex_unlock(&probe.lock);
+    return due;
+}
+
+bool audio_probe_waiting(void)
+{
+    bool waiting;
+
+    pthread_mutex_lock(&probe.lock);
+    waiting = probe.waiting;
+    pthread_mutex_unlock(&probe.lock);
+    return waiting;
+}
+
+void audio_probe_pong(const struct audio_probe_sample *sample)
+{
+    struct audio_probe_estimate *est = &probe.estimate;
+    int64_t host_send_ns;
+    int64_t rtt_ns;
+    int64_t offset_ns;
+    int64_t delay_ns;
+    bool first;
+    int i, best;
+
+    pthread_mutex_lock(&probe.lock);
+    if (!probe.waiting || sample->id != probe.waiting_id)
+    {
+        probe.stale++;
+        pthread_mutex_unlock(&probe.lock);
+        return;
+    }
+    probe.waiting = false;
+
+    // Round trip without the time the client held the ping, and the offset
+    // that puts the client's receive and send halfway along it.
+    host_send_ns = sample->host_send_ns ? sample->host_send_ns : sample->host_receive_ns;
+    rtt_ns = (sample->guest_receive_ns - sample->guest_send_ns) -
+             (host_send_ns - sample->host_receive_ns);
+    if (rtt_ns < 0)
+    {
+        rtt_ns = 0;
+    }
+    offset_ns = ((sample->host_receive_ns - sample->guest_send_ns) +
+                 (host_send_ns - sample->guest_receive_ns)) / 2;
+
+    probe.window_rtt_ns[probe.window_pos] = rtt_ns;
+    probe.window_offset_ns[probe.window_pos] = offset_ns;
+    probe.window_pos = (probe.window_pos + 1) % AUDIO_PROBE_WINDOW;
+    if (probe.window_count < AUDIO_PROBE_WINDOW)
+    {
+        probe.window_count++;
+    }
+    // Queueing only ever adds delay, so the fastest round trip is the one
+    // whose offset is least skewed by an asymmetric path.
+    best = 0;
+    for (i = 1; i < probe.window_count; i++)
+    {
+        if (probe.window_rtt_ns[i] < probe.window_rtt_ns[best])
+        {
+            best = i;
+        }
+    }
+
+    first = est->samples == 0;
+    est->samples++;
+    est->rtt_ns = smooth(est->rtt_ns, rtt_ns, first);
+    est->rtt_min_ns = probe.window_rtt_ns[best];
+    est->clock_offset_ns = probe.window_offset_ns[best];
+    // The ping left behind the period just written, so its delay includes
+    // whatever audio was still queued in front of it.
+    delay_ns = sample->host_receive_ns - est->clock_offset_ns - sample->guest_send_ns;
+    est->one_way_ns = smooth(est->one_way_ns, delay_ns > 0 ? delay_ns : 0, first);
+    if (sample->host_render_ns)
+    {
+        delay_ns = sample->host_render_ns - est->clock_offset_ns - sample->guest_send_ns;
+        est->output_latency_ns = smooth(est->output_latency_ns, delay_ns > 0 ? delay_ns : 0,
+                                        est->output_latency_ns < 0);
+    }
+    pthread_mutex_unlock(&probe.lock);
+}
+
+bool audio_probe_get(struct audio_probe_estimate *estimate)
+{
+    pthread_mutex_lock(&probe.lock);
+    *estimate = probe.estimate;
+    pthread_mutex_unlock(&probe.lock);
+    return estimate->samples > 0;
+}
+
+static void add_us(struct str_parms *reply, const char *key, int64_t ns)
+{
+    char value[32];
+    snprintf(value, sizeof(value), "%" PRId64, ns / 1000);
+    str_parms_add_str(reply, key, value);
+}
+
+void audio_probe_get_parameters(struct str_parms *query, struct str_parms *reply)
+{
+    struct audio_probe_estimate est;
+
+    if (!audio_probe_get(&est))
+    {
+        return;
+    }
+    if (str_parms_has_key(query, AUDIO_PARAMETER_PROBE_RTT))
+    {
+        add_us(reply, AUDIO_PARAMETER_PROBE_RTT, est.rtt_ns);
+    }
+    if (str_parms_has_key(query, AUDIO_PARAMETER_PROBE_ONE_WAY))
+    {
+        add_us(reply, AUDIO_PARAMETER_PROBE_ONE_WAY, est.one_way_ns);
+    }
+    if (str_parms_has_key(query, AUDIO_PARAMETER_PROBE_CLOCK_OFFSET))
+    {
+        add_us(reply, AUDIO_PARAMETER_PROBE_CLOCK_OFFSET, est.clock_offset_ns);
+    }
+    if (str_parms_has_key(query, AUDIO_PARAMETER_PROBE_OUTPUT_LATENCY) &&
+        est.output_latency_ns >= 0)
+    {
+        add_us(reply, AUDIO_PARAMETER_PROBE_OUTPUT_LATENCY, est.output_latency_ns);
+    }
+}
+
+void audio_probe_dump(int fd)
+{
+    struct audio_probe_estimate est;
+
+    if (!audio_probe_enabled())
+    {
+        dprintf(fd, "  latency probe: off\n");
+        return;
+    }
+    pthread_mutex_lock(&probe.lock);
+    est = probe.estimate;
+    dprintf(fd, "  latency probe: every %dms, pings %llu answered %llu lost %llu stale %llu\n",
+            probe.interval_ms, (unsigned long long)probe.pings, (unsigned long long)est.samples,
+            (unsigned long long)probe.lost, (unsigned long long)probe.stale);
+    pthread_mutex_unlock(&probe.lock);
+    if (est.samples == 0)
+    {
+        return;
+    }
+    dprintf(fd, "    rtt %lldus (min %lldus) one way %lldus clock offset %lldus",
+            (long long)(est.rtt_ns / 1000), (long long)(est.rtt_min_ns / 1000),
+            (long long)(est.one_way_ns / 1000), (long long)(est.clock_offset_ns / 1000));
+    if (est.output_latency_ns >= 0)
+    {
+        dprintf(fd, " output latency %lldus", (long long)(est.output_latency_ns / 1000));
+    }
+    dprintf(fd, "\n");
+}
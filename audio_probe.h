@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef AUDIO_PROBE_H
+#define AUDIO_PROBE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <cutils/str_parms.h>
+
+// Latency probe of the output connection. Every interval_ms the sender
+// follows a period with CMD_PING carrying its CLOCK_MONOTONIC time; the
+// client answers with CMD_PONG echoing that time together with its own
+// receive, send and render times. The round trips give a running estimate
+// of the round trip time, the one way delay, the offset between the two
+// clocks and the write-to-render latency, NTP style: the clock offset is
+// the one of the fastest round trip among the last AUDIO_PROBE_WINDOW.
+// As with NTP, a path slower in one direction than the other cannot be told
+// apart from a clock offset; the one way delay assumes a symmetric path.
+// The ping is that asymmetric path: it queues behind the output audio on
+// its way out and the pong does not, so the clock offset is skewed by up
+// to the audio in flight. It describes the link; do not map client
+// timestamps onto our clock with it.
+//
+// Off unless virtual.audio.probe.interval_ms is set, since clients that
+// predate CMD_PING do not answer it.
+#define AUDIO_PROBE_WINDOW 8
+#define AUDIO_PROBE_TIMEOUT_MS 1000 // A ping unanswered for this long is lost
+
+// Keys of get_parameters() on the device and on the output stream.
+#define AUDIO_PARAMETER_PROBE_RTT "latency_probe_rtt_us"
+#define AUDIO_PARAMETER_PROBE_ONE_WAY "latency_probe_one_way_us"
+#define AUDIO_PARAMETER_PROBE_CLOCK_OFFSET "latency_probe_clock_offset_us"
+#define AUDIO_PARAMETER_PROBE_OUTPUT_LATENCY "latency_probe_output_latency_us"
+
+// One answered ping. guest_* are CLOCK_MONOTONIC here, host_* are the
+// client's clock; host_send_ns and host_render_ns are 0 when unknown.
+struct audio_probe_sample
+{
+    uint32_t id;
+    int64_t guest_send_ns;
+    int64_t host_receive_ns;
+    int64_t host_send_ns;
+    int64_t host_render_ns; // When the period before the ping is heard
+    int64_t guest_receive_ns;
+};
+
+struct audio_probe_estimate
+{
+    uint64_t samples;
+    int64_t rtt_ns;            // Smoothed, without the client's turnaround
+    int64_t rtt_min_ns;        // Over the last AUDIO_PROBE_WINDOW samples
+    int64_t one_way_ns;        // Smoothed guest to client delay
+    int64_t clock_offset_ns;   // Client clock minus guest clock, plus half the output queue
+    int64_t output_latency_ns; // Smoothed write to render, -1 when unknown
+};
+
+// Read virtual.audio.probe.interval_ms.
+int audio_probe_init(void);
+void audio_probe_release(void);
+bool audio_probe_enabled(void);
+// A new client: its clock has nothing to do with the previous one.
+void audio_probe_reset(void);
+
+// True when a ping is due at now_ns; it is then outstanding under *id.
+bool audio_probe_next(int64_t now_ns, uint32_t *id);
+// True while a ping waits for its answer.
+bool audio_probe_waiting(void);
+void audio_probe_pong(const struct audio_probe_sample *sample);
+
+// False until the first answer.
+bool audio_probe_get(struct audio_probe_estimate *estimate);
+// Add the AUDIO_PARAMETER_PROBE_* keys asked for in query to reply.
+void audio_probe_get_parameters(struct str_parms *query, struct str_parms *reply);
+void audio_probe_dump(int fd);
+
+#endif // AUDIO_PROBE_H
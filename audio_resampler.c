@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "audio_hw_virtual"
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <log/log.h>
+
+#include "audio_resampler.h"
+
+#define AUDIO_RESAMPLER_HISTORY_FRAMES 2
+
+bool audio_resampler_supported(audio_format_t format)
+{
+    return format == AUDIO_FORMAT_PCM_16_BIT || format == AUDIO_FORMAT_PCM_32_BIT ||
+           format == AUDIO_FORMAT_PCM_FLOAT;
+}
+
+static bool reserve_frames(struct audio_resampler *resampler, size_t frames)
+{
+    float *fifo;
+
+    if (frames <= resampler->fifo_capacity)
+    {
+        return true;
+    }
+    fifo = realloc(resampler->fifo, frames * resampler->channels * sizeof(float));
+    if (!fifo)
+    {
+        return false;
+    }
+    resampler->fifo = fifo;
+    resampler->fifo_capacity = frames;
+    return true;
+}
+
+int audio_resampler_reset(struct audio_resampler *resampler, audio_format_t out_format,
+                          uint32_t channels, double step, size_t capacity_frames)
+{
+    if (channels != resampler->channels)
+    {
+        audio_resampler_release(resampler);
+    }
+    resampler->out_format = out_format;
+    resampler->channels = channels;
+    resampler->step = step;
+    resampler->fifo_frames = 0;
+    resampler->pos = 0;
+    if (channels == 0 || !reserve_frames(resampler, capacity_frames + 2 * AUDIO_RESAMPLER_HISTORY_FRAMES))
+    {
+        return -ENOMEM;
+    }
+    // Start from silence: the first output frame is the second history frame.
+    memset(resampler->fifo, 0, AUDIO_RESAMPLER_HISTORY_FRAMES * channels * sizeof(float));
+    resampler->fifo_frames = AUDIO_RESAMPLER_HISTORY_FRAMES;
+    resampler->pos = AUDIO_RESAMPLER_HISTORY_FRAMES - 1;
+    return 0;
+}
+
+void audio_resampler_release(struct audio_resampler *resampler)
+{
+    free(resampler->fifo);
+    resampler->fifo = NULL;
+    resampler->fifo_capacity = 0;
+    resampler->fifo_frames = 0;
+}
+
+size_t audio_resampler_input_frames(const struct audio_resampler *resampler, size_t out_frames)
+{
+    size_t needed;
+
+    if (out_frames == 0)
+    {
+        return 0;
+    }
+    // The last output frame interpolates between FIFO frames i - 1 .. i + 2.
+    needed = (size_t)(resampler->pos + (out_frames - 1) * resampler->step) + 3;
+    return needed > resampler->fifo_frames ? needed - resampler->fifo_frames : 0;
+}
+
+double audio_resampler_queued_frames(const struct audio_resampler *resampler)
+{
+    return resampler->fifo_frames - resampler->pos;
+}
+
+float *audio_resampler_append(struct audio_resampler *resampler, size_t frames)
+{
+    float *dst;
+
+    if (!reserve_frames(resampler, resampler->fifo_frames + frames))
+    {
+        ALOGE("%s: cannot queue %zu frames.", __func__, frames);
+        return NULL;
+    }
+    dst = resampler->fifo + resampler->fifo_frames * resampler->channels;
+    resampler->fifo_frames += frames;
+    return dst;
+}
+
+static void store_sample(audio_format_t format, void *out, size_t index, float value)
+{
+    switch (format)
+    {
+    case AUDIO_FORMAT_PCM_16_BIT:
+        value = lrintf(value * 32768.0f);
+        ((int16_t *)out)[index] = value > 32767.0f ? 32767 : value < -32768.0f ? -32768 : value;
+        break;
+    case AUDIO_FORMAT_PCM_32_BIT:
+    {
+        double scaled = nearbyint(value * 2147483648.0);
+        ((int32_t *)out)[index] = scaled > 2147483647.0 ? INT32_MAX :
+                                  scaled < -2147483648.0 ? INT32_MIN : (int32_t)scaled;
+        break;
+    }
+    default:
+        ((float *)out)[index] = value;
+        break;
+    }
+}
+
+size_t audio_resampler_process(struct audio_resampler *resampler, void *out,
+                               size_t max_out_frames)
+{
+    const uint32_t channels = resampler->channels;
+    size_t produced = 0;
+    size_t drop;
+    uint32_t c;
+
+    while (produced < max_out_frames)
+    {
+        size_t i = (size_t)resampler->pos;
+        float f = (float)(resampler->pos - i);
+        const float *x;
+
+        if (i + 2 >= resampler->fifo_frames)
+        {
+            break;
+        }
+        // Catmull-Rom through frames i - 1 .. i + 2; exactly x[i] at f = 0,
+        // so a ratio of 1 passes the input through unchanged.
+        x = resampler->fifo + (i - 1) * channels;
+        for (c = 0; c < channels; c++)
+        {
+            float xm1 = x[c], x0 = x[channels + c];
+            float x1 = x[2 * channels + c], x2 = x[3 * channels + c];
+            float c1 = 0.5f * (x1 - xm1);
+            float c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+            float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+            store_sample(resampler->out_format, out, produced * channels + c,
+                         ((c3 * f + c2) * f + c1) * f + x0);
+        }
+        resampler->pos += resampler->step;
+        produced++;
+    }
+
+    // Keep one frame of history before the next output frame.
+    drop = (size_t)resampler->pos - 1;
+    if (drop > resampler->fifo_frames)
+    {
+        drop = resampler->fifo_frames;
+    }
+    if (drop > 0)
+    {
+        memmove(resampler->fifo, resampler->fifo + drop * channels,
+                (resampler->fifo_frames - drop) * channels * sizeof(float));
+        resampler->fifo_frames -= drop;
+        resampler->pos -= drop;
+    }
+    return produced;
+}
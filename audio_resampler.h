@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef AUDIO_RESAMPLER_H
+#define AUDIO_RESAMPLER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <system/audio.h>
+
+// Fractional-ratio resampler shared by the drift compensation and the
+// capture conversion: 4-point cubic interpolation over a FIFO of frames
+// already converted to float. The owner appends input frames to the FIFO
+// in its own way (format, channel mapping, filtering) and sets the ratio;
+// the resampler interpolates and stores the output in out_format.
+struct audio_resampler
+{
+    audio_format_t out_format;
+    uint32_t channels;
+    double step; // Input frames consumed per output frame
+    float *fifo;
+    size_t fifo_frames;
+    size_t fifo_capacity; // In frames
+    double pos;           // Fractional FIFO index of the next output frame
+};
+
+// True for the formats the resampler stores.
+bool audio_resampler_supported(audio_format_t format);
+
+// Start over from silence with room for capacity_frames of input. The FIFO
+// is kept when the channel count does not change.
+int audio_resampler_reset(struct audio_resampler *resampler, audio_format_t out_format,
+                          uint32_t channels, double step, size_t capacity_frames);
+void audio_resampler_release(struct audio_resampler *resampler);
+
+// Input frames still missing to produce out_frames.
+size_t audio_resampler_input_frames(const struct audio_resampler *resampler, size_t out_frames);
+// Input frames held that no output frame has consumed yet.
+double audio_resampler_queued_frames(const struct audio_resampler *resampler);
+
+// Room for frames more input frames at the end of the FIFO, counted as
+// queued; NULL when out of memory. The caller fills it before the next
+// call to audio_resampler_process().
+float *audio_resampler_append(struct audio_resampler *resampler, size_t frames);
+// Produce up to max_out_frames from the queued input; returns how many
+// were produced.
+size_t audio_resampler_process(struct audio_resampler *resampler, void *out,
+                               size_t max_out_frames);
+
+#endif // AUDIO_RESAMPLER_H
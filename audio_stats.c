@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "audio_stats.h"
+
+#define AUDIO_STATS_RATE_WINDOW_NS 1000000000LL
+
+static unsigned int audio_histogram_index(uint64_t value)
+{
+    unsigned int exponent;
+    unsigned int index;
+
+    if (value < AUDIO_HISTOGRAM_SUB_BUCKETS)
+    {
+        return value;
+    }
+    exponent = 63 - __builtin_clzll(value);
+    index = (exponent - AUDIO_HISTOGRAM_SUB_BUCKET_BITS + 1) * AUDIO_HISTOGRAM_SUB_BUCKETS +
+            ((value >> (exponent - AUDIO_HISTOGRAM_SUB_BUCKET_BITS)) &
+             (AUDIO_HISTOGRAM_SUB_BUCKETS - 1));
+    return index < AUDIO_HISTOGRAM_BUCKETS ? index : AUDIO_HISTOGRAM_BUCKETS - 1;
+}
+
+// Upper bound of the values counted in bucket index.
+static uint64_t audio_histogram_bucket_limit(unsigned int index)
+{
+    unsigned int exponent;
+    uint64_t sub;
+
+    if (index < AUDIO_HISTOGRAM_SUB_BUCKETS)
+    {
+        return index;
+    }
+    exponent = index / AUDIO_HISTOGRAM_SUB_BUCKETS + AUDIO_HISTOGRAM_SUB_BUCKET_BITS - 1;
+    sub = index % AUDIO_HISTOGRAM_SUB_BUCKETS;
+    return ((AUDIO_HISTOGRAM_SUB_BUCKETS + sub + 1) << (exponent - AUDIO_HISTOGRAM_SUB_BUCKET_BITS)) - 1;
+}
+
+void audio_histogram_record(struct audio_histogram *histogram, uint64_t value)
+{
+    _Atomic uint32_t *bucket = &histogram->buckets[audio_histogram_index(value)];
+
+    atomic_store_explicit(bucket, atomic_load_explicit(bucket, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    audio_stats_inc(&histogram->count);
+    audio_stats_add(&histogram->sum, value);
+    if (value > atomic_load_explicit(&histogram->max, memory_order_relaxed))
+    {
+        atomic_store_explicit(&histogram->max, value, memory_order_relaxed);
+    }
+}
+
+uint64_t audio_histogram_percentile(const struct audio_histogram *histogram, double percentile)
+{
+    uint64_t count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    uint64_t target;
+    uint64_t seen = 0;
+    unsigned int index;
+
+    if (count == 0)
+    {
+        return 0;
+    }
+    target = (uint64_t)(count * percentile / 100.0 + 0.5);
+    if (target == 0)
+    {
+        target = 1;
+    }
+    for (index = 0; index < AUDIO_HISTOGRAM_BUCKETS; index++)
+    {
+        seen += atomic_load_explicit(&histogram->buckets[index], memory_order_relaxed);
+        if (seen >= target)
+        {
+            uint64_t limit = audio_histogram_bucket_limit(index);
+            return limit < max ? limit : max;
+        }
+    }
+    return max;
+}
+
+void audio_histogram_reset(struct audio_histogram *histogram)
+{
+    unsigned int index;
+
+    atomic_store_explicit(&histogram->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&histogram->sum, 0, memory_order_relaxed);
+    atomic_store_explicit(&histogram->max, 0, memory_order_relaxed);
+    for (index = 0; index < AUDIO_HISTOGRAM_BUCKETS; index++)
+    {
+        atomic_store_explicit(&histogram->buckets[index], 0, memory_order_relaxed);
+    }
+}
+
+void audio_histogram_dump(int fd, const char *name, const struct audio_histogram *histogram)
+{
+    uint64_t count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    uint64_t sum = atomic_load_explicit(&histogram->sum, memory_order_relaxed);
+
+    dprintf(fd, "    %-16s count %llu mean %llu p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu us\n",
+            name, (unsigned long long)count,
+            (unsigned long long)(count ? sum / count : 0),
+            (unsigned long long)audio_histogram_percentile(histogram, 50),
+            (unsigned long long)audio_histogram_percentile(histogram, 90),
+            (unsigned long long)audio_histogram_percentile(histogram, 99),
+            (unsigned long long)audio_histogram_percentile(histogram, 99.9),
+            (unsigned long long)atomic_load_explicit(&histogram->max, memory_order_relaxed));
+}
+
+void audio_stream_stats_reset(struct audio_stream_stats *stats, int64_t now_ns)
+{
+    atomic_store_explicit(&stats->start_ns, now_ns, memory_order_relaxed);
+    atomic_store_explicit(&stats->periods, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->bytes, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->short_transfers, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->timeouts, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->zero_filled, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->dropped, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->errors, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->stalls, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->recoveries, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->stall_dropped_frames, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->window_start_ns, now_ns, memory_order_relaxed);
+    atomic_store_explicit(&stats->window_bytes, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->window_rate, 0, memory_order_relaxed);
+    audio_histogram_reset(&stats->wait_us);
+    audio_histogram_reset(&stats->io_us);
+    audio_histogram_reset(&stats->pacing_error_us);
+    audio_histogram_reset(&stats->queue_us);
+    audio_histogram_reset(&stats->first_sound_us);
+}
+
+void audio_stream_stats_add_bytes(struct audio_stream_stats *stats, uint64_t bytes, int64_t now_ns)
+{
+    int64_t window_start_ns = atomic_load_explicit(&stats->window_start_ns, memory_order_relaxed);
+    uint64_t window_bytes = atomic_load_explicit(&stats->window_bytes, memory_order_relaxed) + bytes;
+
+    audio_stats_inc(&stats->periods);
+    audio_stats_add(&stats->bytes, bytes);
+    if (now_ns - window_start_ns >= AUDIO_STATS_RATE_WINDOW_NS)
+    {
+        atomic_store_explicit(&stats->window_rate,
+                              window_bytes * 1000000000ULL / (now_ns - window_start_ns),
+                              memory_order_relaxed);
+        atomic_store_explicit(&stats->window_start_ns, now_ns, memory_order_relaxed);
+        window_bytes = 0;
+    }
+    atomic_store_explicit(&stats->window_bytes, window_bytes, memory_order_relaxed);
+}
+
+void audio_stream_stats_dump(int fd, const struct audio_stream_stats *stats, int64_t now_ns)
+{
+    int64_t elapsed_ns = now_ns - atomic_load_explicit(&stats->start_ns, memory_order_relaxed);
+    uint64_t bytes = atomic_load_explicit(&stats->bytes, memory_order_relaxed);
+
+    dprintf(fd, "    periods %llu bytes %llu avg %llu B/s last %llu B/s\n",
+            (unsigned long long)atomic_load_explicit(&stats->periods, memory_order_relaxed),
+            (unsigned long long)bytes,
+            (unsigned long long)(elapsed_ns > 0 ? bytes * 1000000000ULL / elapsed_ns : 0),
+            (unsigned long long)atomic_load_explicit(&stats->window_rate, memory_order_relaxed));
+    dprintf(fd, "    short %llu timeouts %llu zero-filled %llu dropped %llu errors %llu\n",
+            (unsigned long long)atomic_load_explicit(&stats->short_transfers, memory_order_relaxed),
+            (unsigned long long)atomic_load_explicit(&stats->timeouts, memory_order_relaxed),
+            (unsigned long long)atomic_load_explicit(&stats->zero_filled, memory_order_relaxed),
+            (unsigned long long)atomic_load_explicit(&stats->dropped, memory_order_relaxed),
+            (unsigned long long)atomic_load_explicit(&stats->errors, memory_order_relaxed));
+    if (atomic_load_explicit(&stats->stalls, memory_order_relaxed) > 0)
+    {
+        dprintf(fd, "    stalls %llu recoveries %llu frames dropped while stalled %llu\n",
+                (unsigned long long)atomic_load_explicit(&stats->stalls, memory_order_relaxed),
+                (unsigned long long)atomic_load_explicit(&stats->recoveries, memory_order_relaxed),
+                (unsigned long long)atomic_load_explicit(&stats->stall_dropped_frames,
+                                                         memory_order_relaxed));
+    }
+    audio_histogram_dump(fd, "epoll wait", &stats->wait_us);
+    audio_histogram_dump(fd, "syscall", &stats->io_us);
+    audio_histogram_dump(fd, "pacing error", &stats->pacing_error_us);
+    audio_histogram_dump(fd, "socket queue", &stats->queue_us);
+    audio_histogram_dump(fd, "first sound", &stats->first_sound_us);
+}
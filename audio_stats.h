@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef AUDIO_STATS_H
+#define AUDIO_STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Log-linear histogram: values below AUDIO_HISTOGRAM_SUB_BUCKETS are counted
+// exactly, every power of two above is split in AUDIO_HISTOGRAM_SUB_BUCKETS
+// buckets, so the relative error of a reported percentile stays below 1/8.
+#define AUDIO_HISTOGRAM_SUB_BUCKET_BITS 3
+#define AUDIO_HISTOGRAM_SUB_BUCKETS (1 << AUDIO_HISTOGRAM_SUB_BUCKET_BITS)
+#define AUDIO_HISTOGRAM_BUCKETS ((33 - AUDIO_HISTOGRAM_SUB_BUCKET_BITS) * AUDIO_HISTOGRAM_SUB_BUCKETS)
+
+// Each histogram and stream stats block has a single writer, the thread
+// driving the stream. Readers (dump) may run concurrently; all fields are
+// updated with relaxed atomics so no lock is taken on the I/O path.
+struct audio_histogram
+{
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+    _Atomic uint32_t buckets[AUDIO_HISTOGRAM_BUCKETS];
+};
+
+struct audio_stream_stats
+{
+    _Atomic int64_t start_ns;
+    _Atomic uint64_t periods;
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t short_transfers; // write()/read() moved fewer bytes than asked
+    _Atomic uint64_t timeouts;        // epoll_wait() expired
+    _Atomic uint64_t zero_filled;     // input periods filled with silence
+    _Atomic uint64_t dropped;         // output periods not delivered to the client
+    _Atomic uint64_t errors;
+    _Atomic uint64_t stalls;          // times the client stopped draining
+    _Atomic uint64_t recoveries;      // times it drained again
+    _Atomic uint64_t stall_dropped_frames; // frames discarded while stalled
+    // Throughput over the last completed window of about one second.
+    _Atomic int64_t window_start_ns;
+    _Atomic uint64_t window_bytes;
+    _Atomic uint64_t window_rate;     // bytes per second
+    struct audio_histogram wait_us;   // epoll_wait() duration
+    struct audio_histogram io_us;     // write()/read() syscall duration
+    struct audio_histogram pacing_error_us; // |period interval - nominal period|
+    struct audio_histogram queue_us;  // client data queued in the socket after a period
+    struct audio_histogram first_sound_us; // write out of standby to the client having a period
+};
+
+static inline void audio_stats_add(_Atomic uint64_t *counter, uint64_t value)
+{
+    atomic_store_explicit(counter,
+                          atomic_load_explicit(counter, memory_order_relaxed) + value,
+                          memory_order_relaxed);
+}
+
+static inline void audio_stats_inc(_Atomic uint64_t *counter)
+{
+    audio_stats_add(counter, 1);
+}
+
+void audio_histogram_record(struct audio_histogram *histogram, uint64_t value);
+uint64_t audio_histogram_percentile(const struct audio_histogram *histogram, double percentile);
+void audio_histogram_reset(struct audio_histogram *histogram);
+void audio_histogram_dump(int fd, const char *name, const struct audio_histogram *histogram);
+
+void audio_stream_stats_reset(struct audio_stream_stats *stats, int64_t now_ns);
+void audio_stream_stats_add_bytes(struct audio_stream_stats *stats, uint64_t bytes, int64_t now_ns);
+void audio_stream_stats_dump(int fd, const struct audio_stream_stats *stats, int64_t now_ns);
+
+#endif // AUDIO_STATS_H
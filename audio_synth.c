@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_virtual"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <log/log.h>
+
+#include <cutils/properties.h>
+
+#include "audio_synth.h"
+
+#define AUDIO_SYNTH_TONE_AMPLITUDE 0.5f // -6 dBFS
+#define AUDIO_SYNTH_WAV_PCM 1
+#define AUDIO_SYNTH_WAV_FLOAT 3
+#define AUDIO_SYNTH_WAV_EXTENSIBLE 0xfffe
+
+static struct
+{
+    int mode;
+    uint32_t tone_hz;
+    char path[PROPERTY_VALUE_MAX];
+    uint8_t *map;
+    size_t map_size;
+    // What the file holds; a raw file has no format and is taken to be in
+    // the one of each stream.
+    const uint8_t *data;
+    size_t data_bytes;
+    bool raw;
+    audio_format_t format;
+    uint32_t channels;
+    uint32_t sample_rate;
+} synth;
+
+static const char *audio_synth_mode_to_string(int mode)
+{
+    switch (mode)
+    {
+    case AUDIO_SYNTH_TONE:
+        return "tone";
+    case AUDIO_SYNTH_FILE:
+        return "file";
+    default:
+        return "off";
+    }
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return get_le16(p) | (uint32_t)get_le16(p + 2) << 16;
+}
+
+// Find the format and the data of a RIFF/WAVE mapping; anything else is
+// raw PCM.
+static int audio_synth_parse_wav(void)
+{
+    const uint8_t *p = synth.map;
+    const uint8_t *end = synth.map + synth.map_size;
+    bool has_format = false;
+
+    if (synth.map_size < 12 || memcmp(p, "RIFF", 4) != 0 || memcmp(p + 8, "WAVE", 4) != 0)
+    {
+        synth.raw = true;
+        synth.data = synth.map;
+        synth.data_bytes = synth.map_size;
+        return 0;
+    }
+    for (p += 12; end - p >= 8; )
+    {
+        uint32_t size = get_le32(p + 4);
+        const uint8_t *body = p + 8;
+
+        if (size > (size_t)(end - body))
+        {
+            size = end - body;
+        }
+        if (memcmp(p, "fmt ", 4) == 0 && size >= 16)
+        {
+            uint16_t tag = get_le16(body);
+            uint16_t bits = get_le16(body + 14);
+
+            if (tag == AUDIO_SYNTH_WAV_EXTENSIBLE && size >= 26)
+            {
+                tag = get_le16(body + 24); // First bytes of the subformat GUID
+            }
+            synth.channels = get_le16(body + 2);
+            synth.sample_rate = get_le32(body + 4);
+            synth.format = tag == AUDIO_SYNTH_WAV_FLOAT && bits == 32 ? AUDIO_FORMAT_PCM_FLOAT :
+                            tag == AUDIO_SYNTH_WAV_PCM && bits == 16 ? AUDIO_FORMAT_PCM_16_BIT :
+                            tag == AUDIO_SYNTH_WAV_PCM && bits == 32 ? AUDIO_FORMAT_PCM_32_BIT :
+                            AUDIO_FORMAT_INVALID;
+            has_format = true;
+        }
+        else if (memcmp(p, "data", 4) == 0 && has_format)
+        {
+            synth.data = body;
+            synth.data_bytes = size;
+            break;
+        }
+        p = body + size + (size & 1);
+    }
+    if (!synth.data || !audio_convert_supported(synth.format) || synth.channels == 0 ||
+        synth.channels > AUDIO_CHANNEL_COUNT_MAX || synth.sample_rate == 0)
+    {
+        ALOGE("%s: %s is not a WAV file of 16 or 32 bit PCM or float.", __func__, synth.path);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static int audio_synth_map_file(void)
+{
+    struct stat st;
+    int fd = open(synth.path, O_RDONLY | O_CLOEXEC);
+    int ret = 0;
+
+    if (fd < 0)
+    {
+        ALOGE("%s: Fail to open %s: %s", __func__, synth.path, strerror(errno));
+        return -errno;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        ALOGE("%s: %s is empty or cannot be read.", __func__, synth.path);
+        ret = -EINVAL;
+    }
+    else
+    {
+        synth.map = (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (synth.map == MAP_FAILED)
+        {
+            ALOGE("%s: Fail to map %s: %s", __func__, synth.path, strerror(errno));
+            synth.map = NULL;
+            ret = -errno;
+        }
+        else
+        {
+            synth.map_size = st.st_size;
+        }
+    }
+    close(fd);
+    if (ret == 0)
+    {
+        ret = audio_synth_parse_wav();
+    }
+    if (ret == 0)
+    {
+        madvise(synth.map, synth.map_size, MADV_WILLNEED);
+    }
+    return ret;
+}
+
+int audio_synth_init(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+    int ret = 0;
+
+    audio_synth_release();
+    property_get("virtual.audio.in.source", value, "off");
+    synth.mode = strcmp(value, "tone") == 0 ? AUDIO_SYNTH_TONE :
+                  strcmp(value, "file") == 0 ? AUDIO_SYNTH_FILE : AUDIO_SYNTH_OFF;
+    property_get("virtual.audio.in.source.tone_hz", value, "");
+    synth.tone_hz = atoi(value) > 0 ? atoi(value) : AUDIO_SYNTH_DEFAULT_TONE_HZ;
+    property_get("virtual.audio.in.source.path", synth.path, "");
+    if (synth.mode == AUDIO_SYNTH_FILE && (ret = audio_synth_map_file()) < 0)
+    {
+        audio_synth_release();
+        synth.mode = AUDIO_SYNTH_OFF;
+    }
+    if (synth.mode != AUDIO_SYNTH_OFF)
+    {
+        ALOGI("%s: input source %s %s.", __func__, audio_synth_mode_to_string(synth.mode),
+              synth.mode == AUDIO_SYNTH_FILE ? synth.path : "");
+    }
+    return ret;
+}
+
+void audio_synth_release(void)
+{
+    if (synth.map)
+    {
+        munmap(synth.map, synth.map_size);
+    }
+    synth.map = NULL;
+    synth.map_size = 0;
+    synth.data = NULL;
+    synth.data_bytes = 0;
+    synth.raw = false;
+}
+
+int audio_synth_mode(void)
+{
+    return synth.mode;
+}
+
+int audio_synth_open(struct audio_synth *s, audio_format_t format,
+                      audio_channel_mask_t channel_mask, uint32_t sample_rate,
+                      size_t period_frames)
+{
+    audio_format_t in_format = AUDIO_FORMAT_PCM_FLOAT;
+    audio_channel_mask_t in_mask = audio_channel_mask_for_index_assignment_from_count(1);
+    uint32_t in_rate = sample_rate;
+    int ret;
+
+    memset(s, 0, sizeof(*s));
+    if (synth.mode == AUDIO_SYNTH_OFF)
+    {
+        return 0;
+    }
+    if (synth.mode == AUDIO_SYNTH_FILE)
+    {
+        in_format = synth.raw ? format : synth.format;
+        in_mask = synth.raw ? channel_mask :
+                  audio_channel_mask_for_index_assignment_from_count(synth.channels);
+        in_rate = synth.raw ? sample_rate : synth.sample_rate;
+        s->data = synth.data;
+        s->frame_size = audio_bytes_per_sample(in_format) *
+                        audio_channel_count_from_in_mask(in_mask);
+        s->frames = synth.data_bytes / s->frame_size;
+        if (s->frames == 0)
+        {
+            ALOGW("%s: %s has no whole frame for the stream.", __func__, synth.path);
+            return -EINVAL;
+        }
+    }
+    else
+    {
+        s->tone_frames = period_frames > 0 ? period_frames : 1;
+        s->tone = (float *)malloc(s->tone_frames * sizeof(float));
+        if (!s->tone)
+        {
+            return -ENOMEM;
+        }
+        s->phase_step = 2.0 * M_PI * synth.tone_hz / sample_rate;
+    }
+    ret = audio_convert_reset(&s->convert, in_format, in_mask, in_rate, format, channel_mask,
+                              sample_rate, period_frames);
+    if (ret < 0)
+    {
+        ALOGW("%s: the %s source cannot feed format 0x%x, channels 0x%x.", __func__,
+              audio_synth_mode_to_string(synth.mode), format, channel_mask);
+        audio_synth_close(s);
+        return ret;
+    }
+    s->mode = synth.mode;
+    return 0;
+}
+
+void audio_synth_close(struct audio_synth *s)
+{
+    audio_convert_release(&s->convert);
+    free(s->tone);
+    s->tone = NULL;
+    s->mode = AUDIO_SYNTH_OFF;
+}
+
+// Next input frames of the signal, up to max_frames. The file is read in
+// place from the mapping.
+static const void *audio_synth_next(struct audio_synth *s, size_t max_frames, size_t *frames)
+{
+    size_t i;
+
+    if (s->mode == AUDIO_SYNTH_FILE)
+    {
+        const void *in = s->data + s->pos * s->frame_size;
+
+        *frames = s->frames - s->pos < max_frames ? s->frames - s->pos : max_frames;
+        s->pos += *frames;
+        if (s->pos == s->frames)
+        {
+            s->pos = 0;
+            s->loops++;
+        }
+        return in;
+    }
+    *frames = s->tone_frames < max_frames ? s->tone_frames : max_frames;
+    for (i = 0; i < *frames; i++)
+    {
+        s->tone[i] = AUDIO_SYNTH_TONE_AMPLITUDE * (float)sin(s->phase);
+        s->phase += s->phase_step;
+        if (s->phase >= 2.0 * M_PI)
+        {
+            s->phase -= 2.0 * M_PI;
+        }
+    }
+    return s->tone;
+}
+
+size_t audio_synth_read(struct audio_synth *s, void *buffer, size_t frames)
+{
+    const size_t out_frame_size = audio_bytes_per_sample(s->convert.out_format) *
+                                  s->convert.out_channels;
+    size_t produced = 0;
+
+    if (s->mode == AUDIO_SYNTH_OFF)
+    {
+        return 0;
+    }
+    while (produced < frames)
+    {
+        size_t in_frames = 0;
+        size_t needed = audio_convert_input_frames(&s->convert, frames - produced);
+        const void *in = needed > 0 ? audio_synth_next(s, needed, &in_frames) : NULL;
+        size_t got = audio_convert_process(&s->convert, in, in_frames,
+                                           (uint8_t *)buffer + produced * out_frame_size,
+                                           frames - produced);
+
+        if (got == 0 && in_frames == 0)
+        {
+            break;
+        }
+        produced += got;
+    }
+    s->frames_read += produced;
+    return produced;
+}
+
+void audio_synth_dump(int fd)
+{
+    if (synth.mode == AUDIO_SYNTH_TONE)
+    {
+        dprintf(fd, "  Input source: tone of %u Hz without a client\n", synth.tone_hz);
+    }
+    else if (synth.mode == AUDIO_SYNTH_FILE && synth.raw)
+    {
+        dprintf(fd, "  Input source: %s without a client, %zu bytes of raw PCM\n", synth.path,
+                synth.data_bytes);
+    }
+    else if (synth.mode == AUDIO_SYNTH_FILE)
+    {
+        dprintf(fd, "  Input source: %s without a client, %u Hz %u channels format 0x%x, "
+                "%zu bytes\n",
+                synth.path, synth.sample_rate, synth.channels, synth.format,
+                synth.data_bytes);
+    }
+}
+
+void audio_synth_stream_dump(int fd, const struct audio_synth *s)
+{
+    if (s->mode == AUDIO_SYNTH_OFF)
+    {
+        return;
+    }
+    dprintf(fd, "    source %s: %llu frames read", audio_synth_mode_to_string(s->mode),
+            (unsigned long long)s->frames_read);
+    if (s->mode == AUDIO_SYNTH_FILE)
+    {
+        dprintf(fd, ", at frame %zu of %zu, %llu loops", s->pos, s->frames,
+                (unsigned long long)s->loops);
+    }
+    dprintf(fd, "\n");
+}
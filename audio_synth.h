@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef AUDIO_SYNTH_H
+#define AUDIO_SYNTH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <system/audio.h>
+
+#include "audio_convert.h"
+
+// Synthetic capture for input streams while no input client is connected,
+// so recording apps can be load tested without a host. in_read() keeps its
+// own pacing; the source hands out the next frames of a signal that loops
+// seamlessly. virtual.audio.in.source:
+//   off    silence, as without a source (default)
+//   tone   a sine of virtual.audio.in.source.tone_hz (default 1000) at
+//          -6 dBFS on every channel
+//   file   virtual.audio.in.source.path, mapped with mmap() and looped: a
+//          WAV file of 16 or 32 bit PCM or float, converted to each stream,
+//          or raw PCM taken to be in the format of the stream
+enum audio_synth_mode
+{
+    AUDIO_SYNTH_OFF = 0,
+    AUDIO_SYNTH_TONE,
+    AUDIO_SYNTH_FILE,
+};
+
+#define AUDIO_SYNTH_DEFAULT_TONE_HZ 1000
+
+// The synthetic source of one input stream.
+struct audio_synth
+{
+    int mode; // AUDIO_SYNTH_OFF if the stream cannot have the source
+    struct audio_convert convert;
+    // Tone: generated as mono float, a scratch period at a time
+    float *tone;
+    size_t tone_frames;
+    double phase;
+    double phase_step;
+    // File: frames of the mapping, position of the next one
+    const uint8_t *data;
+    size_t frame_size;
+    size_t frames;
+    size_t pos;
+    uint64_t frames_read;
+    uint64_t loops;
+};
+
+// Read the properties and map the file. Called by adev_open().
+int audio_synth_init(void);
+void audio_synth_release(void);
+int audio_synth_mode(void);
+
+int audio_synth_open(struct audio_synth *synth, audio_format_t format,
+                      audio_channel_mask_t channel_mask, uint32_t sample_rate,
+                      size_t period_frames);
+void audio_synth_close(struct audio_synth *synth);
+// Fill frames of the stream; 0 without a source.
+size_t audio_synth_read(struct audio_synth *synth, void *buffer, size_t frames);
+
+void audio_synth_dump(int fd);
+void audio_synth_stream_dump(int fd, const struct audio_synth *synth);
+
+#endif // AUDIO_SYNTH_H
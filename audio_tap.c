@@ -0,0 +1,554 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "audio_hw_virtual"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <log/log.h>
+
+#include <cutils/properties.h>
+
+#include "audio_tap.h"
+
+#define AUDIO_TAP_QUEUE_MILLISECONDS 500 // Rounded up to a power of two bytes
+#define AUDIO_TAP_FLUSH_MILLISECONDS 50
+#define AUDIO_TAP_PROPERTY_POLL_MILLISECONDS 1000
+#define AUDIO_TAP_RETRY_MILLISECONDS 1000 // After a file could not be created
+#define AUDIO_TAP_DEFAULT_DIR "/data/vendor/audio"
+#define AUDIO_TAP_DEFAULT_FILE_KB 16384
+#define AUDIO_TAP_DEFAULT_FILES 4
+#define AUDIO_TAP_MAX_FILES 100
+#define AUDIO_TAP_WAV_HEADER_BYTES 44
+
+struct audio_tap
+{
+    struct audio_tap *next; // Of tap.list
+    int direction;
+    int id; // Of the stream, in the file names
+    uint16_t wav_format; // 1 PCM, 3 IEEE float
+    uint16_t channels;
+    uint16_t sample_bits;
+    uint32_t sample_rate;
+    size_t frame_size;
+
+    // Queue written by the stream thread, allocated once the direction is
+    // tapped and kept until the stream closes.
+    _Atomic(uint8_t *) queue;
+    size_t queue_size; // Power of two
+    _Atomic uint64_t head;
+    _Atomic uint64_t tail;
+    _Atomic uint64_t dropped_bytes;
+
+    // Current file, owned by the writer thread under tap.lock
+    int fd;
+    uint8_t *map;
+    size_t capacity;   // Data bytes the file holds
+    size_t data_bytes; // Data bytes written to it
+    char path[PROPERTY_VALUE_MAX + 32];
+    int64_t retry_ns;
+    uint64_t written_bytes;
+    uint32_t files;
+};
+
+_Atomic int audio_tap_mode = AUDIO_TAP_OFF;
+
+static struct
+{
+    pthread_mutex_t lock; // Serialises the list, the files and the settings
+    struct audio_tap *list;
+    pthread_t thread;
+    bool thread_started;
+    _Atomic bool exit;
+    char property[PROPERTY_VALUE_MAX]; // Last virtual.audio.tap seen
+    char dir[PROPERTY_VALUE_MAX];
+    uint32_t file_kb;
+    uint32_t max_files;
+} tap = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .dir = AUDIO_TAP_DEFAULT_DIR,
+    .file_kb = AUDIO_TAP_DEFAULT_FILE_KB,
+    .max_files = AUDIO_TAP_DEFAULT_FILES,
+};
+
+static int64_t audio_tap_now_ns(void)
+{
+    struct timespec t = {.tv_sec = 0, .tv_nsec = 0};
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static const char *audio_tap_direction_name(int direction)
+{
+    return direction == AUDIO_TAP_OUT ? "out" : "in";
+}
+
+void audio_tap_record(struct audio_tap *t, const void *buffer, size_t bytes)
+{
+    uint8_t *queue = atomic_load_explicit(&t->queue, memory_order_acquire);
+    uint64_t head;
+    size_t offset;
+    size_t first;
+
+    if (!queue)
+    {
+        return;
+    }
+    head = atomic_load_explicit(&t->head, memory_order_relaxed);
+    if (bytes > t->queue_size - (head - atomic_load_explicit(&t->tail, memory_order_acquire)))
+    {
+        atomic_store_explicit(&t->dropped_bytes,
+                              atomic_load_explicit(&t->dropped_bytes, memory_order_relaxed) + bytes,
+                              memory_order_relaxed);
+        return;
+    }
+    offset = head & (t->queue_size - 1);
+    first = t->queue_size - offset < bytes ? t->queue_size - offset : bytes;
+    memcpy(queue + offset, buffer, first);
+    memcpy(queue, (const uint8_t *)buffer + first, bytes - first);
+    atomic_store_explicit(&t->head, head + bytes, memory_order_release);
+}
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, v & 0xffff);
+    put_le16(p + 2, v >> 16);
+}
+
+// The sizes are kept current so a file copied while it grows is readable.
+static void audio_tap_update_header(struct audio_tap *t)
+{
+    put_le32(t->map + 4, 36 + t->data_bytes);
+    put_le32(t->map + 40, t->data_bytes);
+}
+
+static void audio_tap_write_header(struct audio_tap *t)
+{
+    uint8_t *h = t->map;
+
+    memcpy(h, "RIFF", 4);
+    memcpy(h + 8, "WAVE", 4);
+    memcpy(h + 12, "fmt ", 4);
+    put_le32(h + 16, 16);
+    put_le16(h + 20, t->wav_format);
+    put_le16(h + 22, t->channels);
+    put_le32(h + 24, t->sample_rate);
+    put_le32(h + 28, t->sample_rate * t->frame_size);
+    put_le16(h + 32, t->frame_size);
+    put_le16(h + 34, t->sample_bits);
+    memcpy(h + 36, "data", 4);
+    audio_tap_update_header(t);
+}
+
+// Cut the file to what was written. Called with tap.lock held.
+static void audio_tap_close_file_locked(struct audio_tap *t)
+{
+    if (t->fd < 0)
+    {
+        return;
+    }
+    munmap(t->map, AUDIO_TAP_WAV_HEADER_BYTES + t->capacity);
+    if (ftruncate(t->fd, AUDIO_TAP_WAV_HEADER_BYTES + t->data_bytes) < 0)
+    {
+        ALOGW("%s: Fail to trim %s: %s", __func__, t->path, strerror(errno));
+    }
+    close(t->fd);
+    t->fd = -1;
+    t->map = NULL;
+    ALOGI("Tap file %s closed with %zu bytes", t->path, t->data_bytes);
+}
+
+// Create and map the next file of the stream's rotation. Called with
+// tap.lock held.
+static int audio_tap_open_file_locked(struct audio_tap *t)
+{
+    size_t size;
+    int ret;
+
+    t->capacity = ((size_t)tap.file_kb * 1024 - AUDIO_TAP_WAV_HEADER_BYTES) / t->frame_size *
+                  t->frame_size;
+    size = AUDIO_TAP_WAV_HEADER_BYTES + t->capacity;
+    snprintf(t->path, sizeof(t->path), "%s/avh_tap_%s_%d_%u.wav", tap.dir,
+             audio_tap_direction_name(t->direction), t->id, t->files % tap.max_files);
+    t->fd = open(t->path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (t->fd < 0)
+    {
+        ALOGE("%s: Fail to create %s: %s", __func__, t->path, strerror(errno));
+        return -errno;
+    }
+    // Reserve the blocks up front: a store into a mapping the file system
+    // cannot back raises SIGBUS instead of failing.
+    ret = posix_fallocate(t->fd, 0, size);
+    if (ret != 0)
+    {
+        ALOGE("%s: Fail to reserve %zu bytes for %s: %s", __func__, size, t->path, strerror(ret));
+        ret = -ret;
+    }
+    else if ((t->map = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, t->fd, 0)) ==
+             MAP_FAILED)
+    {
+        ret = -errno;
+        ALOGE("%s: Fail to map %s: %s", __func__, t->path, strerror(errno));
+    }
+    if (ret < 0)
+    {
+        close(t->fd);
+        unlink(t->path);
+        t->fd = -1;
+        t->map = NULL;
+        return ret;
+    }
+    t->data_bytes = 0;
+    t->files++;
+    audio_tap_write_header(t);
+    return 0;
+}
+
+// Move the queued periods to the files. Called with tap.lock held.
+static void audio_tap_drain_locked(struct audio_tap *t)
+{
+    uint8_t *queue = atomic_load_explicit(&t->queue, memory_order_acquire);
+    uint64_t head;
+    uint64_t tail;
+
+    if (!queue)
+    {
+        return;
+    }
+    head = atomic_load_explicit(&t->head, memory_order_acquire);
+    tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+    while (tail < head)
+    {
+        size_t offset = tail & (t->queue_size - 1);
+        size_t bytes = head - tail;
+
+        if (t->fd >= 0 && t->data_bytes == t->capacity)
+        {
+            audio_tap_close_file_locked(t);
+        }
+        if (t->fd < 0)
+        {
+            int64_t now_ns = audio_tap_now_ns();
+            if (now_ns < t->retry_ns || audio_tap_open_file_locked(t) < 0)
+            {
+                // Nowhere to write: the queue is emptied all the same.
+                if (now_ns >= t->retry_ns)
+                {
+                    t->retry_ns = now_ns + AUDIO_TAP_RETRY_MILLISECONDS * 1000000LL;
+                }
+                atomic_store_explicit(&t->dropped_bytes,
+                                      atomic_load_explicit(&t->dropped_bytes, memory_order_relaxed) +
+                                          bytes,
+                                      memory_order_relaxed);
+                tail = head;
+                break;
+            }
+        }
+        if (bytes > t->queue_size - offset)
+        {
+            bytes = t->queue_size - offset;
+        }
+        if (bytes > t->capacity - t->data_bytes)
+        {
+            bytes = t->capacity - t->data_bytes;
+        }
+        memcpy(t->map + AUDIO_TAP_WAV_HEADER_BYTES + t->data_bytes, queue + offset, bytes);
+        t->data_bytes += bytes;
+        t->written_bytes += bytes;
+        tail += bytes;
+    }
+    atomic_store_explicit(&t->tail, tail, memory_order_release);
+    if (t->fd >= 0)
+    {
+        audio_tap_update_header(t);
+    }
+}
+
+// Called with tap.lock held.
+static int audio_tap_alloc_queue_locked(struct audio_tap *t)
+{
+    uint8_t *queue;
+
+    if (atomic_load_explicit(&t->queue, memory_order_relaxed))
+    {
+        return 0;
+    }
+    queue = (uint8_t *)malloc(t->queue_size);
+    if (!queue)
+    {
+        ALOGE("%s: Fail to allocate the %s tap queue.", __func__,
+              audio_tap_direction_name(t->direction));
+        return -ENOMEM;
+    }
+    atomic_store_explicit(&t->queue, queue, memory_order_release);
+    return 0;
+}
+
+struct audio_tap *audio_tap_open(int direction, int id, audio_format_t format, uint32_t channels,
+                                 uint32_t sample_rate)
+{
+    struct audio_tap *t;
+    size_t bytes;
+
+    if (!audio_is_linear_pcm(format) || channels == 0 || sample_rate == 0)
+    {
+        ALOGW("%s: format 0x%x is not tapped.", __func__, format);
+        return NULL;
+    }
+    t = (struct audio_tap *)calloc(1, sizeof(struct audio_tap));
+    if (!t)
+    {
+        return NULL;
+    }
+    t->direction = direction;
+    t->id = id;
+    t->wav_format = format == AUDIO_FORMAT_PCM_FLOAT ? 3 : 1;
+    t->channels = channels;
+    t->sample_bits = audio_bytes_per_sample(format) * 8;
+    t->sample_rate = sample_rate;
+    t->frame_size = audio_bytes_per_sample(format) * channels;
+    t->fd = -1;
+    bytes = (size_t)sample_rate * t->frame_size * AUDIO_TAP_QUEUE_MILLISECONDS / 1000;
+    for (t->queue_size = 4096; t->queue_size < bytes; t->queue_size <<= 1)
+    {
+    }
+
+    pthread_mutex_lock(&tap.lock);
+    if (atomic_load_explicit(&audio_tap_mode, memory_order_relaxed) & direction)
+    {
+        audio_tap_alloc_queue_locked(t);
+    }
+    t->next = tap.list;
+    tap.list = t;
+    pthread_mutex_unlock(&tap.lock);
+    return t;
+}
+
+void audio_tap_close(struct audio_tap *t)
+{
+    struct audio_tap **link;
+
+    if (!t)
+    {
+        return;
+    }
+    pthread_mutex_lock(&tap.lock);
+    for (link = &tap.list; *link; link = &(*link)->next)
+    {
+        if (*link == t)
+        {
+            *link = t->next;
+            break;
+        }
+    }
+    audio_tap_drain_locked(t);
+    audio_tap_close_file_locked(t);
+    pthread_mutex_unlock(&tap.lock);
+    free(atomic_load_explicit(&t->queue, memory_order_relaxed));
+    free(t);
+}
+
+int audio_tap_mode_from_string(const char *str)
+{
+    if (strcmp(str, "off") == 0)
+    {
+        return AUDIO_TAP_OFF;
+    }
+    if (strcmp(str, "out") == 0)
+    {
+        return AUDIO_TAP_OUT;
+    }
+    if (strcmp(str, "in") == 0)
+    {
+        return AUDIO_TAP_IN;
+    }
+    if (strcmp(str, "all") == 0)
+    {
+        return AUDIO_TAP_ALL;
+    }
+    return -1;
+}
+
+const char *audio_tap_mode_to_string(int mode)
+{
+    switch (mode)
+    {
+    case AUDIO_TAP_OUT:
+        return "out";
+    case AUDIO_TAP_IN:
+        return "in";
+    case AUDIO_TAP_ALL:
+        return "all";
+    default:
+        return "off";
+    }
+}
+
+bool audio_tap_control_allowed(void)
+{
+    return property_get_int32("virtual.audio.tap.control", 0) == 1 ||
+           property_get_int32("ro.debuggable", 0) == 1;
+}
+
+int audio_tap_set_mode(int mode)
+{
+    struct audio_tap *t;
+
+    if (mode < AUDIO_TAP_OFF || mode > AUDIO_TAP_ALL)
+    {
+        return -EINVAL;
+    }
+    pthread_mutex_lock(&tap.lock);
+    for (t = tap.list; t; t = t->next)
+    {
+        if (mode & t->direction)
+        {
+            audio_tap_alloc_queue_locked(t);
+        }
+    }
+    atomic_store_explicit(&audio_tap_mode, mode, memory_order_release);
+    ALOGI("Tap mode is %s to %s", audio_tap_mode_to_string(mode), tap.dir);
+    pthread_mutex_unlock(&tap.lock);
+    return 0;
+}
+
+// The file settings apply from the next file; the mode only when the
+// property itself changed, so it does not undo the "tap" parameter.
+static void audio_tap_poll_property(void)
+{
+    char mode[PROPERTY_VALUE_MAX] = {
+        '\0',
+    };
+    char value[PROPERTY_VALUE_MAX] = {
+        '\0',
+    };
+    int file_kb;
+    int files;
+
+    pthread_mutex_lock(&tap.lock);
+    property_get("virtual.audio.tap.dir", tap.dir, AUDIO_TAP_DEFAULT_DIR);
+    property_get("virtual.audio.tap.file_kb", value, "");
+    file_kb = atoi(value);
+    tap.file_kb = file_kb >= 1 ? file_kb : AUDIO_TAP_DEFAULT_FILE_KB;
+    property_get("virtual.audio.tap.files", value, "");
+    files = atoi(value);
+    tap.max_files = files >= 1 && files <= AUDIO_TAP_MAX_FILES ? files : AUDIO_TAP_DEFAULT_FILES;
+    property_get("virtual.audio.tap", mode, "off");
+    if (strcmp(mode, tap.property) == 0)
+    {
+        pthread_mutex_unlock(&tap.lock);
+        return;
+    }
+    snprintf(tap.property, sizeof(tap.property), "%s", mode);
+    pthread_mutex_unlock(&tap.lock);
+    if (audio_tap_mode_from_string(mode) < 0)
+    {
+        ALOGW("%s: unknown tap mode %s.", __func__, mode);
+        return;
+    }
+    audio_tap_set_mode(audio_tap_mode_from_string(mode));
+}
+
+static void *audio_tap_thread(void *args)
+{
+    int64_t next_poll_ns = 0;
+
+    while (!atomic_load_explicit(&tap.exit, memory_order_relaxed))
+    {
+        int64_t now_ns = audio_tap_now_ns();
+        struct audio_tap *t;
+        int mode;
+
+        if (now_ns >= next_poll_ns)
+        {
+            audio_tap_poll_property();
+            next_poll_ns = now_ns + AUDIO_TAP_PROPERTY_POLL_MILLISECONDS * 1000000LL;
+        }
+        mode = atomic_load_explicit(&audio_tap_mode, memory_order_acquire);
+        pthread_mutex_lock(&tap.lock);
+        for (t = tap.list; t; t = t->next)
+        {
+            audio_tap_drain_locked(t);
+            if (!(mode & t->direction))
+            {
+                audio_tap_close_file_locked(t);
+            }
+        }
+        pthread_mutex_unlock(&tap.lock);
+        usleep((mode != AUDIO_TAP_OFF ? AUDIO_TAP_FLUSH_MILLISECONDS
+                                      : AUDIO_TAP_PROPERTY_POLL_MILLISECONDS) * 1000);
+    }
+    return NULL;
+}
+
+int audio_tap_init(void)
+{
+    atomic_store_explicit(&tap.exit, false, memory_order_relaxed);
+    tap.property[0] = '\0';
+    audio_tap_poll_property();
+    if (pthread_create(&tap.thread, NULL, audio_tap_thread, NULL))
+    {
+        ALOGE("%s: Fail to create tap writer thread.", __func__);
+        return -1;
+    }
+    tap.thread_started = true;
+    return 0;
+}
+
+void audio_tap_release(void)
+{
+    if (tap.thread_started)
+    {
+        atomic_store_explicit(&tap.exit, true, memory_order_relaxed);
+        pthread_join(tap.thread, NULL);
+        tap.thread_started = false;
+    }
+    audio_tap_set_mode(AUDIO_TAP_OFF);
+}
+
+void audio_tap_dump(int fd)
+{
+    struct audio_tap *t;
+
+    pthread_mutex_lock(&tap.lock);
+    dprintf(fd, "  Tap %s to %s, %u files of %u KB per stream\n",
+            audio_tap_mode_to_string(atomic_load_explicit(&audio_tap_mode, memory_order_relaxed)),
+            tap.dir, tap.max_files, tap.file_kb);
+    for (t = tap.list; t; t = t->next)
+    {
+        dprintf(fd, "    %s %d %u Hz %u channels: %llu bytes in %u files, %llu dropped, %s%s\n",
+                audio_tap_direction_name(t->direction), t->id, t->sample_rate, t->channels,
+                (unsigned long long)t->written_bytes, t->files,
+                (unsigned long long)atomic_load_explicit(&t->dropped_bytes, memory_order_relaxed),
+                t->fd >= 0 ? "writing " : "no file", t->fd >= 0 ? t->path : "");
+    }
+    pthread_mutex_unlock(&tap.lock);
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef AUDIO_TAP_H
+#define AUDIO_TAP_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <system/audio.h>
+
+// Debug tap of the PCM the streams carry, for looking at a customer's audio
+// without rebuilding the image. While it is enabled for their direction,
+// out_write() and in_read() copy each period into a preallocated queue of
+// the stream (single producer, single consumer); a background thread drains
+// the queues into WAV files it maps with mmap(), starting the next file when
+// one reaches its size cap:
+//   virtual.audio.tap           off|out|in|all, also the "tap" parameter
+//   virtual.audio.tap.dir       directory of the files
+//   virtual.audio.tap.file_kb   size cap of a file
+//   virtual.audio.tap.files     files per stream, reused in turn
+//   virtual.audio.tap.control   1 lets the "tap" parameter turn the tap on
+//                               on a user build; it records the microphone
+// The files take their whole size when they are created, so a full disk
+// fails the file instead of the process.
+// Files are named avh_tap_<direction>_<id>_<n>.wav, id being that of the
+// stream. A period that does not fit in the queue is left out of the file
+// rather than waited for.
+enum audio_tap_mode
+{
+    AUDIO_TAP_OFF = 0,
+    AUDIO_TAP_OUT = 1 << 0,
+    AUDIO_TAP_IN = 1 << 1,
+    AUDIO_TAP_ALL = AUDIO_TAP_OUT | AUDIO_TAP_IN,
+};
+
+extern _Atomic int audio_tap_mode;
+
+struct audio_tap;
+
+void audio_tap_record(struct audio_tap *tap, const void *buffer, size_t bytes);
+
+// direction is AUDIO_TAP_OUT or AUDIO_TAP_IN, that of the stream.
+static inline void audio_tap(struct audio_tap *tap, int direction, const void *buffer, size_t bytes)
+{
+    if ((atomic_load_explicit(&audio_tap_mode, memory_order_relaxed) & direction) && tap)
+    {
+        audio_tap_record(tap, buffer, bytes);
+    }
+}
+
+// id tells the streams of a direction apart, the audio_io_handle_t. NULL
+// for formats a WAV file cannot hold; the stream is then not tapped.
+struct audio_tap *audio_tap_open(int direction, int id, audio_format_t format, uint32_t channels,
+                                 uint32_t sample_rate);
+// Writes out what the queue still holds. The stream must not record anymore.
+void audio_tap_close(struct audio_tap *tap);
+
+// Read the properties and start the writer thread, which keeps polling them.
+int audio_tap_init(void);
+void audio_tap_release(void);
+int audio_tap_set_mode(int mode);
+// Whether the "tap" parameter may turn the tap on: on a debuggable build,
+// or with virtual.audio.tap.control=1. The property is for the device owner.
+bool audio_tap_control_allowed(void);
+int audio_tap_mode_from_string(const char *str); // -1 if unknown
+const char *audio_tap_mode_to_string(int mode);
+void audio_tap_dump(int fd);
+
+#endif // AUDIO_TAP_H
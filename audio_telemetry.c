@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "audio_hw_virtual"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <log/log.h>
+
+#include <cutils/properties.h>
+
+#include "audio_telemetry.h"
+
+static char telemetry_path[PROPERTY_VALUE_MAX];
+static bool telemetry_mapped;
+
+static void audio_telemetry_init_page(struct audio_telemetry_page *page)
+{
+    memset(page, 0, sizeof(*page));
+    page->version = AUDIO_TELEMETRY_VERSION;
+    page->size = sizeof(*page);
+    // Publish the magic last: readers treat a page without it as not ready.
+    atomic_thread_fence(memory_order_release);
+    page->magic = AUDIO_TELEMETRY_MAGIC;
+}
+
+struct audio_telemetry_page *audio_telemetry_open(void)
+{
+    struct audio_telemetry_page *page = NULL;
+    int fd;
+
+    telemetry_mapped = false;
+    property_get("virtual.audio.telemetry.path", telemetry_path, "");
+    if (telemetry_path[0] != '\0')
+    {
+        fd = open(telemetry_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            ALOGE("%s: Fail to open %s: %s", __func__, telemetry_path, strerror(errno));
+        }
+        else
+        {
+            if (ftruncate(fd, sizeof(struct audio_telemetry_page)) == 0)
+            {
+                page = (struct audio_telemetry_page *)mmap(NULL, sizeof(struct audio_telemetry_page),
+                                                           PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (page == MAP_FAILED)
+                {
+                    ALOGE("%s: Fail to map %s: %s", __func__, telemetry_path, strerror(errno));
+                    page = NULL;
+                }
+            }
+            else
+            {
+                ALOGE("%s: Fail to size %s: %s", __func__, telemetry_path, strerror(errno));
+            }
+            close(fd);
+        }
+    }
+    if (page)
+    {
+        telemetry_mapped = true;
+        ALOGI("Telemetry page is mapped at %s", telemetry_path);
+    }
+    else
+    {
+        page = (struct audio_telemetry_page *)calloc(1, sizeof(struct audio_telemetry_page));
+        telemetry_path[0] = '\0';
+        if (!page)
+        {
+            return NULL;
+        }
+    }
+    audio_telemetry_init_page(page);
+    return page;
+}
+
+void audio_telemetry_close(struct audio_telemetry_page *page)
+{
+    if (!page)
+    {
+        return;
+    }
+    if (telemetry_mapped)
+    {
+        munmap(page, sizeof(struct audio_telemetry_page));
+        telemetry_mapped = false;
+    }
+    else
+    {
+        free(page);
+    }
+}
+
+const char *audio_telemetry_path(void)
+{
+    return telemetry_path[0] != '\0' ? telemetry_path : "none";
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef AUDIO_TELEMETRY_H
+#define AUDIO_TELEMETRY_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Telemetry page shared with host tools through a file mapping at
+ * virtual.audio.telemetry.path (usually on a tmpfs bind-mounted into the
+ * host). Host tools mmap() the file read-only and take consistent snapshots
+ * with audio_telemetry_read_stream() without any syscall.
+ *
+ * Each stream section is written by a single thread (the one driving the
+ * stream) and protected by its own sequence lock: sequence is odd while an
+ * update is in progress. The HAL may open several input streams on the one
+ * capture; the input section covers only the oldest open one.
+ */
+#define AUDIO_TELEMETRY_MAGIC 0x54485641 // "AVHT"
+#define AUDIO_TELEMETRY_VERSION 1
+
+struct audio_telemetry_stream
+{
+    _Atomic uint32_t sequence;
+    _Atomic uint32_t generation; // Client connections accepted so far
+    _Atomic uint32_t connected;  // 1 while a client is connected
+    _Atomic uint32_t sample_rate;
+    _Atomic uint64_t frames;     // Frames sent to (output) or received from (input) the client
+    _Atomic uint64_t underruns;  // Periods not delivered (output) or zero-filled (input)
+    _Atomic uint64_t drops;      // Frames discarded by the HAL
+    _Atomic uint64_t timeouts;   // Periods where the client was not ready in time
+    _Atomic int64_t latency_us;  // Output: out_get_latency(). Input: age of the next frame to
+                                 // read, from its capture by the client (ring fill + transport)
+    _Atomic int64_t update_ns;   // CLOCK_MONOTONIC of the guest at the last update
+};
+
+struct audio_telemetry_page
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size; // sizeof(struct audio_telemetry_page) of the writer
+    uint32_t reserved;
+    struct audio_telemetry_stream out;
+    struct audio_telemetry_stream in;
+};
+
+struct audio_telemetry_snapshot
+{
+    uint32_t generation;
+    uint32_t connected;
+    uint32_t sample_rate;
+    uint64_t frames;
+    uint64_t underruns;
+    uint64_t drops;
+    uint64_t timeouts;
+    int64_t latency_us;
+    int64_t update_ns;
+};
+
+static inline void audio_telemetry_begin(struct audio_telemetry_stream *stream)
+{
+    atomic_store_explicit(&stream->sequence,
+                          atomic_load_explicit(&stream->sequence, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void audio_telemetry_end(struct audio_telemetry_stream *stream)
+{
+    atomic_store_explicit(&stream->sequence,
+                          atomic_load_explicit(&stream->sequence, memory_order_relaxed) + 1,
+                          memory_order_release);
+}
+
+// Take a consistent copy of one stream section. Return false if the writer
+// kept the section busy for all attempts.
+static inline bool audio_telemetry_read_stream(const struct audio_telemetry_stream *stream,
+                                               struct audio_telemetry_snapshot *snapshot)
+{
+    int attempt;
+
+    for (attempt = 0; attempt < 100; attempt++)
+    {
+        uint32_t sequence = atomic_load_explicit(&stream->sequence, memory_order_acquire);
+        if (sequence & 1)
+        {
+            continue;
+        }
+        snapshot->generation = atomic_load_explicit(&stream->generation, memory_order_relaxed);
+        snapshot->connected = atomic_load_explicit(&stream->connected, memory_order_relaxed);
+        snapshot->sample_rate = atomic_load_explicit(&stream->sample_rate, memory_order_relaxed);
+        snapshot->frames = atomic_load_explicit(&stream->frames, memory_order_relaxed);
+        snapshot->underruns = atomic_load_explicit(&stream->underruns, memory_order_relaxed);
+        snapshot->drops = atomic_load_explicit(&stream->drops, memory_order_relaxed);
+        snapshot->timeouts = atomic_load_explicit(&stream->timeouts, memory_order_relaxed);
+        snapshot->latency_us = atomic_load_explicit(&stream->latency_us, memory_order_relaxed);
+        snapshot->update_ns = atomic_load_explicit(&stream->update_ns, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&stream->sequence, memory_order_relaxed) == sequence)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifndef AUDIO_TELEMETRY_READER_ONLY
+
+// Map the page at virtual.audio.telemetry.path. Without the property, or
+// when the file cannot be mapped, a private page is used so callers never
+// need to check.
+struct audio_telemetry_page *audio_telemetry_open(void);
+void audio_telemetry_close(struct audio_telemetry_page *page);
+const char *audio_telemetry_path(void);
+
+// Per period update from the thread driving the stream.
+static inline void audio_telemetry_update(struct audio_telemetry_stream *stream,
+                                          uint32_t sample_rate, uint64_t frames,
+                                          uint64_t underruns, uint64_t drops, uint64_t timeouts,
+                                          int64_t latency_us, int64_t now_ns)
+{
+    audio_telemetry_begin(stream);
+    if (atomic_load_explicit(&stream->sample_rate, memory_order_relaxed) != sample_rate)
+    {
+        atomic_store_explicit(&stream->sample_rate, sample_rate, memory_order_relaxed);
+    }
+    if (frames)
+    {
+        atomic_store_explicit(&stream->frames,
+                              atomic_load_explicit(&stream->frames, memory_order_relaxed) + frames,
+                              memory_order_relaxed);
+    }
+    if (underruns)
+    {
+        atomic_store_explicit(&stream->underruns,
+                              atomic_load_explicit(&stream->underruns, memory_order_relaxed) + underruns,
+                              memory_order_relaxed);
+    }
+    if (drops)
+    {
+        atomic_store_explicit(&stream->drops,
+                              atomic_load_explicit(&stream->drops, memory_order_relaxed) + drops,
+                              memory_order_relaxed);
+    }
+    if (timeouts)
+    {
+        atomic_store_explicit(&stream->timeouts,
+                              atomic_load_explicit(&stream->timeouts, memory_order_relaxed) + timeouts,
+                              memory_order_relaxed);
+    }
+    atomic_store_explicit(&stream->latency_us, latency_us, memory_order_relaxed);
+    atomic_store_explicit(&stream->update_ns, now_ns, memory_order_relaxed);
+    audio_telemetry_end(stream);
+}
+
+// Called by the socket server threads when a client connects or leaves.
+// Connection events and period updates may come from different threads, so
+// the connection fields are plain atomics outside the sequence lock.
+static inline void audio_telemetry_set_connected(struct audio_telemetry_stream *stream,
+                                                 bool connected)
+{
+    if (connected)
+    {
+        atomic_fetch_add_explicit(&stream->generation, 1, memory_order_relaxed);
+    }
+    atomic_store_explicit(&stream->connected, connected ? 1 : 0, memory_order_relaxed);
+}
+
+#endif // AUDIO_TELEMETRY_READER_ONLY
+
+#endif // AUDIO_TELEMETRY_H
@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "audio_hw_virtual"
+#define ATRACE_TAG ATRACE_TAG_AUDIO
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <log/log.h>
+
+#include <cutils/properties.h>
+#include <cutils/trace.h>
+
+#include "audio_trace.h"
+
+#define AUDIO_TRACE_RING_EVENTS 2048 // Power of two
+#define AUDIO_TRACE_MAX_THREADS 8
+#define AUDIO_TRACE_FLUSH_MILLISECONDS 100
+#define AUDIO_TRACE_PROPERTY_POLL_MILLISECONDS 1000
+#define AUDIO_TRACE_DEFAULT_PATH "/data/vendor/audio/avh_trace.txt"
+
+struct audio_trace_event
+{
+    int64_t timestamp_ns;
+    int64_t value;
+    uint32_t id;
+    uint32_t reserved;
+};
+
+// Single producer (the owning thread), single consumer (the flush thread).
+struct audio_trace_ring
+{
+    _Atomic uint64_t head;
+    _Atomic uint64_t tail;
+    _Atomic uint64_t dropped;
+    _Atomic bool owned; // Claimed by a live thread
+    pid_t tid;
+    struct audio_trace_event events[AUDIO_TRACE_RING_EVENTS];
+};
+
+static const char *const audio_trace_names[AUDIO_TRACE_ID_COUNT] = {
+    [AUDIO_TRACE_OUT_WRITE] = "avh_out_write",
+    [AUDIO_TRACE_OUT_CLIENT_HUP] = "avh_out_client_EPOLLERR_or_EPOLLHUP",
+    [AUDIO_TRACE_OUT_CMD_DATA_BEFORE_WRITE] = "avh_CMD_DATA_count_before_write",
+    [AUDIO_TRACE_OUT_CMD_DATA_AFTER_WRITE] = "avh_CMD_DATA_count_after_write",
+    [AUDIO_TRACE_OUT_DATA_BEFORE_WRITE] = "avh_data_count_before_write",
+    [AUDIO_TRACE_OUT_DATA_AFTER_WRITE] = "avh_data_count_after_write",
+    [AUDIO_TRACE_OSST_BEFORE_SEND_CLOSE] = "avh_osst_before_send_close_cmd",
+    [AUDIO_TRACE_OSST_AFTER_SEND_CLOSE] = "avh_osst_after_send_close_cmd",
+    [AUDIO_TRACE_OSST_BEFORE_SEND_OPEN] = "avh_osst_before_send_open_cmd",
+    [AUDIO_TRACE_OSST_AFTER_SEND_OPEN] = "avh_osst_after_send_open_cmd",
+    [AUDIO_TRACE_OPEN_OUTPUT_BEFORE_SEND_OPEN] = "avh_adv_open_output_stream_before_send_open_cmd",
+    [AUDIO_TRACE_OPEN_OUTPUT_AFTER_SEND_OPEN] = "avh_adv_open_output_stream_after_send_open_cmd",
+    [AUDIO_TRACE_IN_READ] = "avh_in_read",
+    [AUDIO_TRACE_IN_DATA_READ] = "avh_in_data_read",
+};
+
+_Atomic int audio_trace_mode = AUDIO_TRACE_MODE_OFF;
+
+static struct
+{
+    struct audio_trace_ring *rings; // AUDIO_TRACE_MAX_THREADS, allocated on first enable
+    _Atomic uint64_t unregistered_dropped; // Events of threads beyond AUDIO_TRACE_MAX_THREADS
+    pthread_once_t key_once;
+    pthread_key_t key; // Releases the ring of an exiting thread
+    pthread_mutex_t lock;                  // Serialises mode changes and flushes
+    pthread_t thread;
+    bool thread_started;
+    _Atomic bool exit;
+    FILE *file;
+    char path[PROPERTY_VALUE_MAX];
+    uint64_t flushed;
+} trace = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .key_once = PTHREAD_ONCE_INIT,
+};
+
+static __thread struct audio_trace_ring *thread_ring;
+static __thread bool thread_ring_unavailable;
+
+static int64_t audio_trace_now_ns(void)
+{
+    struct timespec t = {.tv_sec = 0, .tv_nsec = 0};
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+// Pending events of an exiting thread are still drained by the flush thread.
+static void audio_trace_release_ring(void *ring)
+{
+    atomic_store_explicit(&((struct audio_trace_ring *)ring)->owned, false, memory_order_release);
+}
+
+static void audio_trace_create_key(void)
+{
+    pthread_key_create(&trace.key, audio_trace_release_ring);
+}
+
+static struct audio_trace_ring *audio_trace_claim_ring(void)
+{
+    unsigned int index;
+
+    if (thread_ring_unavailable)
+    {
+        return NULL;
+    }
+    pthread_once(&trace.key_once, audio_trace_create_key);
+    for (index = 0; index < AUDIO_TRACE_MAX_THREADS; index++)
+    {
+        bool owned = false;
+        if (atomic_compare_exchange_strong(&trace.rings[index].owned, &owned, true))
+        {
+            thread_ring = &trace.rings[index];
+            thread_ring->tid = gettid();
+            pthread_setspecific(trace.key, thread_ring);
+            return thread_ring;
+        }
+    }
+    thread_ring_unavailable = true;
+    return NULL;
+}
+
+void audio_trace_record(uint32_t id, int64_t value)
+{
+    int mode = atomic_load_explicit(&audio_trace_mode, memory_order_acquire);
+    struct audio_trace_ring *ring = thread_ring;
+    struct audio_trace_event *event;
+    uint64_t head;
+
+    if (mode == AUDIO_TRACE_MODE_OFF)
+    {
+        return;
+    }
+    if (mode == AUDIO_TRACE_MODE_ATRACE)
+    {
+        // atrace stamps a counter when it is written: a batch written later
+        // would show every value at the time of the flush.
+        if (ATRACE_ENABLED())
+        {
+            ATRACE_INT64(id < AUDIO_TRACE_ID_COUNT ? audio_trace_names[id] : "?", value);
+        }
+        return;
+    }
+    if (!ring && !(ring = audio_trace_claim_ring()))
+    {
+        atomic_fetch_add_explicit(&trace.unregistered_dropped, 1, memory_order_relaxed);
+        return;
+    }
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= AUDIO_TRACE_RING_EVENTS)
+    {
+        atomic_store_explicit(&ring->dropped,
+                              atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return;
+    }
+    event = &ring->events[head & (AUDIO_TRACE_RING_EVENTS - 1)];
+    event->timestamp_ns = audio_trace_now_ns();
+    event->value = value;
+    event->id = id;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Drain all rings into the file. Called with trace.lock held; events left
+// from the file mode are dropped in the others.
+static void audio_trace_flush_locked(int mode)
+{
+    unsigned int index;
+
+    if (!trace.rings)
+    {
+        return;
+    }
+    for (index = 0; index < AUDIO_TRACE_MAX_THREADS; index++)
+    {
+        struct audio_trace_ring *ring = &trace.rings[index];
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+        for (; tail < head; tail++)
+        {
+            const struct audio_trace_event *event =
+                &ring->events[tail & (AUDIO_TRACE_RING_EVENTS - 1)];
+            const char *name = event->id < AUDIO_TRACE_ID_COUNT ? audio_trace_names[event->id] : "?";
+
+            if (mode == AUDIO_TRACE_MODE_FILE && trace.file)
+            {
+                fprintf(trace.file, "%lld %d %s %lld\n", (long long)event->timestamp_ns,
+                        ring->tid, name, (long long)event->value);
+            }
+            trace.flushed++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+    if (trace.file)
+    {
+        fflush(trace.file);
+    }
+}
+
+static void audio_trace_poll_property(void)
+{
+    char mode[PROPERTY_VALUE_MAX] = {
+        '\0',
+    };
+    char path[PROPERTY_VALUE_MAX] = {
+        '\0',
+    };
+
+    property_get("virtual.audio.trace", mode, "atrace");
+    property_get("virtual.audio.trace.path", path, AUDIO_TRACE_DEFAULT_PATH);
+    if (audio_trace_mode_from_string(mode) !=
+            atomic_load_explicit(&audio_trace_mode, memory_order_relaxed) ||
+        strcmp(path, trace.path) != 0)
+    {
+        audio_trace_set_mode(audio_trace_mode_from_string(mode), path);
+    }
+}
+
+static void *audio_trace_thread(void *args)
+{
+    int64_t next_poll_ns = 0;
+
+    while (!atomic_load_explicit(&trace.exit, memory_order_relaxed))
+    {
+        int mode = atomic_load_explicit(&audio_trace_mode, memory_order_acquire);
+        int64_t now_ns = audio_trace_now_ns();
+
+        if (now_ns >= next_poll_ns)
+        {
+            audio_trace_poll_property();
+            next_poll_ns = now_ns + AUDIO_TRACE_PROPERTY_POLL_MILLISECONDS * 1000000LL;
+        }
+        if (mode == AUDIO_TRACE_MODE_FILE)
+        {
+            pthread_mutex_lock(&trace.lock);
+            audio_trace_flush_locked(mode);
+            pthread_mutex_unlock(&trace.lock);
+        }
+        usleep((mode == AUDIO_TRACE_MODE_FILE ? AUDIO_TRACE_FLUSH_MILLISECONDS
+                                             : AUDIO_TRACE_PROPERTY_POLL_MILLISECONDS) * 1000);
+    }
+    return NULL;
+}
+
+int audio_trace_mode_from_string(const char *str)
+{
+    if (strcmp(str, "file") == 0)
+    {
+        return AUDIO_TRACE_MODE_FILE;
+    }
+    if (strcmp(str, "atrace") == 0)
+    {
+        return AUDIO_TRACE_MODE_ATRACE;
+    }
+    return AUDIO_TRACE_MODE_OFF;
+}
+
+const char *audio_trace_mode_to_string(int mode)
+{
+    switch (mode)
+    {
+    case AUDIO_TRACE_MODE_FILE:
+        return "file";
+    case AUDIO_TRACE_MODE_ATRACE:
+        return "atrace";
+    default:
+        return "off";
+    }
+}
+
+int audio_trace_set_mode(int mode, const char *path)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&trace.lock);
+    // Flush what was recorded under the previous mode before switching.
+    audio_trace_flush_locked(atomic_load_explicit(&audio_trace_mode, memory_order_relaxed));
+    if (mode == AUDIO_TRACE_MODE_FILE && !trace.rings)
+    {
+        trace.rings = (struct audio_trace_ring *)calloc(AUDIO_TRACE_MAX_THREADS,
+                                                        sizeof(struct audio_trace_ring));
+        if (!trace.rings)
+        {
+            ALOGE("%s: Fail to allocate trace rings.", __func__);
+            mode = AUDIO_TRACE_MODE_OFF;
+            ret = -ENOMEM;
+        }
+    }
+    if (path && strcmp(path, trace.path) != 0)
+    {
+        snprintf(trace.path, sizeof(trace.path), "%s", path);
+        if (trace.file)
+        {
+            fclose(trace.file);
+            trace.file = NULL;
+        }
+    }
+    if (mode == AUDIO_TRACE_MODE_FILE && !trace.file)
+    {
+        trace.file = fopen(trace.path, "a");
+        if (!trace.file)
+        {
+            ALOGE("%s: Fail to open trace file %s: %s", __func__, trace.path, strerror(errno));
+            mode = AUDIO_TRACE_MODE_OFF;
+            ret = -errno;
+        }
+    }
+    else if (mode != AUDIO_TRACE_MODE_FILE && trace.file)
+    {
+        fclose(trace.file);
+        trace.file = NULL;
+    }
+    atomic_store_explicit(&audio_trace_mode, mode, memory_order_release);
+    pthread_mutex_unlock(&trace.lock);
+    ALOGI("Trace mode is %s%s%s", audio_trace_mode_to_string(mode),
+          mode == AUDIO_TRACE_MODE_FILE ? " to " : "",
+          mode == AUDIO_TRACE_MODE_FILE ? trace.path : "");
+    return ret;
+}
+
+int audio_trace_init(void)
+{
+    atomic_store_explicit(&trace.exit, false, memory_order_relaxed);
+    audio_trace_poll_property();
+    if (pthread_create(&trace.thread, NULL, audio_trace_thread, NULL))
+    {
+        ALOGE("%s: Fail to create trace flush thread.", __func__);
+        return -1;
+    }
+    trace.thread_started = true;
+    return 0;
+}
+
+void audio_trace_release(void)
+{
+    if (trace.thread_started)
+    {
+        atomic_store_explicit(&trace.exit, true, memory_order_relaxed);
+        pthread_join(trace.thread, NULL);
+        trace.thread_started = false;
+    }
+    // The rings stay allocated: threads of the process may still hold them.
+    audio_trace_set_mode(AUDIO_TRACE_MODE_OFF, NULL);
+}
+
+void audio_trace_dump(int fd)
+{
+    uint64_t dropped = atomic_load_explicit(&trace.unregistered_dropped, memory_order_relaxed);
+    unsigned int count = 0;
+    unsigned int index;
+
+    for (index = 0; trace.rings && index < AUDIO_TRACE_MAX_THREADS; index++)
+    {
+        dropped += atomic_load_explicit(&trace.rings[index].dropped, memory_order_relaxed);
+        count += atomic_load_explicit(&trace.rings[index].owned, memory_order_relaxed);
+    }
+    dprintf(fd, "  Trace mode %s%s%s, %u thread rings, %llu events flushed, %llu dropped\n",
+            audio_trace_mode_to_string(atomic_load_explicit(&audio_trace_mode, memory_order_relaxed)),
+            trace.file ? " to " : "", trace.file ? trace.path : "", count,
+            (unsigned long long)trace.flushed, (unsigned long long)dropped);
+}
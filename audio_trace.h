@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef AUDIO_TRACE_H
+#define AUDIO_TRACE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Hot path events. In the file mode each thread records into its own
+// preallocated ring and a background thread drains the rings in batches to
+// a text file, so recording costs one clock read and one store. The atrace
+// mode writes counters (with the names below) to trace_marker inline, while
+// atrace enables the audio tag: atrace stamps a counter when it is written,
+// so a batch would carry the time of the flush instead of the event's.
+enum audio_trace_id
+{
+    AUDIO_TRACE_OUT_WRITE = 0, // 1 when out_write() begins, 0 when it ends
+    AUDIO_TRACE_OUT_CLIENT_HUP,
+    AUDIO_TRACE_OUT_CMD_DATA_BEFORE_WRITE,
+    AUDIO_TRACE_OUT_CMD_DATA_AFTER_WRITE,
+    AUDIO_TRACE_OUT_DATA_BEFORE_WRITE,
+    AUDIO_TRACE_OUT_DATA_AFTER_WRITE,
+    AUDIO_TRACE_OSST_BEFORE_SEND_CLOSE,
+    AUDIO_TRACE_OSST_AFTER_SEND_CLOSE,
+    AUDIO_TRACE_OSST_BEFORE_SEND_OPEN,
+    AUDIO_TRACE_OSST_AFTER_SEND_OPEN,
+    AUDIO_TRACE_OPEN_OUTPUT_BEFORE_SEND_OPEN,
+    AUDIO_TRACE_OPEN_OUTPUT_AFTER_SEND_OPEN,
+    AUDIO_TRACE_IN_READ,       // 1 when in_read() begins, 0 when it ends
+    AUDIO_TRACE_IN_DATA_READ,  // Bytes returned by read() from the client
+    AUDIO_TRACE_ID_COUNT
+};
+
+enum audio_trace_mode
+{
+    AUDIO_TRACE_MODE_OFF = 0,
+    AUDIO_TRACE_MODE_ATRACE, // Inline counters, only while atrace enables the audio tag
+    AUDIO_TRACE_MODE_FILE,
+};
+
+extern _Atomic int audio_trace_mode;
+
+void audio_trace_record(uint32_t id, int64_t value);
+
+static inline void audio_trace(uint32_t id, int64_t value)
+{
+    if (atomic_load_explicit(&audio_trace_mode, memory_order_relaxed) != AUDIO_TRACE_MODE_OFF)
+    {
+        audio_trace_record(id, value);
+    }
+}
+
+// Read virtual.audio.trace / virtual.audio.trace.path and start the flush
+// thread. The mode can be changed at runtime through the property or
+// audio_trace_set_mode().
+int audio_trace_init(void);
+void audio_trace_release(void);
+int audio_trace_set_mode(int mode, const char *path);
+int audio_trace_mode_from_string(const char *str);
+const char *audio_trace_mode_to_string(int mode);
+void audio_trace_dump(int fd);
+
+#endif // AUDIO_TRACE_H
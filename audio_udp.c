@@ -0,0 +1,482 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "audio_hw_virtual"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <log/log.h>
+
+#include <cutils/properties.h>
+
+#include "audio_udp.h"
+
+#define AUDIO_UDP_EXIT_POLL_MS 200
+#define AUDIO_UDP_STREAMS 2 // Indexed by AUDIO_IN/AUDIO_OUT
+
+struct audio_udp_config
+{
+    bool enabled;
+    struct in_addr bind_address;
+    int port;
+    int fec_group;
+    int jitter_ms;
+};
+
+struct audio_udp
+{
+    struct audio_udp_config config;
+    int fd;
+    pthread_t thread;
+    bool running;
+    volatile int exit;
+    audio_udp_receive_fn receive;
+    struct audio_datagram_batch *batch; // Receive thread only
+    struct audio_jitter_buffer *input;
+    uint64_t secret[2]; // Keys the attach cookies
+
+    pthread_mutex_t lock; // Peer, senders and send counters
+    bool attached;
+    struct sockaddr_in peer;
+    struct audio_datagram_sender senders[AUDIO_UDP_STREAMS];
+    uint64_t attaches;
+    uint64_t sent;
+    uint64_t parity_sent;
+    uint64_t send_calls;
+    uint64_t send_dropped;
+
+    // Receive thread only
+    uint64_t received;
+    uint64_t receive_calls;
+    uint64_t malformed;
+    uint64_t challenges; // CMD_OPEN without the sender's cookie
+};
+
+static struct audio_udp udp = {
+    .fd = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int64_t udp_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int audio_udp_init(void)
+{
+    char address[PROPERTY_VALUE_MAX];
+
+    udp.config.enabled = property_get_int32("virtual.audio.udp.enable", 0) > 0;
+    property_get("virtual.audio.udp.bind", address, AUDIO_UDP_DEFAULT_BIND);
+    if (inet_pton(AF_INET, address, &udp.config.bind_address) != 1)
+    {
+        ALOGE("%s virtual.audio.udp.bind=%s is not an IPv4 address, using %s", __func__, address,
+              AUDIO_UDP_DEFAULT_BIND);
+        inet_pton(AF_INET, AUDIO_UDP_DEFAULT_BIND, &udp.config.bind_address);
+    }
+    udp.config.port = property_get_int32("virtual.audio.udp.port", AUDIO_UDP_DEFAULT_PORT);
+    udp.config.fec_group = property_get_int32("virtual.audio.udp.fec_group", 0);
+    if (udp.config.fec_group < 0)
+    {
+        udp.config.fec_group = 0;
+    }
+    else if (udp.config.fec_group > AUDIO_DATAGRAM_MAX_FEC_GROUP)
+    {
+        udp.config.fec_group = AUDIO_DATAGRAM_MAX_FEC_GROUP;
+    }
+    udp.config.jitter_ms = property_get_int32("virtual.audio.udp.jitter_ms",
+                                              AUDIO_UDP_DEFAULT_JITTER_MS);
+    if (udp.config.jitter_ms < 0)
+    {
+        udp.config.jitter_ms = 0;
+    }
+    return 0;
+}
+
+bool audio_udp_enabled(void)
+{
+    return udp.config.enabled;
+}
+
+static bool same_address(const struct sockaddr_in *a, const struct sockaddr_in *b)
+{
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+static uint64_t udp_mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Never 0, which is what a client that was not challenged yet sends.
+static uint32_t udp_cookie(const struct sockaddr_in *from)
+{
+    uint64_t x = udp_mix(udp.secret[0] ^ ((uint64_t)from->sin_addr.s_addr << 16 | from->sin_port));
+    return (uint32_t)(udp_mix(x ^ udp.secret[1]) >> 32) | 1;
+}
+
+bool audio_udp_admit(const struct audio_datagram_header *header, const struct sockaddr_in *from)
+{
+    struct audio_datagram challenge;
+    uint32_t cookie = udp_cookie(from);
+
+    if (header->cookie == cookie)
+    {
+        return true;
+    }
+    // No payload: the answer is never larger than what asked for it.
+    memset(&challenge.header, 0, sizeof(challenge.header));
+    challenge.header.cmd = header->cmd;
+    challenge.header.stream = header->stream;
+    challenge.header.flags = AUDIO_DATAGRAM_FLAG_COOKIE;
+    challenge.header.cookie = cookie;
+    challenge.payload = NULL;
+    audio_datagram_send(udp.fd, from, &challenge, 1, MSG_DONTWAIT);
+    udp.challenges++;
+    return false;
+}
+
+static void *udp_receive_thread(void *args)
+{
+    struct pollfd pfd = {.fd = udp.fd, .events = POLLIN};
+
+    ALOGV("%s Receiving on udp port %d", __func__, udp.config.port);
+    while (!udp.exit)
+    {
+        int count;
+        int i;
+
+        if (poll(&pfd, 1, AUDIO_UDP_EXIT_POLL_MS) <= 0)
+        {
+            continue;
+        }
+        count = audio_datagram_receive(udp.fd, udp.batch, MSG_DONTWAIT);
+        if (count <= 0)
+        {
+            if (count < 0 && errno != EAGAIN)
+            {
+                ALOGE("%s recvmmsg() failed: %s", __func__, strerror(errno));
+            }
+            continue;
+        }
+        udp.receive_calls++;
+        for (i = 0; i < count; i++)
+        {
+            struct audio_datagram_header header;
+            const struct sockaddr_in *from = &udp.batch->from[i];
+            size_t bytes;
+            const uint8_t *payload = audio_datagram_parse(udp.batch, i, &header, &bytes);
+            bool from_peer;
+
+            if (!payload)
+            {
+                udp.malformed++;
+                continue;
+            }
+            udp.received++;
+            pthread_mutex_lock(&udp.lock);
+            from_peer = udp.attached && same_address(&udp.peer, from);
+            pthread_mutex_unlock(&udp.lock);
+            udp.receive(&header, payload, bytes, from, from_peer);
+        }
+    }
+    return NULL;
+}
+
+int audio_udp_start(audio_udp_receive_fn receive)
+{
+    struct sockaddr_in addr_in;
+    int so_reuseaddr = 1;
+
+    if (!udp.config.enabled || udp.running)
+    {
+        return 0;
+    }
+    udp.batch = calloc(1, sizeof(*udp.batch));
+    udp.input = calloc(1, sizeof(*udp.input));
+    if (!udp.batch || !udp.input || audio_jitter_init(udp.input) != 0)
+    {
+        ALOGE("%s Cannot allocate the udp buffers", __func__);
+        free(udp.batch);
+        free(udp.input);
+        udp.batch = NULL;
+        udp.input = NULL;
+        return -ENOMEM;
+    }
+    udp.receive = receive;
+    if (getrandom(udp.secret, sizeof(udp.secret), 0) != sizeof(udp.secret))
+    {
+        ALOGW("%s getrandom() failed: %s, the attach cookies are guessable", __func__,
+              strerror(errno));
+        udp.secret[0] = udp_now_ns();
+        udp.secret[1] = udp_mix(udp.secret[0] ^ getpid());
+    }
+
+    udp.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udp.fd < 0)
+    {
+        ALOGE("%s Fail to construct udp socket with error: %s", __func__, strerror(errno));
+        audio_udp_release();
+        return -errno;
+    }
+    if (setsockopt(udp.fd, SOL_SOCKET, SO_REUSEADDR, &so_reuseaddr, sizeof(int)) < 0)
+    {
+        ALOGE("%s setsockopt(SO_REUSEADDR) failed. fd: %d", __func__, udp.fd);
+    }
+    memset(&addr_in, 0, sizeof(addr_in));
+    addr_in.sin_family = AF_INET;
+    addr_in.sin_addr = udp.config.bind_address;
+    addr_in.sin_port = htons(udp.config.port);
+    if (bind(udp.fd, (struct sockaddr *)&addr_in, sizeof(addr_in)) < 0)
+    {
+        ALOGE("%s Failed to bind udp %s:%d. %s", __func__, inet_ntoa(udp.config.bind_address),
+              udp.config.port, strerror(errno));
+        audio_udp_release();
+        return -EADDRINUSE;
+    }
+
+    udp.exit = 0;
+    if (pthread_create(&udp.thread, NULL, udp_receive_thread, NULL) != 0)
+    {
+        ALOGE("%s Cannot start the udp receive thread", __func__);
+        audio_udp_release();
+        return -ENOMEM;
+    }
+    udp.running = true;
+    ALOGI("%s UDP transport on %s:%d, fec group %d, jitter buffer %d ms", __func__,
+          inet_ntoa(udp.config.bind_address), udp.config.port, udp.config.fec_group, udp.config.jitter_ms);
+    return 0;
+}
+
+void audio_udp_release(void)
+{
+    if (udp.running)
+    {
+        udp.exit = 1;
+        pthread_join(udp.thread, NULL);
+        udp.running = false;
+    }
+    if (udp.fd >= 0)
+    {
+        close(udp.fd);
+        udp.fd = -1;
+    }
+    audio_udp_detach();
+    if (udp.input)
+    {
+        audio_jitter_destroy(udp.input);
+        free(udp.input);
+        udp.input = NULL;
+    }
+    free(udp.batch);
+    udp.batch = NULL;
+}
+
+void audio_udp_attach(const struct sockaddr_in *peer)
+{
+    char address[INET_ADDRSTRLEN];
+    int i;
+
+    pthread_mutex_lock(&udp.lock);
+    udp.peer = *peer;
+    udp.attached = true;
+    for (i = 0; i < AUDIO_UDP_STREAMS; i++)
+    {
+        audio_datagram_sender_reset(&udp.senders[i], i, udp.config.fec_group);
+    }
+    udp.attaches++;
+    pthread_mutex_unlock(&udp.lock);
+    if (udp.input)
+    {
+        audio_jitter_reset(udp.input, udp.input->target_bytes);
+    }
+    ALOGW("%s A new udp client attached: %s:%d", __func__,
+          inet_ntop(AF_INET, &peer->sin_addr, address, sizeof(address)), ntohs(peer->sin_port));
+}
+
+void audio_udp_detach(void)
+{
+    pthread_mutex_lock(&udp.lock);
+    udp.attached = false;
+    pthread_mutex_unlock(&udp.lock);
+}
+
+bool audio_udp_attached(void)
+{
+    bool attached;
+    pthread_mutex_lock(&udp.lock);
+    attached = udp.attached;
+    pthread_mutex_unlock(&udp.lock);
+    return attached;
+}
+
+int audio_udp_send_command(uint32_t cmd, uint32_t stream, const void *payload, size_t bytes)
+{
+    struct audio_datagram datagram;
+    int ret = -1;
+
+    if (bytes > AUDIO_DATAGRAM_MAX_PAYLOAD)
+    {
+        return -1;
+    }
+    memset(&datagram.header, 0, sizeof(datagram.header));
+    datagram.header.cmd = cmd;
+    datagram.header.stream = stream;
+    datagram.header.timestamp_ns = udp_now_ns();
+    datagram.header.data_size = bytes;
+    datagram.payload = payload;
+    pthread_mutex_lock(&udp.lock);
+    if (udp.attached && udp.fd >= 0)
+    {
+        ret = audio_datagram_send(udp.fd, &udp.peer, &datagram, 1, MSG_DONTWAIT) == 1 ? 0 : -1;
+        udp.send_calls++;
+    }
+    pthread_mutex_unlock(&udp.lock);
+    return ret;
+}
+
+ssize_t audio_udp_send_data(uint32_t cmd, uint32_t stream, const void *data, size_t bytes)
+{
+    struct audio_datagram datagrams[AUDIO_DATAGRAM_BATCH];
+    int64_t now_ns = udp_now_ns();
+    size_t offset = 0;
+    bool complete = true;
+
+    if (stream >= AUDIO_UDP_STREAMS)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&udp.lock);
+    if (!udp.attached || udp.fd < 0)
+    {
+        pthread_mutex_unlock(&udp.lock);
+        return -1;
+    }
+    while (offset < bytes)
+    {
+        size_t consumed = 0;
+        int count = audio_datagram_packetize(&udp.senders[stream], cmd,
+                                             (const uint8_t *)data + offset, bytes - offset,
+                                             now_ns, datagrams, AUDIO_DATAGRAM_BATCH, &consumed);
+        int sent = audio_datagram_send(udp.fd, &udp.peer, datagrams, count, MSG_DONTWAIT);
+        int i;
+
+        udp.send_calls++;
+        if (sent < count)
+        {
+            udp.send_dropped += count - (sent > 0 ? sent : 0);
+            complete = false;
+        }
+        for (i = 0; i < sent; i++)
+        {
+            udp.sent++;
+            if (datagrams[i].header.flags & AUDIO_DATAGRAM_FLAG_PARITY)
+            {
+                udp.parity_sent++;
+            }
+        }
+        if (consumed == 0)
+        {
+            break;
+        }
+        offset += consumed;
+    }
+    pthread_mutex_unlock(&udp.lock);
+    return complete ? (ssize_t)bytes : -1;
+}
+
+void audio_udp_open_input(size_t bytes_per_ms)
+{
+    if (udp.input)
+    {
+        audio_jitter_reset(udp.input, bytes_per_ms * udp.config.jitter_ms);
+    }
+}
+
+void audio_udp_put_input(const struct audio_datagram_header *header,
+                         const void *payload, size_t bytes)
+{
+    if (udp.input)
+    {
+        audio_jitter_put(udp.input, header, payload, bytes);
+    }
+}
+
+size_t audio_udp_read_input(void *buffer, size_t bytes, int timeout_ms)
+{
+    if (!udp.input)
+    {
+        return 0;
+    }
+    return audio_jitter_get(udp.input, buffer, bytes, timeout_ms, NULL);
+}
+
+void audio_udp_dump(int fd)
+{
+    char address[INET_ADDRSTRLEN] = "-";
+    char bound[INET_ADDRSTRLEN];
+    struct sockaddr_in peer;
+    bool attached;
+    uint64_t attaches, sent, parity_sent, send_calls, send_dropped;
+
+    if (!udp.config.enabled)
+    {
+        dprintf(fd, "  udp transport: off\n");
+        return;
+    }
+    pthread_mutex_lock(&udp.lock);
+    attached = udp.attached;
+    peer = udp.peer;
+    attaches = udp.attaches;
+    sent = udp.sent;
+    parity_sent = udp.parity_sent;
+    send_calls = udp.send_calls;
+    send_dropped = udp.send_dropped;
+    pthread_mutex_unlock(&udp.lock);
+    if (attached)
+    {
+        inet_ntop(AF_INET, &peer.sin_addr, address, sizeof(address));
+    }
+    inet_ntop(AF_INET, &udp.config.bind_address, bound, sizeof(bound));
+    dprintf(fd, "  udp transport: %s:%d, client %s:%d (%llu attaches, %llu challenges), "
+            "fec group %d, jitter buffer %d ms\n",
+            bound, udp.config.port, address, attached ? ntohs(peer.sin_port) : 0,
+            (unsigned long long)attaches, (unsigned long long)udp.challenges,
+            udp.config.fec_group, udp.config.jitter_ms);
+    dprintf(fd, "    sent %llu datagrams (%llu parity) in %llu sendmmsg, dropped %llu; "
+            "received %llu in %llu recvmmsg, malformed %llu\n",
+            (unsigned long long)sent, (unsigned long long)parity_sent,
+            (unsigned long long)send_calls, (unsigned long long)send_dropped,
+            (unsigned long long)udp.received, (unsigned long long)udp.receive_calls,
+            (unsigned long long)udp.malformed);
+    if (udp.input)
+    {
+        audio_jitter_dump(fd, "capture", udp.input);
+    }
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef AUDIO_UDP_H
+#define AUDIO_UDP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "audio_datagram.h"
+
+// UDP transport, for links where TCP head-of-line blocking turns one lost
+// segment into a stall of several periods. Off by default; with
+// virtual.audio.udp.enable=1 it replaces the out, in and duplex
+// connections: one socket bound to virtual.audio.udp.port (default 8770)
+// carries both streams as audio_datagram.h datagrams, with the commands
+// and payloads of the duplex connection. A client attaches by sending
+// CMD_OPEN without payload and detaches with CMD_CLOSE; the HAL only talks
+// to the last client that attached.
+//
+// Attaching takes a round trip, so a spoofed source address can neither
+// take the streams over nor aim them at someone else: a CMD_OPEN without
+// the cookie of its sender's address is answered, to that address, by a
+// datagram of the same size carrying AUDIO_DATAGRAM_FLAG_COOKIE and the
+// cookie, which the client echoes in a new CMD_OPEN. Cookies are keyed by
+// a secret drawn when the socket opens.
+//
+//   udp.bind        IPv4 address to bind (default 127.0.0.1; the vsock or
+//                   bridge address of the host side when it is remote)
+//   udp.fec_group   output datagrams per XOR parity datagram (default 0, no FEC)
+//   udp.jitter_ms   capture buffered before in_read() starts playing (default 40)
+//
+// Capture goes through a jitter buffer, so a lost datagram costs its own
+// length of silence rather than a stall. The latency probe and the drift
+// compensation need the TCP connections.
+#define AUDIO_UDP_DEFAULT_PORT 8770
+#define AUDIO_UDP_DEFAULT_BIND "127.0.0.1"
+#define AUDIO_UDP_DEFAULT_JITTER_MS 40
+
+// Called on the receive thread for every well formed datagram; from_peer
+// tells whether it came from the attached client.
+typedef void (*audio_udp_receive_fn)(const struct audio_datagram_header *header,
+                                     const void *payload, size_t bytes,
+                                     const struct sockaddr_in *from, bool from_peer);
+
+// Read the properties.
+int audio_udp_init(void);
+bool audio_udp_enabled(void);
+// Bind the socket and start the receive thread.
+int audio_udp_start(audio_udp_receive_fn receive);
+void audio_udp_release(void);
+
+// Whether header carries the cookie of from. When it does not, from gets
+// its cookie back in a challenge and the datagram must be ignored.
+bool audio_udp_admit(const struct audio_datagram_header *header, const struct sockaddr_in *from);
+// Talk to peer from now on; numbering and the capture buffer start over.
+void audio_udp_attach(const struct sockaddr_in *peer);
+void audio_udp_detach(void);
+bool audio_udp_attached(void);
+
+// A command datagram to the attached client, 0 on success.
+int audio_udp_send_command(uint32_t cmd, uint32_t stream, const void *payload, size_t bytes);
+// One period of the stream as CMD_DATA datagrams, with parity when FEC is
+// on, in one sendmmsg(). Never blocks. Returns bytes, or -1 when not
+// attached or the socket is full.
+ssize_t audio_udp_send_data(uint32_t cmd, uint32_t stream, const void *data, size_t bytes);
+
+// Size the capture jitter buffer for a stream of bytes_per_ms.
+void audio_udp_open_input(size_t bytes_per_ms);
+void audio_udp_put_input(const struct audio_datagram_header *header,
+                         const void *payload, size_t bytes);
+// Capture audio in sequence, see audio_jitter_get(). Returns the bytes
+// copied, fewer than asked when the client sent nothing in time.
+size_t audio_udp_read_input(void *buffer, size_t bytes, int timeout_ms);
+
+void audio_udp_dump(int fd);
+
+#endif // AUDIO_UDP_H
@@ -0,0 +1,1674 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Loopback benchmark of the virtual audio HAL on a Linux host.
+//
+// Every case runs in a forked child: the module is dlopen()ed, opened
+// through HAL_MODULE_INFO_SYM on private ports, and driven by a writer (and
+// optionally a reader) thread while simulated host clients consume the
+// playback stream and feed the capture stream over loopback TCP (or UDP
+// with --udp, losing datagrams at random with --loss). Each
+// period carries a marker and a CLOCK_MONOTONIC stamp so the clients and
+// the reader can measure end-to-end latency. Durations and pacing jitter
+// are measured on the HAL pacing clock, so with --clock virtual a case
+// runs as fast as the socket path allows. With --telemetry the bench maps
+// the HAL's telemetry page as a host tool would and reads it while the case
+// runs.
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <hardware/audio.h>
+
+#include "audio_datagram.h"
+#define AUDIO_TELEMETRY_READER_ONLY
+#include "audio_telemetry.h"
+#include "avh_host.h"
+#include "avh_syscalls.h"
+
+#define BENCH_DEFAULT_PORT 28760
+#define BENCH_SAMPLE_RATE 48000
+#define BENCH_CHANNELS 2
+#define BENCH_WARMUP_MS 200
+#define BENCH_MAX_LIST 8
+#define BENCH_MARKER 0x4156484250455231ULL // "AVHBPER1"
+#define BENCH_QUEUE_SAMPLES 100 // Playback queue reports averaged at each end
+#define BENCH_CONTROL_KEYS "out_period_ms;in_period_ms;socket_periods;stall_periods;standby_delay_ms;pacing;tap;transport"
+
+struct period_stamp
+{
+    uint64_t marker;
+    int64_t time_ns;
+};
+
+struct bench_case
+{
+    int period_ms;
+    audio_format_t format;
+    int streams; // 1: playback, 2: playback and capture
+};
+
+struct bench_samples
+{
+    int64_t *values;
+    size_t count;
+    size_t capacity;
+};
+
+struct bench_result
+{
+    int ok;
+    uint64_t out_periods;
+    uint64_t in_periods;
+    double speed; // Audio time over real time
+    double cpu_us_per_period;
+    double syscalls_per_period;
+    uint64_t syscalls[AVH_SYSCALL_COUNT];
+    int64_t out_latency_us[3]; // p50, p99, max
+    int64_t out_jitter_us[3];
+    int64_t in_latency_us[3];
+    int64_t in_jitter_us[3];
+    char probe[256]; // Latency probe estimate from get_parameters()
+    double queue_ms[2]; // Simulated client playback queue, mean at start and end
+    uint32_t reported_latency_ms[2]; // out_get_latency(), min and max while measuring
+    struct audio_jitter_stats udp_out; // Jitter buffer of the UDP client
+    char udp_in[256];                  // HAL capture jitter buffer, from its dump
+    int preroll_ms;            // Reported by the input stream at open
+    int64_t first_read_us;     // Duration of the first in_read()
+    int64_t first_read_age_us; // Age of the oldest audio it returned, -1 if unstamped
+    char startup[128];         // Module open and first sound times from get_parameters()
+    int set_ret;               // adev set_parameters() halfway through the run
+    char controls[256];        // Control keys read back after it
+    int64_t in_position_us[3]; // get_capture_position() time against the period stamps
+    uint64_t in_lost;          // Sum of get_input_frames_lost()
+    int telemetry_read;        // Snapshots taken of the telemetry page, of 4 (2 for playback only)
+    uint32_t telemetry_connected[2]; // Out and in, at the end of the measurement
+    uint64_t telemetry_frames[2];    // Out and in, counted while measuring
+    uint32_t telemetry_rate[2];      // Out and in, at the end of the measurement
+    int64_t telemetry_latency_us[2]; // Out and in, at the end of the measurement
+};
+
+struct bench_options
+{
+    const char *module;
+    int port;
+    int duration_ms;
+    const char *clock;
+    bool duplex;
+    bool udp;
+    int loss_percent; // UDP datagrams lost in each direction
+    int fec_group;
+    int preroll_ms; // Always-on capture kept by the HAL before the input opens
+    const char *set; // Control key/value pairs applied halfway through the run
+    const char *telemetry; // virtual.audio.telemetry.path, mapped and read by the bench
+    bool framed_in;  // Frame headers on the separate capture connection
+    int gap;         // Framed capture: every gap-th period is lost at the client
+    bool csv;
+    bool verbose;
+    int probe_ms;
+    bool drift;
+    int drift_ppm; // Simulated host device clock error
+    int periods[BENCH_MAX_LIST];
+    int num_periods;
+    audio_format_t formats[BENCH_MAX_LIST];
+    int num_formats;
+    int streams[BENCH_MAX_LIST];
+    int num_streams;
+};
+
+// State of one case, shared by the driver and the client threads.
+struct bench_run
+{
+    const struct bench_options *opts;
+    struct bench_case c;
+    size_t period_bytes;
+    int out_port;
+    int in_port;
+    int duplex_port;
+    int udp_port;
+    int client_fds[2];
+    pthread_mutex_t write_lock; // The duplex connection has two writers
+    volatile int stop;
+    volatile int measuring;
+    volatile int reader_started;
+    _Atomic int64_t measure_begin_ns; // Real time; stamps from then on are measured
+    bool paced_clients; // Clients pace the capture stream in real time
+    avh_clock_fn audio_now_us;
+    _Atomic int64_t client_cpu_ns;
+    struct bench_samples out_latency;
+    struct bench_samples out_jitter;
+    struct bench_samples in_latency;
+    struct bench_samples in_jitter;
+    struct bench_samples in_position;
+    struct audio_stream_in *in;
+    uint64_t in_periods;
+    uint64_t in_frames_read;
+    uint64_t in_lost;
+    double queue_first_ms; // Sum over the first BENCH_QUEUE_SAMPLES reports
+    double queue_last_ms[BENCH_QUEUE_SAMPLES];
+    uint64_t queue_reports;
+    struct audio_jitter_buffer *udp_out; // Playback of the UDP client
+    int64_t first_read_us;
+    int64_t first_read_age_us;
+};
+
+// Playback of the simulated client: starts once two periods are queued
+// and plays at the host device rate, drift_ppm off the nominal one.
+struct bench_playout
+{
+    int64_t begin_ns;
+    uint64_t received;
+};
+
+static void samples_init(struct bench_samples *s, size_t capacity)
+{
+    s->values = calloc(capacity, sizeof(*s->values));
+    s->capacity = s->values ? capacity : 0;
+    s->count = 0;
+}
+
+static void samples_add(struct bench_samples *s, int64_t value)
+{
+    if (s->count < s->capacity)
+    {
+        s->values[s->count++] = value;
+    }
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Fills p50, p99 and max; -1 when nothing was recorded.
+static void samples_summary(struct bench_samples *s, int64_t out[3])
+{
+    if (s->count == 0)
+    {
+        out[0] = out[1] = out[2] = -1;
+        return;
+    }
+    qsort(s->values, s->count, sizeof(*s->values), compare_int64);
+    out[0] = s->values[(s->count - 1) * 50 / 100];
+    out[1] = s->values[(s->count - 1) * 99 / 100];
+    out[2] = s->values[s->count - 1];
+}
+
+static void client_account_cpu(struct bench_run *run, int64_t *last_cpu_ns)
+{
+    int64_t cpu = avh_now_ns(CLOCK_THREAD_CPUTIME_ID);
+    if (run->measuring)
+    {
+        atomic_fetch_add(&run->client_cpu_ns, cpu - *last_cpu_ns);
+    }
+    *last_cpu_ns = cpu;
+}
+
+static void record_out_latency(struct bench_run *run, const uint8_t *payload, size_t bytes)
+{
+    struct period_stamp stamp;
+    int64_t begin_ns = atomic_load(&run->measure_begin_ns);
+    if (!begin_ns || bytes < sizeof(stamp))
+    {
+        return;
+    }
+    memcpy(&stamp, payload, sizeof(stamp));
+    if (stamp.marker == BENCH_MARKER && stamp.time_ns >= begin_ns)
+    {
+        samples_add(&run->out_latency, (avh_now_ns(CLOCK_MONOTONIC) - stamp.time_ns) / 1000);
+    }
+}
+
+// Answer CMD_PING. The client plays what it receives at once, so the
+// period before the ping is heard when the ping arrives.
+static struct audio_socket_pong make_pong(const uint32_t ping[3], int64_t receive_ns)
+{
+    struct audio_socket_pong pong = {
+        .id = ping[0],
+        .guest_send_ns = (int64_t)((uint64_t)ping[2] << 32 | ping[1]),
+        .host_receive_ns = receive_ns,
+        .host_render_ns = receive_ns,
+    };
+    pong.host_send_ns = avh_now_ns(CLOCK_MONOTONIC);
+    return pong;
+}
+
+// Account for frames received now; return the frames not played yet.
+static uint32_t playout_receive(struct bench_run *run, struct bench_playout *playout,
+                                size_t bytes)
+{
+    int64_t now = avh_now_ns(CLOCK_MONOTONIC);
+    size_t frame_bytes = run->period_bytes / (BENCH_SAMPLE_RATE * run->c.period_ms / 1000);
+    double rate = BENCH_SAMPLE_RATE * (1.0 + run->opts->drift_ppm / 1e6);
+    uint64_t played = 0;
+    uint32_t queued;
+
+    playout->received += bytes / frame_bytes;
+    if (!playout->begin_ns &&
+        playout->received >= 2ULL * BENCH_SAMPLE_RATE * run->c.period_ms / 1000)
+    {
+        playout->begin_ns = now;
+    }
+    if (playout->begin_ns)
+    {
+        played = (uint64_t)((now - playout->begin_ns) * rate / 1e9);
+    }
+    if (played > playout->received)
+    {
+        // Underrun: playback resumes from what arrives next.
+        playout->begin_ns = now - (int64_t)(playout->received / rate * 1e9);
+        played = playout->received;
+    }
+    queued = playout->received - played;
+    if (run->measuring)
+    {
+        double ms = queued * 1000.0 / BENCH_SAMPLE_RATE;
+        if (run->queue_reports < BENCH_QUEUE_SAMPLES)
+        {
+            run->queue_first_ms += ms;
+        }
+        run->queue_last_ms[run->queue_reports++ % BENCH_QUEUE_SAMPLES] = ms;
+    }
+    return queued;
+}
+
+// Sends one capture period every period_ms, stamped at send time.
+static void feed_capture(struct bench_run *run, int fd, bool framed)
+{
+    uint8_t *period = calloc(1, run->period_bytes);
+    struct audio_socket_frame_header header;
+    struct timespec next;
+    uint32_t sequence = 0;
+    int64_t cpu = avh_now_ns(CLOCK_THREAD_CPUTIME_ID);
+
+    if (!period)
+    {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!run->stop)
+    {
+        struct period_stamp stamp = {BENCH_MARKER, avh_now_ns(CLOCK_MONOTONIC)};
+        int failed;
+        memcpy(period, &stamp, sizeof(stamp));
+        pthread_mutex_lock(&run->write_lock);
+        failed = 0;
+        if (framed && run->opts->gap > 0 && sequence % run->opts->gap == run->opts->gap - 1)
+        {
+            // Lost before it reached the client socket: only its number is used.
+            sequence++;
+        }
+        else if (framed)
+        {
+            header.cmd = CMD_DATA;
+            header.stream = AUDIO_IN;
+            header.data_size = run->period_bytes;
+            header.sequence = sequence++;
+            header.timestamp_ns = stamp.time_ns;
+            failed = avh_write_exact(fd, &header, sizeof(header)) < 0 ||
+                     avh_write_exact(fd, period, run->period_bytes) < 0;
+        }
+        else
+        {
+            failed = avh_write_exact(fd, period, run->period_bytes) < 0;
+        }
+        pthread_mutex_unlock(&run->write_lock);
+        if (failed)
+        {
+            break;
+        }
+        client_account_cpu(run, &cpu);
+        if (!run->paced_clients)
+        {
+            continue;
+        }
+        next.tv_nsec += run->c.period_ms * 1000000L;
+        while (next.tv_nsec >= 1000000000L)
+        {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    free(period);
+}
+
+static void *capture_feeder_thread(void *args)
+{
+    struct bench_run *run = args;
+    avh_syscalls_ignore = 1;
+    feed_capture(run, run->client_fds[0], true);
+    return NULL;
+}
+
+// Legacy playback client: 20-byte command, then the payload of CMD_DATA.
+static void *out_client_thread(void *args)
+{
+    struct bench_run *run = args;
+    struct audio_socket_info asi;
+    struct bench_playout playout = {0};
+    uint8_t *payload = malloc(1 << 20);
+    int64_t cpu = avh_now_ns(CLOCK_THREAD_CPUTIME_ID);
+    int fd;
+
+    avh_syscalls_ignore = 1;
+    fd = avh_connect_loopback(run->out_port);
+    if (fd < 0 || !payload)
+    {
+        fprintf(stderr, "out client: cannot connect to port %d\n", run->out_port);
+        free(payload);
+        return NULL;
+    }
+    run->client_fds[0] = fd;
+    while (!run->stop && avh_read_exact(fd, &asi, sizeof(asi)) == 0)
+    {
+        if (asi.cmd == CMD_DATA)
+        {
+            uint32_t bytes = asi.data[0];
+            if (bytes > (1 << 20) || avh_read_exact(fd, payload, bytes) < 0)
+            {
+                break;
+            }
+            record_out_latency(run, payload, bytes);
+            if (run->opts->drift)
+            {
+                struct
+                {
+                    struct audio_socket_info asi;
+                    struct audio_socket_status status;
+                } __attribute__((packed)) report;
+                memset(&report, 0, sizeof(report));
+                report.asi.cmd = CMD_STATUS;
+                report.asi.data[0] = sizeof(report.status);
+                report.status.stream = AUDIO_OUT;
+                report.status.fill_frames = playout_receive(run, &playout, bytes);
+                report.status.host_time_ns = avh_now_ns(CLOCK_MONOTONIC);
+                if (avh_write_exact(fd, &report, sizeof(report)) < 0)
+                {
+                    break;
+                }
+            }
+        }
+        else if (asi.cmd == CMD_PING)
+        {
+            struct
+            {
+                struct audio_socket_info asi;
+                struct audio_socket_pong pong;
+            } __attribute__((packed)) reply;
+            reply.pong = make_pong(asi.data, avh_now_ns(CLOCK_MONOTONIC));
+            memset(&reply.asi, 0, sizeof(reply.asi));
+            reply.asi.cmd = CMD_PONG;
+            reply.asi.data[0] = sizeof(reply.pong);
+            if (avh_write_exact(fd, &reply, sizeof(reply)) < 0)
+            {
+                break;
+            }
+        }
+        client_account_cpu(run, &cpu);
+    }
+    close(fd);
+    free(payload);
+    return NULL;
+}
+
+// Legacy capture client: waits for CMD_OPEN, then streams raw PCM.
+static void *in_client_thread(void *args)
+{
+    struct bench_run *run = args;
+    struct audio_socket_info asi;
+    int fd;
+
+    avh_syscalls_ignore = 1;
+    fd = avh_connect_loopback(run->in_port);
+    if (fd < 0)
+    {
+        fprintf(stderr, "in client: cannot connect to port %d\n", run->in_port);
+        return NULL;
+    }
+    run->client_fds[1] = fd;
+    while (!run->stop && avh_read_exact(fd, &asi, sizeof(asi)) == 0)
+    {
+        if (asi.cmd == CMD_OPEN)
+        {
+            feed_capture(run, fd, run->opts->framed_in);
+            break;
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+// Full-duplex client: one connection, framed in both directions. The
+// capture feeder runs on its own thread once the HAL opens the input.
+static void *duplex_client_thread(void *args)
+{
+    struct bench_run *run = args;
+    struct audio_socket_frame_header header;
+    struct bench_playout playout = {0};
+    uint8_t *payload = malloc(1 << 20);
+    int64_t cpu = avh_now_ns(CLOCK_THREAD_CPUTIME_ID);
+    pthread_t feeder;
+    bool feeding = false;
+    int fd;
+
+    avh_syscalls_ignore = 1;
+    fd = avh_connect_loopback(run->duplex_port);
+    if (fd < 0 || !payload)
+    {
+        fprintf(stderr, "duplex client: cannot connect to port %d\n", run->duplex_port);
+        free(payload);
+        return NULL;
+    }
+    run->client_fds[0] = fd;
+    while (!run->stop && avh_read_exact(fd, &header, sizeof(header)) == 0)
+    {
+        int64_t receive_ns = avh_now_ns(CLOCK_MONOTONIC);
+        if (header.data_size > (1 << 20) ||
+            avh_read_exact(fd, payload, header.data_size) < 0)
+        {
+            break;
+        }
+        if (header.cmd == CMD_DATA && header.stream == AUDIO_OUT)
+        {
+            record_out_latency(run, payload, header.data_size);
+            if (run->opts->drift)
+            {
+                struct audio_socket_status status = {
+                    .stream = AUDIO_OUT,
+                    .fill_frames = playout_receive(run, &playout, header.data_size),
+                    .host_time_ns = avh_now_ns(CLOCK_MONOTONIC),
+                };
+                int failed;
+                header.cmd = CMD_STATUS;
+                header.data_size = sizeof(status);
+                header.timestamp_ns = status.host_time_ns;
+                pthread_mutex_lock(&run->write_lock);
+                failed = avh_write_exact(fd, &header, sizeof(header)) < 0 ||
+                         avh_write_exact(fd, &status, sizeof(status)) < 0;
+                pthread_mutex_unlock(&run->write_lock);
+                if (failed)
+                {
+                    break;
+                }
+            }
+        }
+        else if (header.cmd == CMD_PING && header.data_size >= 3 * sizeof(uint32_t))
+        {
+            uint32_t ping[3];
+            struct audio_socket_pong pong;
+            int failed;
+            memcpy(ping, payload, sizeof(ping));
+            pong = make_pong(ping, receive_ns);
+            header.cmd = CMD_PONG;
+            header.stream = AUDIO_OUT;
+            header.data_size = sizeof(pong);
+            header.timestamp_ns = pong.host_send_ns;
+            pthread_mutex_lock(&run->write_lock);
+            failed = avh_write_exact(fd, &header, sizeof(header)) < 0 ||
+                     avh_write_exact(fd, &pong, sizeof(pong)) < 0;
+            pthread_mutex_unlock(&run->write_lock);
+            if (failed)
+            {
+                break;
+            }
+        }
+        else if (header.cmd == CMD_OPEN && header.stream == AUDIO_IN && !feeding)
+        {
+            feeding = pthread_create(&feeder, NULL, capture_feeder_thread, run) == 0;
+        }
+        client_account_cpu(run, &cpu);
+    }
+    run->stop = 1;
+    if (feeding)
+    {
+        pthread_join(feeder, NULL);
+    }
+    close(fd);
+    free(payload);
+    return NULL;
+}
+
+static bool udp_lose(const struct bench_run *run, unsigned int *seed)
+{
+    return run->opts->loss_percent > 0 && (int)(rand_r(seed) % 100) < run->opts->loss_percent;
+}
+
+// Capture of the UDP client: one period every period_ms, as datagrams.
+static void *udp_feeder_thread(void *args)
+{
+    struct bench_run *run = args;
+    uint8_t *period = calloc(1, run->period_bytes);
+    struct audio_datagram_sender *sender = calloc(1, sizeof(*sender));
+    struct audio_datagram datagrams[AUDIO_DATAGRAM_BATCH];
+    struct timespec next;
+    unsigned int seed = 2;
+    int64_t cpu = avh_now_ns(CLOCK_THREAD_CPUTIME_ID);
+
+    avh_syscalls_ignore = 1;
+    if (!period || !sender)
+    {
+        free(period);
+        free(sender);
+        return NULL;
+    }
+    audio_datagram_sender_reset(sender, AUDIO_IN, run->opts->fec_group);
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!run->stop)
+    {
+        struct period_stamp stamp = {BENCH_MARKER, avh_now_ns(CLOCK_MONOTONIC)};
+        size_t offset = 0;
+
+        memcpy(period, &stamp, sizeof(stamp));
+        while (offset < run->period_bytes)
+        {
+            size_t consumed;
+            int count = audio_datagram_packetize(sender, CMD_DATA, period + offset,
+                                                 run->period_bytes - offset, stamp.time_ns,
+                                                 datagrams, AUDIO_DATAGRAM_BATCH, &consumed);
+            int kept = 0;
+            int i;
+            for (i = 0; i < count; i++)
+            {
+                if (!udp_lose(run, &seed))
+                {
+                    datagrams[kept++] = datagrams[i];
+                }
+            }
+            if (kept > 0)
+            {
+                audio_datagram_send(run->client_fds[0], NULL, datagrams, kept, 0);
+            }
+            offset += consumed;
+        }
+        client_account_cpu(run, &cpu);
+        if (!run->paced_clients)
+        {
+            continue;
+        }
+        next.tv_nsec += run->c.period_ms * 1000000L;
+        while (next.tv_nsec >= 1000000000L)
+        {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    free(sender);
+    free(period);
+    return NULL;
+}
+
+// Playback of the UDP client: a period at a time out of the jitter buffer.
+static void *udp_playout_thread(void *args)
+{
+    struct bench_run *run = args;
+    uint8_t *period = malloc(run->period_bytes);
+    int64_t cpu = avh_now_ns(CLOCK_THREAD_CPUTIME_ID);
+    struct timespec next;
+
+    avh_syscalls_ignore = 1;
+    if (!period)
+    {
+        return NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!run->stop)
+    {
+        size_t n = audio_jitter_get(run->udp_out, period, run->period_bytes,
+                                    run->c.period_ms * 2, NULL);
+        if (n == run->period_bytes)
+        {
+            record_out_latency(run, period, n);
+        }
+        client_account_cpu(run, &cpu);
+        if (!run->paced_clients)
+        {
+            continue;
+        }
+        next.tv_nsec += run->c.period_ms * 1000000L;
+        while (next.tv_nsec >= 1000000000L)
+        {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    free(period);
+    return NULL;
+}
+
+// UDP client: attaches with CMD_OPEN, echoing the cookie the HAL challenges
+// it with, plays the output through a jitter buffer of two periods and
+// starts feeding the capture when the HAL opens the input.
+static void *udp_client_thread(void *args)
+{
+    struct bench_run *run = args;
+    struct audio_datagram_batch *batch = calloc(1, sizeof(*batch));
+    struct audio_datagram attach = {{.cmd = CMD_OPEN}, NULL};
+    struct sockaddr_in addr;
+    struct timeval timeout = {0, 100000};
+    pthread_t feeder, playout;
+    bool feeding = false, playing = false;
+    unsigned int seed = 1;
+    int64_t cpu = avh_now_ns(CLOCK_THREAD_CPUTIME_ID);
+    int fd;
+
+    avh_syscalls_ignore = 1;
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(run->udp_port);
+    if (fd < 0 || !batch || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        fprintf(stderr, "udp client: cannot connect to port %d\n", run->udp_port);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        free(batch);
+        return NULL;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    run->client_fds[0] = fd;
+    audio_jitter_reset(run->udp_out, run->period_bytes * 2);
+    playing = pthread_create(&playout, NULL, udp_playout_thread, run) == 0;
+    // The HAL binds its port asynchronously: attach until it answers.
+    audio_datagram_send(fd, NULL, &attach, 1, 0);
+    while (!run->stop)
+    {
+        int count = audio_datagram_receive(fd, batch, 0);
+        int i;
+
+        if (count < 0)
+        {
+            if (!feeding)
+            {
+                audio_datagram_send(fd, NULL, &attach, 1, 0);
+            }
+            continue;
+        }
+        for (i = 0; i < count; i++)
+        {
+            struct audio_datagram_header header;
+            size_t bytes;
+            const uint8_t *payload = audio_datagram_parse(batch, i, &header, &bytes);
+
+            if (!payload)
+            {
+                continue;
+            }
+            if (header.flags & AUDIO_DATAGRAM_FLAG_COOKIE)
+            {
+                // Challenged: attach again with the cookie of our address.
+                attach.header.cookie = header.cookie;
+                audio_datagram_send(fd, NULL, &attach, 1, 0);
+            }
+            else if (header.cmd == CMD_DATA && header.stream == AUDIO_OUT)
+            {
+                if (!udp_lose(run, &seed))
+                {
+                    audio_jitter_put(run->udp_out, &header, payload, bytes);
+                }
+            }
+            else if (header.cmd == CMD_OPEN && header.stream == AUDIO_IN && !feeding)
+            {
+                feeding = pthread_create(&feeder, NULL, udp_feeder_thread, run) == 0;
+            }
+        }
+        client_account_cpu(run, &cpu);
+    }
+    if (feeding)
+    {
+        pthread_join(feeder, NULL);
+    }
+    if (playing)
+    {
+        pthread_join(playout, NULL);
+    }
+    run->client_fds[0] = -1;
+    close(fd);
+    free(batch);
+    return NULL;
+}
+
+// The line of the HAL dump that starts with prefix, without the newline.
+static void dump_line(struct audio_hw_device *adev, const char *prefix, char *line, size_t size)
+{
+    int fd = memfd_create("avh_bench_dump", 0);
+    char *text;
+    char *found;
+    off_t length;
+
+    line[0] = '\0';
+    if (fd < 0)
+    {
+        return;
+    }
+    adev->dump(adev, fd);
+    length = lseek(fd, 0, SEEK_END);
+    text = calloc(1, length + 1);
+    if (text && pread(fd, text, length, 0) == length && (found = strstr(text, prefix)))
+    {
+        found += strlen(prefix);
+        snprintf(line, size, "%.*s", (int)strcspn(found, "\n"), found);
+    }
+    free(text);
+    close(fd);
+}
+
+static void *reader_thread(void *args)
+{
+    struct bench_run *run = args;
+    const size_t frame_bytes = run->period_bytes / (BENCH_SAMPLE_RATE * run->c.period_ms / 1000);
+    uint8_t *buffer = malloc(run->period_bytes);
+    int64_t last_begin = 0;
+
+    if (!buffer)
+    {
+        return NULL;
+    }
+    while (!run->stop)
+    {
+        int64_t begin = run->audio_now_us();
+        int64_t begin_ns = avh_now_ns(CLOCK_MONOTONIC);
+        int64_t position_frames = -1, position_ns = 0;
+        // Where the HAL says the period about to be read was captured.
+        bool positioned = run->in->get_capture_position(run->in, &position_frames,
+                                                        &position_ns) == 0 &&
+                          position_frames == (int64_t)run->in_frames_read;
+        ssize_t n = run->in->read(run->in, buffer, run->period_bytes);
+        struct period_stamp stamp;
+
+        if (n > 0)
+        {
+            run->in_frames_read += n / frame_bytes;
+        }
+        run->in_lost += run->in->get_input_frames_lost(run->in);
+        if (!run->reader_started)
+        {
+            run->first_read_us = (avh_now_ns(CLOCK_MONOTONIC) - begin_ns) / 1000;
+            memcpy(&stamp, buffer, sizeof(stamp));
+            run->first_read_age_us = n > 0 && stamp.marker == BENCH_MARKER ?
+                                     (avh_now_ns(CLOCK_MONOTONIC) - stamp.time_ns) / 1000 : -1;
+        }
+        run->reader_started = 1;
+        if (run->measuring)
+        {
+            run->in_periods++;
+            if (last_begin)
+            {
+                int64_t error = begin - last_begin - run->c.period_ms * 1000;
+                samples_add(&run->in_jitter, error < 0 ? -error : error);
+            }
+            memcpy(&stamp, buffer, sizeof(stamp));
+            if (n == (ssize_t)run->period_bytes && stamp.marker == BENCH_MARKER &&
+                stamp.time_ns >= atomic_load(&run->measure_begin_ns))
+            {
+                samples_add(&run->in_latency, (avh_now_ns(CLOCK_MONOTONIC) - stamp.time_ns) / 1000);
+                if (positioned)
+                {
+                    int64_t error = position_ns - stamp.time_ns;
+                    samples_add(&run->in_position, (error < 0 ? -error : error) / 1000);
+                }
+            }
+        }
+        last_begin = begin;
+    }
+    free(buffer);
+    return NULL;
+}
+
+static const char *format_name(audio_format_t format)
+{
+    switch (format)
+    {
+    case AUDIO_FORMAT_PCM_16_BIT:
+        return "pcm16";
+    case AUDIO_FORMAT_PCM_FLOAT:
+        return "float";
+    case AUDIO_FORMAT_PCM_32_BIT:
+        return "pcm32";
+    default:
+        return "?";
+    }
+}
+
+static size_t format_bytes(audio_format_t format)
+{
+    return format == AUDIO_FORMAT_PCM_16_BIT ? 2 : 4;
+}
+
+// Every key of set that is read back in controls has the value it was set
+// to; keys that are not read back, like stats_reset, are not compared.
+static bool controls_match(const char *set, const char *controls)
+{
+    char copy[256];
+    char *save = NULL;
+    char *pair;
+
+    snprintf(copy, sizeof(copy), "%s", set);
+    for (pair = strtok_r(copy, ";", &save); pair; pair = strtok_r(NULL, ";", &save))
+    {
+        char *value = strchr(pair, '=');
+        const char *found = controls;
+        size_t key_len, value_len;
+
+        if (!value)
+        {
+            continue;
+        }
+        *value++ = '\0';
+        key_len = strlen(pair);
+        while ((found = strstr(found, pair)) &&
+               ((found != controls && found[-1] != ';') || found[key_len] != '='))
+        {
+            found += key_len;
+        }
+        if (!found)
+        {
+            continue;
+        }
+        found += key_len + 1;
+        value_len = strcspn(found, ";");
+        if (value_len != strlen(value) || strncmp(found, value, value_len) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Map the telemetry page the HAL writes, read-only; NULL until the HAL has
+// published it.
+static const struct audio_telemetry_page *map_telemetry(const char *path)
+{
+    struct audio_telemetry_page *page;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED)
+    {
+        return NULL;
+    }
+    if (page->magic != AUDIO_TELEMETRY_MAGIC || page->version != AUDIO_TELEMETRY_VERSION)
+    {
+        munmap(page, sizeof(*page));
+        return NULL;
+    }
+    return page;
+}
+
+// Snapshot the streams of the case; at the end, keep what changed since
+// begin.
+static void read_telemetry(const struct audio_telemetry_page *page, const struct bench_case *c,
+                           struct audio_telemetry_snapshot begin[2], bool end,
+                           struct bench_result *result)
+{
+    const struct audio_telemetry_stream *streams[2] = {&page->out, &page->in};
+    int i;
+
+    for (i = 0; i < c->streams && i < 2; i++)
+    {
+        struct audio_telemetry_snapshot snapshot;
+
+        if (!audio_telemetry_read_stream(streams[i], &snapshot))
+        {
+            continue;
+        }
+        result->telemetry_read++;
+        if (!end)
+        {
+            begin[i] = snapshot;
+            continue;
+        }
+        result->telemetry_connected[i] = snapshot.connected;
+        result->telemetry_frames[i] = snapshot.frames - begin[i].frames;
+        result->telemetry_rate[i] = snapshot.sample_rate;
+        result->telemetry_latency_us[i] = snapshot.latency_us;
+    }
+}
+
+static bool telemetry_passed(const struct bench_case *c, const struct bench_result *r)
+{
+    int i;
+
+    if (r->telemetry_read != 2 * c->streams)
+    {
+        return false;
+    }
+    for (i = 0; i < c->streams && i < 2; i++)
+    {
+        if (r->telemetry_connected[i] != 1 || r->telemetry_frames[i] == 0 ||
+            r->telemetry_rate[i] != BENCH_SAMPLE_RATE || r->telemetry_latency_us[i] <= 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int run_case(const struct bench_options *opts, const struct bench_case *c,
+                    int port, struct bench_result *result)
+{
+    struct bench_run run;
+    struct audio_hw_device *adev;
+    struct audio_stream_out *out = NULL;
+    struct audio_config config;
+    const struct audio_telemetry_page *telemetry = NULL;
+    struct audio_telemetry_snapshot telemetry_begin[2];
+    pthread_t clients[2], reader;
+    int num_clients = 0;
+    bool set_done = false;
+    bool reading = false;
+    uint8_t *buffer;
+    void *dso;
+    size_t capacity;
+    int64_t begin, end, deadline, measure_begin = 0, last_begin = 0;
+    int64_t cpu_begin = 0, real_begin = 0;
+    struct rusage usage;
+    uint64_t syscalls_begin[AVH_SYSCALL_COUNT];
+    int i;
+
+    memset(&run, 0, sizeof(run));
+    memset(result, 0, sizeof(*result));
+    run.opts = opts;
+    run.c = *c;
+    run.period_bytes = (size_t)BENCH_SAMPLE_RATE * c->period_ms / 1000 *
+                       BENCH_CHANNELS * format_bytes(c->format);
+    run.out_port = port;
+    run.in_port = port + 1;
+    run.duplex_port = port + 2;
+    run.udp_port = port + 3;
+    pthread_mutex_init(&run.write_lock, NULL);
+    capacity = (size_t)opts->duration_ms / c->period_ms * 2 + 64;
+    samples_init(&run.out_latency, capacity);
+    samples_init(&run.out_jitter, capacity);
+    samples_init(&run.in_latency, capacity);
+    samples_init(&run.in_jitter, capacity);
+    samples_init(&run.in_position, capacity);
+
+    avh_set_env_int("VIRTUAL_AUDIO_OUT_TCP_PORT", run.out_port);
+    avh_set_env_int("VIRTUAL_AUDIO_IN_TCP_PORT", run.in_port);
+    avh_set_env_int("VIRTUAL_AUDIO_DUPLEX_TCP_PORT", run.duplex_port);
+    setenv("VIRTUAL_AUDIO_DUPLEX_ENABLE", opts->duplex ? "1" : "0", 1);
+    avh_set_env_int("VIRTUAL_AUDIO_UDP_PORT", run.udp_port);
+    setenv("VIRTUAL_AUDIO_UDP_ENABLE", opts->udp ? "1" : "0", 1);
+    avh_set_env_int("VIRTUAL_AUDIO_UDP_FEC_GROUP", opts->fec_group);
+    setenv("VIRTUAL_AUDIO_TRACE", "off", 0);
+    setenv("VIRTUAL_AUDIO_CLOCK", opts->clock, 1);
+    avh_set_env_int("VIRTUAL_AUDIO_PROBE_INTERVAL_MS", opts->probe_ms);
+    avh_set_env_int("VIRTUAL_AUDIO_DRIFT_ENABLE", opts->drift);
+    avh_set_env_int("VIRTUAL_AUDIO_IN_PREROLL_MS", opts->preroll_ms);
+    avh_set_env_int("VIRTUAL_AUDIO_IN_FRAMED", opts->framed_in);
+    if (opts->telemetry)
+    {
+        setenv("VIRTUAL_AUDIO_TELEMETRY_PATH", opts->telemetry, 1);
+    }
+    run.paced_clients = strcmp(opts->clock, "monotonic") == 0;
+
+    adev = avh_open_module(opts->module, &dso);
+    if (!adev)
+    {
+        return -1;
+    }
+    run.audio_now_us = avh_module_clock(dso);
+    if (opts->telemetry && !(telemetry = map_telemetry(opts->telemetry)))
+    {
+        fprintf(stderr, "cannot map the telemetry page %s\n", opts->telemetry);
+    }
+
+    if (opts->udp)
+    {
+        run.udp_out = calloc(1, sizeof(*run.udp_out));
+        if (!run.udp_out || audio_jitter_init(run.udp_out) != 0)
+        {
+            return -1;
+        }
+        pthread_create(&clients[num_clients++], NULL, udp_client_thread, &run);
+    }
+    else if (opts->duplex)
+    {
+        pthread_create(&clients[num_clients++], NULL, duplex_client_thread, &run);
+    }
+    else
+    {
+        pthread_create(&clients[num_clients++], NULL, out_client_thread, &run);
+        if (c->streams > 1)
+        {
+            pthread_create(&clients[num_clients++], NULL, in_client_thread, &run);
+        }
+    }
+    // Give the clients time to connect before the streams are opened, and
+    // the HAL time to fill the pre-roll.
+    usleep(100000 + opts->preroll_ms * 1000);
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = BENCH_SAMPLE_RATE;
+    config.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config.format = c->format;
+    if (adev->open_output_stream(adev, 0, AUDIO_DEVICE_OUT_SPEAKER, AUDIO_OUTPUT_FLAG_PRIMARY,
+                                 &config, &out, NULL) != 0)
+    {
+        fprintf(stderr, "cannot open the output stream\n");
+        return -1;
+    }
+    if (c->streams > 1)
+    {
+        config.channel_mask = AUDIO_CHANNEL_IN_STEREO;
+        if (adev->open_input_stream(adev, 1, AUDIO_DEVICE_IN_BUILTIN_MIC, &config, &run.in,
+                                    AUDIO_INPUT_FLAG_NONE, NULL, AUDIO_SOURCE_MIC) != 0)
+        {
+            fprintf(stderr, "cannot open the input stream\n");
+            return -1;
+        }
+        if (opts->preroll_ms > 0)
+        {
+            char *preroll = run.in->common.get_parameters(&run.in->common, "preroll_ms");
+            const char *value = preroll ? strchr(preroll, '=') : NULL;
+            result->preroll_ms = value ? atoi(value + 1) : -1;
+            free(preroll);
+        }
+        reading = pthread_create(&reader, NULL, reader_thread, &run) == 0;
+        // Both streams must be attached to the pacing clock before the
+        // writer starts, or a virtual clock runs the writer alone.
+        while (reading && !run.reader_started)
+        {
+            usleep(1000);
+        }
+    }
+
+    buffer = calloc(1, run.period_bytes);
+    begin = run.audio_now_us();
+    deadline = begin + (int64_t)(BENCH_WARMUP_MS + opts->duration_ms) * 1000LL;
+    end = begin;
+    while (buffer && end < deadline)
+    {
+        int64_t write_begin = run.audio_now_us();
+        struct period_stamp stamp = {BENCH_MARKER, avh_now_ns(CLOCK_MONOTONIC)};
+
+        if (!run.measuring && write_begin - begin >= BENCH_WARMUP_MS * 1000LL)
+        {
+            real_begin = avh_now_ns(CLOCK_MONOTONIC) / 1000;
+            atomic_store(&run.measure_begin_ns, real_begin * 1000LL);
+            getrusage(RUSAGE_SELF, &usage);
+            cpu_begin = usage.ru_utime.tv_sec * 1000000000LL + usage.ru_utime.tv_usec * 1000LL +
+                        usage.ru_stime.tv_sec * 1000000000LL + usage.ru_stime.tv_usec * 1000LL;
+            avh_syscalls_snapshot(syscalls_begin);
+            measure_begin = write_begin;
+            run.measuring = 1;
+            if (telemetry)
+            {
+                read_telemetry(telemetry, c, telemetry_begin, false, result);
+            }
+        }
+        if (opts->set && !set_done && run.measuring &&
+            write_begin - measure_begin >= opts->duration_ms * 500LL)
+        {
+            char *controls;
+
+            result->set_ret = adev->set_parameters(adev, opts->set);
+            controls = adev->get_parameters(adev, BENCH_CONTROL_KEYS);
+            snprintf(result->controls, sizeof(result->controls), "%s", controls ? controls : "");
+            free(controls);
+            set_done = true;
+        }
+        memcpy(buffer, &stamp, sizeof(stamp));
+        out->write(out, buffer, run.period_bytes);
+        if (run.measuring)
+        {
+            uint32_t latency = out->get_latency(out);
+            if (result->out_periods == 0 || latency < result->reported_latency_ms[0])
+            {
+                result->reported_latency_ms[0] = latency;
+            }
+            if (latency > result->reported_latency_ms[1])
+            {
+                result->reported_latency_ms[1] = latency;
+            }
+            result->out_periods++;
+            if (last_begin && write_begin > measure_begin)
+            {
+                int64_t error = write_begin - last_begin - c->period_ms * 1000;
+                samples_add(&run.out_jitter, error < 0 ? -error : error);
+            }
+        }
+        last_begin = write_begin;
+        end = run.audio_now_us();
+    }
+    run.measuring = 0;
+    if (telemetry)
+    {
+        read_telemetry(telemetry, c, telemetry_begin, true, result);
+    }
+    getrusage(RUSAGE_SELF, &usage);
+    {
+        char *module = adev->get_parameters(adev, "module_open_us");
+        char *stream = out->common.get_parameters(&out->common, "open_first_sound_us");
+        snprintf(result->startup, sizeof(result->startup), "%s %s", module ? module : "",
+                 stream ? stream : "");
+        free(module);
+        free(stream);
+    }
+    if (opts->probe_ms > 0)
+    {
+        char *probe = out->common.get_parameters(&out->common,
+                                                 "latency_probe_rtt_us;latency_probe_one_way_us;"
+                                                 "latency_probe_clock_offset_us;"
+                                                 "latency_probe_output_latency_us");
+        snprintf(result->probe, sizeof(result->probe), "%s", probe ? probe : "");
+        free(probe);
+    }
+    // Detach the writer from the virtual clock so the reader keeps moving.
+    out->common.standby(&out->common);
+    avh_syscalls_snapshot(result->syscalls);
+    for (i = 0; i < AVH_SYSCALL_COUNT; i++)
+    {
+        result->syscalls[i] -= syscalls_begin[i];
+    }
+    if (result->out_periods > 0)
+    {
+        int64_t cpu = usage.ru_utime.tv_sec * 1000000000LL + usage.ru_utime.tv_usec * 1000LL +
+                      usage.ru_stime.tv_sec * 1000000000LL + usage.ru_stime.tv_usec * 1000LL -
+                      cpu_begin - atomic_load(&run.client_cpu_ns);
+        result->cpu_us_per_period = cpu / 1000.0 / result->out_periods;
+        result->speed = (double)(end - measure_begin) / (avh_now_ns(CLOCK_MONOTONIC) / 1000 - real_begin);
+        result->syscalls_per_period = 0;
+        for (i = 0; i < AVH_SYSCALL_COUNT; i++)
+        {
+            result->syscalls_per_period += result->syscalls[i];
+        }
+        result->syscalls_per_period /= result->out_periods;
+    }
+
+    run.stop = 1;
+    if (reading)
+    {
+        pthread_join(reader, NULL);
+    }
+    result->in_periods = run.in_periods;
+    result->first_read_us = run.first_read_us;
+    result->first_read_age_us = run.first_read_age_us;
+    result->in_lost = run.in_lost;
+    if (opts->udp)
+    {
+        dump_line(adev, "capture jitter buffer: ", result->udp_in, sizeof(result->udp_in));
+    }
+    if (run.in)
+    {
+        adev->close_input_stream(adev, run.in);
+    }
+    adev->close_output_stream(adev, out);
+    // The legacy server threads keep the client connections open; wake
+    // the clients up before joining them.
+    for (i = 0; i < 2; i++)
+    {
+        if (run.client_fds[i] > 0)
+        {
+            shutdown(run.client_fds[i], SHUT_RDWR);
+        }
+    }
+    for (i = 0; i < num_clients; i++)
+    {
+        pthread_join(clients[i], NULL);
+    }
+    adev->common.close(&adev->common);
+    if (telemetry)
+    {
+        munmap((void *)telemetry, sizeof(*telemetry));
+    }
+    if (run.udp_out)
+    {
+        size_t buffered;
+        audio_jitter_get_stats(run.udp_out, &result->udp_out, &buffered);
+        audio_jitter_destroy(run.udp_out);
+        free(run.udp_out);
+    }
+
+    if (run.queue_reports >= BENCH_QUEUE_SAMPLES)
+    {
+        result->queue_ms[0] = run.queue_first_ms / BENCH_QUEUE_SAMPLES;
+        for (i = 0; i < BENCH_QUEUE_SAMPLES; i++)
+        {
+            result->queue_ms[1] += run.queue_last_ms[i] / BENCH_QUEUE_SAMPLES;
+        }
+    }
+    samples_summary(&run.out_latency, result->out_latency_us);
+    samples_summary(&run.out_jitter, result->out_jitter_us);
+    samples_summary(&run.in_latency, result->in_latency_us);
+    samples_summary(&run.in_jitter, result->in_jitter_us);
+    samples_summary(&run.in_position, result->in_position_us);
+    free(buffer);
+    pthread_mutex_destroy(&run.write_lock);
+    result->ok = 1;
+    // A control that was refused or did not take fails the case.
+    if (opts->set && (!set_done || result->set_ret != 0 ||
+                      !controls_match(opts->set, result->controls)))
+    {
+        result->ok = 0;
+    }
+    // Connected streams that count no frames in the page fail it too.
+    if (opts->telemetry && !telemetry_passed(c, result))
+    {
+        result->ok = 0;
+    }
+    return 0;
+}
+
+static int parse_int_list(const char *str, int *values, int max)
+{
+    int count = 0;
+    char *end;
+    while (*str && count < max)
+    {
+        long value = strtol(str, &end, 10);
+        if (end == str || value <= 0)
+        {
+            return -1;
+        }
+        values[count++] = value;
+        str = *end == ',' ? end + 1 : end;
+    }
+    return *str ? -1 : count;
+}
+
+static int parse_format_list(const char *str, audio_format_t *formats, int max)
+{
+    char copy[128];
+    char *save = NULL;
+    char *token;
+    int count = 0;
+
+    snprintf(copy, sizeof(copy), "%s", str);
+    for (token = strtok_r(copy, ",", &save); token && count < max;
+         token = strtok_r(NULL, ",", &save))
+    {
+        if (strcmp(token, "pcm16") == 0)
+        {
+            formats[count++] = AUDIO_FORMAT_PCM_16_BIT;
+        }
+        else if (strcmp(token, "pcm32") == 0)
+        {
+            formats[count++] = AUDIO_FORMAT_PCM_32_BIT;
+        }
+        else if (strcmp(token, "float") == 0)
+        {
+            formats[count++] = AUDIO_FORMAT_PCM_FLOAT;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+    return count;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -m, --module PATH     HAL module to load (default %s)\n"
+            "  -p, --periods LIST    period sizes in ms (default 5,10,20)\n"
+            "  -f, --formats LIST    pcm16, pcm32, float (default pcm16,float)\n"
+            "  -s, --streams LIST    1: playback, 2: playback and capture (default 1,2)\n"
+            "  -d, --duration MS     measured audio time per case (default 2000)\n"
+            "  -C, --clock MODE      HAL pacing clock: monotonic, virtual (default monotonic)\n"
+            "  -P, --port PORT       first TCP port to use (default %d)\n"
+            "  -x, --duplex          use the full-duplex connection\n"
+            "  -u, --udp             use the UDP transport\n"
+            "  -l, --loss PERCENT    lose UDP datagrams in both directions\n"
+            "  -F, --fec N           XOR parity every N UDP datagrams\n"
+            "  -R, --preroll MS      keep MS of capture before the input opens, and\n"
+            "                        print what the first read returns\n"
+            "  -S, --set KVPAIRS     set HAL controls halfway through each case, e.g.\n"
+            "                        \"socket_periods=2;stats_reset=1\", and print them\n"
+            "  -T, --framed-in       frame the capture on the separate connection, and\n"
+            "                        print how well get_capture_position() matches it\n"
+            "  -G, --gap N           with framing, lose every Nth capture period at\n"
+            "                        the client\n"
+            "  -M, --telemetry PATH  map the telemetry page at PATH while each case runs,\n"
+            "                        and check that its streams are connected, count\n"
+            "                        frames and have a rate and a latency\n"
+            "  -L, --probe MS        enable the HAL latency probe and print its estimate\n"
+            "  -D, --drift PPM       enable drift compensation against a client whose\n"
+            "                        playback clock is PPM off, and print its queue\n"
+            "                        (latencies are not measured: resampling moves\n"
+            "                        the stamps)\n"
+            "  -c, --csv             print comma separated values\n"
+            "  -v, --verbose         print the system calls of every case\n"
+            "HAL logs go to stderr when AVH_LOG_LEVEL is set (V, D, I, W, E).\n",
+            name, AVH_DEFAULT_MODULE, BENCH_DEFAULT_PORT);
+}
+
+static void print_telemetry(const struct bench_case *c, const struct bench_result *r)
+{
+    printf("    telemetry: %d snapshots, out connected %u counted %" PRIu64 " frames at %u Hz, "
+           "latency %" PRId64 " us",
+           r->telemetry_read, r->telemetry_connected[0], r->telemetry_frames[0],
+           r->telemetry_rate[0], r->telemetry_latency_us[0]);
+    if (c->streams > 1)
+    {
+        printf(", in connected %u counted %" PRIu64 " frames at %u Hz, latency %" PRId64 " us",
+               r->telemetry_connected[1], r->telemetry_frames[1], r->telemetry_rate[1],
+               r->telemetry_latency_us[1]);
+    }
+    printf("\n");
+}
+
+static void print_result(const struct bench_options *opts, const struct bench_case *c,
+                         const struct bench_result *r)
+{
+    const char *mode = opts->udp ? "udp" : opts->duplex ? "duplex" : "separate";
+    int i;
+
+    if (opts->csv)
+    {
+        printf("%s,%d,%s,%d,%d,%" PRIu64 ",%.1f,%.1f,%.2f,%" PRId64 ",%" PRId64 ",%" PRId64
+               ",%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64 "\n",
+               mode, c->period_ms, format_name(c->format), c->streams, r->ok, r->out_periods,
+               r->speed, r->cpu_us_per_period, r->syscalls_per_period,
+               r->out_latency_us[0], r->out_latency_us[1],
+               r->out_jitter_us[0], r->out_jitter_us[1], r->out_jitter_us[2],
+               r->in_latency_us[0], r->in_latency_us[1], r->in_jitter_us[1]);
+        return;
+    }
+    if (!r->ok)
+    {
+        printf("%-8s %4dms %-6s %d  FAILED\n", mode, c->period_ms, format_name(c->format),
+               c->streams);
+        if (opts->set)
+        {
+            printf("    set: %s returned %d, now %s\n", opts->set, r->set_ret, r->controls);
+        }
+        if (opts->telemetry)
+        {
+            print_telemetry(c, r);
+        }
+        return;
+    }
+    printf("%-8s %4dms %-6s %d %7" PRIu64 " %6.1fx %9.1f %8.2f %7" PRId64 " %7" PRId64
+           " %7" PRId64 " %7" PRId64 " %7" PRId64 " %7" PRId64 " %7" PRId64 " %7" PRId64 "\n",
+           mode, c->period_ms, format_name(c->format), c->streams, r->out_periods,
+           r->speed, r->cpu_us_per_period, r->syscalls_per_period,
+           r->out_latency_us[0], r->out_latency_us[1],
+           r->out_jitter_us[0], r->out_jitter_us[1], r->out_jitter_us[2],
+           r->in_latency_us[0], r->in_latency_us[1], r->in_jitter_us[1]);
+    if (opts->probe_ms > 0)
+    {
+        printf("    probe: %s\n", r->probe[0] ? r->probe : "no answer");
+    }
+    if (opts->udp)
+    {
+        printf("    udp out: received %llu recovered %llu concealed %llu late %llu underruns %llu\n",
+               (unsigned long long)r->udp_out.received, (unsigned long long)r->udp_out.recovered,
+               (unsigned long long)r->udp_out.concealed, (unsigned long long)r->udp_out.late,
+               (unsigned long long)r->udp_out.underruns);
+        printf("    udp in: %s\n", r->udp_in[0] ? r->udp_in : "no capture");
+    }
+    if (opts->preroll_ms > 0 && c->streams > 1)
+    {
+        printf("    preroll: %d ms at open, first read %" PRId64 " us returned audio %" PRId64
+               " ms old\n", r->preroll_ms, r->first_read_us,
+               r->first_read_age_us < 0 ? -1 : r->first_read_age_us / 1000);
+    }
+    if (opts->set)
+    {
+        printf("    set: %s returned %d, now %s\n", opts->set, r->set_ret, r->controls);
+    }
+    if (opts->telemetry)
+    {
+        print_telemetry(c, r);
+    }
+    if ((opts->framed_in || opts->duplex) && c->streams > 1)
+    {
+        printf("    capture position: error p50 %" PRId64 " p99 %" PRId64 " max %" PRId64
+               " us, %" PRIu64 " frames lost\n", r->in_position_us[0], r->in_position_us[1],
+               r->in_position_us[2], r->in_lost);
+    }
+    if (opts->drift)
+    {
+        printf("    drift: client queue %.1f ms at start, %.1f ms at end\n", r->queue_ms[0],
+               r->queue_ms[1]);
+    }
+    if (opts->verbose)
+    {
+        printf("    get_latency: %u..%u ms\n", r->reported_latency_ms[0],
+               r->reported_latency_ms[1]);
+        printf("    startup: %s\n", r->startup);
+        printf("    syscalls:");
+        for (i = 0; i < AVH_SYSCALL_COUNT; i++)
+        {
+            if (r->syscalls[i])
+            {
+                printf(" %s=%" PRIu64, avh_syscall_name(i), r->syscalls[i]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        {"module", required_argument, NULL, 'm'},
+        {"periods", required_argument, NULL, 'p'},
+        {"formats", required_argument, NULL, 'f'},
+        {"streams", required_argument, NULL, 's'},
+        {"duration", required_argument, NULL, 'd'},
+        {"clock", required_argument, NULL, 'C'},
+        {"port", required_argument, NULL, 'P'},
+        {"duplex", no_argument, NULL, 'x'},
+        {"udp", no_argument, NULL, 'u'},
+        {"loss", required_argument, NULL, 'l'},
+        {"fec", required_argument, NULL, 'F'},
+        {"preroll", required_argument, NULL, 'R'},
+        {"set", required_argument, NULL, 'S'},
+        {"framed-in", no_argument, NULL, 'T'},
+        {"gap", required_argument, NULL, 'G'},
+        {"telemetry", required_argument, NULL, 'M'},
+        {"probe", required_argument, NULL, 'L'},
+        {"drift", required_argument, NULL, 'D'},
+        {"csv", no_argument, NULL, 'c'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    struct bench_options opts = {
+        .module = avh_default_module_path(),
+        .port = BENCH_DEFAULT_PORT,
+        .duration_ms = 2000,
+        .clock = "monotonic",
+        .periods = {5, 10, 20},
+        .num_periods = 3,
+        .formats = {AUDIO_FORMAT_PCM_16_BIT, AUDIO_FORMAT_PCM_FLOAT},
+        .num_formats = 2,
+        .streams = {1, 2},
+        .num_streams = 2,
+    };
+    int port, failures = 0;
+    int p, f, s, opt;
+
+    while ((opt = getopt_long(argc, argv, "m:p:f:s:d:C:P:xul:F:R:S:TG:M:L:D:cvh", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            opts.module = optarg;
+            break;
+        case 'p':
+            opts.num_periods = parse_int_list(optarg, opts.periods, BENCH_MAX_LIST);
+            break;
+        case 'f':
+            opts.num_formats = parse_format_list(optarg, opts.formats, BENCH_MAX_LIST);
+            break;
+        case 's':
+            opts.num_streams = parse_int_list(optarg, opts.streams, BENCH_MAX_LIST);
+            break;
+        case 'd':
+            opts.duration_ms = atoi(optarg);
+            break;
+        case 'C':
+            opts.clock = optarg;
+            break;
+        case 'P':
+            opts.port = atoi(optarg);
+            break;
+        case 'x':
+            opts.duplex = true;
+            break;
+        case 'u':
+            opts.udp = true;
+            break;
+        case 'l':
+            opts.loss_percent = atoi(optarg);
+            break;
+        case 'F':
+            opts.fec_group = atoi(optarg);
+            break;
+        case 'R':
+            opts.preroll_ms = atoi(optarg);
+            break;
+        case 'S':
+            opts.set = optarg;
+            break;
+        case 'T':
+            opts.framed_in = true;
+            break;
+        case 'G':
+            opts.gap = atoi(optarg);
+            break;
+        case 'M':
+            opts.telemetry = optarg;
+            break;
+        case 'L':
+            opts.probe_ms = atoi(optarg);
+            break;
+        case 'D':
+            opts.drift = true;
+            opts.drift_ppm = atoi(optarg);
+            break;
+        case 'c':
+            opts.csv = true;
+            break;
+        case 'v':
+            opts.verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (opts.num_periods <= 0 || opts.num_formats <= 0 || opts.num_streams <= 0 ||
+        opts.duration_ms <= 0 || opts.port <= 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    for (s = 0; s < opts.num_streams; s++)
+    {
+        if (opts.streams[s] > 2)
+        {
+            fprintf(stderr, "the HAL serves one playback and one capture stream\n");
+            return 2;
+        }
+    }
+
+    if (opts.csv)
+    {
+        printf("mode,period_ms,format,streams,ok,periods,speed,cpu_us_per_period,syscalls_per_period,"
+               "out_latency_p50_us,out_latency_p99_us,out_jitter_p50_us,out_jitter_p99_us,"
+               "out_jitter_max_us,in_latency_p50_us,in_latency_p99_us,in_jitter_p99_us\n");
+    }
+    else
+    {
+        printf("%-8s %6s %-6s %s %7s %7s %9s %8s %15s %23s %15s %7s\n", "mode", "period", "format",
+               "n", "periods", "speed", "cpu/per", "sys/per", "out lat p50/99", "out jitter p50/99/max",
+               "in lat p50/99", "in jit");
+    }
+    fflush(stdout);
+
+    // Every case gets fresh ports and a fresh process: the HAL keeps its
+    // connections in a global and the legacy server threads never exit.
+    setenv("AVH_LOG_LEVEL", "S", 0);
+    port = opts.port;
+    for (p = 0; p < opts.num_periods; p++)
+    {
+        for (f = 0; f < opts.num_formats; f++)
+        {
+            for (s = 0; s < opts.num_streams; s++)
+            {
+                struct bench_case c = {opts.periods[p], opts.formats[f], opts.streams[s]};
+                struct bench_result result;
+                int fds[2];
+                int status;
+                pid_t pid;
+
+                memset(&result, 0, sizeof(result));
+                if (pipe(fds) != 0)
+                {
+                    perror("pipe");
+                    return 1;
+                }
+                pid = fork();
+                if (pid == 0)
+                {
+                    close(fds[0]);
+                    run_case(&opts, &c, port, &result);
+                    avh_write_exact(fds[1], &result, sizeof(result));
+                    _exit(result.ok ? 0 : 1);
+                }
+                close(fds[1]);
+                if (pid < 0 || avh_read_exact(fds[0], &result, sizeof(result)) != 0)
+                {
+                    result.ok = 0;
+                }
+                close(fds[0]);
+                if (pid > 0)
+                {
+                    waitpid(pid, &status, 0);
+                }
+                failures += !result.ok;
+                print_result(&opts, &c, &result);
+                fflush(stdout);
+                port += 4;
+            }
+        }
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,621 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Shared capture check. The capture client sends a microphone array
+// (virtual.audio.in.mic_channels) or a plain stereo capture in which every
+// sample tells its frame and its channel. Several input streams with
+// different channel masks are open on the one connection at the same time,
+// each read by its own thread, and every frame they return is compared
+// with what their mask selects: a sample from the wrong channel, or
+// channels of one frame from different frames, is corrupt, and a frame
+// that does not follow the one before is a jump. A mono stream of the
+// stereo capture must carry the average of the two channels, and a stream
+// at another rate, which goes through the resampler, samples of its own
+// channels from about one frame; its frames are not checked for jumps.
+// The run fails on any corrupt frame or jump, or when a stream received
+// too little of the capture.
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <hardware/audio.h>
+
+#include "avh_host.h"
+
+#define CAPTURE_DEFAULT_PORT 29860
+#define CAPTURE_SAMPLE_RATE 48000
+#define CAPTURE_MAX_STREAMS 4
+#define CAPTURE_MIN_PERCENT 80 // Of the run each stream must verify
+#define CAPTURE_SETTLE_MS 100  // Before the readers start
+
+struct capture_case
+{
+    const char *name;
+    int mics; // virtual.audio.in.mic_channels, 0 for a stereo capture
+    audio_format_t format;
+    audio_channel_mask_t masks[CAPTURE_MAX_STREAMS]; // AUDIO_CHANNEL_NONE ends the list
+    uint32_t rates[CAPTURE_MAX_STREAMS];             // 0 for CAPTURE_SAMPLE_RATE
+};
+
+#define INDEX(bits) (AUDIO_CHANNEL_INDEX_HDR | (bits))
+
+static const struct capture_case capture_cases[] = {
+    {"mic4-pcm16", 4, AUDIO_FORMAT_PCM_16_BIT, {INDEX(0x3), INDEX(0xc), INDEX(0x9), INDEX(0xf)}},
+    {"mic4-pcm32", 4, AUDIO_FORMAT_PCM_32_BIT, {INDEX(0x3), INDEX(0xc), INDEX(0x9), INDEX(0xf)}},
+    {"mic8-pcm16", 8, AUDIO_FORMAT_PCM_16_BIT, {INDEX(0xf), INDEX(0xf0), INDEX(0x81), INDEX(0x55)}},
+    {"mic8-pcm32", 8, AUDIO_FORMAT_PCM_32_BIT, {INDEX(0xf), INDEX(0xf0), INDEX(0x81), INDEX(0x55)}},
+    {"stereo-convert", 0, AUDIO_FORMAT_PCM_16_BIT,
+     {AUDIO_CHANNEL_IN_STEREO, AUDIO_CHANNEL_IN_MONO, AUDIO_CHANNEL_IN_STEREO},
+     {0, 0, CAPTURE_SAMPLE_RATE / 2}},
+};
+
+#define CAPTURE_CASE_COUNT (sizeof(capture_cases) / sizeof(capture_cases[0]))
+
+struct capture_options
+{
+    const char *module;
+    int port;
+    int period_ms;
+    int duration_ms;
+    bool selected[CAPTURE_CASE_COUNT];
+};
+
+struct capture_counters
+{
+    uint64_t frames;  // Verified
+    uint64_t corrupt; // Frames with a sample that is not what the mask selects
+    uint64_t silent;  // All zero: nothing had arrived yet
+    uint64_t jumps;   // The frame after a verified one is not the next frame
+};
+
+struct capture_result
+{
+    int ok;
+    int streams;
+    struct capture_counters counters[CAPTURE_MAX_STREAMS];
+};
+
+struct capture_run
+{
+    const struct capture_options *opts;
+    const struct capture_case *c;
+    uint32_t channels; // Of the capture
+    size_t sample_size;
+    int port;
+    int client_fd;
+    volatile int stop;
+};
+
+struct capture_reader
+{
+    struct capture_run *run;
+    struct audio_stream_in *in;
+    audio_channel_mask_t mask;
+    uint32_t rate;
+    uint32_t channels;
+    bool downmix;   // Mono average of the capture channels
+    bool resampled; // At another rate than the capture
+    int source[AUDIO_CHANNEL_COUNT_MAX]; // Capture channel of each stream channel
+    struct capture_counters *counters;
+};
+
+// Sample of the capture: set top bit so it is never 0, the channel and as
+// much of the frame counter as fits below it.
+static uint32_t frame_bits(size_t sample_size)
+{
+    return sample_size == 2 ? 11 : 24;
+}
+
+static int64_t pattern(size_t sample_size, uint64_t frame, uint32_t channel)
+{
+    const uint32_t bits = frame_bits(sample_size);
+    const uint32_t v = (uint32_t)channel << bits | (uint32_t)(frame & ((1u << bits) - 1));
+
+    return sample_size == 2 ? (int16_t)(0x8000 | v) : (int32_t)(0x80000000u | v);
+}
+
+// Mono average of the capture channels in frame.
+static int64_t downmix_pattern(const struct capture_run *run, uint64_t frame)
+{
+    int64_t sum = 0;
+    uint32_t c;
+
+    for (c = 0; c < run->channels; c++)
+    {
+        sum += pattern(run->sample_size, frame, c);
+    }
+    return sum / (int64_t)run->channels;
+}
+
+// A sample interpolated between neighbouring frames of one channel keeps
+// the top bit and the channel; the frame counter is about right. Returns
+// the counter, or -1 for a sample of another channel.
+static int64_t near_pattern(size_t sample_size, int64_t v, uint32_t channel)
+{
+    const uint32_t bits = frame_bits(sample_size);
+    const uint32_t top = sample_size == 2 ? 0x8000u : 0x80000000u;
+    const uint32_t u = sample_size == 2 ? (uint16_t)v : (uint32_t)v;
+
+    if (!(u & top) || (u & ~top) >> bits != channel)
+    {
+        return -1;
+    }
+    return u & ((1u << bits) - 1);
+}
+
+static void sleep_until_ns(int64_t deadline_ns)
+{
+    struct timespec ts = {.tv_sec = deadline_ns / 1000000000LL,
+                          .tv_nsec = deadline_ns % 1000000000LL};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+    {
+    }
+}
+
+// Capture client of the legacy protocol: raw PCM after CMD_OPEN, in real
+// time.
+static void *client_thread(void *args)
+{
+    struct capture_run *run = args;
+    const size_t frames = (size_t)CAPTURE_SAMPLE_RATE * run->opts->period_ms / 1000;
+    const size_t period_bytes = frames * run->channels * run->sample_size;
+    uint8_t *period = malloc(period_bytes);
+    struct audio_socket_info asi;
+    uint64_t frame = 0;
+    int64_t start_ns;
+    uint64_t periods = 0;
+    int fd = avh_connect_loopback(run->port);
+
+    run->client_fd = fd;
+    while (fd >= 0 && !run->stop && avh_read_exact(fd, &asi, sizeof(asi)) == 0)
+    {
+        if (asi.cmd == CMD_OPEN)
+        {
+            break;
+        }
+    }
+    start_ns = avh_now_ns(CLOCK_MONOTONIC);
+    while (fd >= 0 && period && !run->stop)
+    {
+        size_t i;
+        uint32_t c;
+
+        for (i = 0; i < frames; i++, frame++)
+        {
+            for (c = 0; c < run->channels; c++)
+            {
+                int64_t v = pattern(run->sample_size, frame, c);
+                if (run->sample_size == 2)
+                {
+                    ((int16_t *)period)[i * run->channels + c] = (int16_t)v;
+                }
+                else
+                {
+                    ((int32_t *)period)[i * run->channels + c] = (int32_t)v;
+                }
+            }
+        }
+        if (avh_write_exact(fd, period, period_bytes) < 0)
+        {
+            break;
+        }
+        periods++;
+        sleep_until_ns(start_ns + periods * run->opts->period_ms * 1000000LL);
+    }
+    free(period);
+    return NULL;
+}
+
+// The capture channel each stream channel carries: an index mask picks
+// microphones by position, a positional mask takes the capture channels in
+// order.
+static int map_sources(const struct capture_run *run, audio_channel_mask_t mask,
+                       int source[AUDIO_CHANNEL_COUNT_MAX])
+{
+    uint32_t bits = audio_channel_mask_get_bits(mask);
+    uint32_t channels = audio_channel_count_from_in_mask(mask);
+    uint32_t c;
+
+    for (c = 0; c < channels; c++)
+    {
+        if (audio_channel_mask_get_representation(mask) == AUDIO_CHANNEL_REPRESENTATION_INDEX)
+        {
+            source[c] = __builtin_ctz(bits);
+            bits &= bits - 1;
+        }
+        else
+        {
+            source[c] = c < run->channels ? (int)c : -1;
+        }
+    }
+    return channels;
+}
+
+// Check one frame of the stream; returns its frame counter, or -1 when it
+// is silent or corrupt.
+static int64_t verify_frame(struct capture_reader *r, const uint8_t *frame)
+{
+    const size_t sample_size = r->run->sample_size;
+    const uint32_t bits = frame_bits(sample_size);
+    int64_t counter = -1;
+    bool silent = true;
+    uint32_t c;
+
+    for (c = 0; c < r->channels; c++)
+    {
+        int64_t v = sample_size == 2 ? ((const int16_t *)frame)[c] : ((const int32_t *)frame)[c];
+        int64_t f;
+
+        silent = silent && v == 0;
+        if (r->source[c] < 0)
+        {
+            continue;
+        }
+        if (r->downmix)
+        {
+            f = (int64_t)((uint64_t)(v - downmix_pattern(r->run, 0)) & ((1u << bits) - 1));
+            if (v != downmix_pattern(r->run, f))
+            {
+                f = -2;
+            }
+        }
+        else if (r->resampled)
+        {
+            f = near_pattern(sample_size, v, r->source[c]);
+            // Channels of one frame are interpolated alike.
+            if (f >= 0 && counter >= 0 && (f > counter + 1 || f < counter - 1))
+            {
+                f = -2;
+            }
+        }
+        else
+        {
+            f = (int64_t)((uint64_t)v & ((1u << bits) - 1));
+            if (v != pattern(sample_size, f, r->source[c]) || (counter >= 0 && f != counter))
+            {
+                f = -2;
+            }
+        }
+        if (f < 0)
+        {
+            counter = -2;
+            break;
+        }
+        counter = f;
+    }
+    if (silent)
+    {
+        r->counters->silent++;
+        return -1;
+    }
+    if (counter < 0)
+    {
+        r->counters->corrupt++;
+        return -1;
+    }
+    r->counters->frames++;
+    return counter;
+}
+
+static void *reader_thread(void *args)
+{
+    struct capture_reader *r = args;
+    const size_t frame_size = r->channels * r->run->sample_size;
+    const size_t frames = (size_t)r->rate * r->run->opts->period_ms / 1000;
+    const int64_t wrap = 1LL << frame_bits(r->run->sample_size);
+    uint8_t *buffer = malloc(frames * frame_size);
+    int64_t end_ns = avh_now_ns(CLOCK_MONOTONIC) + r->run->opts->duration_ms * 1000000LL;
+    int64_t last = -1;
+
+    while (buffer && avh_now_ns(CLOCK_MONOTONIC) < end_ns)
+    {
+        ssize_t n = r->in->read(r->in, buffer, frames * frame_size);
+        ssize_t i;
+
+        for (i = 0; i + (ssize_t)frame_size <= n; i += frame_size)
+        {
+            int64_t counter = verify_frame(r, buffer + i);
+            if (!r->resampled && counter >= 0 && last >= 0 && counter != (last + 1) % wrap)
+            {
+                r->counters->jumps++;
+            }
+            last = counter;
+        }
+    }
+    free(buffer);
+    return NULL;
+}
+
+static uint32_t stream_rate(const struct capture_case *c, int s)
+{
+    return c->rates[s] > 0 ? c->rates[s] : CAPTURE_SAMPLE_RATE;
+}
+
+static void run_case(const struct capture_options *opts, const struct capture_case *c, int port,
+                     struct capture_result *result)
+{
+    struct capture_run run;
+    struct capture_reader readers[CAPTURE_MAX_STREAMS];
+    pthread_t threads[CAPTURE_MAX_STREAMS];
+    struct audio_hw_device *adev;
+    pthread_t client;
+    void *dso;
+    int s, n = 0;
+
+    memset(&run, 0, sizeof(run));
+    memset(readers, 0, sizeof(readers));
+    memset(result, 0, sizeof(*result));
+    run.opts = opts;
+    run.c = c;
+    run.channels = c->mics > 0 ? (uint32_t)c->mics : 2;
+    run.sample_size = audio_bytes_per_sample(c->format);
+    run.port = port + 1;
+    run.client_fd = -1;
+
+    avh_set_env_int("VIRTUAL_AUDIO_OUT_TCP_PORT", port);
+    avh_set_env_int("VIRTUAL_AUDIO_IN_TCP_PORT", port + 1);
+    avh_set_env_int("VIRTUAL_AUDIO_IN_MIC_CHANNELS", c->mics);
+    avh_set_env_int("VIRTUAL_AUDIO_IN_BUFFER_MILLISECONDS", opts->period_ms);
+    setenv("VIRTUAL_AUDIO_DUPLEX_ENABLE", "0", 1);
+    setenv("VIRTUAL_AUDIO_CLOCK", "monotonic", 1);
+    setenv("VIRTUAL_AUDIO_TRACE", "off", 0);
+
+    adev = avh_open_module(opts->module, &dso);
+    if (!adev)
+    {
+        return;
+    }
+    pthread_create(&client, NULL, client_thread, &run);
+    usleep(100000);
+
+    for (s = 0; s < CAPTURE_MAX_STREAMS && c->masks[s] != AUDIO_CHANNEL_NONE; s++)
+    {
+        struct audio_config config;
+
+        memset(&config, 0, sizeof(config));
+        config.sample_rate = stream_rate(c, s);
+        config.channel_mask = c->masks[s];
+        config.format = c->format;
+        if (adev->open_input_stream(adev, 1 + s, AUDIO_DEVICE_IN_BUILTIN_MIC, &config,
+                                    &readers[s].in, AUDIO_INPUT_FLAG_NONE, NULL,
+                                    AUDIO_SOURCE_MIC) != 0)
+        {
+            fprintf(stderr, "%s: stream %d with channels 0x%x at %u Hz did not open\n", c->name,
+                    s, c->masks[s], config.sample_rate);
+            break;
+        }
+        readers[s].run = &run;
+        readers[s].mask = c->masks[s];
+        readers[s].rate = config.sample_rate;
+        readers[s].channels = map_sources(&run, c->masks[s], readers[s].source);
+        readers[s].downmix = readers[s].channels == 1 && run.channels > 1 &&
+                             c->masks[s] == AUDIO_CHANNEL_IN_MONO;
+        readers[s].resampled = config.sample_rate != CAPTURE_SAMPLE_RATE;
+        readers[s].counters = &result->counters[s];
+        n++;
+    }
+    usleep(CAPTURE_SETTLE_MS * 1000);
+    for (s = 0; s < n; s++)
+    {
+        pthread_create(&threads[s], NULL, reader_thread, &readers[s]);
+    }
+    for (s = 0; s < n; s++)
+    {
+        pthread_join(threads[s], NULL);
+    }
+
+    run.stop = 1;
+    if (run.client_fd >= 0)
+    {
+        shutdown(run.client_fd, SHUT_RDWR);
+    }
+    for (s = 0; s < n; s++)
+    {
+        adev->close_input_stream(adev, readers[s].in);
+    }
+    pthread_join(client, NULL);
+    adev->common.close(&adev->common);
+    result->streams = n;
+    result->ok = n > 0 && (s == CAPTURE_MAX_STREAMS || c->masks[s] == AUDIO_CHANNEL_NONE);
+}
+
+static bool case_passed(const struct capture_options *opts, const struct capture_case *c,
+                        const struct capture_result *r)
+{
+    int s;
+
+    if (!r->ok)
+    {
+        return false;
+    }
+    for (s = 0; s < r->streams; s++)
+    {
+        const uint64_t expected = (uint64_t)stream_rate(c, s) * opts->duration_ms / 1000;
+        if (r->counters[s].corrupt > 0 || r->counters[s].jumps > 0 ||
+            r->counters[s].frames * 100 < expected * CAPTURE_MIN_PERCENT)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int select_cases(struct capture_options *opts, const char *list)
+{
+    char *copy = strdup(list);
+    char *save = NULL;
+    char *name;
+    size_t i;
+
+    memset(opts->selected, 0, sizeof(opts->selected));
+    for (name = strtok_r(copy, ",", &save); name; name = strtok_r(NULL, ",", &save))
+    {
+        for (i = 0; i < CAPTURE_CASE_COUNT && strcmp(name, capture_cases[i].name) != 0; i++)
+        {
+        }
+        if (i == CAPTURE_CASE_COUNT)
+        {
+            fprintf(stderr, "unknown case %s\n", name);
+            free(copy);
+            return -1;
+        }
+        opts->selected[i] = true;
+    }
+    free(copy);
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    size_t i;
+
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -m, --module PATH    HAL module (default %s next to the executable)\n"
+            "  -p, --period MS      period of the client and the streams (default 10)\n"
+            "  -d, --duration MS    reading time of each case (default 1000)\n"
+            "  -c, --cases LIST     comma separated cases, of:",
+            name, AVH_DEFAULT_MODULE);
+    for (i = 0; i < CAPTURE_CASE_COUNT; i++)
+    {
+        fprintf(stderr, " %s", capture_cases[i].name);
+    }
+    fprintf(stderr, "\n"
+                    "  -P, --port PORT      first TCP port, two per case (default %d)\n",
+            CAPTURE_DEFAULT_PORT);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        {"module", required_argument, NULL, 'm'},
+        {"period", required_argument, NULL, 'p'},
+        {"duration", required_argument, NULL, 'd'},
+        {"cases", required_argument, NULL, 'c'},
+        {"port", required_argument, NULL, 'P'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    struct capture_options opts = {
+        .module = avh_default_module_path(),
+        .port = CAPTURE_DEFAULT_PORT,
+        .period_ms = 10,
+        .duration_ms = 1000,
+    };
+    bool passed = true;
+    size_t i;
+    int port, opt, s;
+
+    for (i = 0; i < CAPTURE_CASE_COUNT; i++)
+    {
+        opts.selected[i] = true;
+    }
+    while ((opt = getopt_long(argc, argv, "m:p:d:c:P:h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            opts.module = optarg;
+            break;
+        case 'p':
+            opts.period_ms = atoi(optarg);
+            break;
+        case 'd':
+            opts.duration_ms = atoi(optarg);
+            break;
+        case 'c':
+            if (select_cases(&opts, optarg) < 0)
+            {
+                return 2;
+            }
+            break;
+        case 'P':
+            opts.port = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (opts.period_ms <= 0 || opts.duration_ms < opts.period_ms * 10 || opts.port <= 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    setenv("AVH_LOG_LEVEL", "S", 0);
+
+    // One process per case, as in avh_bench: the HAL state is global.
+    port = opts.port;
+    for (i = 0; i < CAPTURE_CASE_COUNT; i++)
+    {
+        struct capture_result result;
+        int fds[2];
+        pid_t pid;
+        bool ok;
+
+        if (!opts.selected[i])
+        {
+            continue;
+        }
+        memset(&result, 0, sizeof(result));
+        if (pipe(fds) != 0)
+        {
+            perror("pipe");
+            return 1;
+        }
+        pid = fork();
+        if (pid == 0)
+        {
+            close(fds[0]);
+            run_case(&opts, &capture_cases[i], port, &result);
+            avh_write_exact(fds[1], &result, sizeof(result));
+            _exit(0);
+        }
+        close(fds[1]);
+        if (pid < 0 || avh_read_exact(fds[0], &result, sizeof(result)) != 0)
+        {
+            result.ok = 0;
+        }
+        close(fds[0]);
+        if (pid > 0)
+        {
+            waitpid(pid, NULL, 0);
+        }
+        port += 2;
+        ok = case_passed(&opts, &capture_cases[i], &result);
+        passed = passed && ok;
+        fprintf(stderr, "%-14s %s\n", capture_cases[i].name, ok ? "pass" : "FAIL");
+        for (s = 0; s < result.streams; s++)
+        {
+            const struct capture_counters *k = &result.counters[s];
+            fprintf(stderr, "  channels 0x%08x %5u Hz: %8" PRIu64 " frames, %" PRIu64 " corrupt, %"
+                            PRIu64 " silent, %" PRIu64 " jumps\n",
+                    capture_cases[i].masks[s], stream_rate(&capture_cases[i], s), k->frames,
+                    k->corrupt, k->silent, k->jumps);
+        }
+    }
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <arpa/inet.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <hardware/hardware.h>
+
+#include "avh_host.h"
+
+int64_t avh_now_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int avh_read_exact(int fd, void *buffer, size_t bytes)
+{
+    size_t done = 0;
+    while (done < bytes)
+    {
+        ssize_t n = read(fd, (uint8_t *)buffer + done, bytes - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+int avh_write_exact(int fd, const void *buffer, size_t bytes)
+{
+    size_t done = 0;
+    while (done < bytes)
+    {
+        ssize_t n = write(fd, (const uint8_t *)buffer + done, bytes - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+int avh_connect_loopback(int port)
+{
+    int attempt;
+    for (attempt = 0; attempt < 200; attempt++)
+    {
+        struct sockaddr_in addr;
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            return -1;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+        {
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+void avh_set_env_int(const char *name, int value)
+{
+    char str[16];
+    snprintf(str, sizeof(str), "%d", value);
+    setenv(name, str, 1);
+}
+
+const char *avh_default_module_path(void)
+{
+    static char path[4096];
+    char *slash;
+    ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - sizeof(AVH_DEFAULT_MODULE) - 1);
+    if (n <= 0 || !(slash = memrchr(path, '/', n)))
+    {
+        return AVH_DEFAULT_MODULE;
+    }
+    strcpy(slash + 1, AVH_DEFAULT_MODULE);
+    return path;
+}
+
+struct audio_hw_device *avh_open_module(const char *path, void **dso)
+{
+    struct audio_module *hmi;
+    struct hw_device_t *device;
+
+    *dso = dlopen(path, RTLD_NOW);
+    if (!*dso)
+    {
+        fprintf(stderr, "dlopen %s: %s\n", path, dlerror());
+        return NULL;
+    }
+    hmi = (struct audio_module *)dlsym(*dso, HAL_MODULE_INFO_SYM_AS_STR);
+    if (!hmi || hmi->common.methods->open(&hmi->common, AUDIO_HARDWARE_INTERFACE, &device) != 0)
+    {
+        fprintf(stderr, "cannot open the audio device of %s\n", path);
+        return NULL;
+    }
+    return (struct audio_hw_device *)device;
+}
+
+static int64_t monotonic_now_us(void)
+{
+    return avh_now_ns(CLOCK_MONOTONIC) / 1000;
+}
+
+avh_clock_fn avh_module_clock(void *dso)
+{
+    avh_clock_fn clock = (avh_clock_fn)dlsym(dso, "audio_clock_now_us");
+    return clock ? clock : monotonic_now_us;
+}
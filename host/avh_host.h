@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef AVH_HOST_H
+#define AVH_HOST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <hardware/audio.h>
+
+// Helpers shared by the host tools: the wire protocol of audio_hw.c, socket
+// I/O on loopback and loading the module through HAL_MODULE_INFO_SYM.
+
+#define AVH_DEFAULT_MODULE "audio.primary.host.so" // Next to the executable
+
+enum
+{
+    CMD_OPEN = 0,
+    CMD_CLOSE = 1,
+    CMD_DATA = 2,
+    CMD_STREAM_START = 3,
+    CMD_STREAM_STOP = 4,
+    CMD_PING = 5,
+    CMD_PONG = 6,
+    CMD_STATUS = 7
+};
+
+enum
+{
+    AUDIO_IN = 0,
+    AUDIO_OUT = 1
+};
+
+struct audio_socket_info
+{
+    uint32_t cmd;
+    uint32_t data[4]; // Configuration, data_size, offset or ping
+};
+
+// CMD_PING carries {id, send time low, send time high} in data[] on the
+// legacy connection and as its payload on the duplex one.
+struct audio_socket_pong
+{
+    uint32_t id;
+    uint32_t reserved;
+    int64_t guest_send_ns;
+    int64_t host_receive_ns;
+    int64_t host_send_ns;
+    int64_t host_render_ns;
+};
+
+struct audio_socket_status
+{
+    uint32_t stream;
+    uint32_t fill_frames;
+    int64_t host_time_ns;
+};
+
+struct audio_socket_frame_header
+{
+    uint32_t cmd;
+    uint32_t stream;
+    uint32_t data_size;
+    uint32_t sequence;
+    int64_t timestamp_ns;
+};
+
+int64_t avh_now_ns(clockid_t clock);
+int avh_read_exact(int fd, void *buffer, size_t bytes);
+int avh_write_exact(int fd, const void *buffer, size_t bytes);
+// Retries for up to two seconds: the HAL binds its ports asynchronously.
+int avh_connect_loopback(int port);
+void avh_set_env_int(const char *name, int value);
+
+const char *avh_default_module_path(void);
+// dlopen()s the module and opens its audio device. Returns NULL on failure.
+struct audio_hw_device *avh_open_module(const char *path, void **dso);
+// The pacing clock of the module, CLOCK_MONOTONIC when it has none.
+typedef int64_t (*avh_clock_fn)(void);
+avh_clock_fn avh_module_clock(void *dso);
+
+#endif // AVH_HOST_H
@@ -0,0 +1,670 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Pacing accuracy regression suite.
+//
+// Drives one stream of the HAL per scenario while a simulated host client
+// consumes (playback) or produces (capture) in a controlled way: fast,
+// slow (90% of real time), bursty (four periods back to back, then a four
+// period pause) or stalled (one 500ms pause a third into the run), or
+// without any client, capture coming from the HAL's synthetic tone. The
+// driver records the interval between successive out_write()/in_read()
+// calls and the accumulated drift from the nominal rate, writes a JSON
+// report and exits non-zero when a scenario exceeds its thresholds.
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <hardware/audio.h>
+
+#include "avh_host.h"
+
+#define PACING_DEFAULT_PORT 29760
+#define PACING_SAMPLE_RATE 48000
+#define PACING_CHANNELS 2
+#define PACING_SLOW_PERCENT 90
+#define PACING_BURST_PERIODS 4
+#define PACING_STALL_MS 500
+#define PACING_CLIENT_BUFFER_PERIODS 4 // Client socket buffer, so backpressure shows quickly
+#define PACING_HISTOGRAM_BINS 60       // Interval histogram: 0..3 periods in period/20 bins
+#define PACING_WARMUP_CALLS 2          // The first write primes the client and returns early
+#define PACING_REPORT_VERSION 1
+
+enum client_behaviour
+{
+    CLIENT_FAST = 0,
+    CLIENT_SLOW,
+    CLIENT_BURSTY,
+    CLIENT_STALLED,
+    CLIENT_NONE, // virtual.audio.in.source=tone feeds the input stream
+};
+
+static const char *const client_behaviour_names[] = {"fast", "slow", "bursty", "stalled", "none"};
+
+// Thresholds are scaled with --scale. The interval error is gated at the
+// 90th percentile: a scheduling hiccup of the host shows up in the p99 and
+// the maximum, a pacing regression moves the bulk of the distribution.
+struct pacing_scenario
+{
+    const char *name;
+    int stream; // AUDIO_OUT or AUDIO_IN
+    int behaviour;
+    int max_p90_error_percent; // |interval - period| at p90, in percent of the period
+    int64_t max_drift_us;      // |accumulated drift| at any time
+};
+
+// A slow or stalled capture client makes in_read() wait for data, so the
+// reader falls behind by up to the missing audio; playback must hold its
+// rate whatever the client does. Without a client, the synthetic source
+// must not stall the reader or hand out silence.
+static const struct pacing_scenario pacing_scenarios[] = {
+    {"out-fast", AUDIO_OUT, CLIENT_FAST, 25, 25000},
+    {"out-slow", AUDIO_OUT, CLIENT_SLOW, 25, 25000},
+    {"out-bursty", AUDIO_OUT, CLIENT_BURSTY, 25, 30000},
+    {"out-stalled", AUDIO_OUT, CLIENT_STALLED, 25, 25000},
+    {"in-fast", AUDIO_IN, CLIENT_FAST, 25, 25000},
+    {"in-slow", AUDIO_IN, CLIENT_SLOW, 25, 200000},
+    {"in-bursty", AUDIO_IN, CLIENT_BURSTY, 25, 40000},
+    {"in-stalled", AUDIO_IN, CLIENT_STALLED, 25, 200000},
+    {"in-tone", AUDIO_IN, CLIENT_NONE, 25, 25000},
+};
+
+#define PACING_SCENARIO_COUNT (sizeof(pacing_scenarios) / sizeof(pacing_scenarios[0]))
+
+struct pacing_options
+{
+    const char *module;
+    const char *output;
+    int port;
+    int period_ms;
+    int duration_ms;
+    double scale;
+    bool selected[PACING_SCENARIO_COUNT];
+};
+
+struct pacing_result
+{
+    int ok; // The scenario ran
+    uint64_t calls;
+    uint64_t short_calls; // Returned fewer bytes than asked, or an error
+    uint64_t silent_calls; // Read a period of silence
+    int64_t interval_p50_us;
+    int64_t interval_p99_us;
+    int64_t interval_min_us;
+    int64_t interval_max_us;
+    int64_t error_p50_us;
+    int64_t error_p90_us;
+    int64_t error_p99_us;
+    int64_t error_p999_us;
+    int64_t error_max_us;
+    int64_t drift_final_us;
+    int64_t drift_max_us; // Largest |drift|
+    uint64_t late;        // Interval above 1.5 periods
+    uint64_t early;       // Interval below 0.5 periods
+    uint32_t histogram[PACING_HISTOGRAM_BINS + 1]; // Last bin: 3 periods and more
+};
+
+struct pacing_run
+{
+    const struct pacing_options *opts;
+    const struct pacing_scenario *scenario;
+    size_t period_bytes;
+    int port;
+    int client_fd;
+    volatile int stop;
+};
+
+static void sleep_until_ns(int64_t deadline_ns)
+{
+    struct timespec ts = {deadline_ns / 1000000000LL, deadline_ns % 1000000000LL};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static int connect_client(struct pacing_run *run)
+{
+    // Connecting first and shrinking the buffers afterwards keeps the
+    // connect retry loop of avh_connect_loopback().
+    int fd = avh_connect_loopback(run->port);
+    int size = run->period_bytes * PACING_CLIENT_BUFFER_PERIODS;
+    if (fd < 0)
+    {
+        fprintf(stderr, "client: cannot connect to port %d\n", run->port);
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    run->client_fd = fd;
+    return fd;
+}
+
+// When the client may move its next period, in CLOCK_MONOTONIC ns.
+static int64_t client_schedule_ns(const struct pacing_run *run, int64_t start_ns,
+                                  uint64_t periods, bool *stalled)
+{
+    int64_t period_ns = run->opts->period_ms * 1000000LL;
+    int64_t stall_begin_ns = start_ns + run->opts->duration_ms * 1000000LL / 3;
+    int64_t next_ns;
+
+    switch (run->scenario->behaviour)
+    {
+    case CLIENT_SLOW:
+        return start_ns + periods * period_ns * 100 / PACING_SLOW_PERCENT;
+    case CLIENT_BURSTY:
+        return start_ns + periods / PACING_BURST_PERIODS * PACING_BURST_PERIODS * period_ns;
+    case CLIENT_STALLED:
+        next_ns = start_ns + periods * period_ns;
+        if (!*stalled && next_ns >= stall_begin_ns)
+        {
+            *stalled = true;
+        }
+        return *stalled ? next_ns + PACING_STALL_MS * 1000000LL : next_ns;
+    default:
+        return run->scenario->stream == AUDIO_OUT ? 0 : start_ns + periods * period_ns;
+    }
+}
+
+// Playback client of the legacy protocol.
+static void *out_client_thread(void *args)
+{
+    struct pacing_run *run = args;
+    struct audio_socket_info asi;
+    uint8_t *payload = malloc(1 << 20);
+    int64_t start_ns = 0;
+    uint64_t periods = 0;
+    bool stalled = false;
+    int fd = connect_client(run);
+
+    while (fd >= 0 && payload && !run->stop && avh_read_exact(fd, &asi, sizeof(asi)) == 0)
+    {
+        if (asi.cmd != CMD_DATA)
+        {
+            continue;
+        }
+        if (asi.data[0] > (1 << 20) || avh_read_exact(fd, payload, asi.data[0]) < 0)
+        {
+            break;
+        }
+        if (!start_ns)
+        {
+            start_ns = avh_now_ns(CLOCK_MONOTONIC);
+        }
+        periods++;
+        sleep_until_ns(client_schedule_ns(run, start_ns, periods, &stalled));
+    }
+    free(payload);
+    return NULL;
+}
+
+// Capture client of the legacy protocol: raw PCM after CMD_OPEN.
+static void *in_client_thread(void *args)
+{
+    struct pacing_run *run = args;
+    struct audio_socket_info asi;
+    uint8_t *period = calloc(1, run->period_bytes);
+    int64_t start_ns;
+    uint64_t periods = 0;
+    bool stalled = false;
+    int fd = run->scenario->behaviour != CLIENT_NONE ? connect_client(run) : -1;
+
+    while (fd >= 0 && !run->stop && avh_read_exact(fd, &asi, sizeof(asi)) == 0)
+    {
+        if (asi.cmd == CMD_OPEN)
+        {
+            break;
+        }
+    }
+    start_ns = avh_now_ns(CLOCK_MONOTONIC);
+    while (fd >= 0 && period && !run->stop)
+    {
+        if (run->scenario->behaviour != CLIENT_FAST)
+        {
+            sleep_until_ns(client_schedule_ns(run, start_ns, periods, &stalled));
+        }
+        if (avh_write_exact(fd, period, run->period_bytes) < 0)
+        {
+            break;
+        }
+        periods++;
+    }
+    free(period);
+    return NULL;
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int64_t percentile(const int64_t *sorted, size_t count, int per_mille)
+{
+    return count ? sorted[(count - 1) * per_mille / 1000] : 0;
+}
+
+static void run_scenario(const struct pacing_options *opts, const struct pacing_scenario *scenario,
+                         int port, struct pacing_result *result)
+{
+    struct pacing_run run;
+    struct audio_hw_device *adev;
+    struct audio_stream_out *out = NULL;
+    struct audio_stream_in *in = NULL;
+    struct audio_config config;
+    avh_clock_fn now_us;
+    pthread_t client;
+    size_t capacity, count = 0, i;
+    int64_t *intervals, *errors;
+    int64_t period_us = opts->period_ms * 1000LL;
+    int64_t start_us, end_us, last_us = 0;
+    uint8_t *buffer;
+    void *dso;
+
+    memset(&run, 0, sizeof(run));
+    memset(result, 0, sizeof(*result));
+    run.opts = opts;
+    run.scenario = scenario;
+    run.period_bytes = (size_t)PACING_SAMPLE_RATE * opts->period_ms / 1000 * PACING_CHANNELS * 2;
+    run.port = scenario->stream == AUDIO_OUT ? port : port + 1;
+    run.client_fd = -1;
+
+    avh_set_env_int("VIRTUAL_AUDIO_OUT_TCP_PORT", port);
+    avh_set_env_int("VIRTUAL_AUDIO_IN_TCP_PORT", port + 1);
+    setenv("VIRTUAL_AUDIO_DUPLEX_ENABLE", "0", 1);
+    setenv("VIRTUAL_AUDIO_CLOCK", "monotonic", 1);
+    setenv("VIRTUAL_AUDIO_TRACE", "off", 0);
+    setenv("VIRTUAL_AUDIO_IN_SOURCE", scenario->behaviour == CLIENT_NONE ? "tone" : "off", 1);
+
+    adev = avh_open_module(opts->module, &dso);
+    if (!adev)
+    {
+        return;
+    }
+    now_us = avh_module_clock(dso);
+    pthread_create(&client, NULL, scenario->stream == AUDIO_OUT ? out_client_thread : in_client_thread,
+                   &run);
+    usleep(100000);
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = PACING_SAMPLE_RATE;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+    if (scenario->stream == AUDIO_OUT)
+    {
+        config.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+        if (adev->open_output_stream(adev, 0, AUDIO_DEVICE_OUT_SPEAKER, AUDIO_OUTPUT_FLAG_PRIMARY,
+                                     &config, &out, NULL) != 0)
+        {
+            return;
+        }
+    }
+    else
+    {
+        config.channel_mask = AUDIO_CHANNEL_IN_STEREO;
+        if (adev->open_input_stream(adev, 1, AUDIO_DEVICE_IN_BUILTIN_MIC, &config, &in,
+                                    AUDIO_INPUT_FLAG_NONE, NULL, AUDIO_SOURCE_MIC) != 0)
+        {
+            return;
+        }
+    }
+
+    capacity = opts->duration_ms / opts->period_ms * 2 + 16;
+    intervals = calloc(capacity, sizeof(*intervals));
+    errors = calloc(capacity, sizeof(*errors));
+    buffer = calloc(1, run.period_bytes);
+    if (!intervals || !errors || !buffer)
+    {
+        return;
+    }
+
+    for (i = 0; i < PACING_WARMUP_CALLS; i++)
+    {
+        if (out)
+        {
+            out->write(out, buffer, run.period_bytes);
+        }
+        else
+        {
+            in->read(in, buffer, run.period_bytes);
+        }
+    }
+
+    start_us = now_us();
+    end_us = start_us + opts->duration_ms * 1000LL;
+    for (;;)
+    {
+        int64_t begin_us = now_us();
+        ssize_t n;
+        int64_t drift;
+
+        if (begin_us >= end_us)
+        {
+            break;
+        }
+        // Drift: how far this call starts behind (positive) or ahead of
+        // the nominal rate.
+        drift = begin_us - start_us - (int64_t)result->calls * period_us;
+        result->drift_final_us = drift;
+        if ((drift < 0 ? -drift : drift) > result->drift_max_us)
+        {
+            result->drift_max_us = drift < 0 ? -drift : drift;
+        }
+        n = out ? out->write(out, buffer, run.period_bytes) : in->read(in, buffer, run.period_bytes);
+        result->calls++;
+        if (n != (ssize_t)run.period_bytes)
+        {
+            result->short_calls++;
+        }
+        if (in && n > 0)
+        {
+            ssize_t b;
+            for (b = 0; b < n && !buffer[b]; b++)
+            {
+            }
+            result->silent_calls += b == n;
+        }
+        if (last_us && count < capacity)
+        {
+            int64_t interval = begin_us - last_us;
+            size_t bin = interval * 20 / period_us;
+            intervals[count] = interval;
+            errors[count] = interval > period_us ? interval - period_us : period_us - interval;
+            count++;
+            result->histogram[bin < PACING_HISTOGRAM_BINS ? bin : PACING_HISTOGRAM_BINS]++;
+            result->late += interval * 2 > period_us * 3;
+            result->early += interval * 2 < period_us;
+        }
+        last_us = begin_us;
+    }
+
+    run.stop = 1;
+    if (run.client_fd >= 0)
+    {
+        shutdown(run.client_fd, SHUT_RDWR);
+    }
+    if (out)
+    {
+        adev->close_output_stream(adev, out);
+    }
+    if (in)
+    {
+        adev->close_input_stream(adev, in);
+    }
+    pthread_join(client, NULL);
+    adev->common.close(&adev->common);
+
+    qsort(intervals, count, sizeof(*intervals), compare_int64);
+    qsort(errors, count, sizeof(*errors), compare_int64);
+    result->interval_min_us = count ? intervals[0] : 0;
+    result->interval_p50_us = percentile(intervals, count, 500);
+    result->interval_p99_us = percentile(intervals, count, 990);
+    result->interval_max_us = count ? intervals[count - 1] : 0;
+    result->error_p50_us = percentile(errors, count, 500);
+    result->error_p90_us = percentile(errors, count, 900);
+    result->error_p99_us = percentile(errors, count, 990);
+    result->error_p999_us = percentile(errors, count, 999);
+    result->error_max_us = count ? errors[count - 1] : 0;
+    result->ok = count > 0;
+    free(intervals);
+    free(errors);
+    free(buffer);
+}
+
+static bool scenario_passed(const struct pacing_options *opts, const struct pacing_scenario *s,
+                            const struct pacing_result *r)
+{
+    return r->ok &&
+           r->error_p90_us <= opts->period_ms * 10LL * s->max_p90_error_percent * opts->scale &&
+           r->drift_max_us <= s->max_drift_us * opts->scale &&
+           (s->behaviour != CLIENT_NONE || r->silent_calls == 0);
+}
+
+static void write_report(FILE *f, const struct pacing_options *opts,
+                         const struct pacing_result *results, bool passed)
+{
+    size_t i;
+    int b;
+    bool first = true;
+
+    fprintf(f, "{\n  \"suite\": \"pacing\",\n  \"version\": %d,\n", PACING_REPORT_VERSION);
+    fprintf(f, "  \"period_ms\": %d,\n  \"duration_ms\": %d,\n  \"threshold_scale\": %.2f,\n",
+            opts->period_ms, opts->duration_ms, opts->scale);
+    fprintf(f, "  \"histogram_bin_us\": %d,\n", opts->period_ms * 1000 / 20);
+    fprintf(f, "  \"passed\": %s,\n  \"scenarios\": [", passed ? "true" : "false");
+    for (i = 0; i < PACING_SCENARIO_COUNT; i++)
+    {
+        const struct pacing_scenario *s = &pacing_scenarios[i];
+        const struct pacing_result *r = &results[i];
+        if (!opts->selected[i])
+        {
+            continue;
+        }
+        fprintf(f, "%s\n    {\n", first ? "" : ",");
+        first = false;
+        fprintf(f, "      \"name\": \"%s\",\n      \"stream\": \"%s\",\n      \"client\": \"%s\",\n",
+                s->name, s->stream == AUDIO_OUT ? "out" : "in", client_behaviour_names[s->behaviour]);
+        fprintf(f, "      \"ran\": %s,\n      \"passed\": %s,\n", r->ok ? "true" : "false",
+                scenario_passed(opts, s, r) ? "true" : "false");
+        fprintf(f, "      \"calls\": %" PRIu64 ",\n      \"short_calls\": %" PRIu64 ",\n",
+                r->calls, r->short_calls);
+        fprintf(f, "      \"silent_calls\": %" PRIu64 ",\n", r->silent_calls);
+        fprintf(f, "      \"interval_us\": {\"min\": %" PRId64 ", \"p50\": %" PRId64
+                   ", \"p99\": %" PRId64 ", \"max\": %" PRId64 "},\n",
+                r->interval_min_us, r->interval_p50_us, r->interval_p99_us, r->interval_max_us);
+        fprintf(f, "      \"error_us\": {\"p50\": %" PRId64 ", \"p90\": %" PRId64
+                   ", \"p99\": %" PRId64 ", \"p999\": %" PRId64 ", \"max\": %" PRId64 "},\n",
+                r->error_p50_us, r->error_p90_us, r->error_p99_us, r->error_p999_us,
+                r->error_max_us);
+        fprintf(f, "      \"drift_us\": {\"final\": %" PRId64 ", \"max_abs\": %" PRId64 "},\n",
+                r->drift_final_us, r->drift_max_us);
+        fprintf(f, "      \"late\": %" PRIu64 ",\n      \"early\": %" PRIu64 ",\n", r->late, r->early);
+        fprintf(f, "      \"thresholds_us\": {\"error_p90\": %.0f, \"drift_max_abs\": %.0f},\n",
+                opts->period_ms * 10.0 * s->max_p90_error_percent * opts->scale,
+                s->max_drift_us * opts->scale);
+        fprintf(f, "      \"histogram\": [");
+        for (b = 0; b <= PACING_HISTOGRAM_BINS; b++)
+        {
+            fprintf(f, "%s%u", b ? ", " : "", r->histogram[b]);
+        }
+        fprintf(f, "]\n    }");
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+static void usage(const char *name)
+{
+    size_t i;
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -m, --module PATH     HAL module to load (default %s)\n"
+            "  -p, --period MS       period size (default 10)\n"
+            "  -d, --duration MS     run time per scenario (default 3000)\n"
+            "  -s, --scenarios LIST  comma separated scenario names (default all)\n"
+            "  -k, --scale F         multiply every threshold by F (default 1.0)\n"
+            "  -o, --output FILE     write the JSON report to FILE (default stdout)\n"
+            "  -P, --port PORT       first TCP port to use (default %d)\n"
+            "scenarios:",
+            name, AVH_DEFAULT_MODULE, PACING_DEFAULT_PORT);
+    for (i = 0; i < PACING_SCENARIO_COUNT; i++)
+    {
+        fprintf(stderr, " %s", pacing_scenarios[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+static int select_scenarios(struct pacing_options *opts, const char *list)
+{
+    char copy[256];
+    char *save = NULL;
+    char *token;
+    size_t i;
+
+    memset(opts->selected, 0, sizeof(opts->selected));
+    snprintf(copy, sizeof(copy), "%s", list);
+    for (token = strtok_r(copy, ",", &save); token; token = strtok_r(NULL, ",", &save))
+    {
+        for (i = 0; i < PACING_SCENARIO_COUNT; i++)
+        {
+            if (strcmp(token, pacing_scenarios[i].name) == 0)
+            {
+                opts->selected[i] = true;
+                break;
+            }
+        }
+        if (i == PACING_SCENARIO_COUNT)
+        {
+            fprintf(stderr, "unknown scenario %s\n", token);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        {"module", required_argument, NULL, 'm'},
+        {"period", required_argument, NULL, 'p'},
+        {"duration", required_argument, NULL, 'd'},
+        {"scenarios", required_argument, NULL, 's'},
+        {"scale", required_argument, NULL, 'k'},
+        {"output", required_argument, NULL, 'o'},
+        {"port", required_argument, NULL, 'P'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    struct pacing_options opts = {
+        .module = avh_default_module_path(),
+        .port = PACING_DEFAULT_PORT,
+        .period_ms = 10,
+        .duration_ms = 3000,
+        .scale = 1.0,
+    };
+    struct pacing_result results[PACING_SCENARIO_COUNT];
+    bool passed = true;
+    FILE *report = stdout;
+    size_t i;
+    int port, opt;
+
+    memset(results, 0, sizeof(results));
+    for (i = 0; i < PACING_SCENARIO_COUNT; i++)
+    {
+        opts.selected[i] = true;
+    }
+    while ((opt = getopt_long(argc, argv, "m:p:d:s:k:o:P:h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            opts.module = optarg;
+            break;
+        case 'p':
+            opts.period_ms = atoi(optarg);
+            break;
+        case 'd':
+            opts.duration_ms = atoi(optarg);
+            break;
+        case 's':
+            if (select_scenarios(&opts, optarg) < 0)
+            {
+                return 2;
+            }
+            break;
+        case 'k':
+            opts.scale = atof(optarg);
+            break;
+        case 'o':
+            opts.output = optarg;
+            break;
+        case 'P':
+            opts.port = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (opts.period_ms <= 0 || opts.duration_ms < opts.period_ms * 10 || opts.scale <= 0 ||
+        opts.port <= 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    setenv("AVH_LOG_LEVEL", "S", 0);
+
+    // One process per scenario, as in avh_bench: the HAL state is global.
+    port = opts.port;
+    for (i = 0; i < PACING_SCENARIO_COUNT; i++)
+    {
+        int fds[2];
+        pid_t pid;
+
+        if (!opts.selected[i])
+        {
+            continue;
+        }
+        if (pipe(fds) != 0)
+        {
+            perror("pipe");
+            return 1;
+        }
+        pid = fork();
+        if (pid == 0)
+        {
+            close(fds[0]);
+            run_scenario(&opts, &pacing_scenarios[i], port, &results[i]);
+            avh_write_exact(fds[1], &results[i], sizeof(results[i]));
+            _exit(0);
+        }
+        close(fds[1]);
+        if (pid < 0 || avh_read_exact(fds[0], &results[i], sizeof(results[i])) != 0)
+        {
+            results[i].ok = 0;
+        }
+        close(fds[0]);
+        if (pid > 0)
+        {
+            waitpid(pid, NULL, 0);
+        }
+        port += 2;
+        passed = passed && scenario_passed(&opts, &pacing_scenarios[i], &results[i]);
+        fprintf(stderr, "%-12s %s  error p90 %6" PRId64 "us p99 %6" PRId64 "us  drift max %7" PRId64
+                        "us\n",
+                pacing_scenarios[i].name,
+                scenario_passed(&opts, &pacing_scenarios[i], &results[i]) ? "pass" : "FAIL",
+                results[i].error_p90_us, results[i].error_p99_us, results[i].drift_max_us);
+    }
+
+    if (opts.output && !(report = fopen(opts.output, "w")))
+    {
+        perror(opts.output);
+        return 1;
+    }
+    write_report(report, &opts, results, passed);
+    if (report != stdout)
+    {
+        fclose(report);
+    }
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,822 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Soak and integrity test. Every sample frame written to out_write() and
+// sent by the capture client carries its own stamp, so the receiving side
+// can check that each frame arrives exactly once and in order. Several
+// processes (one HAL instance each, on their own ports) run side by side
+// and the clients reconnect periodically; the run ends after --time
+// seconds or on SIGINT, with non-zero status if any frame was lost,
+// duplicated, misordered or corrupted while a client was connected.
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <hardware/audio.h>
+
+#include "avh_host.h"
+
+#define SOAK_DEFAULT_PORT 30760
+#define SOAK_MAX_PROCESSES 64
+#define SOAK_SAMPLE_RATE 48000
+#define SOAK_FRAME_BYTES 4 // Stereo PCM 16: each frame is one 32-bit stamp
+// A stamp is the connection id in the top byte and a frame counter below.
+// Id 0 is never used, so a zero-filled frame cannot pass for audio.
+#define SOAK_COUNTER_BITS 24
+#define SOAK_COUNTER_MASK ((1u << SOAK_COUNTER_BITS) - 1)
+#define SOAK_WINDOW_FRAMES (1u << 20)            // Late frames are told from duplicates within ~21s
+#define SOAK_MAX_JUMP_FRAMES (SOAK_SAMPLE_RATE * 10) // A larger jump is corruption, not loss
+
+struct soak_options
+{
+    const char *module;
+    int port;
+    int processes;
+    int time_s; // 0 runs until interrupted
+    int reconnect_ms;
+    int period_ms;
+    int report_s;
+    bool duplex;
+};
+
+struct soak_counters
+{
+    uint64_t frames; // Verified in order
+    uint64_t lost;
+    uint64_t duplicated;
+    uint64_t misordered;
+    uint64_t corrupt;
+    uint64_t zero_filled;
+    uint64_t resyncs;       // New connection or stream id, not an error
+    uint64_t odd_transfers; // Transfers that were not a whole number of frames
+};
+
+struct soak_verifier
+{
+    pthread_mutex_t lock;
+    struct soak_counters c;
+    bool synced;
+    uint32_t id;
+    uint32_t expected;
+    uint8_t *seen; // Bitmap over the last SOAK_WINDOW_FRAMES counters
+    uint8_t partial[SOAK_FRAME_BYTES];
+    size_t partial_bytes;
+};
+
+struct soak_result
+{
+    int ok;
+    double seconds;
+    uint64_t reconnects;
+    struct soak_counters out;
+    struct soak_counters in;
+};
+
+struct soak_run
+{
+    const struct soak_options *opts;
+    size_t period_bytes;
+    int out_port;
+    int in_port;
+    int duplex_port;
+    struct audio_stream_in *in;
+    volatile int stop;
+    _Atomic int client_fds[2];
+    _Atomic uint32_t in_id;  // Stamp id of the capture client's current connection
+    _Atomic uint64_t reconnects;
+    struct soak_verifier out_verifier; // Fed by the playback client
+    struct soak_verifier in_verifier;  // Fed by in_read()
+};
+
+static volatile sig_atomic_t soak_interrupted;
+
+static void soak_on_signal(int signum)
+{
+    soak_interrupted = 1;
+}
+
+static int verifier_init(struct soak_verifier *v)
+{
+    memset(v, 0, sizeof(*v));
+    pthread_mutex_init(&v->lock, NULL);
+    v->seen = calloc(1, SOAK_WINDOW_FRAMES / 8);
+    return v->seen ? 0 : -1;
+}
+
+static bool verifier_test_and_set(struct soak_verifier *v, uint32_t counter)
+{
+    uint32_t bit = counter % SOAK_WINDOW_FRAMES;
+    bool was_set = v->seen[bit / 8] & (1u << (bit % 8));
+    v->seen[bit / 8] |= 1u << (bit % 8);
+    return was_set;
+}
+
+static void verifier_clear(struct soak_verifier *v, uint32_t counter)
+{
+    uint32_t bit = counter % SOAK_WINDOW_FRAMES;
+    v->seen[bit / 8] &= ~(1u << (bit % 8));
+}
+
+static void verifier_sync_locked(struct soak_verifier *v, uint32_t id, uint32_t counter)
+{
+    memset(v->seen, 0, SOAK_WINDOW_FRAMES / 8);
+    v->synced = true;
+    v->id = id;
+    v->expected = counter;
+    v->c.resyncs++;
+}
+
+// accept_id: the only id a new stream may switch to, 0 to accept none.
+static void verifier_frame_locked(struct soak_verifier *v, uint32_t stamp, uint32_t accept_id)
+{
+    uint32_t id = stamp >> SOAK_COUNTER_BITS;
+    uint32_t counter = stamp & SOAK_COUNTER_MASK;
+    uint32_t ahead;
+
+    if (stamp == 0)
+    {
+        v->c.zero_filled++;
+        return;
+    }
+    if (!v->synced || (id != v->id && id == accept_id))
+    {
+        verifier_sync_locked(v, id, counter);
+    }
+    else if (id != v->id)
+    {
+        v->c.corrupt++;
+        return;
+    }
+
+    ahead = (counter - v->expected) & SOAK_COUNTER_MASK;
+    if (ahead == 0)
+    {
+        verifier_test_and_set(v, counter);
+        v->expected = (counter + 1) & SOAK_COUNTER_MASK;
+        v->c.frames++;
+    }
+    else if (ahead < SOAK_MAX_JUMP_FRAMES)
+    {
+        uint32_t skipped;
+        for (skipped = 0; skipped < ahead && skipped < SOAK_WINDOW_FRAMES; skipped++)
+        {
+            verifier_clear(v, v->expected + skipped);
+        }
+        v->c.lost += ahead;
+        verifier_test_and_set(v, counter);
+        v->expected = (counter + 1) & SOAK_COUNTER_MASK;
+        v->c.frames++;
+    }
+    else if (((v->expected - counter) & SOAK_COUNTER_MASK) <= SOAK_WINDOW_FRAMES)
+    {
+        if (verifier_test_and_set(v, counter))
+        {
+            v->c.duplicated++;
+        }
+        else
+        {
+            // Counted as lost when it was skipped.
+            v->c.misordered++;
+            v->c.lost--;
+        }
+    }
+    else
+    {
+        v->c.corrupt++;
+    }
+}
+
+static void verifier_bytes(struct soak_verifier *v, const uint8_t *data, size_t bytes,
+                           uint32_t accept_id)
+{
+    pthread_mutex_lock(&v->lock);
+    if ((bytes + v->partial_bytes) % SOAK_FRAME_BYTES != 0 || v->partial_bytes > 0)
+    {
+        v->c.odd_transfers++;
+    }
+    while (bytes > 0)
+    {
+        uint32_t stamp;
+        if (v->partial_bytes > 0 || bytes < SOAK_FRAME_BYTES)
+        {
+            size_t take = SOAK_FRAME_BYTES - v->partial_bytes;
+            take = take < bytes ? take : bytes;
+            memcpy(v->partial + v->partial_bytes, data, take);
+            v->partial_bytes += take;
+            data += take;
+            bytes -= take;
+            if (v->partial_bytes < SOAK_FRAME_BYTES)
+            {
+                break;
+            }
+            memcpy(&stamp, v->partial, sizeof(stamp));
+            v->partial_bytes = 0;
+        }
+        else
+        {
+            memcpy(&stamp, data, sizeof(stamp));
+            data += SOAK_FRAME_BYTES;
+            bytes -= SOAK_FRAME_BYTES;
+        }
+        verifier_frame_locked(v, stamp, accept_id);
+    }
+    pthread_mutex_unlock(&v->lock);
+}
+
+// The next connection starts a new stream: sync on its first frame.
+static void verifier_reconnect(struct soak_verifier *v)
+{
+    pthread_mutex_lock(&v->lock);
+    v->synced = false;
+    v->partial_bytes = 0;
+    pthread_mutex_unlock(&v->lock);
+}
+
+static void verifier_snapshot(struct soak_verifier *v, struct soak_counters *c)
+{
+    pthread_mutex_lock(&v->lock);
+    *c = v->c;
+    pthread_mutex_unlock(&v->lock);
+}
+
+static uint32_t *stamp_period(uint32_t *frames, size_t count, uint32_t id, uint32_t *counter)
+{
+    size_t i;
+    for (i = 0; i < count; i++)
+    {
+        frames[i] = id << SOAK_COUNTER_BITS | *counter;
+        *counter = (*counter + 1) & SOAK_COUNTER_MASK;
+    }
+    return frames;
+}
+
+static int64_t reconnect_deadline_ns(const struct soak_run *run)
+{
+    if (run->opts->reconnect_ms <= 0)
+    {
+        return INT64_MAX;
+    }
+    return avh_now_ns(CLOCK_MONOTONIC) + run->opts->reconnect_ms * 1000000LL;
+}
+
+static uint32_t next_in_id(struct soak_run *run)
+{
+    uint32_t id = atomic_load(&run->in_id) % 255 + 1;
+    atomic_store(&run->in_id, id);
+    return id;
+}
+
+// Legacy playback client: verifies the CMD_DATA payloads.
+static void *out_client_thread(void *args)
+{
+    struct soak_run *run = args;
+    uint8_t *payload = malloc(1 << 20);
+
+    while (payload && !run->stop)
+    {
+        struct audio_socket_info asi;
+        int64_t deadline_ns = reconnect_deadline_ns(run);
+        int fd = avh_connect_loopback(run->out_port);
+
+        if (fd < 0)
+        {
+            fprintf(stderr, "out client: cannot connect to port %d\n", run->out_port);
+            break;
+        }
+        atomic_store(&run->client_fds[0], fd);
+        verifier_reconnect(&run->out_verifier);
+        while (!run->stop && avh_now_ns(CLOCK_MONOTONIC) < deadline_ns &&
+               avh_read_exact(fd, &asi, sizeof(asi)) == 0)
+        {
+            if (asi.cmd != CMD_DATA)
+            {
+                continue;
+            }
+            if (asi.data[0] > (1 << 20) || avh_read_exact(fd, payload, asi.data[0]) < 0)
+            {
+                break;
+            }
+            verifier_bytes(&run->out_verifier, payload, asi.data[0], 0);
+        }
+        atomic_store(&run->client_fds[0], -1);
+        close(fd);
+        if (!run->stop)
+        {
+            atomic_fetch_add(&run->reconnects, 1);
+        }
+    }
+    free(payload);
+    return NULL;
+}
+
+// Sends stamped capture periods every period_ms until the deadline.
+// framed: prefix every period with a duplex frame header.
+static int feed_capture(struct soak_run *run, int fd, uint32_t id, uint32_t *counter,
+                        int64_t *next_ns, bool framed)
+{
+    uint32_t *period = malloc(run->period_bytes);
+    struct audio_socket_frame_header header;
+    static _Thread_local uint32_t sequence;
+    int ret = -1;
+
+    if (period)
+    {
+        stamp_period(period, run->period_bytes / SOAK_FRAME_BYTES, id, counter);
+        memset(&header, 0, sizeof(header));
+        header.cmd = CMD_DATA;
+        header.stream = AUDIO_IN;
+        header.data_size = run->period_bytes;
+        header.sequence = sequence++;
+        header.timestamp_ns = avh_now_ns(CLOCK_MONOTONIC);
+        if ((!framed || avh_write_exact(fd, &header, sizeof(header)) == 0) &&
+            avh_write_exact(fd, period, run->period_bytes) == 0)
+        {
+            ret = 0;
+        }
+    }
+    free(period);
+    *next_ns += run->opts->period_ms * 1000000LL;
+    return ret;
+}
+
+// Legacy capture client: waits for CMD_OPEN, then streams raw PCM.
+static void *in_client_thread(void *args)
+{
+    struct soak_run *run = args;
+    uint32_t counter = 0;
+
+    while (!run->stop)
+    {
+        struct audio_socket_info asi;
+        int64_t deadline_ns = reconnect_deadline_ns(run);
+        int64_t next_ns;
+        uint32_t id = next_in_id(run);
+        int fd = avh_connect_loopback(run->in_port);
+
+        if (fd < 0)
+        {
+            fprintf(stderr, "in client: cannot connect to port %d\n", run->in_port);
+            break;
+        }
+        atomic_store(&run->client_fds[1], fd);
+        while (!run->stop && avh_read_exact(fd, &asi, sizeof(asi)) == 0 && asi.cmd != CMD_OPEN)
+        {
+        }
+        next_ns = avh_now_ns(CLOCK_MONOTONIC);
+        while (!run->stop && next_ns < deadline_ns)
+        {
+            struct timespec ts = {next_ns / 1000000000LL, next_ns % 1000000000LL};
+            if (feed_capture(run, fd, id, &counter, &next_ns, false) < 0)
+            {
+                break;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+        atomic_store(&run->client_fds[1], -1);
+        close(fd);
+        if (!run->stop)
+        {
+            atomic_fetch_add(&run->reconnects, 1);
+        }
+    }
+    return NULL;
+}
+
+// Full-duplex client: one connection, framed in both directions. Playback
+// frames are verified as they arrive; capture periods are sent on time
+// once the HAL opened the input.
+static void *duplex_client_thread(void *args)
+{
+    struct soak_run *run = args;
+    uint8_t *payload = malloc(1 << 20);
+    uint32_t counter = 0;
+
+    while (payload && !run->stop)
+    {
+        struct audio_socket_frame_header header;
+        int64_t deadline_ns = reconnect_deadline_ns(run);
+        int64_t next_ns = INT64_MAX;
+        uint32_t id = next_in_id(run);
+        int fd = avh_connect_loopback(run->duplex_port);
+
+        if (fd < 0)
+        {
+            fprintf(stderr, "duplex client: cannot connect to port %d\n", run->duplex_port);
+            break;
+        }
+        atomic_store(&run->client_fds[0], fd);
+        verifier_reconnect(&run->out_verifier);
+        while (!run->stop && avh_now_ns(CLOCK_MONOTONIC) < deadline_ns)
+        {
+            struct pollfd pfd = {.fd = fd, .events = POLLIN};
+            int64_t now_ns = avh_now_ns(CLOCK_MONOTONIC);
+            int timeout_ms = next_ns == INT64_MAX ? 100 : (int)((next_ns - now_ns) / 1000000LL);
+
+            if (next_ns <= now_ns)
+            {
+                if (feed_capture(run, fd, id, &counter, &next_ns, true) < 0)
+                {
+                    break;
+                }
+                continue;
+            }
+            if (poll(&pfd, 1, timeout_ms > 100 ? 100 : timeout_ms) <= 0)
+            {
+                continue;
+            }
+            if (avh_read_exact(fd, &header, sizeof(header)) < 0 || header.data_size > (1 << 20) ||
+                avh_read_exact(fd, payload, header.data_size) < 0)
+            {
+                break;
+            }
+            if (header.cmd == CMD_DATA && header.stream == AUDIO_OUT)
+            {
+                verifier_bytes(&run->out_verifier, payload, header.data_size, 0);
+            }
+            else if (header.cmd == CMD_OPEN && header.stream == AUDIO_IN && next_ns == INT64_MAX)
+            {
+                next_ns = avh_now_ns(CLOCK_MONOTONIC);
+            }
+        }
+        atomic_store(&run->client_fds[0], -1);
+        close(fd);
+        if (!run->stop)
+        {
+            atomic_fetch_add(&run->reconnects, 1);
+        }
+    }
+    free(payload);
+    return NULL;
+}
+
+static void *reader_thread(void *args)
+{
+    struct soak_run *run = args;
+    uint8_t *buffer = malloc(run->period_bytes);
+
+    while (buffer && !run->stop)
+    {
+        ssize_t n = run->in->read(run->in, buffer, run->period_bytes);
+        if (n > 0)
+        {
+            verifier_bytes(&run->in_verifier, buffer, n, atomic_load(&run->in_id));
+        }
+    }
+    free(buffer);
+    return NULL;
+}
+
+static uint64_t counters_errors(const struct soak_counters *c)
+{
+    return c->lost + c->duplicated + c->misordered + c->corrupt;
+}
+
+static void print_counters(FILE *f, const char *name, const struct soak_counters *c, double seconds)
+{
+    fprintf(f, "%s %12" PRIu64 " frames %5.3fx lost %" PRIu64 " dup %" PRIu64 " misordered %" PRIu64
+               " corrupt %" PRIu64 " zero %" PRIu64 " resync %" PRIu64 " odd %" PRIu64,
+            name, c->frames, seconds > 0 ? c->frames / seconds / SOAK_SAMPLE_RATE : 0.0, c->lost,
+            c->duplicated, c->misordered, c->corrupt, c->zero_filled, c->resyncs, c->odd_transfers);
+}
+
+static void print_progress(int index, struct soak_run *run, double seconds)
+{
+    struct soak_counters out, in;
+
+    verifier_snapshot(&run->out_verifier, &out);
+    verifier_snapshot(&run->in_verifier, &in);
+    fprintf(stderr, "soak[%d] %8.0fs ", index, seconds);
+    print_counters(stderr, "out", &out, seconds);
+    fprintf(stderr, " | ");
+    print_counters(stderr, "in", &in, seconds);
+    fprintf(stderr, " | reconnects %" PRIu64 "\n", atomic_load(&run->reconnects));
+}
+
+static void run_instance(const struct soak_options *opts, int index, int port,
+                         struct soak_result *result)
+{
+    struct soak_run run;
+    struct audio_hw_device *adev;
+    struct audio_stream_out *out = NULL;
+    struct audio_config config;
+    pthread_t clients[2], reader;
+    int num_clients = 0;
+    bool reading = false;
+    uint32_t *buffer;
+    uint32_t counter = 0;
+    int64_t begin_ns, now_ns, next_report_ns;
+    void *dso;
+    int i;
+
+    memset(&run, 0, sizeof(run));
+    memset(result, 0, sizeof(*result));
+    run.opts = opts;
+    run.period_bytes = (size_t)SOAK_SAMPLE_RATE * opts->period_ms / 1000 * SOAK_FRAME_BYTES;
+    run.out_port = port;
+    run.in_port = port + 1;
+    run.duplex_port = port + 2;
+    atomic_store(&run.client_fds[0], -1);
+    atomic_store(&run.client_fds[1], -1);
+    if (verifier_init(&run.out_verifier) < 0 || verifier_init(&run.in_verifier) < 0)
+    {
+        return;
+    }
+
+    avh_set_env_int("VIRTUAL_AUDIO_OUT_TCP_PORT", run.out_port);
+    avh_set_env_int("VIRTUAL_AUDIO_IN_TCP_PORT", run.in_port);
+    avh_set_env_int("VIRTUAL_AUDIO_DUPLEX_TCP_PORT", run.duplex_port);
+    setenv("VIRTUAL_AUDIO_DUPLEX_ENABLE", opts->duplex ? "1" : "0", 1);
+    setenv("VIRTUAL_AUDIO_TRACE", "off", 0);
+    setenv("VIRTUAL_AUDIO_CLOCK", "monotonic", 1);
+
+    adev = avh_open_module(opts->module, &dso);
+    if (!adev)
+    {
+        return;
+    }
+    if (opts->duplex)
+    {
+        pthread_create(&clients[num_clients++], NULL, duplex_client_thread, &run);
+    }
+    else
+    {
+        pthread_create(&clients[num_clients++], NULL, out_client_thread, &run);
+        pthread_create(&clients[num_clients++], NULL, in_client_thread, &run);
+    }
+    usleep(100000);
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = SOAK_SAMPLE_RATE;
+    config.channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+    if (adev->open_output_stream(adev, 0, AUDIO_DEVICE_OUT_SPEAKER, AUDIO_OUTPUT_FLAG_PRIMARY,
+                                 &config, &out, NULL) != 0)
+    {
+        fprintf(stderr, "soak[%d]: cannot open the output stream\n", index);
+        return;
+    }
+    config.channel_mask = AUDIO_CHANNEL_IN_STEREO;
+    if (adev->open_input_stream(adev, 1, AUDIO_DEVICE_IN_BUILTIN_MIC, &config, &run.in,
+                                AUDIO_INPUT_FLAG_NONE, NULL, AUDIO_SOURCE_MIC) != 0)
+    {
+        fprintf(stderr, "soak[%d]: cannot open the input stream\n", index);
+        return;
+    }
+    reading = pthread_create(&reader, NULL, reader_thread, &run) == 0;
+
+    buffer = malloc(run.period_bytes);
+    begin_ns = now_ns = avh_now_ns(CLOCK_MONOTONIC);
+    next_report_ns = begin_ns + opts->report_s * 1000000000LL;
+    while (buffer && !soak_interrupted &&
+           (opts->time_s == 0 || now_ns - begin_ns < opts->time_s * 1000000000LL))
+    {
+        // Playback keeps one stamp id: the client resyncs on reconnect.
+        stamp_period(buffer, run.period_bytes / SOAK_FRAME_BYTES, 1, &counter);
+        out->write(out, buffer, run.period_bytes);
+        now_ns = avh_now_ns(CLOCK_MONOTONIC);
+        if (opts->report_s > 0 && now_ns >= next_report_ns)
+        {
+            print_progress(index, &run, (now_ns - begin_ns) / 1e9);
+            next_report_ns += opts->report_s * 1000000000LL;
+        }
+    }
+    result->seconds = (avh_now_ns(CLOCK_MONOTONIC) - begin_ns) / 1e9;
+
+    run.stop = 1;
+    if (reading)
+    {
+        pthread_join(reader, NULL);
+    }
+    adev->close_input_stream(adev, run.in);
+    adev->close_output_stream(adev, out);
+    for (i = 0; i < 2; i++)
+    {
+        int fd = atomic_load(&run.client_fds[i]);
+        if (fd >= 0)
+        {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+    for (i = 0; i < num_clients; i++)
+    {
+        pthread_join(clients[i], NULL);
+    }
+    adev->common.close(&adev->common);
+
+    verifier_snapshot(&run.out_verifier, &result->out);
+    verifier_snapshot(&run.in_verifier, &result->in);
+    result->reconnects = atomic_load(&run.reconnects);
+    result->ok = 1;
+    free(buffer);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -m, --module PATH      HAL module to load (default %s)\n"
+            "  -j, --processes N      HAL instances run side by side (default 4)\n"
+            "  -t, --time S           run time in seconds, 0 until interrupted (default 60)\n"
+            "  -r, --reconnect MS     clients reconnect every MS, 0 never (default 5000)\n"
+            "  -p, --period MS        period size (default 10)\n"
+            "  -i, --interval S       progress report interval, 0 for none (default 10)\n"
+            "  -x, --duplex           use the full-duplex connection\n"
+            "  -P, --port PORT        first TCP port; each instance takes 3 (default %d)\n",
+            name, AVH_DEFAULT_MODULE, SOAK_DEFAULT_PORT);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        {"module", required_argument, NULL, 'm'},
+        {"processes", required_argument, NULL, 'j'},
+        {"time", required_argument, NULL, 't'},
+        {"reconnect", required_argument, NULL, 'r'},
+        {"period", required_argument, NULL, 'p'},
+        {"interval", required_argument, NULL, 'i'},
+        {"duplex", no_argument, NULL, 'x'},
+        {"port", required_argument, NULL, 'P'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    struct soak_options opts = {
+        .module = avh_default_module_path(),
+        .port = SOAK_DEFAULT_PORT,
+        .processes = 4,
+        .time_s = 60,
+        .reconnect_ms = 5000,
+        .period_ms = 10,
+        .report_s = 10,
+    };
+    struct soak_result results[SOAK_MAX_PROCESSES];
+    struct soak_counters total_out, total_in;
+    pid_t pids[SOAK_MAX_PROCESSES];
+    int fds[SOAK_MAX_PROCESSES];
+    struct sigaction sa;
+    uint64_t reconnects = 0;
+    bool passed = true;
+    int i, opt;
+
+    while ((opt = getopt_long(argc, argv, "m:j:t:r:p:i:xP:h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            opts.module = optarg;
+            break;
+        case 'j':
+            opts.processes = atoi(optarg);
+            break;
+        case 't':
+            opts.time_s = atoi(optarg);
+            break;
+        case 'r':
+            opts.reconnect_ms = atoi(optarg);
+            break;
+        case 'p':
+            opts.period_ms = atoi(optarg);
+            break;
+        case 'i':
+            opts.report_s = atoi(optarg);
+            break;
+        case 'x':
+            opts.duplex = true;
+            break;
+        case 'P':
+            opts.port = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (opts.processes <= 0 || opts.processes > SOAK_MAX_PROCESSES || opts.time_s < 0 ||
+        opts.period_ms <= 0 || opts.port <= 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    setenv("AVH_LOG_LEVEL", "S", 0);
+
+    // No SA_RESTART: the parent's read() returns so it can pass the signal on.
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = soak_on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    for (i = 0; i < opts.processes; i++)
+    {
+        int pipe_fds[2];
+
+        if (pipe(pipe_fds) != 0)
+        {
+            perror("pipe");
+            return 1;
+        }
+        pids[i] = fork();
+        if (pids[i] == 0)
+        {
+            close(pipe_fds[0]);
+            run_instance(&opts, i, opts.port + i * 3, &results[i]);
+            avh_write_exact(pipe_fds[1], &results[i], sizeof(results[i]));
+            _exit(0);
+        }
+        close(pipe_fds[1]);
+        fds[i] = pipe_fds[0];
+    }
+
+    memset(&total_out, 0, sizeof(total_out));
+    memset(&total_in, 0, sizeof(total_in));
+    for (i = 0; i < opts.processes; i++)
+    {
+        size_t done = 0;
+        while (done < sizeof(results[i]))
+        {
+            ssize_t n = read(fds[i], (uint8_t *)&results[i] + done, sizeof(results[i]) - done);
+            if (n < 0 && errno == EINTR)
+            {
+                int j;
+                for (j = 0; j < opts.processes; j++)
+                {
+                    if (pids[j] > 0)
+                    {
+                        kill(pids[j], SIGTERM);
+                    }
+                }
+                continue;
+            }
+            if (n <= 0)
+            {
+                break;
+            }
+            done += n;
+        }
+        if (done < sizeof(results[i]))
+        {
+            memset(&results[i], 0, sizeof(results[i]));
+        }
+        close(fds[i]);
+        if (pids[i] > 0)
+        {
+            waitpid(pids[i], NULL, 0);
+        }
+
+        printf("soak[%d] %s %8.0fs ", i, results[i].ok ? "ran " : "FAIL", results[i].seconds);
+        print_counters(stdout, "out", &results[i].out, results[i].seconds);
+        printf(" | ");
+        print_counters(stdout, "in", &results[i].in, results[i].seconds);
+        printf(" | reconnects %" PRIu64 "\n", results[i].reconnects);
+
+        passed = passed && results[i].ok && counters_errors(&results[i].out) == 0 &&
+                 counters_errors(&results[i].in) == 0 && results[i].out.frames > 0 &&
+                 results[i].in.frames > 0;
+        reconnects += results[i].reconnects;
+#define SOAK_ADD(field)                                  \
+    total_out.field += results[i].out.field;             \
+    total_in.field += results[i].in.field
+        SOAK_ADD(frames);
+        SOAK_ADD(lost);
+        SOAK_ADD(duplicated);
+        SOAK_ADD(misordered);
+        SOAK_ADD(corrupt);
+        SOAK_ADD(zero_filled);
+        SOAK_ADD(resyncs);
+        SOAK_ADD(odd_transfers);
+#undef SOAK_ADD
+    }
+    printf("total %d processes, %" PRIu64 " reconnects: out %" PRIu64 " frames lost %" PRIu64
+           " dup %" PRIu64 " misordered %" PRIu64 " corrupt %" PRIu64 ", in %" PRIu64
+           " frames lost %" PRIu64 " dup %" PRIu64 " misordered %" PRIu64 " corrupt %" PRIu64
+           ": %s\n",
+           opts.processes, reconnects, total_out.frames, total_out.lost, total_out.duplicated,
+           total_out.misordered, total_out.corrupt, total_in.frames, total_in.lost,
+           total_in.duplicated, total_in.misordered, total_in.corrupt, passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Wrappers for the system calls counted by the host tools. Built without
+// _FORTIFY_SOURCE so the definitions do not collide with the inline
+// checking wrappers of glibc.
+
+#ifdef _FORTIFY_SOURCE
+#undef _FORTIFY_SOURCE
+#endif
+
+#include <dlfcn.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "avh_syscalls.h"
+
+__thread int avh_syscalls_ignore;
+_Atomic uint64_t avh_syscalls[AVH_SYSCALL_COUNT];
+
+static const char *const avh_syscall_names[AVH_SYSCALL_COUNT] = {
+    "read", "write", "readv", "writev", "send", "recv", "sendmsg",
+    "recvmsg", "epoll_wait", "poll", "ioctl", "sleep", "accept",
+};
+
+const char *avh_syscall_name(int call)
+{
+    return call >= 0 && call < AVH_SYSCALL_COUNT ? avh_syscall_names[call] : "?";
+}
+
+uint64_t avh_syscalls_total(void)
+{
+    uint64_t total = 0;
+    int i;
+    for (i = 0; i < AVH_SYSCALL_COUNT; i++)
+    {
+        total += atomic_load_explicit(&avh_syscalls[i], memory_order_relaxed);
+    }
+    return total;
+}
+
+void avh_syscalls_snapshot(uint64_t counts[AVH_SYSCALL_COUNT])
+{
+    int i;
+    for (i = 0; i < AVH_SYSCALL_COUNT; i++)
+    {
+        counts[i] = atomic_load_explicit(&avh_syscalls[i], memory_order_relaxed);
+    }
+}
+
+static inline void count(int call)
+{
+    if (!avh_syscalls_ignore)
+    {
+        atomic_fetch_add_explicit(&avh_syscalls[call], 1, memory_order_relaxed);
+    }
+}
+
+// Resolves the libc definition once; dlsym() is safe to race on.
+#define REAL(name)                                                  \
+    static __typeof__(name) *real_##name;                           \
+    if (!real_##name)                                               \
+    {                                                               \
+        real_##name = (__typeof__(name) *)dlsym(RTLD_NEXT, #name);  \
+    }
+
+ssize_t read(int fd, void *buf, size_t count_)
+{
+    REAL(read);
+    count(AVH_SYSCALL_READ);
+    return real_read(fd, buf, count_);
+}
+
+ssize_t write(int fd, const void *buf, size_t count_)
+{
+    REAL(write);
+    count(AVH_SYSCALL_WRITE);
+    return real_write(fd, buf, count_);
+}
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
+{
+    REAL(readv);
+    count(AVH_SYSCALL_READV);
+    return real_readv(fd, iov, iovcnt);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    REAL(writev);
+    count(AVH_SYSCALL_WRITEV);
+    return real_writev(fd, iov, iovcnt);
+}
+
+ssize_t send(int fd, const void *buf, size_t len, int flags)
+{
+    REAL(send);
+    count(AVH_SYSCALL_SEND);
+    return real_send(fd, buf, len, flags);
+}
+
+ssize_t recv(int fd, void *buf, size_t len, int flags)
+{
+    REAL(recv);
+    count(AVH_SYSCALL_RECV);
+    return real_recv(fd, buf, len, flags);
+}
+
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+    REAL(sendmsg);
+    count(AVH_SYSCALL_SENDMSG);
+    return real_sendmsg(fd, msg, flags);
+}
+
+ssize_t recvmsg(int fd, struct msghdr *msg, int flags)
+{
+    REAL(recvmsg);
+    count(AVH_SYSCALL_RECVMSG);
+    return real_recvmsg(fd, msg, flags);
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+    REAL(epoll_wait);
+    count(AVH_SYSCALL_EPOLL_WAIT);
+    return real_epoll_wait(epfd, events, maxevents, timeout);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    REAL(poll);
+    count(AVH_SYSCALL_POLL);
+    return real_poll(fds, nfds, timeout);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+    va_list args;
+    void *arg;
+    REAL(ioctl);
+    va_start(args, request);
+    arg = va_arg(args, void *);
+    va_end(args);
+    count(AVH_SYSCALL_IOCTL);
+    return real_ioctl(fd, request, arg);
+}
+
+int usleep(useconds_t usec)
+{
+    REAL(usleep);
+    count(AVH_SYSCALL_SLEEP);
+    return real_usleep(usec);
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem)
+{
+    REAL(nanosleep);
+    count(AVH_SYSCALL_SLEEP);
+    return real_nanosleep(req, rem);
+}
+
+int clock_nanosleep(clockid_t clock, int flags, const struct timespec *req,
+                    struct timespec *rem)
+{
+    REAL(clock_nanosleep);
+    count(AVH_SYSCALL_SLEEP);
+    return real_clock_nanosleep(clock, flags, req, rem);
+}
+
+int accept(int fd, struct sockaddr *addr, socklen_t *addrlen)
+{
+    REAL(accept);
+    count(AVH_SYSCALL_ACCEPT);
+    return real_accept(fd, addr, addrlen);
+}
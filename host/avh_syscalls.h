@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AVH_SYSCALLS_H
+#define AVH_SYSCALLS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Counts the system calls the dlopen()ed HAL makes. The host tools export
+// wrappers for the I/O and sleep calls the HAL uses (link with -rdynamic);
+// the module binds to them instead of libc. Threads that play the part of
+// the host client set avh_syscalls_ignore so only HAL work is counted.
+
+enum avh_syscall
+{
+    AVH_SYSCALL_READ = 0,
+    AVH_SYSCALL_WRITE,
+    AVH_SYSCALL_READV,
+    AVH_SYSCALL_WRITEV,
+    AVH_SYSCALL_SEND,
+    AVH_SYSCALL_RECV,
+    AVH_SYSCALL_SENDMSG,
+    AVH_SYSCALL_RECVMSG,
+    AVH_SYSCALL_EPOLL_WAIT,
+    AVH_SYSCALL_POLL,
+    AVH_SYSCALL_IOCTL,
+    AVH_SYSCALL_SLEEP,
+    AVH_SYSCALL_ACCEPT,
+    AVH_SYSCALL_COUNT
+};
+
+extern __thread int avh_syscalls_ignore;
+extern _Atomic uint64_t avh_syscalls[AVH_SYSCALL_COUNT];
+
+const char *avh_syscall_name(int call);
+uint64_t avh_syscalls_total(void);
+void avh_syscalls_snapshot(uint64_t counts[AVH_SYSCALL_COUNT]);
+
+#endif // AVH_SYSCALLS_H
@@ -0,0 +1,477 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Tests of the HAL's signal code against known input, without the module
+// or a client. The Makefile builds it twice: as the HAL is built, and with
+// __SSE2__ undefined so the plain C paths of the same code run too.
+//
+//   glitch    a sine with a spliced period, a 10 ms run of zeros and a run
+//             clipped at full scale must show exactly one discontinuity,
+//             one silence gap and one clip in the dump; the clean sine none
+//   channels  subsets of 4, 8 and 16 channel index masks picked from 16
+//             and 32 bit frames must match a plain per-sample copy
+//   fec       a stream of datagrams of mixed sizes with XOR parity through
+//             the jitter buffer: one datagram lost per group must come out
+//             rebuilt, two lost in a group as silence of their length
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <system/audio.h>
+
+#include "audio_channels.h"
+#include "audio_datagram.h"
+#include "audio_glitch.h"
+
+#define UNIT_SAMPLE_RATE 48000
+#define UNIT_PERIOD_FRAMES 480
+#define UNIT_CHANNEL_FRAMES 203 // Several blocks of audio_channel_select() and a tail
+#define UNIT_FEC_GROUP 4
+#define UNIT_FEC_GROUPS 8
+#define UNIT_FEC_DATAGRAMS (UNIT_FEC_GROUPS * (UNIT_FEC_GROUP + 1))
+
+#if defined(__SSE2__)
+#define UNIT_PATH "sse2"
+#else
+#define UNIT_PATH "scalar"
+#endif
+
+static int unit_failures;
+
+static void unit_check(bool ok, const char *test, const char *what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "%s [%s]: FAIL %s\n", test, UNIT_PATH, what);
+        unit_failures++;
+    }
+}
+
+static const char *format_name(audio_format_t format)
+{
+    switch (format)
+    {
+    case AUDIO_FORMAT_PCM_16_BIT:
+        return "pcm16";
+    case AUDIO_FORMAT_PCM_32_BIT:
+        return "pcm32";
+    default:
+        return "float";
+    }
+}
+
+// Store v, clamped to full scale, as sample i of buf.
+static void put_sample(audio_format_t format, void *buf, size_t i, double v)
+{
+    v = v > 1.0 ? 1.0 : v < -1.0 ? -1.0 : v;
+    switch (format)
+    {
+    case AUDIO_FORMAT_PCM_16_BIT:
+        ((int16_t *)buf)[i] = (int16_t)lrint(v * 32767.0);
+        break;
+    case AUDIO_FORMAT_PCM_32_BIT:
+        ((int32_t *)buf)[i] = (int32_t)llrint(v * 2147483647.0);
+        break;
+    default:
+        ((float *)buf)[i] = (float)v;
+        break;
+    }
+}
+
+// Read back "glitches in N frames: D discontinuities, G silence gaps, C clips"
+// from the dump, as a user of dumpsys would.
+static int read_glitch_dump(const struct audio_glitch *g, unsigned long long counts[3])
+{
+    char line[256];
+    FILE *f = tmpfile();
+    int ret = -1;
+
+    if (!f)
+    {
+        return -1;
+    }
+    fflush(f);
+    audio_glitch_dump(fileno(f), g, 0);
+    rewind(f);
+    while (fgets(line, sizeof(line), f))
+    {
+        unsigned long long frames;
+        if (sscanf(line, " glitches in %llu frames: %llu discontinuities, %llu silence gaps, %llu clips",
+                   &frames, &counts[0], &counts[1], &counts[2]) == 4)
+        {
+            ret = 0;
+            break;
+        }
+    }
+    fclose(f);
+    return ret;
+}
+
+// 220 Hz at 0.8 of full scale, so a dropped period moves the phase by a
+// fifth of a cycle. The clip comes from an 8 ms swell of the gain to 1.6:
+// a smooth entry into the clip, which is not a discontinuity itself.
+static void test_glitch_run(audio_format_t format, uint32_t channels, bool impaired)
+{
+    const double w = 2.0 * M_PI * 220.0 / UNIT_SAMPLE_RATE;
+    const size_t sample_size = audio_bytes_per_sample(format);
+    const int periods = 100;
+    const int splice_period = 20;
+    const int gap_period = 40;
+    const size_t swell_start = 60 * UNIT_PERIOD_FRAMES + 100;
+    const size_t swell_frames = UNIT_SAMPLE_RATE * 8 / 1000;
+    uint8_t *buf = (uint8_t *)malloc(UNIT_PERIOD_FRAMES * channels * sample_size);
+    struct audio_glitch g;
+    unsigned long long counts[3] = {0, 0, 0};
+    unsigned long long expected = impaired ? 1 : 0;
+    uint64_t t = 0; // Frame of the sine
+    char test[64];
+    int p;
+
+    snprintf(test, sizeof(test), "glitch %s %u ch%s", format_name(format), channels,
+             impaired ? " impaired" : "");
+    memset(&g, 0, sizeof(g));
+    if (!buf || audio_glitch_reset(&g, format, channels, UNIT_SAMPLE_RATE, UNIT_PERIOD_FRAMES) < 0)
+    {
+        unit_check(false, test, "reset");
+        free(buf);
+        return;
+    }
+    for (p = 0; p < periods; p++)
+    {
+        size_t i, c;
+
+        if (impaired && p == splice_period)
+        {
+            t += UNIT_PERIOD_FRAMES;
+        }
+        for (i = 0; i < UNIT_PERIOD_FRAMES; i++)
+        {
+            double v = 0.0;
+            if (!impaired || p != gap_period)
+            {
+                double gain = 1.0;
+                size_t frame = (size_t)p * UNIT_PERIOD_FRAMES + i;
+                if (impaired && frame >= swell_start && frame < swell_start + swell_frames)
+                {
+                    gain += 0.3 * (1.0 - cos(2.0 * M_PI * (frame - swell_start) / swell_frames));
+                }
+                v = 0.8 * gain * sin(w * t++);
+            }
+            for (c = 0; c < channels; c++)
+            {
+                put_sample(format, buf, i * channels + c, v);
+            }
+        }
+        audio_glitch_analyse(&g, buf, UNIT_PERIOD_FRAMES * channels * sample_size, 0);
+    }
+    unit_check(read_glitch_dump(&g, counts) == 0, test, "no counts in the dump");
+    if (counts[0] != expected || counts[1] != expected || counts[2] != expected)
+    {
+        char what[128];
+        snprintf(what, sizeof(what), "%llu discontinuities, %llu gaps, %llu clips, expected %llu each",
+                 counts[0], counts[1], counts[2], expected);
+        unit_check(false, test, what);
+    }
+    audio_glitch_release(&g);
+    free(buf);
+}
+
+static void test_glitch(void)
+{
+    static const audio_format_t formats[] = {AUDIO_FORMAT_PCM_16_BIT, AUDIO_FORMAT_PCM_32_BIT,
+                                             AUDIO_FORMAT_PCM_FLOAT};
+    size_t f;
+    uint32_t channels;
+
+    audio_glitch_init();
+    for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+    {
+        for (channels = 1; channels <= 2; channels++)
+        {
+            test_glitch_run(formats[f], channels, false);
+            test_glitch_run(formats[f], channels, true);
+        }
+    }
+}
+
+// Input channel of output channel out, as the masks say, or
+// AUDIO_CHANNEL_SILENT.
+static int channel_source(audio_channel_mask_t in_mask, audio_channel_mask_t out_mask, uint32_t out)
+{
+    const uint32_t in_bits = audio_channel_mask_get_bits(in_mask);
+    const uint32_t in_channels = audio_channel_count_from_in_mask(in_mask);
+    uint32_t out_bits = audio_channel_mask_get_bits(out_mask);
+    uint32_t bit = 0;
+    uint32_t n;
+
+    if (audio_channel_mask_get_representation(out_mask) != AUDIO_CHANNEL_REPRESENTATION_INDEX)
+    {
+        return out < in_channels ? (int)out : AUDIO_CHANNEL_SILENT;
+    }
+    for (n = 0; n <= out; n++)
+    {
+        bit = __builtin_ctz(out_bits);
+        out_bits &= out_bits - 1;
+    }
+    if (!((in_bits >> bit) & 1))
+    {
+        return AUDIO_CHANNEL_SILENT;
+    }
+    return __builtin_popcount(in_bits & ((1u << bit) - 1));
+}
+
+static void test_channels_run(uint32_t in_channels, audio_channel_mask_t out_mask,
+                              size_t sample_size)
+{
+    const audio_channel_mask_t in_mask = audio_channel_mask_for_index_assignment_from_count(in_channels);
+    const uint32_t out_channels = audio_channel_count_from_in_mask(out_mask);
+    const size_t frames = UNIT_CHANNEL_FRAMES;
+    uint8_t *in = (uint8_t *)malloc(frames * in_channels * sample_size);
+    uint8_t *out = (uint8_t *)malloc(frames * out_channels * sample_size);
+    struct audio_channel_map map;
+    char test[64];
+    size_t i, c;
+
+    snprintf(test, sizeof(test), "channels %u to 0x%x, %zu bit", in_channels, out_mask,
+             sample_size * 8);
+    if (!in || !out || audio_channel_map_init(&map, in_mask, out_mask) < 0)
+    {
+        unit_check(false, test, "map");
+        free(in);
+        free(out);
+        return;
+    }
+    // Every sample tells its frame and channel.
+    for (i = 0; i < frames * in_channels; i++)
+    {
+        uint32_t v = (uint32_t)(i / in_channels) << 4 | (uint32_t)(i % in_channels);
+        if (sample_size == 2)
+        {
+            ((int16_t *)in)[i] = (int16_t)(v | 0x8000);
+        }
+        else
+        {
+            ((int32_t *)in)[i] = (int32_t)(v | 0x80000000u);
+        }
+    }
+    memset(out, 0x5a, frames * out_channels * sample_size);
+    audio_channel_select(&map, in, out, sample_size, frames);
+    for (i = 0; i < frames; i++)
+    {
+        for (c = 0; c < out_channels; c++)
+        {
+            int source = channel_source(in_mask, out_mask, c);
+            int64_t expected, got;
+            if (sample_size == 2)
+            {
+                expected = source == AUDIO_CHANNEL_SILENT ? 0 : ((int16_t *)in)[i * in_channels + source];
+                got = ((int16_t *)out)[i * out_channels + c];
+            }
+            else
+            {
+                expected = source == AUDIO_CHANNEL_SILENT ? 0 : ((int32_t *)in)[i * in_channels + source];
+                got = ((int32_t *)out)[i * out_channels + c];
+            }
+            if (got != expected)
+            {
+                char what[96];
+                snprintf(what, sizeof(what), "frame %zu channel %zu is 0x%llx, expected 0x%llx", i,
+                         c, (unsigned long long)got, (unsigned long long)expected);
+                unit_check(false, test, what);
+                i = frames;
+                break;
+            }
+        }
+    }
+    free(in);
+    free(out);
+}
+
+static void test_channels(void)
+{
+    // Index subsets of the array, down to one microphone and up to all of
+    // them; 0x30 has a channel a 4 microphone array lacks. Eight of 16
+    // microphones take the 8 channel interleave, all of an array is a copy.
+    // Stereo is positional, the first two microphones.
+    static const uint32_t subsets[] = {0x1,  0x3,  0x6,  0x9,  0xf,   0x30,
+                                       0x55, 0xaa, 0xf0, 0xff, 0xff0, 0xff00};
+    static const uint32_t arrays[] = {4, 8, 16};
+    size_t a, s, size;
+
+    for (a = 0; a < sizeof(arrays) / sizeof(arrays[0]); a++)
+    {
+        for (size = 2; size <= 4; size += 2)
+        {
+            for (s = 0; s < sizeof(subsets) / sizeof(subsets[0]); s++)
+            {
+                // Beyond the array, only the one subset with a missing channel.
+                if (subsets[s] >> arrays[a] && subsets[s] != 0x30)
+                {
+                    continue;
+                }
+                test_channels_run(arrays[a], AUDIO_CHANNEL_INDEX_HDR | subsets[s], size);
+            }
+            test_channels_run(arrays[a], AUDIO_CHANNEL_IN_STEREO, size);
+        }
+    }
+}
+
+struct unit_datagram
+{
+    struct audio_datagram_header header;
+    uint8_t payload[AUDIO_DATAGRAM_MAX_PAYLOAD];
+};
+
+// Payload size of data datagram n: every third one short, so the parity
+// covers padding and rebuilds sizes too.
+static size_t fec_size(int n)
+{
+    return n % 3 == 2 ? AUDIO_DATAGRAM_MAX_PAYLOAD / 2 - 100 : AUDIO_DATAGRAM_MAX_PAYLOAD;
+}
+
+// Put the stream without the data datagrams lost() picks into a jitter
+// buffer and play all of it out.
+static void test_fec_run(const char *test, const struct unit_datagram *datagrams, int count,
+                         const uint8_t *stream, size_t bytes, bool (*lost)(uint32_t sequence),
+                         uint64_t recovered, uint64_t concealed)
+{
+    struct audio_jitter_buffer *jitter = calloc(1, sizeof(*jitter));
+    uint8_t *out = malloc(bytes);
+    struct audio_jitter_stats stats;
+    size_t buffered, copied, i;
+    bool intact = true;
+    int n;
+
+    if (!jitter || !out || audio_jitter_init(jitter) != 0)
+    {
+        unit_check(false, test, "allocation");
+        free(jitter);
+        free(out);
+        return;
+    }
+    audio_jitter_reset(jitter, 1);
+    for (n = 0; n < count; n++)
+    {
+        const struct unit_datagram *d = &datagrams[n];
+        if ((d->header.flags & AUDIO_DATAGRAM_FLAG_PARITY) || !lost(d->header.sequence))
+        {
+            audio_jitter_put(jitter, &d->header, d->payload, d->header.data_size);
+        }
+    }
+    copied = audio_jitter_get(jitter, out, bytes, 0, NULL);
+    audio_jitter_get_stats(jitter, &stats, &buffered);
+    unit_check(copied == bytes, test, "short read");
+    // Concealed datagrams are silence of their length, the rest is intact.
+    for (n = 0; n < count && copied == bytes; n++)
+    {
+        const struct audio_datagram_header *h = &datagrams[n].header;
+        if (h->flags & AUDIO_DATAGRAM_FLAG_PARITY)
+        {
+            continue;
+        }
+        for (i = 0; i < h->data_size; i++)
+        {
+            uint8_t expected = concealed > 0 && lost(h->sequence) ? 0 : stream[h->offset + i];
+            intact = intact && out[h->offset + i] == expected;
+        }
+    }
+    unit_check(intact, test, "payload differs");
+    if (stats.recovered != recovered || stats.concealed != concealed)
+    {
+        char what[128];
+        snprintf(what, sizeof(what), "%llu recovered, %llu concealed, expected %llu and %llu",
+                 (unsigned long long)stats.recovered, (unsigned long long)stats.concealed,
+                 (unsigned long long)recovered, (unsigned long long)concealed);
+        unit_check(false, test, what);
+    }
+    audio_jitter_destroy(jitter);
+    free(jitter);
+    free(out);
+}
+
+// One datagram of every group, at a different place in each. Not the
+// first of the stream: the buffer starts at the first one it receives.
+static bool fec_lose_one(uint32_t sequence)
+{
+    uint32_t group = sequence / UNIT_FEC_GROUP;
+    return sequence % UNIT_FEC_GROUP == (group + 1) % UNIT_FEC_GROUP;
+}
+
+// The first two datagrams of the second group.
+static bool fec_lose_two(uint32_t sequence)
+{
+    return sequence == UNIT_FEC_GROUP || sequence == UNIT_FEC_GROUP + 1;
+}
+
+static void test_fec(void)
+{
+    struct unit_datagram *datagrams = calloc(UNIT_FEC_DATAGRAMS, sizeof(*datagrams));
+    uint8_t *stream = malloc(UNIT_FEC_GROUPS * UNIT_FEC_GROUP * AUDIO_DATAGRAM_MAX_PAYLOAD);
+    struct audio_datagram_sender sender;
+    size_t bytes = 0, i;
+    int count = 0, n;
+
+    if (!datagrams || !stream)
+    {
+        unit_check(false, "fec", "allocation");
+        free(datagrams);
+        free(stream);
+        return;
+    }
+    audio_datagram_sender_reset(&sender, 0, UNIT_FEC_GROUP);
+    // One datagram per period; the parity payload lives in the sender, so
+    // copy each batch before the next.
+    for (n = 0; n < UNIT_FEC_GROUPS * UNIT_FEC_GROUP; n++)
+    {
+        struct audio_datagram batch[2];
+        size_t size = fec_size(n), consumed = 0;
+        int got, b;
+
+        for (i = 0; i < size; i++)
+        {
+            stream[bytes + i] = (uint8_t)((bytes + i) % 251 + 1);
+        }
+        got = audio_datagram_packetize(&sender, 0, stream + bytes, size, 1000000LL * n, batch, 2,
+                                       &consumed);
+        unit_check(consumed == size, "fec", "period not packetized whole");
+        for (b = 0; b < got && count < UNIT_FEC_DATAGRAMS; b++, count++)
+        {
+            datagrams[count].header = batch[b].header;
+            memcpy(datagrams[count].payload, batch[b].payload, batch[b].header.data_size);
+        }
+        bytes += size;
+    }
+    unit_check(count == UNIT_FEC_DATAGRAMS, "fec", "parity datagrams missing");
+    test_fec_run("fec one lost per group", datagrams, count, stream, bytes, fec_lose_one,
+                 UNIT_FEC_GROUPS, 0);
+    test_fec_run("fec two lost in a group", datagrams, count, stream, bytes, fec_lose_two, 0, 2);
+    free(datagrams);
+    free(stream);
+}
+
+int main(int argc, char **argv)
+{
+    test_glitch();
+    test_channels();
+    test_fec();
+    printf("avh_unit [%s]: %s\n", UNIT_PATH, unit_failures ? "FAIL" : "PASS");
+    return unit_failures ? 1 : 0;
+}
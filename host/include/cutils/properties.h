@@ -0,0 +1,30 @@
+/*
+ * Minimal host stand-in for <cutils/properties.h>.
+ *
+ * property_get() first looks at values stored with property_set(), then at
+ * the environment: "virtual.audio.out.tcp.port" is read from
+ * VIRTUAL_AUDIO_OUT_TCP_PORT.
+ */
+
+#ifndef AVH_HOST_CUTILS_PROPERTIES_H
+#define AVH_HOST_CUTILS_PROPERTIES_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROPERTY_KEY_MAX 32
+#define PROPERTY_VALUE_MAX 92
+
+int property_get(const char *key, char *value, const char *default_value);
+// default_value when unset or not a number in range, as in libcutils.
+int32_t property_get_int32(const char *key, int32_t default_value);
+int property_set(const char *key, const char *value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // AVH_HOST_CUTILS_PROPERTIES_H
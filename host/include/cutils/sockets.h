@@ -0,0 +1,12 @@
+/*
+ * Minimal host stand-in for <cutils/sockets.h>.
+ */
+
+#ifndef AVH_HOST_CUTILS_SOCKETS_H
+#define AVH_HOST_CUTILS_SOCKETS_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#endif // AVH_HOST_CUTILS_SOCKETS_H
@@ -0,0 +1,42 @@
+/*
+ * Minimal host stand-in for <cutils/str_parms.h>, implemented in
+ * host/str_parms.c with the same semantics as libcutils: "key=value" pairs
+ * separated by ';', a key without '=' has an empty value.
+ */
+
+#ifndef AVH_HOST_CUTILS_STR_PARMS_H
+#define AVH_HOST_CUTILS_STR_PARMS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct str_parms;
+
+struct str_parms *str_parms_create(void);
+struct str_parms *str_parms_create_str(const char *_string);
+void str_parms_destroy(struct str_parms *str_parms);
+
+void str_parms_del(struct str_parms *str_parms, const char *key);
+
+int str_parms_add_str(struct str_parms *str_parms, const char *key, const char *value);
+int str_parms_add_int(struct str_parms *str_parms, const char *key, int value);
+int str_parms_add_float(struct str_parms *str_parms, const char *key, float value);
+
+// Returns non-zero if the str_parms contains the specified key.
+int str_parms_has_key(struct str_parms *str_parms, const char *key);
+
+// Return the length of the value, or -ENOENT.
+int str_parms_get_str(struct str_parms *str_parms, const char *key, char *out_val, int len);
+// Return 0, -ENOENT or -EINVAL.
+int str_parms_get_int(struct str_parms *str_parms, const char *key, int *out_val);
+int str_parms_get_float(struct str_parms *str_parms, const char *key, float *out_val);
+
+// The caller frees the returned string.
+char *str_parms_to_str(struct str_parms *str_parms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // AVH_HOST_CUTILS_STR_PARMS_H
@@ -0,0 +1,18 @@
+/*
+ * Minimal host stand-in for <cutils/trace.h>. Tracing is always disabled.
+ */
+
+#ifndef AVH_HOST_CUTILS_TRACE_H
+#define AVH_HOST_CUTILS_TRACE_H
+
+#include <stdint.h>
+
+#define ATRACE_TAG_AUDIO (1 << 8)
+
+#define ATRACE_ENABLED() 0
+#define ATRACE_BEGIN(name) ((void)(name))
+#define ATRACE_END() ((void)0)
+#define ATRACE_INT(name, value) ((void)(name), (void)(value))
+#define ATRACE_INT64(name, value) ((void)(name), (void)(value))
+
+#endif // AVH_HOST_CUTILS_TRACE_H
@@ -0,0 +1,154 @@
+/*
+ * Minimal host stand-in for <hardware/audio.h>. The struct layouts follow the
+ * Android audio HAL v3 interface closely enough for audio_hw.c to compile and
+ * for the host tools to drive it through HAL_MODULE_INFO_SYM.
+ */
+
+#ifndef AVH_HOST_HARDWARE_AUDIO_H
+#define AVH_HOST_HARDWARE_AUDIO_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <hardware/hardware.h>
+#include <system/audio.h>
+
+#define AUDIO_HARDWARE_MODULE_ID "audio"
+#define AUDIO_HARDWARE_INTERFACE "audio_hw_if"
+
+#define AUDIO_MODULE_API_VERSION_0_1 HARDWARE_MAKE_API_VERSION(0, 1)
+#define AUDIO_DEVICE_API_VERSION_2_0 HARDWARE_MAKE_API_VERSION(2, 0)
+
+typedef void *effect_handle_t;
+
+struct source_metadata
+{
+    size_t track_count;
+    void *tracks;
+};
+
+struct sink_metadata
+{
+    size_t track_count;
+    void *tracks;
+};
+
+struct audio_stream
+{
+    uint32_t (*get_sample_rate)(const struct audio_stream *stream);
+    int (*set_sample_rate)(struct audio_stream *stream, uint32_t rate);
+    size_t (*get_buffer_size)(const struct audio_stream *stream);
+    audio_channel_mask_t (*get_channels)(const struct audio_stream *stream);
+    audio_format_t (*get_format)(const struct audio_stream *stream);
+    int (*set_format)(struct audio_stream *stream, audio_format_t format);
+    int (*standby)(struct audio_stream *stream);
+    int (*dump)(const struct audio_stream *stream, int fd);
+    audio_devices_t (*get_device)(const struct audio_stream *stream);
+    int (*set_device)(struct audio_stream *stream, audio_devices_t device);
+    int (*set_parameters)(struct audio_stream *stream, const char *kv_pairs);
+    char *(*get_parameters)(const struct audio_stream *stream, const char *keys);
+    int (*add_audio_effect)(const struct audio_stream *stream, effect_handle_t effect);
+    int (*remove_audio_effect)(const struct audio_stream *stream, effect_handle_t effect);
+};
+typedef struct audio_stream audio_stream_t;
+
+struct audio_stream_out
+{
+    struct audio_stream common;
+    uint32_t (*get_latency)(const struct audio_stream_out *stream);
+    int (*set_volume)(struct audio_stream_out *stream, float left, float right);
+    ssize_t (*write)(struct audio_stream_out *stream, const void *buffer, size_t bytes);
+    int (*get_render_position)(const struct audio_stream_out *stream, uint32_t *dsp_frames);
+    int (*get_next_write_timestamp)(const struct audio_stream_out *stream, int64_t *timestamp);
+    int (*get_presentation_position)(const struct audio_stream_out *stream,
+                                     uint64_t *frames, struct timespec *timestamp);
+    void (*update_source_metadata)(struct audio_stream_out *stream,
+                                   const struct source_metadata *source_metadata);
+};
+typedef struct audio_stream_out audio_stream_out_t;
+
+struct audio_stream_in
+{
+    struct audio_stream common;
+    int (*set_gain)(struct audio_stream_in *stream, float gain);
+    ssize_t (*read)(struct audio_stream_in *stream, void *buffer, size_t bytes);
+    uint32_t (*get_input_frames_lost)(struct audio_stream_in *stream);
+    int (*get_capture_position)(const struct audio_stream_in *stream,
+                                int64_t *frames, int64_t *time);
+    void (*update_sink_metadata)(struct audio_stream_in *stream,
+                                 const struct sink_metadata *sink_metadata);
+};
+typedef struct audio_stream_in audio_stream_in_t;
+
+static inline size_t audio_stream_out_frame_size(const struct audio_stream_out *s)
+{
+    size_t chan_samp_sz;
+    audio_format_t format = s->common.get_format(&s->common);
+
+    if (audio_has_proportional_frames(format))
+    {
+        chan_samp_sz = audio_bytes_per_sample(format);
+        return audio_channel_count_from_out_mask(s->common.get_channels(&s->common)) * chan_samp_sz;
+    }
+    return sizeof(int8_t);
+}
+
+static inline size_t audio_stream_in_frame_size(const struct audio_stream_in *s)
+{
+    size_t chan_samp_sz;
+    audio_format_t format = s->common.get_format(&s->common);
+
+    if (audio_has_proportional_frames(format))
+    {
+        chan_samp_sz = audio_bytes_per_sample(format);
+        return audio_channel_count_from_in_mask(s->common.get_channels(&s->common)) * chan_samp_sz;
+    }
+    return sizeof(int8_t);
+}
+
+struct audio_module
+{
+    struct hw_module_t common;
+};
+
+struct audio_hw_device
+{
+    struct hw_device_t common;
+    uint32_t (*get_supported_devices)(const struct audio_hw_device *dev);
+    int (*init_check)(const struct audio_hw_device *dev);
+    int (*set_voice_volume)(struct audio_hw_device *dev, float volume);
+    int (*set_master_volume)(struct audio_hw_device *dev, float volume);
+    int (*get_master_volume)(struct audio_hw_device *dev, float *volume);
+    int (*set_mode)(struct audio_hw_device *dev, audio_mode_t mode);
+    int (*set_mic_mute)(struct audio_hw_device *dev, bool state);
+    int (*get_mic_mute)(const struct audio_hw_device *dev, bool *state);
+    int (*set_parameters)(struct audio_hw_device *dev, const char *kv_pairs);
+    char *(*get_parameters)(const struct audio_hw_device *dev, const char *keys);
+    size_t (*get_input_buffer_size)(const struct audio_hw_device *dev,
+                                    const struct audio_config *config);
+    int (*open_output_stream)(struct audio_hw_device *dev,
+                              audio_io_handle_t handle,
+                              audio_devices_t devices,
+                              audio_output_flags_t flags,
+                              struct audio_config *config,
+                              struct audio_stream_out **stream_out,
+                              const char *address);
+    void (*close_output_stream)(struct audio_hw_device *dev,
+                                struct audio_stream_out *stream_out);
+    int (*open_input_stream)(struct audio_hw_device *dev,
+                             audio_io_handle_t handle,
+                             audio_devices_t devices,
+                             struct audio_config *config,
+                             struct audio_stream_in **stream_in,
+                             audio_input_flags_t flags,
+                             const char *address,
+                             audio_source_t source);
+    void (*close_input_stream)(struct audio_hw_device *dev,
+                               struct audio_stream_in *stream_in);
+    int (*dump)(const struct audio_hw_device *dev, int fd);
+    int (*set_master_mute)(struct audio_hw_device *dev, bool mute);
+    int (*get_master_mute)(struct audio_hw_device *dev, bool *mute);
+};
+typedef struct audio_hw_device audio_hw_device_t;
+
+#endif // AVH_HOST_HARDWARE_AUDIO_H
@@ -0,0 +1,74 @@
+/*
+ * Minimal host stand-in for <log/log.h>. Messages go to stderr; the
+ * AVH_LOG_LEVEL environment variable selects the lowest printed priority
+ * (V, D, I, W, E; default W).
+ */
+
+#ifndef AVH_HOST_LOG_LOG_H
+#define AVH_HOST_LOG_LOG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef LOG_TAG
+#define LOG_TAG NULL
+#endif
+
+#ifndef LOG_NDEBUG
+#define LOG_NDEBUG 1
+#endif
+
+enum
+{
+    ANDROID_LOG_VERBOSE = 2,
+    ANDROID_LOG_DEBUG = 3,
+    ANDROID_LOG_INFO = 4,
+    ANDROID_LOG_WARN = 5,
+    ANDROID_LOG_ERROR = 6,
+};
+
+static inline int __avh_host_log_level(void)
+{
+    static int level = 0;
+    if (level == 0)
+    {
+        const char *env = getenv("AVH_LOG_LEVEL");
+        level = ANDROID_LOG_WARN;
+        if (env)
+        {
+            switch (env[0])
+            {
+            case 'V': level = ANDROID_LOG_VERBOSE; break;
+            case 'D': level = ANDROID_LOG_DEBUG; break;
+            case 'I': level = ANDROID_LOG_INFO; break;
+            case 'W': level = ANDROID_LOG_WARN; break;
+            case 'E': level = ANDROID_LOG_ERROR; break;
+            case 'S': level = ANDROID_LOG_ERROR + 1; break;
+            }
+        }
+    }
+    return level;
+}
+
+#define __avh_host_log(prio, letter, ...)                                  \
+    do                                                                     \
+    {                                                                      \
+        if ((prio) >= __avh_host_log_level())                              \
+        {                                                                  \
+            fprintf(stderr, letter "/%s: ", LOG_TAG ? LOG_TAG : "");       \
+            fprintf(stderr, __VA_ARGS__);                                  \
+            fputc('\n', stderr);                                           \
+        }                                                                  \
+    } while (0)
+
+#if LOG_NDEBUG
+#define ALOGV(...) do { if (0) { __avh_host_log(ANDROID_LOG_VERBOSE, "V", __VA_ARGS__); } } while (0)
+#else
+#define ALOGV(...) __avh_host_log(ANDROID_LOG_VERBOSE, "V", __VA_ARGS__)
+#endif
+#define ALOGD(...) __avh_host_log(ANDROID_LOG_DEBUG, "D", __VA_ARGS__)
+#define ALOGI(...) __avh_host_log(ANDROID_LOG_INFO, "I", __VA_ARGS__)
+#define ALOGW(...) __avh_host_log(ANDROID_LOG_WARN, "W", __VA_ARGS__)
+#define ALOGE(...) __avh_host_log(ANDROID_LOG_ERROR, "E", __VA_ARGS__)
+
+#endif // AVH_HOST_LOG_LOG_H
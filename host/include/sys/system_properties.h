@@ -0,0 +1,10 @@
+/*
+ * Minimal host stand-in for <sys/system_properties.h>.
+ */
+
+#ifndef AVH_HOST_SYS_SYSTEM_PROPERTIES_H
+#define AVH_HOST_SYS_SYSTEM_PROPERTIES_H
+
+#define PROP_VALUE_MAX 92
+
+#endif // AVH_HOST_SYS_SYSTEM_PROPERTIES_H
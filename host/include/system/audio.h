@@ -0,0 +1,172 @@
+/*
+ * Minimal host stand-in for <system/audio.h>. Only the types, constants and
+ * helpers used by audio_hw.c are provided; values match the Android headers.
+ */
+
+#ifndef AVH_HOST_SYSTEM_AUDIO_H
+#define AVH_HOST_SYSTEM_AUDIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef __unused
+#define __unused __attribute__((__unused__))
+#endif
+
+typedef int audio_io_handle_t;
+typedef uint32_t audio_devices_t;
+typedef uint32_t audio_channel_mask_t;
+typedef int audio_mode_t;
+typedef int audio_source_t;
+typedef int audio_output_flags_t;
+typedef int audio_input_flags_t;
+
+#define AUDIO_DEVICE_OUT_SPEAKER 0x2u
+#define AUDIO_DEVICE_IN_BUILTIN_MIC 0x80000004u
+#define AUDIO_OUTPUT_FLAG_PRIMARY 0x2
+#define AUDIO_INPUT_FLAG_NONE 0x0
+#define AUDIO_SOURCE_MIC 1
+
+typedef enum
+{
+    AUDIO_FORMAT_DEFAULT = 0,
+    AUDIO_FORMAT_PCM_16_BIT = 0x1u,
+    AUDIO_FORMAT_PCM_8_BIT = 0x2u,
+    AUDIO_FORMAT_PCM_32_BIT = 0x3u,
+    AUDIO_FORMAT_PCM_8_24_BIT = 0x4u,
+    AUDIO_FORMAT_PCM_FLOAT = 0x5u,
+    AUDIO_FORMAT_PCM_24_BIT_PACKED = 0x6u,
+    AUDIO_FORMAT_INVALID = 0xFFFFFFFFu,
+} audio_format_t;
+
+enum
+{
+    AUDIO_CHANNEL_REPRESENTATION_POSITION = 0x0u,
+    AUDIO_CHANNEL_REPRESENTATION_INDEX = 0x2u,
+};
+
+#define AUDIO_CHANNEL_COUNT_MAX 30u
+#define AUDIO_CHANNEL_NONE 0x0u
+#define AUDIO_CHANNEL_INDEX_HDR 0x80000000u
+
+#define AUDIO_CHANNEL_OUT_FRONT_LEFT 0x1u
+#define AUDIO_CHANNEL_OUT_FRONT_RIGHT 0x2u
+#define AUDIO_CHANNEL_OUT_MONO AUDIO_CHANNEL_OUT_FRONT_LEFT
+#define AUDIO_CHANNEL_OUT_STEREO (AUDIO_CHANNEL_OUT_FRONT_LEFT | AUDIO_CHANNEL_OUT_FRONT_RIGHT)
+#define AUDIO_CHANNEL_OUT_ALL 0x3ffffffu
+
+#define AUDIO_CHANNEL_IN_LEFT 0x4u
+#define AUDIO_CHANNEL_IN_RIGHT 0x8u
+#define AUDIO_CHANNEL_IN_FRONT 0x10u
+#define AUDIO_CHANNEL_IN_MONO AUDIO_CHANNEL_IN_FRONT
+#define AUDIO_CHANNEL_IN_STEREO (AUDIO_CHANNEL_IN_LEFT | AUDIO_CHANNEL_IN_RIGHT)
+#define AUDIO_CHANNEL_IN_ALL 0x3ffc1ffcu
+
+#define AUDIO_CHANNEL_INDEX_MASK_1 (AUDIO_CHANNEL_INDEX_HDR | 0x1u)
+#define AUDIO_CHANNEL_INDEX_MASK_2 (AUDIO_CHANNEL_INDEX_HDR | 0x3u)
+#define AUDIO_CHANNEL_INDEX_MASK_3 (AUDIO_CHANNEL_INDEX_HDR | 0x7u)
+#define AUDIO_CHANNEL_INDEX_MASK_4 (AUDIO_CHANNEL_INDEX_HDR | 0xfu)
+#define AUDIO_CHANNEL_INDEX_MASK_5 (AUDIO_CHANNEL_INDEX_HDR | 0x1fu)
+#define AUDIO_CHANNEL_INDEX_MASK_6 (AUDIO_CHANNEL_INDEX_HDR | 0x3fu)
+#define AUDIO_CHANNEL_INDEX_MASK_7 (AUDIO_CHANNEL_INDEX_HDR | 0x7fu)
+#define AUDIO_CHANNEL_INDEX_MASK_8 (AUDIO_CHANNEL_INDEX_HDR | 0xffu)
+
+typedef struct
+{
+    uint16_t version;
+    uint16_t size;
+} audio_offload_info_t;
+
+struct audio_config
+{
+    uint32_t sample_rate;
+    audio_channel_mask_t channel_mask;
+    audio_format_t format;
+    audio_offload_info_t offload_info;
+    uint32_t frame_count;
+};
+
+static inline uint32_t audio_channel_mask_get_bits(audio_channel_mask_t channel)
+{
+    return channel & ((1u << AUDIO_CHANNEL_COUNT_MAX) - 1);
+}
+
+static inline uint32_t audio_channel_mask_get_representation(audio_channel_mask_t channel)
+{
+    return (channel >> AUDIO_CHANNEL_COUNT_MAX) & 3u;
+}
+
+static inline uint32_t audio_channel_count_from_in_mask(audio_channel_mask_t channel)
+{
+    uint32_t bits = audio_channel_mask_get_bits(channel);
+    switch (audio_channel_mask_get_representation(channel))
+    {
+    case AUDIO_CHANNEL_REPRESENTATION_POSITION:
+        bits &= AUDIO_CHANNEL_IN_ALL;
+        /* fall through */
+    case AUDIO_CHANNEL_REPRESENTATION_INDEX:
+        return __builtin_popcount(bits);
+    default:
+        return 0;
+    }
+}
+
+static inline uint32_t audio_channel_count_from_out_mask(audio_channel_mask_t channel)
+{
+    uint32_t bits = audio_channel_mask_get_bits(channel);
+    switch (audio_channel_mask_get_representation(channel))
+    {
+    case AUDIO_CHANNEL_REPRESENTATION_POSITION:
+        bits &= AUDIO_CHANNEL_OUT_ALL;
+        /* fall through */
+    case AUDIO_CHANNEL_REPRESENTATION_INDEX:
+        return __builtin_popcount(bits);
+    default:
+        return 0;
+    }
+}
+
+static inline audio_channel_mask_t audio_channel_mask_for_index_assignment_from_count(uint32_t channel_count)
+{
+    if (channel_count == 0 || channel_count > AUDIO_CHANNEL_COUNT_MAX)
+        return AUDIO_CHANNEL_NONE;
+    return AUDIO_CHANNEL_INDEX_HDR | ((1u << channel_count) - 1);
+}
+
+static inline bool audio_is_linear_pcm(audio_format_t format)
+{
+    return format >= AUDIO_FORMAT_PCM_16_BIT && format <= AUDIO_FORMAT_PCM_24_BIT_PACKED;
+}
+
+static inline size_t audio_bytes_per_sample(audio_format_t format)
+{
+    switch (format)
+    {
+    case AUDIO_FORMAT_PCM_32_BIT:
+    case AUDIO_FORMAT_PCM_8_24_BIT:
+    case AUDIO_FORMAT_PCM_FLOAT:
+        return sizeof(int32_t);
+    case AUDIO_FORMAT_PCM_24_BIT_PACKED:
+        return 3;
+    case AUDIO_FORMAT_PCM_16_BIT:
+        return sizeof(int16_t);
+    case AUDIO_FORMAT_PCM_8_BIT:
+        return sizeof(uint8_t);
+    default:
+        return 0;
+    }
+}
+
+static inline bool audio_has_proportional_frames(audio_format_t format)
+{
+    return audio_is_linear_pcm(format);
+}
+
+static inline size_t audio_bytes_per_frame(uint32_t channel_count, audio_format_t fmt)
+{
+    return channel_count * audio_bytes_per_sample(fmt);
+}
+
+#endif // AVH_HOST_SYSTEM_AUDIO_H
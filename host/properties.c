@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host implementation of the property API used by the HAL. Values set with
+// property_set() live in a small table; everything else comes from the
+// environment, "virtual.audio.out.tcp.port" being read from
+// VIRTUAL_AUDIO_OUT_TCP_PORT.
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/properties.h>
+
+#define HOST_PROPERTY_MAX 64
+#define HOST_PROPERTY_NAME_MAX 128
+
+struct host_property
+{
+    char name[HOST_PROPERTY_NAME_MAX];
+    char value[PROPERTY_VALUE_MAX];
+};
+
+static pthread_mutex_t host_property_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct host_property host_properties[HOST_PROPERTY_MAX];
+static int host_property_count;
+
+static struct host_property *find_property(const char *key)
+{
+    int i;
+    for (i = 0; i < host_property_count; i++)
+    {
+        if (strcmp(host_properties[i].name, key) == 0)
+        {
+            return &host_properties[i];
+        }
+    }
+    return NULL;
+}
+
+int property_get(const char *key, char *value, const char *default_value)
+{
+    char env[HOST_PROPERTY_NAME_MAX];
+    const char *found;
+    struct host_property *prop;
+    size_t i;
+
+    pthread_mutex_lock(&host_property_lock);
+    prop = find_property(key);
+    if (prop)
+    {
+        snprintf(value, PROPERTY_VALUE_MAX, "%s", prop->value);
+        pthread_mutex_unlock(&host_property_lock);
+        return strlen(value);
+    }
+    pthread_mutex_unlock(&host_property_lock);
+
+    for (i = 0; key[i] && i < sizeof(env) - 1; i++)
+    {
+        env[i] = key[i] == '.' ? '_' : toupper((unsigned char)key[i]);
+    }
+    env[i] = '\0';
+    found = getenv(env);
+    if (!found || !found[0])
+    {
+        found = default_value ? default_value : "";
+    }
+    snprintf(value, PROPERTY_VALUE_MAX, "%s", found);
+    return strlen(value);
+}
+
+int32_t property_get_int32(const char *key, int32_t default_value)
+{
+    char value[PROPERTY_VALUE_MAX];
+    char *end;
+    long long v;
+
+    if (property_get(key, value, "") <= 0)
+    {
+        return default_value;
+    }
+    errno = 0;
+    v = strtoll(value, &end, 0);
+    if (end == value || *end != '\0' || errno == ERANGE || v < INT32_MIN || v > INT32_MAX)
+    {
+        return default_value;
+    }
+    return (int32_t)v;
+}
+
+int property_set(const char *key, const char *value)
+{
+    struct host_property *prop;
+
+    if (!key || strlen(key) >= HOST_PROPERTY_NAME_MAX)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&host_property_lock);
+    prop = find_property(key);
+    if (!prop)
+    {
+        if (host_property_count == HOST_PROPERTY_MAX)
+        {
+            pthread_mutex_unlock(&host_property_lock);
+            return -1;
+        }
+        prop = &host_properties[host_property_count++];
+        snprintf(prop->name, sizeof(prop->name), "%s", key);
+    }
+    snprintf(prop->value, sizeof(prop->value), "%s", value ? value : "");
+    pthread_mutex_unlock(&host_property_lock);
+    return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Host implementation of the str_parms API of libcutils. Pairs are kept in
+// insertion order in a singly linked list; adding an existing key replaces
+// its value.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/str_parms.h>
+
+struct str_parm
+{
+    struct str_parm *next;
+    char *key;
+    char *value;
+};
+
+struct str_parms
+{
+    struct str_parm *head;
+};
+
+static struct str_parm **find_parm(struct str_parms *str_parms, const char *key)
+{
+    struct str_parm **parm;
+    for (parm = &str_parms->head; *parm; parm = &(*parm)->next)
+    {
+        if (strcmp((*parm)->key, key) == 0)
+        {
+            break;
+        }
+    }
+    return parm;
+}
+
+static void free_parm(struct str_parm *parm)
+{
+    free(parm->key);
+    free(parm->value);
+    free(parm);
+}
+
+struct str_parms *str_parms_create(void)
+{
+    return calloc(1, sizeof(struct str_parms));
+}
+
+struct str_parms *str_parms_create_str(const char *_string)
+{
+    struct str_parms *str_parms = str_parms_create();
+    char *copy = _string ? strdup(_string) : NULL;
+    char *save = NULL;
+    char *pair;
+
+    if (!str_parms || !copy)
+    {
+        free(copy);
+        return str_parms;
+    }
+    for (pair = strtok_r(copy, ";", &save); pair; pair = strtok_r(NULL, ";", &save))
+    {
+        char *value = strchr(pair, '=');
+        if (value)
+        {
+            *value++ = '\0';
+        }
+        if (*pair)
+        {
+            str_parms_add_str(str_parms, pair, value ? value : "");
+        }
+    }
+    free(copy);
+    return str_parms;
+}
+
+void str_parms_destroy(struct str_parms *str_parms)
+{
+    struct str_parm *parm;
+
+    if (!str_parms)
+    {
+        return;
+    }
+    while ((parm = str_parms->head))
+    {
+        str_parms->head = parm->next;
+        free_parm(parm);
+    }
+    free(str_parms);
+}
+
+void str_parms_del(struct str_parms *str_parms, const char *key)
+{
+    struct str_parm **link = find_parm(str_parms, key);
+    struct str_parm *parm = *link;
+
+    if (parm)
+    {
+        *link = parm->next;
+        free_parm(parm);
+    }
+}
+
+int str_parms_add_str(struct str_parms *str_parms, const char *key, const char *value)
+{
+    struct str_parm **link = find_parm(str_parms, key);
+    char *copy = strdup(value);
+
+    if (!copy)
+    {
+        return -ENOMEM;
+    }
+    if (*link)
+    {
+        free((*link)->value);
+        (*link)->value = copy;
+        return 0;
+    }
+    *link = calloc(1, sizeof(struct str_parm));
+    if (!*link || !((*link)->key = strdup(key)))
+    {
+        free(*link);
+        *link = NULL;
+        free(copy);
+        return -ENOMEM;
+    }
+    (*link)->value = copy;
+    return 0;
+}
+
+int str_parms_add_int(struct str_parms *str_parms, const char *key, int value)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", value);
+    return str_parms_add_str(str_parms, key, buf);
+}
+
+int str_parms_add_float(struct str_parms *str_parms, const char *key, float value)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*e", 8, (double)value);
+    return str_parms_add_str(str_parms, key, buf);
+}
+
+int str_parms_has_key(struct str_parms *str_parms, const char *key)
+{
+    return *find_parm(str_parms, key) != NULL;
+}
+
+int str_parms_get_str(struct str_parms *str_parms, const char *key, char *out_val, int len)
+{
+    struct str_parm *parm = *find_parm(str_parms, key);
+
+    if (!parm)
+    {
+        return -ENOENT;
+    }
+    return snprintf(out_val, len, "%s", parm->value) < 0 ? -ENOENT : (int)strlen(out_val);
+}
+
+int str_parms_get_int(struct str_parms *str_parms, const char *key, int *out_val)
+{
+    struct str_parm *parm = *find_parm(str_parms, key);
+    char *end;
+
+    if (!parm)
+    {
+        return -ENOENT;
+    }
+    *out_val = (int)strtol(parm->value, &end, 0);
+    return *parm->value == '\0' || *end != '\0' ? -EINVAL : 0;
+}
+
+int str_parms_get_float(struct str_parms *str_parms, const char *key, float *out_val)
+{
+    struct str_parm *parm = *find_parm(str_parms, key);
+    char *end;
+
+    if (!parm)
+    {
+        return -ENOENT;
+    }
+    *out_val = strtof(parm->value, &end);
+    return *parm->value == '\0' || *end != '\0' ? -EINVAL : 0;
+}
+
+char *str_parms_to_str(struct str_parms *str_parms)
+{
+    struct str_parm *parm;
+    size_t size = 1;
+    char *str;
+
+    for (parm = str_parms->head; parm; parm = parm->next)
+    {
+        size += strlen(parm->key) + strlen(parm->value) + 2;
+    }
+    str = malloc(size);
+    if (!str)
+    {
+        return NULL;
+    }
+    str[0] = '\0';
+    for (parm = str_parms->head; parm; parm = parm->next)
+    {
+        if (str[0])
+        {
+            strcat(str, ";");
+        }
+        strcat(str, parm->key);
+        strcat(str, "=");
+        strcat(str, parm->value);
+    }
+    return str;
+}